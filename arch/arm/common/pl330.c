@@ -1342,6 +1342,28 @@ xfer_exit:
 }
 EXPORT_SYMBOL(pl330_submit_req);
 
+/*
+ * Bytes of MC pl330_submit_req would generate for 'r', so that the
+ * client can split a long list of xfers over several reqs before
+ * submitting. The req must fit in mcbufsz/2 bytes.
+ * Returns -EINVAL if some xfer is not aligned at the burst.
+ */
+int pl330_req_mcode_len(void *ch_id, struct pl330_req *r)
+{
+	struct pl330_thread *thrd = ch_id;
+	struct _xfer_spec xs;
+
+	if (!r || !r->x || !r->cfg || !thrd || thrd->free)
+		return -EINVAL;
+
+	xs.ccr = _prepare_ccr(r->cfg);
+	xs.r = r;
+
+	/* A dry run doesn't touch the MC buffer of the req */
+	return _setup_req(1, thrd, 0, &xs);
+}
+EXPORT_SYMBOL(pl330_req_mcode_len);
+
 static void pl330_dotask(unsigned long data)
 {
 	struct pl330_dmac *pl330 = (struct pl330_dmac *) data;
@@ -213,5 +213,6 @@ extern void *pl330_request_channel(int id, const struct pl330_info *pi);
 extern int pl330_chan_status(void *ch_id, struct pl330_chanstatus *pstatus);
 extern int pl330_chan_ctrl(void *ch_id, enum pl330_chan_op op);
 extern int pl330_submit_req(void *ch_id, struct pl330_req *r);
+extern int pl330_req_mcode_len(void *ch_id, struct pl330_req *r);
 
 #endif	/* __PL330_CORE_H */
@@ -15,6 +15,8 @@
 #include <linux/io.h>
 #include <linux/slab.h>
 #include <linux/platform_device.h>
+#include <linux/dmaengine.h>
+#include <linux/scatterlist.h>
 
 #include <asm/hardware/pl330.h>
 
@@ -27,6 +29,7 @@
  * @node: To attach to the global list of DMACs.
  * @pi: PL330 configuration info for the DMAC.
  * @kmcache: Pool to quickly allocate xfers for all channels in the dmac.
+ * @dmaengine: dmaengine devices of the DMAC, NULL if not registered.
  */
 struct rk29_pl330_dmac {
 	unsigned		busy_chan;
@@ -34,6 +37,9 @@ struct rk29_pl330_dmac {
 	struct list_head	node;
 	struct pl330_info	*pi;
 	struct kmem_cache	*kmcache;
+#ifdef CONFIG_RK_PL330_DMAENGINE
+	struct rk29_pl330_dmaengine	*dmaengine;
+#endif
 };
 
 /**
@@ -281,11 +287,14 @@ static struct rk29_pl330_dmac *map_chan_to_dmac(struct rk29_pl330_chan *ch)
 	return dmac;
 }
 
-/* Acquire the channel for peripheral 'id' */
-static struct rk29_pl330_chan *chan_acquire(const enum dma_ch id)
+/*
+ * Acquire the channel for peripheral 'id' on 'dmac', or on the
+ * most suitable DMAC if 'dmac' is NULL.
+ */
+static struct rk29_pl330_chan *chan_acquire_on(const enum dma_ch id,
+		struct rk29_pl330_dmac *dmac)
 {
 	struct rk29_pl330_chan *ch = id_to_chan(id);
-	struct rk29_pl330_dmac *dmac;
 
 	/* If the channel doesn't exist or is already acquired */
 	if (!ch || !chan_free(ch)) {
@@ -293,7 +302,10 @@ static struct rk29_pl330_chan *chan_acquire(const enum dma_ch id)
 		goto acq_exit;
 	}
 
-	dmac = map_chan_to_dmac(ch);
+	if (!dmac)
+		dmac = map_chan_to_dmac(ch);
+	else if (!iface_of_dmac(dmac, id) || dmac_busy(dmac))
+		dmac = NULL;
 	/* If couldn't map */
 	if (!dmac) {
 		ch = NULL;
@@ -307,6 +319,12 @@ acq_exit:
 	return ch;
 }
 
+/* Acquire the channel for peripheral 'id' */
+static inline struct rk29_pl330_chan *chan_acquire(const enum dma_ch id)
+{
+	return chan_acquire_on(id, NULL);
+}
+
 /* Delete xfer from the queue */
 static inline void del_from_queue(struct rk29_pl330_xfer *xfer)
 {
@@ -1054,6 +1072,845 @@ int rk29_dma_getposition(enum dma_ch id, dma_addr_t *src, dma_addr_t *dst)
 }
 EXPORT_SYMBOL(rk29_dma_getposition);
 
+#ifdef CONFIG_RK_PL330_DMAENGINE
+/*
+ * dmaengine interface to the same channels.
+ *
+ * A channel is acquired from the pool shared with the rk29_dma_* API
+ * when a client allocates it, so both kinds of clients can coexist on
+ * a DMAC. Transactions are turned into lists of pl330_xfers at prep
+ * time and chained into as few PL330 reqs as fit the MC buffers, so a
+ * whole scatterlist costs one interrupt per req instead of one per
+ * segment. Cyclic transactions keep one req per period in flight on
+ * each of the two req slots of the channel thread, and a finished
+ * period is resubmitted straight from the completion callback.
+ */
+
+/**
+ * struct rk29_pl330_desc - A dmaengine transaction.
+ * @txd: Descriptor handed to the client.
+ * @node: To attach to one of the lists of the channel.
+ * @rqtype: Direction of the xfers.
+ * @rqcfg: Settings for all xfers, latched at prep time.
+ * @cyclic: Restart from the first req after the last one.
+ * @nr_rq: Number of PL330 reqs the transaction is split into.
+ * @next_rq: Index of the next req to be submitted.
+ * @done_rq: Number of reqs done, in the current cycle if cyclic.
+ * @head: First xfer of each req, the xfers of a req are chained.
+ * @px: All the xfers of the transaction.
+ */
+struct rk29_pl330_desc {
+	struct dma_async_tx_descriptor	txd;
+	struct list_head		node;
+	enum pl330_reqtype		rqtype;
+	struct pl330_reqcfg		rqcfg;
+	bool				cyclic;
+	unsigned			nr_rq;
+	unsigned			next_rq;
+	unsigned			done_rq;
+	struct pl330_xfer		**head;
+	struct pl330_xfer		px[0];
+};
+
+/**
+ * struct rk29_pl330_dchan - dmaengine channel for a peripheral.
+ * @chan: The dmaengine channel.
+ * @id: ID of the peripheral.
+ * @dmac: DMAC the channel is registered with.
+ * @ch: Channel acquired from the pool, NULL while not allocated.
+ * @lock: Protects everything below.
+ * @slave: Last DMA_SLAVE_CONFIG from the client.
+ * @req: The two requests to submit to the PL330 core.
+ * @rq_desc: Transaction of each submitted req, NULL if the req is free.
+ * @submitted: Transactions submitted but not issued yet.
+ * @issued: Transactions issued, in order.
+ * @completed: Transactions done, waiting for the tasklet.
+ * @completed_cookie: Cookie of the last transaction done.
+ * @periods: Periods of the cyclic transaction done since the last
+ *	run of the tasklet.
+ * @tasklet: Calls back the client.
+ */
+struct rk29_pl330_dchan {
+	struct dma_chan			chan;
+	enum dma_ch			id;
+	struct rk29_pl330_dmac		*dmac;
+	struct rk29_pl330_chan		*ch;
+	spinlock_t			lock;
+	struct dma_slave_config		slave;
+	struct pl330_req		req[2];
+	struct rk29_pl330_desc		*rq_desc[2];
+	struct list_head		submitted;
+	struct list_head		issued;
+	struct list_head		completed;
+	dma_cookie_t			completed_cookie;
+	unsigned			periods;
+	struct tasklet_struct		tasklet;
+};
+
+/**
+ * struct rk29_pl330_dmaengine - dmaengine devices of a DMAC.
+ * @slave: Device for the peripheral channels.
+ * @memcpy: Device for the MEMTOMEM channels.
+ * @nr_chan: Number of entries in chan.
+ * @chan: All channels of the DMAC.
+ */
+struct rk29_pl330_dmaengine {
+	struct dma_device		slave;
+	struct dma_device		memcpy;
+	unsigned			nr_chan;
+	struct rk29_pl330_dchan		chan[0];
+};
+
+/* Owner of the pool channels taken by dmaengine clients */
+static struct rk29_dma_client rk29_pl330_dmaengine_client = {
+	.name = "dmaengine",
+};
+
+static inline struct rk29_pl330_dchan *to_dchan(struct dma_chan *chan)
+{
+	return container_of(chan, struct rk29_pl330_dchan, chan);
+}
+
+static inline struct rk29_pl330_desc *to_desc(
+		struct dma_async_tx_descriptor *txd)
+{
+	return container_of(txd, struct rk29_pl330_desc, txd);
+}
+
+static inline bool is_memtomem(enum dma_ch id)
+{
+	return id == DMACH_DMAC1_MEMTOMEM || id == DMACH_DMAC2_MEMTOMEM;
+}
+
+/* Submit reqs of the issued transactions on the free req slots */
+static void dchan_push(struct rk29_pl330_dchan *dc)
+{
+	struct rk29_pl330_desc *desc;
+	struct pl330_req *r;
+	int idx, ret, started = 0;
+
+	list_for_each_entry(desc, &dc->issued, node) {
+		while (desc->next_rq < desc->nr_rq) {
+			idx = dc->rq_desc[0] ? 1 : 0;
+			if (dc->rq_desc[idx])
+				goto push_exit;
+
+			r = &dc->req[idx];
+			r->rqtype = desc->rqtype;
+			r->cfg = &desc->rqcfg;
+			r->x = desc->head[desc->next_rq];
+
+			ret = pl330_submit_req(dc->ch->pl330_chan_id, r);
+			/* The core can't take it now, retry on the next
+			 * completion or issue_pending */
+			if (ret == -EAGAIN)
+				goto push_exit;
+			/* Not expected, prep checked the xfers fit the MC */
+			if (ret) {
+				dev_err(dc->dmac->pi->dev, "%s:%d %d!\n",
+					__func__, __LINE__, ret);
+				goto push_exit;
+			}
+
+			dc->rq_desc[idx] = desc;
+			started = 1;
+
+			if (++desc->next_rq == desc->nr_rq && desc->cyclic)
+				desc->next_rq = 0;
+		}
+	}
+
+push_exit:
+	if (started)
+		pl330_chan_ctrl(dc->ch->pl330_chan_id, PL330_OP_START);
+}
+
+static void dchan_rq_done(struct rk29_pl330_dchan *dc, int idx,
+		enum pl330_op_err err)
+{
+	struct rk29_pl330_desc *desc;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dc->lock, flags);
+
+	desc = dc->rq_desc[idx];
+	dc->rq_desc[idx] = NULL;
+
+	/* Flushed by terminate_all */
+	if (!desc) {
+		spin_unlock_irqrestore(&dc->lock, flags);
+		return;
+	}
+
+	if (err != PL330_ERR_NONE)
+		dev_err(dc->dmac->pi->dev, "%s:%d chan %d err %d!\n",
+			__func__, __LINE__, dc->id, err);
+
+	if (desc->cyclic) {
+		if (++desc->done_rq == desc->nr_rq)
+			desc->done_rq = 0;
+		dc->periods++;
+	} else if (++desc->done_rq == desc->nr_rq) {
+		dc->completed_cookie = desc->txd.cookie;
+		list_move_tail(&desc->node, &dc->completed);
+	}
+
+	dchan_push(dc);
+
+	spin_unlock_irqrestore(&dc->lock, flags);
+
+	tasklet_schedule(&dc->tasklet);
+}
+
+static void dchan_rq0(void *token, enum pl330_op_err err)
+{
+	struct pl330_req *r = token;
+	struct rk29_pl330_dchan *dc = container_of(r,
+					struct rk29_pl330_dchan, req[0]);
+	dchan_rq_done(dc, 0, err);
+}
+
+static void dchan_rq1(void *token, enum pl330_op_err err)
+{
+	struct pl330_req *r = token;
+	struct rk29_pl330_dchan *dc = container_of(r,
+					struct rk29_pl330_dchan, req[1]);
+	dchan_rq_done(dc, 1, err);
+}
+
+static void dchan_tasklet(unsigned long data)
+{
+	struct rk29_pl330_dchan *dc = (struct rk29_pl330_dchan *)data;
+	struct rk29_pl330_desc *desc, *t;
+	dma_async_tx_callback callback = NULL;
+	void *param = NULL;
+	unsigned long flags;
+	unsigned periods;
+	LIST_HEAD(list);
+
+	spin_lock_irqsave(&dc->lock, flags);
+
+	list_splice_init(&dc->completed, &list);
+
+	periods = dc->periods;
+	dc->periods = 0;
+	if (periods && !list_empty(&dc->issued)) {
+		desc = list_first_entry(&dc->issued,
+				struct rk29_pl330_desc, node);
+		callback = desc->txd.callback;
+		param = desc->txd.callback_param;
+	}
+
+	spin_unlock_irqrestore(&dc->lock, flags);
+
+	/* One call per period, as if each had been a transaction */
+	while (callback && periods--)
+		callback(param);
+
+	list_for_each_entry_safe(desc, t, &list, node) {
+		if (desc->txd.callback)
+			desc->txd.callback(desc->txd.callback_param);
+		kfree(desc);
+	}
+}
+
+static dma_cookie_t dchan_tx_submit(struct dma_async_tx_descriptor *txd)
+{
+	struct rk29_pl330_desc *desc = to_desc(txd);
+	struct rk29_pl330_dchan *dc = to_dchan(txd->chan);
+	dma_cookie_t cookie;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dc->lock, flags);
+
+	cookie = dc->chan.cookie + 1;
+	if (cookie < 0)
+		cookie = 1;
+	dc->chan.cookie = cookie;
+	txd->cookie = cookie;
+
+	list_add_tail(&desc->node, &dc->submitted);
+
+	spin_unlock_irqrestore(&dc->lock, flags);
+
+	return cookie;
+}
+
+static struct rk29_pl330_desc *desc_alloc(struct rk29_pl330_dchan *dc,
+		unsigned nr_px, unsigned long flags)
+{
+	struct rk29_pl330_desc *desc;
+
+	desc = kzalloc(sizeof(*desc) + nr_px * (sizeof(struct pl330_xfer)
+			+ sizeof(struct pl330_xfer *)), GFP_ATOMIC);
+	if (!desc)
+		return NULL;
+
+	desc->head = (struct pl330_xfer **)&desc->px[nr_px];
+
+	dma_async_tx_descriptor_init(&desc->txd, &dc->chan);
+	desc->txd.tx_submit = dchan_tx_submit;
+	desc->txd.flags = flags;
+	INIT_LIST_HEAD(&desc->node);
+
+	desc->rqcfg.swap = SWAP_NO;
+	desc->rqcfg.scctl = SCCTRL0; /* Noncacheable and nonbufferable */
+	desc->rqcfg.dcctl = DCCTRL0; /* Noncacheable and nonbufferable */
+	desc->rqcfg.privileged = 0;
+	desc->rqcfg.insnaccess = 0;
+
+	return desc;
+}
+
+/*
+ * Chain the nr_px xfers into reqs, each as long as fits in the MC
+ * buffer of a req. If 'chain' is not set, every xfer gets its own req,
+ * and hence its own interrupt.
+ */
+static int desc_build(struct rk29_pl330_dchan *dc,
+		struct rk29_pl330_desc *desc, unsigned nr_px, int chain)
+{
+	int max = dc->dmac->pi->mcbufsz / 2;
+	struct pl330_req r;
+	unsigned i, j;
+	int len;
+
+	r.rqtype = desc->rqtype;
+	r.peri = dc->req[0].peri;
+	r.cfg = &desc->rqcfg;
+
+	for (i = 0; i < nr_px; i = j) {
+		desc->px[i].next = NULL;
+		r.x = &desc->px[i];
+
+		/* Every xfer has to fit a req on its own */
+		len = pl330_req_mcode_len(dc->ch->pl330_chan_id, &r);
+		if (len < 0 || len > max)
+			return -EINVAL;
+
+		for (j = i + 1; chain && j < nr_px; j++) {
+			desc->px[j - 1].next = &desc->px[j];
+			desc->px[j].next = NULL;
+
+			len = pl330_req_mcode_len(dc->ch->pl330_chan_id, &r);
+			if (len < 0 || len > max) {
+				desc->px[j - 1].next = NULL;
+				break;
+			}
+		}
+
+		desc->head[desc->nr_rq++] = &desc->px[i];
+	}
+
+	return 0;
+}
+
+/* Xfer settings for 'direction' from the last DMA_SLAVE_CONFIG */
+static int desc_slave_cfg(struct rk29_pl330_dchan *dc,
+		struct rk29_pl330_desc *desc, enum dma_data_direction direction,
+		dma_addr_t *sdaddr)
+{
+	struct dma_slave_config slave;
+	enum dma_slave_buswidth width;
+	unsigned long flags;
+	u32 maxburst;
+
+	spin_lock_irqsave(&dc->lock, flags);
+	slave = dc->slave;
+	spin_unlock_irqrestore(&dc->lock, flags);
+
+	switch (direction) {
+	case DMA_TO_DEVICE:
+		desc->rqtype = MEMTODEV;
+		desc->rqcfg.src_inc = 1;
+		desc->rqcfg.dst_inc = 0;
+		*sdaddr = slave.dst_addr;
+		width = slave.dst_addr_width;
+		maxburst = slave.dst_maxburst;
+		break;
+	case DMA_FROM_DEVICE:
+		desc->rqtype = DEVTOMEM;
+		desc->rqcfg.src_inc = 0;
+		desc->rqcfg.dst_inc = 1;
+		*sdaddr = slave.src_addr;
+		width = slave.src_addr_width;
+		maxburst = slave.src_maxburst;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	/* Default word size, as rk29_dma_request does */
+	if (width == DMA_SLAVE_BUSWIDTH_UNDEFINED)
+		width = DMA_SLAVE_BUSWIDTH_4_BYTES;
+	desc->rqcfg.brst_size = __ffs(width);
+
+	/* src/dst_burst_len can't be more than 16 */
+	desc->rqcfg.brst_len = maxburst ? min_t(u32, maxburst, 16) : 1;
+
+	return 0;
+}
+
+static struct dma_async_tx_descriptor *dchan_prep_slave_sg(
+		struct dma_chan *chan, struct scatterlist *sgl,
+		unsigned int sg_len, enum dma_data_direction direction,
+		unsigned long flags)
+{
+	struct rk29_pl330_dchan *dc = to_dchan(chan);
+	struct rk29_pl330_desc *desc;
+	struct scatterlist *sg;
+	dma_addr_t sdaddr;
+	int i;
+
+	if (!sgl || !sg_len)
+		return NULL;
+
+	desc = desc_alloc(dc, sg_len, flags);
+	if (!desc)
+		return NULL;
+
+	if (desc_slave_cfg(dc, desc, direction, &sdaddr))
+		goto prep_err;
+
+	for_each_sg(sgl, sg, sg_len, i) {
+		if (direction == DMA_TO_DEVICE) {
+			desc->px[i].src_addr = sg_dma_address(sg);
+			desc->px[i].dst_addr = sdaddr;
+		} else {
+			desc->px[i].src_addr = sdaddr;
+			desc->px[i].dst_addr = sg_dma_address(sg);
+		}
+		desc->px[i].bytes = sg_dma_len(sg);
+	}
+
+	if (desc_build(dc, desc, sg_len, 1))
+		goto prep_err;
+
+	return &desc->txd;
+
+prep_err:
+	dev_err(dc->dmac->pi->dev, "%s:%d chan %d can't prep!\n",
+		__func__, __LINE__, dc->id);
+	kfree(desc);
+	return NULL;
+}
+
+static struct dma_async_tx_descriptor *dchan_prep_dma_cyclic(
+		struct dma_chan *chan, dma_addr_t buf_addr, size_t buf_len,
+		size_t period_len, enum dma_data_direction direction)
+{
+	struct rk29_pl330_dchan *dc = to_dchan(chan);
+	struct rk29_pl330_desc *desc;
+	unsigned i, periods;
+	dma_addr_t sdaddr;
+
+	if (!period_len || !buf_len || buf_len % period_len)
+		return NULL;
+
+	periods = buf_len / period_len;
+
+	desc = desc_alloc(dc, periods, 0);
+	if (!desc)
+		return NULL;
+
+	if (desc_slave_cfg(dc, desc, direction, &sdaddr))
+		goto prep_err;
+
+	for (i = 0; i < periods; i++) {
+		if (direction == DMA_TO_DEVICE) {
+			desc->px[i].src_addr = buf_addr + i * period_len;
+			desc->px[i].dst_addr = sdaddr;
+		} else {
+			desc->px[i].src_addr = sdaddr;
+			desc->px[i].dst_addr = buf_addr + i * period_len;
+		}
+		desc->px[i].bytes = period_len;
+	}
+
+	/* One req per period, for the period interrupt */
+	if (desc_build(dc, desc, periods, 0))
+		goto prep_err;
+
+	desc->cyclic = true;
+
+	return &desc->txd;
+
+prep_err:
+	dev_err(dc->dmac->pi->dev, "%s:%d chan %d can't prep!\n",
+		__func__, __LINE__, dc->id);
+	kfree(desc);
+	return NULL;
+}
+
+static struct dma_async_tx_descriptor *dchan_prep_dma_memcpy(
+		struct dma_chan *chan, dma_addr_t dest, dma_addr_t src,
+		size_t len, unsigned long flags)
+{
+	struct rk29_pl330_dchan *dc = to_dchan(chan);
+	struct pl330_info *pi = dc->dmac->pi;
+	struct rk29_pl330_desc *desc;
+	int burst, bl;
+
+	if (!len)
+		return NULL;
+
+	desc = desc_alloc(dc, 1, flags);
+	if (!desc)
+		return NULL;
+
+	desc->rqtype = MEMTOMEM;
+	desc->rqcfg.src_inc = 1;
+	desc->rqcfg.dst_inc = 1;
+
+	/* Widest burst that suits both addresses and the length */
+	burst = pi->pcfg.data_bus_width / 8;
+	while (burst > 1 && ((src | dest | len) & (burst - 1)))
+		burst /= 2;
+	desc->rqcfg.brst_size = __ffs(burst);
+
+	/* Use max bandwidth for M<->M xfers, as rk29_pl330_submit does */
+	bl = pi->pcfg.data_bus_width / 8;
+	bl *= pi->pcfg.data_buf_dep;
+	bl /= burst;
+
+	/* src/dst_burst_len can't be more than 16 */
+	if (bl > 16)
+		bl = 16;
+
+	while (bl > 1) {
+		if (!(len % (bl * burst)))
+			break;
+		bl--;
+	}
+	desc->rqcfg.brst_len = bl;
+
+	desc->px[0].src_addr = src;
+	desc->px[0].dst_addr = dest;
+	desc->px[0].bytes = len;
+
+	if (desc_build(dc, desc, 1, 0)) {
+		dev_err(pi->dev, "%s:%d chan %d can't prep!\n",
+			__func__, __LINE__, dc->id);
+		kfree(desc);
+		return NULL;
+	}
+
+	return &desc->txd;
+}
+
+static void dchan_terminate_all(struct rk29_pl330_dchan *dc)
+{
+	struct rk29_pl330_desc *desc, *t;
+	unsigned long flags;
+	LIST_HEAD(list);
+
+	spin_lock_irqsave(&dc->lock, flags);
+
+	/* Stop the thread and drop both reqs, no callbacks follow */
+	if (dc->ch)
+		pl330_chan_ctrl(dc->ch->pl330_chan_id, PL330_OP_FLUSH);
+
+	dc->rq_desc[0] = NULL;
+	dc->rq_desc[1] = NULL;
+	dc->periods = 0;
+
+	list_splice_init(&dc->submitted, &list);
+	list_splice_init(&dc->issued, &list);
+	list_splice_init(&dc->completed, &list);
+
+	dc->completed_cookie = dc->chan.cookie;
+
+	spin_unlock_irqrestore(&dc->lock, flags);
+
+	list_for_each_entry_safe(desc, t, &list, node)
+		kfree(desc);
+}
+
+static int dchan_control(struct dma_chan *chan, enum dma_ctrl_cmd cmd,
+		unsigned long arg)
+{
+	struct rk29_pl330_dchan *dc = to_dchan(chan);
+	struct dma_slave_config *slave = (struct dma_slave_config *)arg;
+	unsigned long flags;
+
+	switch (cmd) {
+	case DMA_TERMINATE_ALL:
+		dchan_terminate_all(dc);
+		return 0;
+
+	case DMA_SLAVE_CONFIG:
+		if (is_memtomem(dc->id))
+			return -EINVAL;
+		if (slave->src_maxburst > 16 || slave->dst_maxburst > 16)
+			return -EINVAL;
+
+		spin_lock_irqsave(&dc->lock, flags);
+		dc->slave = *slave;
+		spin_unlock_irqrestore(&dc->lock, flags);
+		return 0;
+
+	default:
+		return -ENXIO;
+	}
+}
+
+static enum dma_status dchan_tx_status(struct dma_chan *chan,
+		dma_cookie_t cookie, struct dma_tx_state *txstate)
+{
+	struct rk29_pl330_dchan *dc = to_dchan(chan);
+	struct rk29_pl330_desc *desc;
+	dma_cookie_t last_done, last_used;
+	struct pl330_xfer *x;
+	enum dma_status ret;
+	unsigned long flags;
+	u32 residue = 0;
+	unsigned i;
+
+	spin_lock_irqsave(&dc->lock, flags);
+
+	last_done = dc->completed_cookie;
+	last_used = chan->cookie;
+	ret = dma_async_is_complete(cookie, last_done, last_used);
+
+	/* Residue at req granularity, for the transaction in flight */
+	if (ret != DMA_SUCCESS)
+		list_for_each_entry(desc, &dc->issued, node) {
+			if (desc->txd.cookie != cookie)
+				continue;
+			for (i = desc->done_rq; i < desc->nr_rq; i++)
+				for (x = desc->head[i]; x; x = x->next)
+					residue += x->bytes;
+			break;
+		}
+
+	spin_unlock_irqrestore(&dc->lock, flags);
+
+	dma_set_tx_state(txstate, last_done, last_used, residue);
+
+	return ret;
+}
+
+static void dchan_issue_pending(struct dma_chan *chan)
+{
+	struct rk29_pl330_dchan *dc = to_dchan(chan);
+	unsigned long flags;
+
+	spin_lock_irqsave(&dc->lock, flags);
+
+	list_splice_tail_init(&dc->submitted, &dc->issued);
+	dchan_push(dc);
+
+	spin_unlock_irqrestore(&dc->lock, flags);
+}
+
+static int dchan_alloc_chan_resources(struct dma_chan *chan)
+{
+	struct rk29_pl330_dchan *dc = to_dchan(chan);
+	struct rk29_pl330_chan *ch;
+	unsigned long flags;
+	int ret = 1;
+
+	spin_lock_irqsave(&res_lock, flags);
+
+	/*
+	 * The peripheral may be in use through the rk29_dma_* API. Ask
+	 * for this channel's own DMAC: left to choose, the core could
+	 * map a peripheral wired to both DMACs to the other one.
+	 */
+	ch = chan_acquire_on(dc->id, dc->dmac);
+	if (!ch) {
+		ret = -EBUSY;
+		goto alloc_exit;
+	}
+
+	ch->pl330_chan_id = pl330_request_channel(dc->id, ch->dmac->pi);
+	if (!ch->pl330_chan_id) {
+		chan_release(ch);
+		ret = -EBUSY;
+		goto alloc_exit;
+	}
+
+	ch->client = &rk29_pl330_dmaengine_client;
+	ch->options = 0;
+	ch->callback_fn = NULL;
+	ch->lrq = NULL;
+	ch->req[0].x = NULL;
+	ch->req[1].x = NULL;
+	INIT_LIST_HEAD(&ch->xfer_list);
+	ch->xfer_head = NULL;
+
+	dc->ch = ch;
+
+	dc->req[0].peri = iface_of_dmac(ch->dmac, dc->id) - 1;
+	dc->req[1].peri = dc->req[0].peri;
+
+	dc->chan.cookie = 1;
+	dc->completed_cookie = 1;
+
+alloc_exit:
+	spin_unlock_irqrestore(&res_lock, flags);
+
+	return ret;
+}
+
+static void dchan_free_chan_resources(struct dma_chan *chan)
+{
+	struct rk29_pl330_dchan *dc = to_dchan(chan);
+	unsigned long flags;
+
+	dchan_terminate_all(dc);
+	tasklet_kill(&dc->tasklet);
+
+	spin_lock_irqsave(&res_lock, flags);
+
+	if (dc->ch) {
+		pl330_release_channel(dc->ch->pl330_chan_id);
+		dc->ch->pl330_chan_id = NULL;
+		dc->ch->client = NULL;
+		chan_release(dc->ch);
+		dc->ch = NULL;
+	}
+
+	spin_unlock_irqrestore(&res_lock, flags);
+}
+
+/**
+ * rk29_dma_filter - dma_request_channel filter for a peripheral
+ * @chan: Channel offered by the dmaengine core.
+ * @param: The enum dma_ch of the peripheral.
+ *
+ * e.g. dma_request_channel(mask, rk29_dma_filter, (void *)DMACH_SPI0_TX)
+ */
+bool rk29_dma_filter(struct dma_chan *chan, void *param)
+{
+	if (chan->device->device_alloc_chan_resources !=
+			dchan_alloc_chan_resources)
+		return false;
+
+	return to_dchan(chan)->id == (enum dma_ch)param;
+}
+EXPORT_SYMBOL(rk29_dma_filter);
+
+static void rk29_pl330_dma_device_init(struct dma_device *dd,
+		struct device *dev)
+{
+	INIT_LIST_HEAD(&dd->channels);
+	dd->dev = dev;
+	dd->device_alloc_chan_resources = dchan_alloc_chan_resources;
+	dd->device_free_chan_resources = dchan_free_chan_resources;
+	dd->device_control = dchan_control;
+	dd->device_tx_status = dchan_tx_status;
+	dd->device_issue_pending = dchan_issue_pending;
+	/* Channels are only handed out by dma_request_channel */
+	dma_cap_set(DMA_PRIVATE, dd->cap_mask);
+}
+
+static int rk29_pl330_dmaengine_add(struct rk29_pl330_dmac *dmac,
+		struct device *dev)
+{
+	struct rk29_pl330_dmaengine *de;
+	struct rk29_pl330_dchan *dc;
+	unsigned i, n = 0;
+	int ret;
+
+	dmac->dmaengine = NULL;
+
+	for (i = 0; i < PL330_MAX_PERI; i++)
+		if (dmac->peri[i] != DMACH_MAX)
+			n++;
+
+	de = kzalloc(sizeof(*de) + n * sizeof(*dc), GFP_KERNEL);
+	if (!de)
+		return -ENOMEM;
+
+	rk29_pl330_dma_device_init(&de->slave, dev);
+	dma_cap_set(DMA_SLAVE, de->slave.cap_mask);
+	dma_cap_set(DMA_CYCLIC, de->slave.cap_mask);
+	de->slave.device_prep_slave_sg = dchan_prep_slave_sg;
+	de->slave.device_prep_dma_cyclic = dchan_prep_dma_cyclic;
+
+	rk29_pl330_dma_device_init(&de->memcpy, dev);
+	dma_cap_set(DMA_MEMCPY, de->memcpy.cap_mask);
+	de->memcpy.device_prep_dma_memcpy = dchan_prep_dma_memcpy;
+
+	for (i = 0; i < PL330_MAX_PERI; i++) {
+		if (dmac->peri[i] == DMACH_MAX)
+			continue;
+
+		dc = &de->chan[de->nr_chan++];
+		dc->id = dmac->peri[i];
+		dc->dmac = dmac;
+		spin_lock_init(&dc->lock);
+		INIT_LIST_HEAD(&dc->submitted);
+		INIT_LIST_HEAD(&dc->issued);
+		INIT_LIST_HEAD(&dc->completed);
+		tasklet_init(&dc->tasklet, dchan_tasklet, (unsigned long)dc);
+
+		dc->req[0].token = &dc->req[0];
+		dc->req[0].xfer_cb = dchan_rq0;
+		dc->req[1].token = &dc->req[1];
+		dc->req[1].xfer_cb = dchan_rq1;
+
+		if (is_memtomem(dc->id))
+			dc->chan.device = &de->memcpy;
+		else
+			dc->chan.device = &de->slave;
+		list_add_tail(&dc->chan.device_node,
+				&dc->chan.device->channels);
+	}
+
+	if (!list_empty(&de->slave.channels)) {
+		ret = dma_async_device_register(&de->slave);
+		if (ret)
+			goto add_err1;
+	}
+
+	if (!list_empty(&de->memcpy.channels)) {
+		ret = dma_async_device_register(&de->memcpy);
+		if (ret)
+			goto add_err2;
+	}
+
+	dmac->dmaengine = de;
+
+	return 0;
+
+add_err2:
+	if (!list_empty(&de->slave.channels))
+		dma_async_device_unregister(&de->slave);
+add_err1:
+	kfree(de);
+
+	return ret;
+}
+
+static void rk29_pl330_dmaengine_del(struct rk29_pl330_dmac *dmac)
+{
+	struct rk29_pl330_dmaengine *de = dmac->dmaengine;
+
+	if (!de)
+		return;
+
+	if (!list_empty(&de->memcpy.channels))
+		dma_async_device_unregister(&de->memcpy);
+	if (!list_empty(&de->slave.channels))
+		dma_async_device_unregister(&de->slave);
+
+	dmac->dmaengine = NULL;
+	kfree(de);
+}
+#else
+static inline int rk29_pl330_dmaengine_add(struct rk29_pl330_dmac *dmac,
+		struct device *dev)
+{
+	return 0;
+}
+
+static inline void rk29_pl330_dmaengine_del(struct rk29_pl330_dmac *dmac)
+{
+}
+#endif /* CONFIG_RK_PL330_DMAENGINE */
+
 static irqreturn_t pl330_irq_handler(int irq, void *data)
 {
 	if (pl330_update(data))
@@ -1186,6 +2043,10 @@ static int pl330_probe(struct platform_device *pdev)
 		if (rk29_pl330_dmac->peri[i] != DMACH_MAX)
 			chan_add(rk29_pl330_dmac->peri[i]);
 
+	/* The rk29_dma_* API keeps working without it */
+	if (rk29_pl330_dmaengine_add(rk29_pl330_dmac, &pdev->dev))
+		dev_err(&pdev->dev, "dmaengine registration failed\n");
+
 	printk(KERN_INFO
 		"Loaded driver for PL330 DMAC-%d %s\n",	pdev->id, pdev->name);
 	printk(KERN_INFO
@@ -1239,6 +2100,10 @@ static int pl330_remove(struct platform_device *pdev)
 
 	dmac = d;
 
+	spin_unlock_irqrestore(&res_lock, flags);
+	rk29_pl330_dmaengine_del(dmac);
+	spin_lock_irqsave(&res_lock, flags);
+
 	/* Remove all Channels that are managed only by this DMAC */
 	list_for_each_entry(ch, &chan_list, node) {
 
@@ -187,4 +187,13 @@ extern int rk29_dma_getposition(unsigned int channel,
 extern int rk29_dma_set_opfn(unsigned int, rk29_dma_opfn_t rtn);
 extern int rk29_dma_set_buffdone_fn(unsigned int, rk29_dma_cbfn_t rtn);
 
+struct dma_chan;
+
+/* rk29_dma_filter
+ *
+ * dma_request_channel filter, param is the enum dma_ch of the peripheral
+*/
+
+extern bool rk29_dma_filter(struct dma_chan *chan, void *param);
+
 #endif	/* __RK29_DMA_PL330_H_ */
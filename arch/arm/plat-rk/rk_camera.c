@@ -1322,7 +1322,11 @@ static struct android_pmem_platform_data android_pmem_cam_pdata = {
 };
 
 static struct platform_device android_pmem_cam_device = {
+#ifdef CONFIG_ION_ROCKCHIP_PMEM
+	.name		= "ion-pmem",
+#else
 	.name		= "android_pmem",
+#endif
 	.id		= 1,
 	.dev		= {
 		.platform_data = &android_pmem_cam_pdata,
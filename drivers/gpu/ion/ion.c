@@ -41,6 +41,9 @@
  * @lock:		lock protecting the buffers & heaps trees
  * @heaps:		list of all the heaps in the system
  * @user_clients:	list of all the clients created from userspace
+ * @kmap_lock:		lock protecting the idle kernel mappings
+ * @kmap_lru:		buffers whose kernel mapping is idle, oldest first
+ * @kmap_lru_size:	total size of the buffers on kmap_lru
  */
 struct ion_device {
 	struct miscdevice dev;
@@ -52,8 +55,18 @@ struct ion_device {
 	struct rb_root user_clients;
 	struct rb_root kernel_clients;
 	struct dentry *debug_root;
+	struct mutex kmap_lock;
+	struct list_head kmap_lru;
+	size_t kmap_lru_size;
 };
 
+/*
+ * Kernel mappings are not torn down when the last user unmaps them:
+ * drivers map and unmap the same buffers every frame. Idle mappings are
+ * kept on an lru, bounded so they don't exhaust the vmalloc space.
+ */
+#define ION_KMAP_CACHE_SIZE	(32 * SZ_1M)
+
 /**
  * struct ion_client - a process/hw block local address space
  * @ref:		for reference counting the client
@@ -157,15 +170,61 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 	buffer->size = len;
 	mutex_init(&buffer->lock);
 	INIT_LIST_HEAD(&buffer->map_addr);
+	INIT_LIST_HEAD(&buffer->kmap_lru);
 	ion_buffer_add(dev, buffer);
 	return buffer;
 }
 
+/* buffer->lock must be held, kmap_cnt must be zero */
+static void ion_buffer_kmap_release(struct ion_buffer *buffer)
+{
+	buffer->heap->ops->unmap_kernel(buffer->heap, buffer);
+	buffer->vaddr = NULL;
+}
+
+/* dev->kmap_lock must be held */
+static void ion_kmap_lru_del(struct ion_device *dev, struct ion_buffer *buffer)
+{
+	list_del_init(&buffer->kmap_lru);
+	dev->kmap_lru_size -= buffer->size;
+}
+
+/*
+ * Tear down the oldest idle mappings until the cache fits. Buffers
+ * whose lock is contended are skipped, as the caller may already hold
+ * one buffer lock.
+ */
+static void ion_kmap_lru_trim(struct ion_device *dev)
+{
+	struct ion_buffer *buffer, *tmp;
+
+	mutex_lock(&dev->kmap_lock);
+	list_for_each_entry_safe(buffer, tmp, &dev->kmap_lru, kmap_lru) {
+		if (dev->kmap_lru_size <= ION_KMAP_CACHE_SIZE)
+			break;
+		if (!mutex_trylock(&buffer->lock))
+			continue;
+		ion_kmap_lru_del(dev, buffer);
+		ion_buffer_kmap_release(buffer);
+		mutex_unlock(&buffer->lock);
+	}
+	mutex_unlock(&dev->kmap_lock);
+}
+
 static void ion_buffer_destroy(struct kref *kref)
 {
 	struct ion_buffer *buffer = container_of(kref, struct ion_buffer, ref);
 	struct ion_device *dev = buffer->dev;
 
+	mutex_lock(&dev->kmap_lock);
+	if (!list_empty(&buffer->kmap_lru)) {
+		ion_kmap_lru_del(dev, buffer);
+		mutex_unlock(&dev->kmap_lock);
+		ion_buffer_kmap_release(buffer);
+	} else {
+		mutex_unlock(&dev->kmap_lock);
+	}
+
 	mutex_lock(&dev->lock);
 	buffer->heap->ops->free(buffer);
 	rb_erase(&buffer->node, &dev->buffers);
@@ -436,10 +495,25 @@ void *ion_map_kernel(struct ion_client *client, struct ion_handle *handle)
 	}
 
 	if (_ion_map(&buffer->kmap_cnt, &handle->kmap_cnt)) {
-		vaddr = buffer->heap->ops->map_kernel(buffer->heap, buffer);
-		if (IS_ERR_OR_NULL(vaddr))
-			_ion_unmap(&buffer->kmap_cnt, &handle->kmap_cnt);
-		buffer->vaddr = vaddr;
+		struct ion_device *dev = buffer->dev;
+		bool cached;
+
+		mutex_lock(&dev->kmap_lock);
+		cached = !list_empty(&buffer->kmap_lru);
+		if (cached)
+			ion_kmap_lru_del(dev, buffer);
+		mutex_unlock(&dev->kmap_lock);
+
+		if (cached) {
+			vaddr = buffer->vaddr;
+		} else {
+			vaddr = buffer->heap->ops->map_kernel(buffer->heap,
+							      buffer);
+			if (IS_ERR_OR_NULL(vaddr))
+				_ion_unmap(&buffer->kmap_cnt,
+					   &handle->kmap_cnt);
+			buffer->vaddr = vaddr;
+		}
 	} else {
 		vaddr = buffer->vaddr;
 	}
@@ -487,16 +561,55 @@ struct scatterlist *ion_map_dma(struct ion_client *client,
 void ion_unmap_kernel(struct ion_client *client, struct ion_handle *handle)
 {
 	struct ion_buffer *buffer;
+	struct ion_device *dev;
+	bool trim = false;
 
 	mutex_lock(&client->lock);
 	buffer = handle->buffer;
+	dev = buffer->dev;
 	mutex_lock(&buffer->lock);
 	if (_ion_unmap(&buffer->kmap_cnt, &handle->kmap_cnt)) {
-		buffer->heap->ops->unmap_kernel(buffer->heap, buffer);
-		buffer->vaddr = NULL;
+		/* keep the mapping around for the next ion_map_kernel */
+		mutex_lock(&dev->kmap_lock);
+		list_add_tail(&buffer->kmap_lru, &dev->kmap_lru);
+		dev->kmap_lru_size += buffer->size;
+		trim = dev->kmap_lru_size > ION_KMAP_CACHE_SIZE;
+		mutex_unlock(&dev->kmap_lock);
 	}
 	mutex_unlock(&buffer->lock);
 	mutex_unlock(&client->lock);
+
+	if (trim)
+		ion_kmap_lru_trim(dev);
+}
+
+int ion_cache_op(struct ion_client *client, struct ion_handle *handle,
+		 void *virt, unsigned long offset, unsigned long len,
+		 unsigned int type)
+{
+	struct ion_buffer *buffer;
+	int ret = -EINVAL;
+
+	mutex_lock(&client->lock);
+	if (!ion_handle_validate(client, handle)) {
+		pr_err("%s: invalid handle passed to cache_op.\n",
+		       __func__);
+		mutex_unlock(&client->lock);
+		return -EINVAL;
+	}
+	buffer = handle->buffer;
+	if (offset > buffer->size || len > buffer->size - offset) {
+		mutex_unlock(&client->lock);
+		return -EINVAL;
+	}
+	if (buffer->heap->ops->cache_op) {
+		mutex_lock(&buffer->lock);
+		ret = buffer->heap->ops->cache_op(buffer->heap, buffer, virt,
+						  offset, len, type);
+		mutex_unlock(&buffer->lock);
+	}
+	mutex_unlock(&client->lock);
+	return ret;
 }
 
 void ion_unmap_dma(struct ion_client *client, struct ion_handle *handle)
@@ -1121,7 +1234,8 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			buffer = data.handle->buffer;
 			if(buffer->heap->ops->cache_op){
 				mutex_lock(&buffer->lock);
-				buffer->heap->ops->cache_op(buffer->heap, buffer, data.virt, data.type);
+				buffer->heap->ops->cache_op(buffer->heap, buffer,
+						data.virt, 0, buffer->size, data.type);
 				mutex_unlock(&buffer->lock);
 				err = 0;
 			}
@@ -1129,6 +1243,16 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		mutex_unlock(&client->lock);
 		break;
 	}
+	case ION_CUSTOM_CACHE_OP_RANGE:
+	{
+		struct ion_cacheop_range_data data;
+
+		if (copy_from_user(&data, (void __user *)arg,
+				sizeof(struct ion_cacheop_range_data)))
+			return -EFAULT;
+		return ion_cache_op(client, data.handle, data.virt,
+				    data.offset, data.len, data.type);
+	}
 	case ION_CUSTOM_GET_CLIENT_INFO:
 	{
 		struct rb_node *n;
@@ -1340,6 +1464,7 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap)
 	rb_insert_color(&heap->node, &dev->heaps);
 	debugfs_create_file(heap->name, 0664, dev->debug_root, heap,
 			    &debug_heap_fops);
+	ion_bench_add_heap(heap);
 end:
 	mutex_unlock(&dev->lock);
 }
@@ -1450,8 +1575,11 @@ struct ion_device *ion_device_create(long (*custom_ioctl)
 	idev->heaps = RB_ROOT;
 	idev->user_clients = RB_ROOT;
 	idev->kernel_clients = RB_ROOT;
+	mutex_init(&idev->kmap_lock);
+	INIT_LIST_HEAD(&idev->kmap_lru);
 	debugfs_create_file("leak", 0664, idev->debug_root, idev,
 			    &debug_leak_fops);
+	ion_bench_init(idev->debug_root);
 	return idev;
 }
 
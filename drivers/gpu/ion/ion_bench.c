@@ -0,0 +1,219 @@
+/*
+ * drivers/gpu/ion/ion_bench.c
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/err.h>
+#include <linux/ion.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include "ion_priv.h"
+
+/*
+ * Allocation benchmark, /sys/kernel/debug/ion/bench/
+ *	size		bytes per buffer
+ *	count		buffers allocated, then all freed, in each round
+ *	rounds		rounds, run back to back as a burst of gralloc
+ *			allocations would be
+ *	<heap>		reading it runs the benchmark on that heap
+ *
+ * The first round starts from what the heap has cached, the following
+ * ones can reuse what the round before freed. The heap's own file shows
+ * the pool hits and misses behind the numbers.
+ */
+
+#define ION_BENCH_MAX_COUNT	256
+#define ION_BENCH_MAX_ROUNDS	64
+
+static struct dentry *bench_dir;
+static DEFINE_MUTEX(bench_lock);	/* one run at a time */
+static u32 bench_size = SZ_4M;		/* about a 720p RGBA buffer */
+static u32 bench_count = 8;
+static u32 bench_rounds = 4;
+
+struct bench_round {
+	u32 allocated;
+	s64 alloc_us;
+	s64 alloc_max_us;
+	s64 free_us;
+	s64 free_max_us;
+};
+
+struct bench_run {
+	struct ion_heap *heap;
+	u32 size;
+	u32 count;
+	u32 rounds;
+	struct bench_round *r;
+	int ret;
+	struct completion done;
+};
+
+/*
+ * Runs in a kernel thread, so that its client is a kernel client and
+ * not the one of the task reading the results.
+ */
+static int bench_thread(void *data)
+{
+	struct bench_run *run = data;
+	struct ion_handle **handles;
+	struct ion_client *client = NULL;
+	u32 n, i;
+
+	handles = kcalloc(run->count, sizeof(*handles), GFP_KERNEL);
+	if (!handles) {
+		run->ret = -ENOMEM;
+		goto out;
+	}
+
+	client = ion_client_create(run->heap->dev, -1, "bench");
+	if (IS_ERR_OR_NULL(client)) {
+		run->ret = client ? PTR_ERR(client) : -ENOMEM;
+		goto out;
+	}
+
+	for (n = 0; n < run->rounds; n++) {
+		struct bench_round *r = &run->r[n];
+		ktime_t start;
+		s64 us;
+
+		for (i = 0; i < run->count; i++) {
+			start = ktime_get();
+			handles[i] = ion_alloc(client, run->size, PAGE_SIZE,
+					       1 << run->heap->id);
+			us = ktime_us_delta(ktime_get(), start);
+			if (IS_ERR_OR_NULL(handles[i]))
+				break;
+			r->alloc_us += us;
+			r->alloc_max_us = max(r->alloc_max_us, us);
+		}
+		r->allocated = i;
+
+		for (i = 0; i < r->allocated; i++) {
+			start = ktime_get();
+			ion_free(client, handles[i]);
+			us = ktime_us_delta(ktime_get(), start);
+			r->free_us += us;
+			r->free_max_us = max(r->free_max_us, us);
+		}
+	}
+
+	ion_client_destroy(client);
+out:
+	kfree(handles);
+	complete(&run->done);
+	return 0;
+}
+
+static int ion_bench_show(struct seq_file *s, void *unused)
+{
+	struct bench_run run;
+	struct task_struct *task;
+	u32 n;
+
+	mutex_lock(&bench_lock);
+
+	run.heap = s->private;
+	run.size = bench_size;
+	run.count = bench_count;
+	run.rounds = bench_rounds;
+	run.ret = 0;
+	init_completion(&run.done);
+
+	if (!run.size || !run.count || run.count > ION_BENCH_MAX_COUNT ||
+	    !run.rounds || run.rounds > ION_BENCH_MAX_ROUNDS) {
+		mutex_unlock(&bench_lock);
+		return -EINVAL;
+	}
+
+	run.r = kcalloc(run.rounds, sizeof(*run.r), GFP_KERNEL);
+	if (!run.r) {
+		mutex_unlock(&bench_lock);
+		return -ENOMEM;
+	}
+
+	task = kthread_run(bench_thread, &run, "ion_bench");
+	if (IS_ERR(task))
+		run.ret = PTR_ERR(task);
+	else
+		wait_for_completion(&run.done);
+	if (run.ret)
+		goto out;
+
+	seq_printf(s, "heap %s, %u buffers of %uK, %u rounds\n",
+		   run.heap->name, run.count, run.size / SZ_1K, run.rounds);
+	seq_printf(s, "%5s %10s %10s %10s %10s\n", "round",
+		   "alloc us", "max us", "free us", "max us");
+	for (n = 0; n < run.rounds; n++) {
+		struct bench_round *r = &run.r[n];
+
+		if (!r->allocated) {
+			seq_printf(s, "%5u allocation failed\n", n);
+			continue;
+		}
+		seq_printf(s, "%5u %10lld %10lld %10lld %10lld", n,
+			   div_s64(r->alloc_us, r->allocated), r->alloc_max_us,
+			   div_s64(r->free_us, r->allocated), r->free_max_us);
+		if (r->allocated < run.count)
+			seq_printf(s, "  (%u allocated)", r->allocated);
+		seq_printf(s, "\n");
+	}
+
+out:
+	kfree(run.r);
+	mutex_unlock(&bench_lock);
+	return run.ret;
+}
+
+static int ion_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ion_bench_show, inode->i_private);
+}
+
+static const struct file_operations bench_fops = {
+	.open = ion_bench_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void ion_bench_init(struct dentry *debug_root)
+{
+	if (bench_dir || IS_ERR_OR_NULL(debug_root))
+		return;
+
+	bench_dir = debugfs_create_dir("bench", debug_root);
+	if (IS_ERR_OR_NULL(bench_dir)) {
+		bench_dir = NULL;
+		return;
+	}
+
+	debugfs_create_u32("size", 0664, bench_dir, &bench_size);
+	debugfs_create_u32("count", 0664, bench_dir, &bench_count);
+	debugfs_create_u32("rounds", 0664, bench_dir, &bench_rounds);
+}
+
+void ion_bench_add_heap(struct ion_heap *heap)
+{
+	if (bench_dir)
+		debugfs_create_file(heap->name, 0444, bench_dir, heap,
+				    &bench_fops);
+}
@@ -14,12 +14,13 @@
  *
  */
 
- #include <linux/spinlock.h>
+#include <linux/spinlock.h>
 #include <linux/err.h>
-#include <linux/genalloc.h>
 #include <linux/io.h>
 #include <linux/ion.h>
+#include <linux/log2.h>
 #include <linux/mm.h>
+#include <linux/rbtree.h>
 #include <linux/scatterlist.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
@@ -30,45 +31,221 @@
 #include <asm/cacheflush.h>
 #include "ion_priv.h"
 
+/*
+ * Free space is kept as a set of extents, indexed both by address (to
+ * coalesce on free) and by size (to find the best fit in O(log n)).
+ * Best fit keeps the big extents intact for the camera and video
+ * buffers that need them, where first fit chips away at them.
+ */
+struct ion_carveout_extent {
+	struct rb_node by_addr;
+	struct rb_node by_size;
+	struct list_head spare;		/* on spare_extents while not in use */
+	ion_phys_addr_t base;
+	unsigned long size;
+};
+
+#define ION_CARVEOUT_SIZE_CLASSES	12
+
 struct ion_carveout_heap {
 	struct ion_heap heap;
-	struct gen_pool *pool;
+	spinlock_t lock;		/* protects the free extents */
+	struct rb_root free_by_addr;
+	struct rb_root free_by_size;
+	unsigned long free_extents;
+	struct list_head spare_extents;	/* one set aside by each allocation */
 	ion_phys_addr_t base;
 	unsigned long bit_nr;
 	unsigned long *bits;
 };
+
+static void extent_insert_addr(struct ion_carveout_heap *carveout_heap,
+			       struct ion_carveout_extent *extent)
+{
+	struct rb_node **p = &carveout_heap->free_by_addr.rb_node;
+	struct rb_node *parent = NULL;
+	struct ion_carveout_extent *e;
+
+	while (*p) {
+		parent = *p;
+		e = rb_entry(parent, struct ion_carveout_extent, by_addr);
+		if (extent->base < e->base)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&extent->by_addr, parent, p);
+	rb_insert_color(&extent->by_addr, &carveout_heap->free_by_addr);
+	carveout_heap->free_extents++;
+}
+
+static void extent_erase_addr(struct ion_carveout_heap *carveout_heap,
+			      struct ion_carveout_extent *extent)
+{
+	rb_erase(&extent->by_addr, &carveout_heap->free_by_addr);
+	carveout_heap->free_extents--;
+}
+
+/* Equal sizes are ordered by address, so low addresses are used first */
+static void extent_insert_size(struct ion_carveout_heap *carveout_heap,
+			       struct ion_carveout_extent *extent)
+{
+	struct rb_node **p = &carveout_heap->free_by_size.rb_node;
+	struct rb_node *parent = NULL;
+	struct ion_carveout_extent *e;
+
+	while (*p) {
+		parent = *p;
+		e = rb_entry(parent, struct ion_carveout_extent, by_size);
+		if (extent->size < e->size ||
+		    (extent->size == e->size && extent->base < e->base))
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&extent->by_size, parent, p);
+	rb_insert_color(&extent->by_size, &carveout_heap->free_by_size);
+}
+
+static void extent_erase_size(struct ion_carveout_heap *carveout_heap,
+			      struct ion_carveout_extent *extent)
+{
+	rb_erase(&extent->by_size, &carveout_heap->free_by_size);
+}
+
+static unsigned long largest_free_extent(struct ion_carveout_heap *carveout_heap)
+{
+	struct rb_node *node = rb_last(&carveout_heap->free_by_size);
+
+	if (!node)
+		return 0;
+	return rb_entry(node, struct ion_carveout_extent, by_size)->size;
+}
+
+/*
+ * Smallest extent that can hold @size bytes at @align. Extents are only
+ * skipped past the best size match when alignment padding doesn't fit.
+ */
+static struct ion_carveout_extent *
+find_best_fit(struct ion_carveout_heap *carveout_heap, unsigned long size,
+	      unsigned long align, ion_phys_addr_t *start)
+{
+	struct rb_node *node = carveout_heap->free_by_size.rb_node;
+	struct ion_carveout_extent *best = NULL;
+
+	while (node) {
+		struct ion_carveout_extent *e =
+			rb_entry(node, struct ion_carveout_extent, by_size);
+
+		if (e->size >= size) {
+			best = e;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+
+	for (node = best ? &best->by_size : NULL; node; node = rb_next(node)) {
+		struct ion_carveout_extent *e =
+			rb_entry(node, struct ion_carveout_extent, by_size);
+		ion_phys_addr_t aligned = ALIGN(e->base, align);
+
+		if (aligned + size <= e->base + e->size) {
+			*start = aligned;
+			return e;
+		}
+	}
+	return NULL;
+}
+
 ion_phys_addr_t ion_carveout_allocate(struct ion_heap *heap,
 				      unsigned long size,
 				      unsigned long align)
 {
 	struct ion_carveout_heap *carveout_heap =
 		container_of(heap, struct ion_carveout_heap, heap);
-	unsigned long offset = gen_pool_alloc(carveout_heap->pool, size);
+	struct ion_carveout_extent *extent, *tail, *spare;
+	unsigned long head_size, tail_size, largest;
+	ion_phys_addr_t offset;
+
+	size = PAGE_ALIGN(size);
+	if (!size)
+		return ION_CARVEOUT_ALLOCATE_FAIL;
+	if (align < PAGE_SIZE || !is_power_of_2(align))
+		align = PAGE_SIZE;
+
+	/*
+	 * The tail of a split extent needs a node of its own, and so may
+	 * the free of this allocation, which cannot fail: take both now.
+	 */
+	tail = kmalloc(sizeof(*tail), GFP_KERNEL);
+	spare = kmalloc(sizeof(*spare), GFP_KERNEL);
+	if (!tail || !spare) {
+		kfree(tail);
+		kfree(spare);
+		return ION_CARVEOUT_ALLOCATE_FAIL;
+	}
+
+	spin_lock(&carveout_heap->lock);
+	extent = find_best_fit(carveout_heap, size, align, &offset);
+	if (!extent) {
+		largest = largest_free_extent(carveout_heap);
+		spin_unlock(&carveout_heap->lock);
+		kfree(tail);
+		kfree(spare);
 
-	if (!offset) {
 		if ((heap->total_size - heap->allocated_size) > size)
 			printk("%s: heap %s has enough memory (%luK) but"
 				" the allocation of size(%luK) still failed."
-				" Memory is probably fragmented.\n",
+				" Largest free extent is %luK, the heap is"
+				" fragmented.\n",
 				__func__, heap->name,
-				(heap->total_size - heap->allocated_size)/SZ_1K, 
-				size/SZ_1K);
+				(heap->total_size - heap->allocated_size)/SZ_1K,
+				size/SZ_1K, largest/SZ_1K);
 		else
 			printk("%s: heap %s has not enough memory(%luK)"
 				"the alloction of size is %luK.\n",
 				__func__, heap->name,
-				(heap->total_size - heap->allocated_size)/SZ_1K, 
+				(heap->total_size - heap->allocated_size)/SZ_1K,
 				size/SZ_1K);
 		return ION_CARVEOUT_ALLOCATE_FAIL;
 	}
 
+	head_size = offset - extent->base;
+	tail_size = extent->base + extent->size - (offset + size);
+
+	extent_erase_size(carveout_heap, extent);
+	if (head_size) {
+		extent->size = head_size;
+		extent_insert_size(carveout_heap, extent);
+		if (tail_size) {
+			tail->base = offset + size;
+			tail->size = tail_size;
+			extent_insert_addr(carveout_heap, tail);
+			extent_insert_size(carveout_heap, tail);
+			tail = NULL;
+		}
+	} else if (tail_size) {
+		/* still in the same place in the address tree */
+		extent->base = offset + size;
+		extent->size = tail_size;
+		extent_insert_size(carveout_heap, extent);
+	} else {
+		extent_erase_addr(carveout_heap, extent);
+		kfree(extent);
+	}
+
+	list_add(&spare->spare, &carveout_heap->spare_extents);
 	heap->allocated_size += size;
 
 	if((offset + size - carveout_heap->base) > heap->max_allocated)
 		heap->max_allocated = offset + size - carveout_heap->base;
 
-	bitmap_set(carveout_heap->bits, 
+	bitmap_set(carveout_heap->bits,
 		(offset - carveout_heap->base)/PAGE_SIZE , size/PAGE_SIZE);
+	spin_unlock(&carveout_heap->lock);
+
+	kfree(tail);
 	return offset;
 }
 
@@ -77,14 +254,71 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
 {
 	struct ion_carveout_heap *carveout_heap =
 		container_of(heap, struct ion_carveout_heap, heap);
+	struct ion_carveout_extent *prev = NULL, *next = NULL, *extent;
+	struct rb_node *node;
+	bool merge_prev, merge_next;
 
 	if (addr == ION_CARVEOUT_ALLOCATE_FAIL)
 		return;
-	gen_pool_free(carveout_heap->pool, addr, size);
+	size = PAGE_ALIGN(size);
+
+	spin_lock(&carveout_heap->lock);
+	/* the node set aside when this was allocated */
+	if (WARN_ON(list_empty(&carveout_heap->spare_extents))) {
+		spin_unlock(&carveout_heap->lock);
+		return;
+	}
+	extent = list_first_entry(&carveout_heap->spare_extents,
+				  struct ion_carveout_extent, spare);
+	list_del(&extent->spare);
+
+	node = carveout_heap->free_by_addr.rb_node;
+	while (node) {
+		struct ion_carveout_extent *e =
+			rb_entry(node, struct ion_carveout_extent, by_addr);
+
+		if (e->base < addr) {
+			prev = e;
+			node = node->rb_right;
+		} else {
+			next = e;
+			node = node->rb_left;
+		}
+	}
+
+	merge_prev = prev && prev->base + prev->size == addr;
+	merge_next = next && addr + size == next->base;
+
+	if (merge_prev && merge_next) {
+		extent_erase_size(carveout_heap, prev);
+		extent_erase_size(carveout_heap, next);
+		extent_erase_addr(carveout_heap, next);
+		prev->size += size + next->size;
+		extent_insert_size(carveout_heap, prev);
+		kfree(next);
+	} else if (merge_prev) {
+		extent_erase_size(carveout_heap, prev);
+		prev->size += size;
+		extent_insert_size(carveout_heap, prev);
+	} else if (merge_next) {
+		extent_erase_size(carveout_heap, next);
+		next->base = addr;
+		next->size += size;
+		extent_insert_size(carveout_heap, next);
+	} else {
+		extent->base = addr;
+		extent->size = size;
+		extent_insert_addr(carveout_heap, extent);
+		extent_insert_size(carveout_heap, extent);
+		extent = NULL;
+	}
 
 	heap->allocated_size -= size;
-	bitmap_clear(carveout_heap->bits, 
+	bitmap_clear(carveout_heap->bits,
 		(addr - carveout_heap->base)/PAGE_SIZE, size/PAGE_SIZE);
+	spin_unlock(&carveout_heap->lock);
+
+	kfree(extent);
 }
 
 static int ion_carveout_heap_phys(struct ion_heap *heap,
@@ -149,7 +383,8 @@ int ion_carveout_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 					vma->vm_page_prot);
 }
 int ion_carveout_cache_op(struct ion_heap *heap, struct ion_buffer *buffer,
-			void *virt, unsigned int type)
+			void *virt, unsigned long offset, unsigned long len,
+			unsigned int type)
 {
 	unsigned long phys_start = 0, phys_end = 0;
 	void *virt_start = NULL, *virt_end = NULL;
@@ -157,13 +392,18 @@ int ion_carveout_cache_op(struct ion_heap *heap, struct ion_buffer *buffer,
 
         if(!buffer)
                 return -EINVAL;
-	phys_start = buffer->priv_phys;
-	phys_end = buffer->priv_phys + buffer->size;
+	phys_start = buffer->priv_phys + offset;
+	phys_end = phys_start + len;
 	
-	list_for_each_entry(map, &buffer->map_addr, list) {
+	if (buffer->vaddr && virt == buffer->vaddr) {
+		virt_start = virt + offset;
+		virt_end = virt_start + len;
+	} else list_for_each_entry(map, &buffer->map_addr, list) {
 		if(map->vaddr == (unsigned long)virt){
-			virt_start = virt;
-			virt_end = (void *)((unsigned long)virt + map->size);
+			if (offset + len > map->size)
+				return -EINVAL;
+			virt_start = virt + offset;
+			virt_end = virt_start + len;
 			break;
 		}
 	}
@@ -197,6 +437,50 @@ int ion_carveout_cache_op(struct ion_heap *heap, struct ion_buffer *buffer,
 	return 0;
 }
 
+/*
+ * The fragmentation index is the share of free memory that lies outside
+ * the largest free extent, in thousandths: 0 means all free memory is
+ * usable by a single allocation, values near 1000 mean it is in shreds.
+ */
+static void ion_carveout_print_fragmentation(struct ion_carveout_heap *carveout_heap,
+					     struct seq_file *s)
+{
+	unsigned long classes[ION_CARVEOUT_SIZE_CLASSES] = { 0 };
+	unsigned long free_pages = 0, largest, extents;
+	struct rb_node *node;
+	int i;
+
+	spin_lock(&carveout_heap->lock);
+	for (node = rb_first(&carveout_heap->free_by_addr); node;
+	     node = rb_next(node)) {
+		struct ion_carveout_extent *e =
+			rb_entry(node, struct ion_carveout_extent, by_addr);
+		unsigned long pages = e->size >> PAGE_SHIFT;
+
+		free_pages += pages;
+		/* a heap smaller than a page starts with an empty extent */
+		if (!pages)
+			continue;
+		i = min_t(int, ilog2(pages), ION_CARVEOUT_SIZE_CLASSES - 1);
+		classes[i]++;
+	}
+	largest = largest_free_extent(carveout_heap) >> PAGE_SHIFT;
+	extents = carveout_heap->free_extents;
+	spin_unlock(&carveout_heap->lock);
+
+	seq_printf(s, "Free: %luK in %lu extents, largest free extent: %luK\n",
+		   free_pages << (PAGE_SHIFT - 10), extents,
+		   largest << (PAGE_SHIFT - 10));
+	seq_printf(s, "Fragmentation index: %lu/1000\n",
+		   free_pages ? 1000 - largest * 1000 / free_pages : 0);
+	seq_printf(s, "Free extents by size:");
+	for (i = 0; i < ION_CARVEOUT_SIZE_CLASSES; i++)
+		seq_printf(s, " %s%luK:%lu",
+			   i == ION_CARVEOUT_SIZE_CLASSES - 1 ? ">=" : "",
+			   (PAGE_SIZE << i) / SZ_1K, classes[i]);
+	seq_printf(s, "\n");
+}
+
 static int ion_carveout_print_debug(struct ion_heap *heap, struct seq_file *s)
 {
 	int i;
@@ -221,6 +505,7 @@ static int ion_carveout_print_debug(struct ion_heap *heap, struct seq_file *s)
 		heap->max_allocated/SZ_1M);
 	seq_printf(s, "Heap size: %luM, heap base: 0x%lx\n", 
 		heap->total_size/SZ_1M, carveout_heap->base);
+	ion_carveout_print_fragmentation(carveout_heap, s);
 	return 0;
 }
 static struct ion_heap_ops carveout_heap_ops = {
@@ -237,19 +522,26 @@ static struct ion_heap_ops carveout_heap_ops = {
 struct ion_heap *ion_carveout_heap_create(struct ion_platform_heap *heap_data)
 {
 	struct ion_carveout_heap *carveout_heap;
+	struct ion_carveout_extent *extent;
 
 	carveout_heap = kzalloc(sizeof(struct ion_carveout_heap), GFP_KERNEL);
 	if (!carveout_heap)
 		return ERR_PTR(-ENOMEM);
 
-	carveout_heap->pool = gen_pool_create(12, -1);
-	if (!carveout_heap->pool) {
+	extent = kmalloc(sizeof(*extent), GFP_KERNEL);
+	if (!extent) {
 		kfree(carveout_heap);
 		return ERR_PTR(-ENOMEM);
 	}
+	spin_lock_init(&carveout_heap->lock);
+	INIT_LIST_HEAD(&carveout_heap->spare_extents);
+	carveout_heap->free_by_addr = RB_ROOT;
+	carveout_heap->free_by_size = RB_ROOT;
 	carveout_heap->base = heap_data->base;
-	gen_pool_add(carveout_heap->pool, carveout_heap->base, heap_data->size,
-		     -1);
+	extent->base = heap_data->base;
+	extent->size = heap_data->size & PAGE_MASK;
+	extent_insert_addr(carveout_heap, extent);
+	extent_insert_size(carveout_heap, extent);
 	carveout_heap->heap.ops = &carveout_heap_ops;
 	carveout_heap->heap.type = ION_HEAP_TYPE_CARVEOUT;
 	carveout_heap->heap.allocated_size = 0;
@@ -266,8 +558,23 @@ void ion_carveout_heap_destroy(struct ion_heap *heap)
 {
 	struct ion_carveout_heap *carveout_heap =
 	     container_of(heap, struct  ion_carveout_heap, heap);
+	struct rb_node *node;
 
-	gen_pool_destroy(carveout_heap->pool);
+	while ((node = rb_first(&carveout_heap->free_by_addr))) {
+		struct ion_carveout_extent *e =
+			rb_entry(node, struct ion_carveout_extent, by_addr);
+
+		extent_erase_addr(carveout_heap, e);
+		kfree(e);
+	}
+	while (!list_empty(&carveout_heap->spare_extents)) {
+		struct ion_carveout_extent *e =
+			list_first_entry(&carveout_heap->spare_extents,
+					 struct ion_carveout_extent, spare);
+
+		list_del(&e->spare);
+		kfree(e);
+	}
 	kfree(carveout_heap->bits);
 	kfree(carveout_heap);
 	carveout_heap = NULL;
@@ -0,0 +1,234 @@
+/*
+ * drivers/gpu/ion/ion_page_pool.c
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/highmem.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <asm/cacheflush.h>
+#include "ion_priv.h"
+
+/*
+ * Freed pages are queued as dirty and zeroed by a worker, so neither the
+ * allocating nor the freeing task pays for clearing them. The worker also
+ * tops the pool up to low_mark zeroed chunks, without retrying reclaim.
+ */
+
+/*
+ * Zero a chunk and push the zeroes out of the caches: the buffer may be
+ * mapped uncached or handed to a device without further maintenance.
+ */
+static void ion_page_pool_zero(struct ion_page_pool *pool, struct page *page)
+{
+	int i;
+
+	for (i = 0; i < (1 << pool->order); i++) {
+		void *addr = kmap_atomic(page + i, KM_USER0);
+
+		clear_page(addr);
+		dmac_flush_range(addr, addr + PAGE_SIZE);
+		kunmap_atomic(addr, KM_USER0);
+	}
+	outer_flush_range(page_to_phys(page),
+			  page_to_phys(page) + (PAGE_SIZE << pool->order));
+}
+
+static struct page *ion_page_pool_alloc_pages(struct ion_page_pool *pool,
+					      gfp_t gfp_mask)
+{
+	struct page *page = alloc_pages(gfp_mask, pool->order);
+
+	if (page)
+		ion_page_pool_zero(pool, page);
+	return page;
+}
+
+static void ion_page_pool_worker(struct work_struct *work)
+{
+	struct ion_page_pool *pool = container_of(work, struct ion_page_pool,
+						  work);
+	struct page *page;
+
+	for (;;) {
+		spin_lock(&pool->lock);
+		if (list_empty(&pool->dirty)) {
+			spin_unlock(&pool->lock);
+			break;
+		}
+		page = list_first_entry(&pool->dirty, struct page, lru);
+		list_del(&page->lru);
+		pool->dirty_count--;
+		spin_unlock(&pool->lock);
+
+		ion_page_pool_zero(pool, page);
+
+		spin_lock(&pool->lock);
+		list_add_tail(&page->lru, &pool->zeroed);
+		pool->zeroed_count++;
+		spin_unlock(&pool->lock);
+	}
+
+	while (ACCESS_ONCE(pool->zeroed_count) < pool->low_mark) {
+		page = ion_page_pool_alloc_pages(pool, pool->gfp_mask |
+						 __GFP_NORETRY | __GFP_NOWARN);
+		if (!page)
+			break;
+
+		spin_lock(&pool->lock);
+		list_add_tail(&page->lru, &pool->zeroed);
+		pool->zeroed_count++;
+		pool->refills++;
+		spin_unlock(&pool->lock);
+	}
+}
+
+/**
+ * ion_page_pool_alloc - get a zeroed chunk of 2^order pages
+ *
+ * Takes a chunk from the pool if there is one, or else allocates and
+ * zeroes one in place. Returns NULL if the page allocator fails.
+ */
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool)
+{
+	struct page *page = NULL;
+	bool refill;
+
+	spin_lock(&pool->lock);
+	if (!list_empty(&pool->zeroed)) {
+		page = list_first_entry(&pool->zeroed, struct page, lru);
+		list_del(&page->lru);
+		pool->zeroed_count--;
+		pool->hits++;
+	} else {
+		pool->misses++;
+	}
+	refill = pool->zeroed_count < pool->low_mark;
+	spin_unlock(&pool->lock);
+
+	if (refill)
+		queue_work(system_unbound_wq, &pool->work);
+
+	if (!page)
+		page = ion_page_pool_alloc_pages(pool, pool->gfp_mask);
+	return page;
+}
+
+/**
+ * ion_page_pool_free - return a chunk to the pool
+ *
+ * The chunk is zeroed later by the pool worker. Once the pool holds
+ * high_mark chunks, further chunks go back to the page allocator.
+ */
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
+{
+	spin_lock(&pool->lock);
+	if (pool->zeroed_count + pool->dirty_count >= pool->high_mark) {
+		spin_unlock(&pool->lock);
+		__free_pages(page, pool->order);
+		return;
+	}
+	list_add_tail(&page->lru, &pool->dirty);
+	pool->dirty_count++;
+	spin_unlock(&pool->lock);
+
+	queue_work(system_unbound_wq, &pool->work);
+}
+
+/**
+ * ion_page_pool_shrink - give pooled chunks back to the page allocator
+ * @nr_to_scan:	number of pages to free, 0 only counts them
+ *
+ * Dirty chunks go first, as they have not been paid for yet. Returns the
+ * number of pages still held by the pool.
+ */
+int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan)
+{
+	struct page *page;
+	int count;
+
+	while (nr_to_scan > 0) {
+		spin_lock(&pool->lock);
+		if (!list_empty(&pool->dirty)) {
+			page = list_first_entry(&pool->dirty, struct page, lru);
+			pool->dirty_count--;
+		} else if (!list_empty(&pool->zeroed)) {
+			page = list_first_entry(&pool->zeroed, struct page,
+						lru);
+			pool->zeroed_count--;
+		} else {
+			spin_unlock(&pool->lock);
+			break;
+		}
+		list_del(&page->lru);
+		pool->shrunk++;
+		spin_unlock(&pool->lock);
+
+		__free_pages(page, pool->order);
+		nr_to_scan -= 1 << pool->order;
+	}
+
+	spin_lock(&pool->lock);
+	count = (pool->zeroed_count + pool->dirty_count) << pool->order;
+	spin_unlock(&pool->lock);
+	return count;
+}
+
+void ion_page_pool_print_debug(struct ion_page_pool *pool, struct seq_file *s)
+{
+	spin_lock(&pool->lock);
+	seq_printf(s, "order %2u: %4d zeroed %4d dirty, "
+		   "%lu hits %lu misses %lu refills %lu shrunk\n",
+		   pool->order, pool->zeroed_count, pool->dirty_count,
+		   pool->hits, pool->misses, pool->refills, pool->shrunk);
+	spin_unlock(&pool->lock);
+}
+
+/**
+ * ion_page_pool_create - create a pool of 2^order page chunks
+ * @gfp_mask:	flags used to allocate chunks
+ * @order:	chunk order
+ * @low_mark:	number of zeroed chunks the worker keeps ready
+ * @high_mark:	number of chunks above which frees bypass the pool
+ */
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
+					   int low_mark, int high_mark)
+{
+	struct ion_page_pool *pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+
+	if (!pool)
+		return NULL;
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->zeroed);
+	INIT_LIST_HEAD(&pool->dirty);
+	INIT_WORK(&pool->work, ion_page_pool_worker);
+	pool->gfp_mask = gfp_mask;
+	pool->order = order;
+	pool->low_mark = low_mark;
+	pool->high_mark = high_mark;
+
+	if (low_mark)
+		queue_work(system_unbound_wq, &pool->work);
+	return pool;
+}
+
+void ion_page_pool_destroy(struct ion_page_pool *pool)
+{
+	cancel_work_sync(&pool->work);
+	ion_page_pool_shrink(pool, INT_MAX);
+	kfree(pool);
+}
@@ -21,6 +21,8 @@
 #include <linux/mm_types.h>
 #include <linux/mutex.h>
 #include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #include <linux/ion.h>
 
 #include <linux/seq_file.h>
@@ -64,6 +66,8 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
  * @vaddr:		the kenrel mapping if kmap_cnt is not zero
  * @dmap_cnt:		number of times the buffer is mapped for dma
  * @sglist:		the scatterlist for the buffer is dmap_cnt is not zero
+ * @kmap_lru:		node in the device's list of idle kernel mappings,
+ *			kept around after kmap_cnt drops to zero
 */
 struct ion_buffer {
 	struct kref ref;
@@ -82,6 +86,7 @@ struct ion_buffer {
 	int dmap_cnt;
 	struct scatterlist *sglist;
         struct list_head map_addr;
+	struct list_head kmap_lru;
 	pid_t pid;
 	int marked;
 };
@@ -97,6 +102,8 @@ struct ion_buffer {
  * @map_kernel		map memory to the kernel
  * @unmap_kernel	unmap memory to the kernel
  * @map_user		map memory to userspace
+ * @cache_op		clean/invalidate/flush [offset, offset + len) of the
+ *			buffer through the mapping starting at virt
  */
 struct ion_heap_ops {
 	int (*allocate) (struct ion_heap *heap,
@@ -113,7 +120,8 @@ struct ion_heap_ops {
 	int (*map_user) (struct ion_heap *mapper, struct ion_buffer *buffer,
 			 struct vm_area_struct *vma);
 	int (*cache_op)(struct ion_heap *heap, struct ion_buffer *buffer,
-			void *virt, unsigned int type);
+			void *virt, unsigned long offset, unsigned long len,
+			unsigned int type);
 	int (*print_debug)(struct ion_heap *heap, struct seq_file *s);
 };
 
@@ -201,4 +209,54 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
  */
 #define ION_CARVEOUT_ALLOCATE_FAIL -1
 
+/**
+ * struct ion_page_pool - pagepool struct
+ * @order:		order of the chunks in the pool
+ * @gfp_mask:		flags chunks are allocated with
+ * @low_mark:		zeroed chunks kept ready by the worker
+ * @high_mark:		chunks above which frees bypass the pool
+ * @lock:		protects the lists and counters
+ * @zeroed:		chunks ready to be handed out
+ * @dirty:		freed chunks waiting to be zeroed
+ * @work:		zeroes dirty chunks and refills the pool
+ * @hits, @misses:	allocations served from the pool or not
+ * @refills, @shrunk:	chunks added by the worker, freed by the shrinker
+ *
+ * Allows you to keep a pool of pre-zeroed pages around. Pages taken from
+ * the page allocator are zeroed and flushed out of the caches before they
+ * are handed out.
+ */
+struct ion_page_pool {
+	unsigned int order;
+	gfp_t gfp_mask;
+	int low_mark;
+	int high_mark;
+	spinlock_t lock;
+	struct list_head zeroed;
+	struct list_head dirty;
+	int zeroed_count;
+	int dirty_count;
+	struct work_struct work;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long refills;
+	unsigned long shrunk;
+};
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
+					   int low_mark, int high_mark);
+void ion_page_pool_destroy(struct ion_page_pool *);
+struct page *ion_page_pool_alloc(struct ion_page_pool *);
+void ion_page_pool_free(struct ion_page_pool *, struct page *);
+int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan);
+void ion_page_pool_print_debug(struct ion_page_pool *pool, struct seq_file *s);
+
+#ifdef CONFIG_ION_BENCH
+void ion_bench_init(struct dentry *debug_root);
+void ion_bench_add_heap(struct ion_heap *heap);
+#else
+static inline void ion_bench_init(struct dentry *debug_root) { }
+static inline void ion_bench_add_heap(struct ion_heap *heap) { }
+#endif
+
 #endif /* _ION_PRIV_H */
@@ -19,9 +19,29 @@
 #include <linux/platform_device.h>
 #include <linux/slab.h>
 #include "../ion_priv.h"
+#include "rockchip_ion.h"
 
 static int num_heaps;
 static struct ion_heap **heaps;
+static struct ion_device *rockchip_ion_dev;
+
+struct ion_client *rockchip_ion_client_create(unsigned int heap_mask,
+					      const char *name)
+{
+	if (!rockchip_ion_dev)
+		return ERR_PTR(-ENODEV);
+	return ion_client_create(rockchip_ion_dev, heap_mask, name);
+}
+
+struct ion_heap *rockchip_ion_find_heap(int id)
+{
+	int i;
+
+	for (i = 0; i < num_heaps; i++)
+		if (heaps[i] && heaps[i]->id == id)
+			return heaps[i];
+	return NULL;
+}
 
 static long rockchip_custom_ioctl (struct ion_client *client, unsigned int cmd,
 			      unsigned long arg)
@@ -55,6 +75,7 @@ static int rockchip_ion_probe(struct platform_device *pdev)
 		ion_device_add_heap(idev, heaps[i]);
 	}
 	platform_set_drvdata(pdev, idev);
+	rockchip_ion_dev = idev;
         pr_info("Rockchip ion module(version: %s) is successfully loaded\n", ION_VERSION);
 	return 0;
 err:
@@ -71,6 +92,7 @@ static int rockchip_ion_remove(struct platform_device *pdev)
 	struct ion_device *idev = platform_get_drvdata(pdev);
 	int i;
 
+	rockchip_ion_dev = NULL;
 	ion_device_destroy(idev);
 	for (i = 0; i < num_heaps; i++)
 		ion_heap_destroy(heaps[i]);
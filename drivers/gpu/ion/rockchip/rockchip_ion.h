@@ -0,0 +1,38 @@
+/*
+ * drivers/gpu/ion/rockchip/rockchip_ion.h
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef _ROCKCHIP_ION_H
+#define _ROCKCHIP_ION_H
+
+#include <linux/ion.h>
+
+/**
+ * rockchip_ion_client_create() - create a client of the rockchip ion device
+ * @heap_mask:	mask of heap types the client may allocate from
+ * @name:	used for debugging
+ *
+ * Returns -ENODEV if the ion device has not been probed yet.
+ */
+struct ion_client *rockchip_ion_client_create(unsigned int heap_mask,
+					      const char *name);
+
+/**
+ * rockchip_ion_find_heap() - look up a heap by id
+ * @id:		heap id from the board file
+ */
+struct ion_heap *rockchip_ion_find_heap(int id);
+
+#endif /* _ROCKCHIP_ION_H */
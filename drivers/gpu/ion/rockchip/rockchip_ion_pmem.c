@@ -0,0 +1,383 @@
+/*
+ * drivers/gpu/ion/rockchip/rockchip_ion_pmem.c
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * pmem compatible devices backed by the ion carveout: the pmem ioctls
+ * userspace still uses, without a region reserved for each device.
+ * Boards register an "ion-pmem" platform device with the usual
+ * android_pmem_platform_data; start and size are ignored.
+ *
+ * Each open file owns at most one ion buffer, allocated by PMEM_ALLOCATE
+ * or by the first mmap. PMEM_CONNECT shares the buffer of another file;
+ * the buffer lives until the last file referring to it is closed.
+ * PMEM_MAP/PMEM_UNMAP (revocable submaps) are not supported.
+ */
+
+#include <linux/android_pmem.h>
+#include <linux/err.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/ion.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/platform_device.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <asm/cacheflush.h>
+#include "../ion_priv.h"
+#include "rockchip_ion.h"
+
+/* the heap pmem devices allocate from */
+#define ION_PMEM_HEAP_ID	ION_NOR_HEAP_ID
+
+struct ion_pmem {
+	struct miscdevice dev;
+	struct android_pmem_platform_data *pdata;
+};
+
+struct ion_pmem_data {
+	struct ion_pmem *pmem;
+	struct mutex lock;		/* protects everything below */
+	struct ion_client *client;
+	struct ion_handle *handle;
+	ion_phys_addr_t phys;
+	size_t len;
+	unsigned long vaddr;		/* user mapping, 0 if not mapped */
+	struct mm_struct *mm;		/* only compared, never dereferenced */
+};
+
+static const struct file_operations ion_pmem_fops;
+
+static int is_ion_pmem_file(struct file *file)
+{
+	return file->f_op == &ion_pmem_fops;
+}
+
+/* data->lock must be held */
+static int ion_pmem_allocate(struct ion_pmem_data *data, size_t len)
+{
+	struct ion_handle *handle;
+	size_t phys_len;
+	int ret;
+
+	if (data->handle)
+		return -EINVAL;
+
+	len = PAGE_ALIGN(len);
+	if (!len)
+		return -EINVAL;
+
+	handle = ion_alloc(data->client, len, PAGE_SIZE,
+			   1 << ION_PMEM_HEAP_ID);
+	if (IS_ERR_OR_NULL(handle))
+		return -ENOMEM;
+
+	ret = ion_phys(data->client, handle, &data->phys, &phys_len);
+	if (ret) {
+		ion_free(data->client, handle);
+		return ret;
+	}
+	data->handle = handle;
+	data->len = len;
+	return 0;
+}
+
+/* Share the buffer of the pmem file behind @fd */
+static int ion_pmem_connect(struct ion_pmem_data *data, int fd)
+{
+	struct ion_pmem_data *master;
+	struct ion_handle *handle = NULL;
+	ion_phys_addr_t phys = 0;
+	struct file *file;
+	size_t len = 0;
+	int ret = 0;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+	if (!is_ion_pmem_file(file) || file->private_data == data) {
+		fput(file);
+		return -EINVAL;
+	}
+	master = file->private_data;
+
+	/* never hold both locks, two files may connect to each other */
+	mutex_lock(&master->lock);
+	if (master->handle) {
+		handle = ion_import(data->client,
+				    ion_share(master->client, master->handle));
+		phys = master->phys;
+		len = master->len;
+	}
+	mutex_unlock(&master->lock);
+	fput(file);
+
+	if (IS_ERR_OR_NULL(handle))
+		return handle ? PTR_ERR(handle) : -EINVAL;
+
+	mutex_lock(&data->lock);
+	if (data->handle) {
+		ret = -EINVAL;
+	} else {
+		data->handle = handle;
+		data->phys = phys;
+		data->len = len;
+		handle = NULL;
+	}
+	mutex_unlock(&data->lock);
+
+	if (handle)
+		ion_free(data->client, handle);
+	return ret;
+}
+
+static void ion_pmem_flush(struct ion_pmem_data *data, unsigned long offset,
+			   unsigned long len)
+{
+	struct ion_pmem *pmem = data->pmem;
+
+	mutex_lock(&data->lock);
+	if (!data->handle || !pmem->pdata->cached)
+		goto out;
+	if (offset > data->len || len > data->len - offset)
+		goto out;
+
+	/* the inner caches can only be reached through the caller's mapping */
+	if (data->vaddr && data->mm == current->mm)
+		dmac_flush_range((void *)(data->vaddr + offset),
+				 (void *)(data->vaddr + offset + len));
+	outer_flush_range(data->phys + offset, data->phys + offset + len);
+out:
+	mutex_unlock(&data->lock);
+}
+
+static long ion_pmem_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct ion_pmem_data *data = file->private_data;
+	struct pmem_region region;
+	struct ion_heap *heap;
+	int ret = 0;
+
+	switch (cmd) {
+	case PMEM_GET_PHYS:
+		mutex_lock(&data->lock);
+		region.offset = data->handle ? data->phys : 0;
+		region.len = data->handle ? data->len : 0;
+		mutex_unlock(&data->lock);
+		if (copy_to_user((void __user *)arg, &region,
+				 sizeof(struct pmem_region)))
+			return -EFAULT;
+		break;
+	case PMEM_GET_SIZE:
+		mutex_lock(&data->lock);
+		region.offset = 0;
+		region.len = data->handle ? data->len : 0;
+		mutex_unlock(&data->lock);
+		if (copy_to_user((void __user *)arg, &region,
+				 sizeof(struct pmem_region)))
+			return -EFAULT;
+		break;
+	case PMEM_GET_TOTAL_SIZE:
+		heap = rockchip_ion_find_heap(ION_PMEM_HEAP_ID);
+		region.offset = 0;
+		region.len = heap ? heap->total_size : 0;
+		if (copy_to_user((void __user *)arg, &region,
+				 sizeof(struct pmem_region)))
+			return -EFAULT;
+		break;
+	case PMEM_ALLOCATE:
+		mutex_lock(&data->lock);
+		ret = ion_pmem_allocate(data, arg);
+		mutex_unlock(&data->lock);
+		break;
+	case PMEM_CONNECT:
+		ret = ion_pmem_connect(data, arg);
+		break;
+	case PMEM_CACHE_FLUSH:
+		if (copy_from_user(&region, (void __user *)arg,
+				   sizeof(struct pmem_region)))
+			return -EFAULT;
+		ion_pmem_flush(data, region.offset, region.len);
+		break;
+	default:
+		return -EINVAL;
+	}
+	return ret;
+}
+
+static void ion_pmem_vma_close(struct vm_area_struct *vma)
+{
+	struct ion_pmem_data *data = vma->vm_file->private_data;
+
+	/* copies made by fork() and split off tails are not the mapping */
+	mutex_lock(&data->lock);
+	if (data->vaddr == vma->vm_start && data->mm == vma->vm_mm) {
+		data->vaddr = 0;
+		data->mm = NULL;
+	}
+	mutex_unlock(&data->lock);
+}
+
+static const struct vm_operations_struct ion_pmem_vm_ops = {
+	.close = ion_pmem_vma_close,
+};
+
+static int ion_pmem_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct ion_pmem_data *data = file->private_data;
+	struct android_pmem_platform_data *pdata = data->pmem->pdata;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	int ret = 0;
+
+	/* same restrictions as pmem */
+	if (vma->vm_pgoff || !IS_ALIGNED(size, PAGE_SIZE))
+		return -EINVAL;
+
+	mutex_lock(&data->lock);
+	if (data->vaddr) {
+		ret = -EINVAL;
+		goto out;
+	}
+	if (!data->handle) {
+		ret = ion_pmem_allocate(data, size);
+		if (ret)
+			goto out;
+	}
+	if (size > data->len) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (!pdata->cached || file->f_flags & O_SYNC)
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	else if (pdata->buffered)
+		vma->vm_page_prot = pgprot_writecombine(vma->vm_page_prot);
+
+	ret = remap_pfn_range(vma, vma->vm_start, __phys_to_pfn(data->phys),
+			      size, vma->vm_page_prot);
+	if (!ret) {
+		vma->vm_ops = &ion_pmem_vm_ops;
+		data->vaddr = vma->vm_start;
+		data->mm = current->mm;
+	}
+out:
+	mutex_unlock(&data->lock);
+	return ret;
+}
+
+static int ion_pmem_open(struct inode *inode, struct file *file)
+{
+	struct miscdevice *misc = file->private_data;
+	struct ion_pmem *pmem = container_of(misc, struct ion_pmem, dev);
+	struct ion_pmem_data *data;
+	struct ion_client *client;
+
+	client = rockchip_ion_client_create(ION_HEAP_CARVEOUT_MASK,
+					    pmem->pdata->name);
+	if (IS_ERR_OR_NULL(client))
+		return client ? PTR_ERR(client) : -ENOMEM;
+
+	data = kzalloc(sizeof(struct ion_pmem_data), GFP_KERNEL);
+	if (!data) {
+		ion_client_destroy(client);
+		return -ENOMEM;
+	}
+	mutex_init(&data->lock);
+	data->pmem = pmem;
+	data->client = client;
+	file->private_data = data;
+	return 0;
+}
+
+static int ion_pmem_release(struct inode *inode, struct file *file)
+{
+	struct ion_pmem_data *data = file->private_data;
+
+	/* mappings stay valid: the vma holds a reference on the file */
+	if (data->handle)
+		ion_free(data->client, data->handle);
+	ion_client_destroy(data->client);
+	kfree(data);
+	return 0;
+}
+
+static const struct file_operations ion_pmem_fops = {
+	.owner = THIS_MODULE,
+	.open = ion_pmem_open,
+	.release = ion_pmem_release,
+	.mmap = ion_pmem_mmap,
+	.unlocked_ioctl = ion_pmem_ioctl,
+};
+
+static int ion_pmem_probe(struct platform_device *pdev)
+{
+	struct android_pmem_platform_data *pdata = pdev->dev.platform_data;
+	struct ion_pmem *pmem;
+	int err;
+
+	if (!pdata || !pdata->name)
+		return -EINVAL;
+
+	pmem = kzalloc(sizeof(struct ion_pmem), GFP_KERNEL);
+	if (!pmem)
+		return -ENOMEM;
+	pmem->pdata = pdata;
+	pmem->dev.minor = MISC_DYNAMIC_MINOR;
+	pmem->dev.name = pdata->name;
+	pmem->dev.fops = &ion_pmem_fops;
+
+	err = misc_register(&pmem->dev);
+	if (err) {
+		pr_err("%s: failed to register %s\n", __func__, pdata->name);
+		kfree(pmem);
+		return err;
+	}
+	platform_set_drvdata(pdev, pmem);
+	pr_info("ion-pmem: %s backed by ion heap %d\n", pdata->name,
+		ION_PMEM_HEAP_ID);
+	return 0;
+}
+
+static int ion_pmem_remove(struct platform_device *pdev)
+{
+	struct ion_pmem *pmem = platform_get_drvdata(pdev);
+
+	misc_deregister(&pmem->dev);
+	kfree(pmem);
+	return 0;
+}
+
+static struct platform_driver ion_pmem_driver = {
+	.probe = ion_pmem_probe,
+	.remove = ion_pmem_remove,
+	.driver = { .name = "ion-pmem" }
+};
+
+static int __init ion_pmem_init(void)
+{
+	return platform_driver_register(&ion_pmem_driver);
+}
+
+static void __exit ion_pmem_exit(void)
+{
+	platform_driver_unregister(&ion_pmem_driver);
+}
+
+module_init(ion_pmem_init);
+module_exit(ion_pmem_exit);
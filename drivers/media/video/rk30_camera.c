@@ -1522,7 +1522,7 @@ static void rk30_camera_request_reserve_mem(void)
         rk_camera_platform_data.meminfo_cif1.size= PMEM_CAMIPP_NECESSARY_CIF_1;
     #endif
  #endif
- #if PMEM_CAM_NECESSARY
+ #if PMEM_CAM_NECESSARY && !defined(CONFIG_ION_ROCKCHIP_PMEM)
         android_pmem_cam_pdata.start = board_mem_reserve_add((char*)(android_pmem_cam_pdata.name),PMEM_CAM_NECESSARY);
         android_pmem_cam_pdata.size= PMEM_CAM_NECESSARY;
  #endif
@@ -30,10 +30,16 @@
 #include <linux/mutex.h>
 #include <linux/videodev2.h>
 #include <linux/kthread.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
 #include <mach/iomux.h>
 #include <media/v4l2-common.h>
 #include <media/v4l2-dev.h>
-#include <media/videobuf-dma-contig.h>
+#include <media/videobuf-core.h>
+#include <media/videobuf2-dma-contig.h>
 #include <media/soc_camera.h>
 #include <media/soc_mediabus.h>
 #include <mach/io.h>
@@ -50,9 +56,15 @@
 #include <mach/rk2928_camera.h>
 #endif
 #include <asm/cacheflush.h>
+#define CREATE_TRACE_POINTS
+#include <trace/events/rk_camera.h>
 static int debug;
 module_param(debug, int, S_IRUGO|S_IWUSR);
 
+/* vivi style synthetic frames at this rate instead of CIF captures, to exercise the buffer queue */
+static int test_fps;
+module_param(test_fps, int, S_IRUGO|S_IWUSR);
+
 #define dprintk(level, fmt, arg...) do {			\
 	if (debug >= level) 					\
 	printk(KERN_WARNING"rk_camera: " fmt , ## arg); } while (0)
@@ -280,8 +292,15 @@ module_param(debug, int, S_IRUGO|S_IWUSR);
 
 *v0.x.1c:
 *         1. fix query resolution error;
+*v0.x.1d:
+*         1. capture through videobuf2-dma-contig, MMAP and USERPTR buffers are written in place;
+*         2. test_fps module parameter feeds synthetic frames instead of the sensor;
+*v0.x.1e:
+*         1. arm scale_crop runs in stripes on all online cpus, debugfs rk_camera/scale_bench times it;
+*v0.x.1f:
+*         1. rk_camera tracepoints for every frame stage, stage latency and drop counters in debugfs rk_camera/cifN/stats;
 */
-#define RK_CAM_VERSION_CODE KERNEL_VERSION(0, 2, 0x1c)
+#define RK_CAM_VERSION_CODE KERNEL_VERSION(0, 2, 0x1f)
 
 /* limit to rk29 hardware capabilities */
 #define RK_CAM_BUS_PARAM   (SOCAM_MASTER |\
@@ -303,16 +322,50 @@ module_param(debug, int, S_IRUGO|S_IWUSR);
 #define RK_CAM_FRAME_INVAL_INIT 3
 #define RK_CAM_FRAME_INVAL_DC 3          /* ddl@rock-chips.com :  */
 #define RK30_CAM_FRAME_MEASURE  5
-extern void videobuf_dma_contig_free(struct videobuf_queue *q, struct videobuf_buffer *buf);
-extern dma_addr_t videobuf_to_dma_contig(struct videobuf_buffer *buf);
 
 /* buffer for one video frame */
 struct rk_camera_buffer
 {
     /* common v4l buffer stuff -- must be first */
-    struct videobuf_buffer vb;
+    struct vb2_buffer vb;
+    struct list_head queue;         /* pcdev->capture */
     enum v4l2_mbus_pixelcode	code;
-    int			inwork;
+    ktime_t ts_start;               /* armed in the CIF */
+    ktime_t ts_done;                /* written by the CIF */
+    ktime_t ts_ready;               /* handed to vb2 */
+};
+
+enum rk_camera_stage {
+    RK_CAM_STAGE_CAPTURE,           /* armed -> CIF dma done */
+    RK_CAM_STAGE_SCALE,             /* dma done -> scale_crop done */
+    RK_CAM_STAGE_QUEUE,             /* ready -> dequeued by the application */
+    RK_CAM_STAGE_TOTAL,             /* armed -> dequeued */
+    RK_CAM_STAGE_NUM
+};
+
+enum rk_camera_drop_reason {
+    RK_CAM_DROP_NO_BUFFER,          /* no buffer queued when the frame ended */
+    RK_CAM_DROP_FRAME_INVAL,        /* skipped while the sensor settles */
+    RK_CAM_DROP_NO_WORK,            /* every scale_crop work item busy */
+    RK_CAM_DROP_SCALE_ERR,          /* ipp/rga/arm scale_crop failed */
+    RK_CAM_DROP_REINIT,             /* returned by the reinit work */
+    RK_CAM_DROP_NUM
+};
+
+#define RK_CAM_HIST_BUCKETS 20
+struct rk_camera_hist
+{
+    unsigned int bucket[RK_CAM_HIST_BUCKETS];
+    unsigned int count;
+    s64 sum_us;
+    s64 max_us;
+};
+
+struct rk_camera_stats
+{
+    spinlock_t lock;
+    struct rk_camera_hist hist[RK_CAM_STAGE_NUM];
+    unsigned int drops[RK_CAM_DROP_NUM];
 };
 enum rk_camera_reg_state
 {
@@ -334,7 +387,7 @@ struct rk_camera_reg
 };
 struct rk_camera_work
 {
-	struct videobuf_buffer *vb;
+	struct vb2_buffer *vb;
 	struct rk_camera_dev *pcdev;
 	struct work_struct work;
     struct list_head queue;
@@ -418,7 +471,7 @@ struct rk_camera_dev
 
 	spinlock_t		lock;
 
-	struct videobuf_buffer	*active;
+	struct vb2_buffer	*active;
 	struct rk_camera_reg reginfo_suspend;
 	struct workqueue_struct *camera_wq;
 	struct rk_camera_work *camera_work;
@@ -433,11 +486,138 @@ struct rk_camera_dev
  //   atomic_t to_process_frames;
     bool timer_get_fps;
     unsigned int reinit_times; 
-    struct videobuf_queue *video_vq;
+    void *alloc_ctx;
+    unsigned int sequence;
+    struct delayed_work test_work;
+    unsigned long test_interval;    /* jiffies, test_fps latched at stream on */
     bool stop_cif;
     struct timeval first_tv;
+    struct rk_camera_stats stats;
+    struct dentry *debugfs;
+};
+
+static inline struct rk_camera_buffer *to_rk_vb(struct vb2_buffer *vb)
+{
+    return container_of(vb, struct rk_camera_buffer, vb);
+}
+
+/*
+ * Frame accounting: stage latencies as log2 histograms (bucket 0 is
+ * 0us, bucket n holds [2^(n-1), 2^n) us, the last one everything above)
+ * and a counter for each way a sensor frame can be lost. Each event is
+ * also a rk_camera tracepoint.
+ */
+static const char *rk_camera_stage_name[RK_CAM_STAGE_NUM] = {
+    [RK_CAM_STAGE_CAPTURE] = "capture",
+    [RK_CAM_STAGE_SCALE] = "scale",
+    [RK_CAM_STAGE_QUEUE] = "queue",
+    [RK_CAM_STAGE_TOTAL] = "total",
+};
+
+static const char *rk_camera_drop_name[RK_CAM_DROP_NUM] = {
+    [RK_CAM_DROP_NO_BUFFER] = "no_buffer",
+    [RK_CAM_DROP_FRAME_INVAL] = "frame_inval",
+    [RK_CAM_DROP_NO_WORK] = "no_work",
+    [RK_CAM_DROP_SCALE_ERR] = "scale_err",
+    [RK_CAM_DROP_REINIT] = "reinit",
 };
 
+static s64 rk_camera_stage(struct rk_camera_dev *pcdev, int stage, ktime_t from, ktime_t to)
+{
+    struct rk_camera_hist *hist = &pcdev->stats.hist[stage];
+    unsigned long flags;
+    s64 us = ktime_us_delta(to, from);
+    int bucket;
+
+    if (us < 0)
+        us = 0;
+    if (us > 0x7fffffff)
+        bucket = RK_CAM_HIST_BUCKETS - 1;
+    else
+        bucket = MIN(fls((unsigned int)us), RK_CAM_HIST_BUCKETS - 1);
+
+    spin_lock_irqsave(&pcdev->stats.lock, flags);
+    hist->bucket[bucket]++;
+    hist->count++;
+    hist->sum_us += us;
+    if (us > hist->max_us)
+        hist->max_us = us;
+    spin_unlock_irqrestore(&pcdev->stats.lock, flags);
+    return us;
+}
+
+static void rk_camera_drop(struct rk_camera_dev *pcdev, int reason, struct vb2_buffer *vb)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&pcdev->stats.lock, flags);
+    pcdev->stats.drops[reason]++;
+    spin_unlock_irqrestore(&pcdev->stats.lock, flags);
+    trace_rk_camera_frame_drop(pcdev->hostid, vb ? vb->v4l2_buf.index : -1,
+                               pcdev->sequence, rk_camera_drop_name[reason]);
+}
+
+static int rk_camera_stats_show(struct seq_file *s, void *unused)
+{
+    struct rk_camera_dev *pcdev = s->private;
+    struct rk_camera_stats *stats;
+    int i,j,last;
+
+    stats = kmalloc(sizeof(struct rk_camera_stats), GFP_KERNEL);
+    if (!stats)
+        return -ENOMEM;
+    spin_lock_irq(&pcdev->stats.lock);
+    memcpy(stats, &pcdev->stats, sizeof(struct rk_camera_stats));
+    spin_unlock_irq(&pcdev->stats.lock);
+
+    seq_printf(s, "frames: %u\n", pcdev->sequence);
+    seq_printf(s, "drops:");
+    for (i = 0; i < RK_CAM_DROP_NUM; i++)
+        seq_printf(s, " %s=%u", rk_camera_drop_name[i], stats->drops[i]);
+    seq_printf(s, "\n");
+
+    for (i = 0; i < RK_CAM_STAGE_NUM; i++) {
+        struct rk_camera_hist *hist = &stats->hist[i];
+
+        seq_printf(s, "\n%s: count=%u avg_us=%lld max_us=%lld\n", rk_camera_stage_name[i], hist->count,
+                   hist->count ? div_s64(hist->sum_us, hist->count) : 0, hist->max_us);
+        for (last = RK_CAM_HIST_BUCKETS - 1; last > 0 && !hist->bucket[last]; last--)
+            ;
+        for (j = 0; j <= last && hist->count; j++)
+            seq_printf(s, "  < %8u us: %u\n", 1 << j, hist->bucket[j]);
+    }
+    kfree(stats);
+    return 0;
+}
+
+static int rk_camera_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, rk_camera_stats_show, inode->i_private);
+}
+
+/* any write clears the counters */
+static ssize_t rk_camera_stats_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+    struct rk_camera_dev *pcdev = ((struct seq_file *)file->private_data)->private;
+
+    spin_lock_irq(&pcdev->stats.lock);
+    memset(pcdev->stats.hist, 0x00, sizeof(pcdev->stats.hist));
+    memset(pcdev->stats.drops, 0x00, sizeof(pcdev->stats.drops));
+    spin_unlock_irq(&pcdev->stats.lock);
+    return count;
+}
+
+static const struct file_operations rk_camera_stats_fops = {
+    .open    = rk_camera_stats_open,
+    .read    = seq_read,
+    .write   = rk_camera_stats_write,
+    .llseek  = seq_lseek,
+    .release = single_release,
+};
+
+/* debugfs rk_camera, one directory per cif below it */
+static struct dentry *rk_camera_debugfs_dir;
+
 static const struct v4l2_queryctrl rk_camera_controls[] =
 {
 	#ifdef CONFIG_VIDEO_RK29_DIGITALZOOM_IPP_ON
@@ -463,10 +643,11 @@ static void rk_camera_capture_process(struct work_struct *work);
 /*
  *  Videobuf operations
  */
-static int rk_videobuf_setup(struct videobuf_queue *vq, unsigned int *count,
-                               unsigned int *size)
+static int rk_videobuf_setup(struct vb2_queue *vq, unsigned int *count,
+                               unsigned int *num_planes, unsigned long sizes[],
+                               void *alloc_ctxs[])
 {
-    struct soc_camera_device *icd = vq->priv_data;
+    struct soc_camera_device *icd = soc_camera_from_vb2q(vq);
 	struct soc_camera_host *ici = to_soc_camera_host(icd->dev.parent);
     struct rk_camera_dev *pcdev = ici->priv;
 	unsigned int i;
@@ -487,13 +668,15 @@ static int rk_videobuf_setup(struct videobuf_queue *vq, unsigned int *count,
 	else
 		bytes_per_line_host = soc_mbus_bytes_per_line(pcdev->host_width,
 					   icd->current_fmt->host_fmt);
-    dev_dbg(&icd->dev, "count=%d, size=%d\n", *count, *size);
+    dev_dbg(&icd->dev, "count=%d\n", *count);
 
 	if (bytes_per_line_host < 0)
 		return bytes_per_line_host;
 
 	/* planar capture requires Y, U and V buffers to be page aligned */
-	*size = PAGE_ALIGN(bytes_per_line*icd->user_height);	   /* Y pages UV pages, yuv422*/
+	*num_planes = 1;
+	sizes[0] = PAGE_ALIGN(bytes_per_line*icd->user_height);	   /* Y pages UV pages, yuv422*/
+	alloc_ctxs[0] = pcdev->alloc_ctx;
 	pcdev->vipmem_bsize = PAGE_ALIGN(bytes_per_line_host * pcdev->host_height);
 
 	if (CAM_WORKQUEUE_IS_EN()) {
@@ -545,138 +728,96 @@ static int rk_videobuf_setup(struct videobuf_queue *vq, unsigned int *count,
         }
 #endif        
 	}
-    pcdev->video_vq = vq;
-    RKCAMERA_DG("%s..%d.. videobuf size:%d, vipmem_buf size:%d, count:%d \n",__FUNCTION__,__LINE__, *size,pcdev->vipmem_size, *count);
+    RKCAMERA_DG("%s..%d.. videobuf size:%lu, vipmem_buf size:%d, count:%d \n",__FUNCTION__,__LINE__, sizes[0],pcdev->vipmem_size, *count);
 
     return 0;
 }
-static void rk_videobuf_free(struct videobuf_queue *vq, struct rk_camera_buffer *buf)
+static int rk_videobuf_init(struct vb2_buffer *vb)
 {
-    struct soc_camera_device *icd = vq->priv_data;
-
-    dev_dbg(&icd->dev, "%s (vb=0x%p) 0x%08lx %zd\n", __func__,
-            &buf->vb, buf->vb.baddr, buf->vb.bsize);
+    struct rk_camera_buffer *buf = to_rk_vb(vb);
 
-	/* ddl@rock-chips.com: buf_release called soc_camera_streamoff and soc_camera_close*/
-	if (buf->vb.state == VIDEOBUF_NEEDS_INIT)
-		return;
-
-    if (in_interrupt())
-        BUG();
-    /*
-	 * This waits until this buffer is out of danger, i.e., until it is no
-	 * longer in STATE_QUEUED or STATE_ACTIVE
-	 */
-	//videobuf_waiton(vq, &buf->vb, 0, 0);
-    videobuf_dma_contig_free(vq, &buf->vb);
-    dev_dbg(&icd->dev, "%s freed\n", __func__);
-    buf->vb.state = VIDEOBUF_NEEDS_INIT;
-	return;
+    INIT_LIST_HEAD(&buf->queue);
+    return 0;
 }
-static int rk_videobuf_prepare(struct videobuf_queue *vq, struct videobuf_buffer *vb, enum v4l2_field field)
+static int rk_videobuf_prepare(struct vb2_buffer *vb)
 {
-    struct soc_camera_device *icd = vq->priv_data;
-    struct rk_camera_buffer *buf;
-    int ret;
+    struct soc_camera_device *icd = soc_camera_from_vb2q(vb->vb2_queue);
+    struct rk_camera_buffer *buf = to_rk_vb(vb);
+    unsigned long size;
     int bytes_per_line = soc_mbus_bytes_per_line(icd->user_width,
 						icd->current_fmt->host_fmt);
-	if ((bytes_per_line < 0) || (vb->boff == 0))
+	if (bytes_per_line < 0)
 		return -EINVAL;
 
-    buf = container_of(vb, struct rk_camera_buffer, vb);
-
-    dev_dbg(&icd->dev, "%s (vb=0x%p) 0x%08lx %zd\n", __func__,
-            vb, vb->baddr, vb->bsize);
-    
-    /* Added list head initialization on alloc */
-    WARN_ON(!list_empty(&vb->queue));    
-
     BUG_ON(NULL == icd->current_fmt);
 
-    if (buf->code    != icd->current_fmt->code ||
-            vb->width   != icd->user_width ||
-            vb->height  != icd->user_height ||
-             vb->field   != field) {
-        buf->code    = icd->current_fmt->code;
-        vb->width   = icd->user_width;
-        vb->height  = icd->user_height;
-        vb->field   = field;
-        vb->state   = VIDEOBUF_NEEDS_INIT;
-    }
+    dev_dbg(&icd->dev, "%s (vb=0x%p) 0x%08lx %lu\n", __func__,
+            vb, (unsigned long)vb2_dma_contig_plane_paddr(vb, 0), vb2_plane_size(vb, 0));
 
-    vb->size = bytes_per_line*vb->height;          /* ddl@rock-chips.com : fmt->depth is coorect */
-    if (0 != vb->baddr && vb->bsize < vb->size) {
-        ret = -EINVAL;
-        goto out;
+    size = bytes_per_line*icd->user_height;          /* ddl@rock-chips.com : fmt->depth is coorect */
+    if (vb2_plane_size(vb, 0) < size) {
+        dev_err(icd->dev.parent, "Buffer too small (%lu < %lu)\n",
+                vb2_plane_size(vb, 0), size);
+        return -ENOBUFS;
     }
+    /* CIF, IPP and RGA write the buffer by its physical address */
+    if (vb2_dma_contig_plane_paddr(vb, 0) == 0)
+        return -EINVAL;
 
-    if (vb->state == VIDEOBUF_NEEDS_INIT) {
-        ret = videobuf_iolock(vq, vb, NULL);
-        if (ret) {
-            goto fail;
-        }
-        vb->state = VIDEOBUF_PREPARED;
-    }
-    
+    buf->code = icd->current_fmt->code;
+    vb2_set_plane_payload(vb, 0, size);
     return 0;
-fail:
-    rk_videobuf_free(vq, buf);
-out:
-    return ret;
 }
 
-static inline void rk_videobuf_capture(struct videobuf_buffer *vb,struct rk_camera_dev *rk_pcdev)
+static inline void rk_videobuf_capture(struct vb2_buffer *vb,struct rk_camera_dev *rk_pcdev)
 {
 	unsigned int y_addr,uv_addr;
 	struct rk_camera_dev *pcdev = rk_pcdev;
 
     if (vb) {
 		if (CAM_WORKQUEUE_IS_EN()) {
-			y_addr = pcdev->vipmem_phybase + vb->i*pcdev->vipmem_bsize;
+			y_addr = pcdev->vipmem_phybase + vb->v4l2_buf.index*pcdev->vipmem_bsize;
 			uv_addr = y_addr + pcdev->zoominfo.vir_width*pcdev->zoominfo.vir_height;
 			if (y_addr > (pcdev->vipmem_phybase + pcdev->vipmem_size - pcdev->vipmem_bsize)) {
 				RKCAMERA_TR("vipmem for IPP is overflow! %dx%d -> %dx%d vb_index:%d\n",pcdev->host_width,pcdev->host_height,
-					          pcdev->icd->user_width,pcdev->icd->user_height, vb->i);
+					          pcdev->icd->user_width,pcdev->icd->user_height, vb->v4l2_buf.index);
 				BUG();
 			}
 		} else {
-			y_addr = vb->boff;
-			uv_addr = y_addr + vb->width * vb->height;
+			y_addr = vb2_dma_contig_plane_paddr(vb, 0);
+			uv_addr = y_addr + pcdev->icd->user_width * pcdev->icd->user_height;
 		}
         write_cif_reg(pcdev->base,CIF_CIF_FRM0_ADDR_Y, y_addr);
         write_cif_reg(pcdev->base,CIF_CIF_FRM0_ADDR_UV, uv_addr);
         write_cif_reg(pcdev->base,CIF_CIF_FRM1_ADDR_Y, y_addr);
         write_cif_reg(pcdev->base,CIF_CIF_FRM1_ADDR_UV, uv_addr);
         write_cif_reg(pcdev->base,CIF_CIF_FRAME_STATUS,  0x00000002);//frame1 has been ready to receive data,frame 2 is not used
+
+        to_rk_vb(vb)->ts_start = ktime_get();
+        trace_rk_camera_frame_start(pcdev->hostid, vb->v4l2_buf.index, pcdev->sequence,
+                                    ktime_to_us(to_rk_vb(vb)->ts_start), 0);
     }
 }
-/* Locking: Caller holds q->irqlock */
-static void rk_videobuf_queue(struct videobuf_queue *vq,
-                                struct videobuf_buffer *vb)
+static void rk_videobuf_queue(struct vb2_buffer *vb)
 {
-    struct soc_camera_device *icd = vq->priv_data;
+    struct soc_camera_device *icd = soc_camera_from_vb2q(vb->vb2_queue);
     struct soc_camera_host *ici = to_soc_camera_host(icd->dev.parent);
     struct rk_camera_dev *pcdev = ici->priv;
+    struct rk_camera_buffer *buf = to_rk_vb(vb);
+    unsigned long flags;
 #if CAMERA_VIDEOBUF_ARM_ACCESS    
     struct rk29_camera_vbinfo *vb_info;
+    unsigned long paddr = vb2_dma_contig_plane_paddr(vb, 0);
+    unsigned long size = vb2_plane_size(vb, 0);
 #endif
 
-    dev_dbg(&icd->dev, "%s (vb=0x%p) 0x%08lx %zd\n", __func__,
-            vb, vb->baddr, vb->bsize);
+    dev_dbg(&icd->dev, "%s (vb=0x%p) 0x%08lx %lu\n", __func__,
+            vb, (unsigned long)vb2_dma_contig_plane_paddr(vb, 0), vb2_get_plane_payload(vb, 0));
 
-    vb->state = VIDEOBUF_QUEUED;
-	if (list_empty(&pcdev->capture)) {
-		list_add_tail(&vb->queue, &pcdev->capture);
-	} else {
-		if (list_entry(pcdev->capture.next, struct videobuf_buffer, queue) != vb)
-			list_add_tail(&vb->queue, &pcdev->capture);
-		else
-			BUG();    /* ddl@rock-chips.com : The same videobuffer queue again */
-	}
 #if CAMERA_VIDEOBUF_ARM_ACCESS
     if (pcdev->vbinfo) {
-        vb_info = pcdev->vbinfo+vb->i;
-        if ((vb_info->phy_addr != vb->boff) || (vb_info->size != vb->bsize)) {
+        vb_info = pcdev->vbinfo+vb->v4l2_buf.index;
+        if ((vb_info->phy_addr != paddr) || (vb_info->size != size)) {
             if (vb_info->vir_addr) {
                 iounmap(vb_info->vir_addr);
                 release_mem_region(vb_info->phy_addr, vb_info->size);
@@ -685,23 +826,35 @@ static void rk_videobuf_queue(struct videobuf_queue *vq,
                 vb_info->size = 0x00;
             }
 
-            if (request_mem_region(vb->boff,vb->bsize,"rk_camera_vb")) {
-                vb_info->vir_addr = ioremap_cached(vb->boff,vb->bsize); 
+            if (request_mem_region(paddr,size,"rk_camera_vb")) {
+                vb_info->vir_addr = ioremap_cached(paddr,size); 
             }
             
             if (vb_info->vir_addr) {
-                vb_info->size = vb->bsize;
-                vb_info->phy_addr = vb->boff;
+                vb_info->size = size;
+                vb_info->phy_addr = paddr;
             } else {
-                RKCAMERA_TR("%s..%d:ioremap videobuf %d failed\n",__FUNCTION__,__LINE__, vb->i);
+                RKCAMERA_TR("%s..%d:ioremap videobuf %d failed\n",__FUNCTION__,__LINE__, vb->v4l2_buf.index);
             }
         }
     }
 #endif    
+    spin_lock_irqsave(&pcdev->lock, flags);
+    list_add_tail(&buf->queue, &pcdev->capture);
     if (!pcdev->active) {
         pcdev->active = vb;
         rk_videobuf_capture(vb,pcdev);
     }
+    spin_unlock_irqrestore(&pcdev->lock, flags);
+}
+/* Locking: Caller holds pcdev->lock */
+static void rk_camera_clear_capture(struct rk_camera_dev *pcdev)
+{
+    struct rk_camera_buffer *buf, *tmp;
+
+    list_for_each_entry_safe(buf, tmp, &pcdev->capture, queue)
+        list_del_init(&buf->queue);
+    pcdev->active = NULL;
 }
 static int rk_pixfmt2ippfmt(unsigned int pixfmt, int *ippfmt)
 {
@@ -767,16 +920,15 @@ rk_pixfmt2rgafmt_err:
 #if (CONFIG_CAMERA_SCALE_CROP_MACHINE == RK_CAM_SCALE_CROP_PP)
 static int rk_camera_scale_crop_pp(struct work_struct *work){
 	struct rk_camera_work *camera_work = container_of(work, struct rk_camera_work, work);
-	struct videobuf_buffer *vb = camera_work->vb;
+	struct vb2_buffer *vb = camera_work->vb;
 	struct rk_camera_dev *pcdev = camera_work->pcdev;
 	int vipdata_base;
-	unsigned long int flags;
 	int scale_times,w,h;
 	int src_y_offset;
 	PP_OP_HANDLE hnd;
 	PP_OPERATION init;
 	int ret = 0;
-	vipdata_base = pcdev->vipmem_phybase + vb->i*pcdev->vipmem_bsize;
+	vipdata_base = pcdev->vipmem_phybase + vb->v4l2_buf.index*pcdev->vipmem_bsize;
 	
 	memset(&init, 0, sizeof(init));
 	init.srcAddr 	= vipdata_base;
@@ -784,7 +936,7 @@ static int rk_camera_scale_crop_pp(struct work_struct *work){
 	init.srcWidth	= init.srcHStride = pcdev->zoominfo.vir_width;
 	init.srcHeight	= init.srcVStride = pcdev->zoominfo.vir_height;
 	
-	init.dstAddr 	= vb->boff;
+	init.dstAddr 	= vb2_dma_contig_plane_paddr(vb, 0);
 	init.dstFormat	= PP_OUT_FORMAT_YUV420INTERLAVE;
 	init.dstWidth	= init.dstHStride = pcdev->icd->user_width;
 	init.dstHeight	= init.dstVStride = pcdev->icd->user_height;
@@ -809,10 +961,9 @@ extern int rga_blit_sync(rga_session *session, struct rga_req *req);
 extern	 void rga_service_session_clear(rga_session *session);
 static int rk_camera_scale_crop_rga(struct work_struct *work){
 	struct rk_camera_work *camera_work = container_of(work, struct rk_camera_work, work);
-	struct videobuf_buffer *vb = camera_work->vb;
+	struct vb2_buffer *vb = camera_work->vb;
 	struct rk_camera_dev *pcdev = camera_work->pcdev;
 	int vipdata_base;
-	unsigned long int flags;
 	int scale_times,w,h;
 	int src_y_offset;
 	struct rga_req req;
@@ -821,7 +972,7 @@ static int rk_camera_scale_crop_rga(struct work_struct *work){
 	const struct soc_mbus_pixelfmt *fmt;
 	int ret = 0;
 	fmt = soc_mbus_get_fmtdesc(pcdev->icd->current_fmt->code);
-	vipdata_base = pcdev->vipmem_phybase + vb->i*pcdev->vipmem_bsize;
+	vipdata_base = pcdev->vipmem_phybase + vb->v4l2_buf.index*pcdev->vipmem_bsize;
 	if((pcdev->icd->current_fmt->host_fmt->fourcc != V4L2_PIX_FMT_RGB565)
 		&& (pcdev->icd->current_fmt->host_fmt->fourcc != V4L2_PIX_FMT_RGB24)){
 		RKCAMERA_TR("RGA not support this format !\n");
@@ -864,7 +1015,7 @@ static int rk_camera_scale_crop_rga(struct work_struct *work){
 	req.dst.vir_h = pcdev->icd->user_height;
 	req.dst.x_offset = 0;
 	req.dst.y_offset = 0;
-	req.dst.yrgb_addr = vb->boff;
+	req.dst.yrgb_addr = vb2_dma_contig_plane_paddr(vb, 0);
 	rk_pixfmt2rgafmt(pcdev->icd->current_fmt->host_fmt->fourcc,&req.dst.format);
 	req.clip.xmin = 0;
 	req.clip.xmax = req.dst.vir_w-1;
@@ -888,7 +1039,7 @@ static int rk_camera_scale_crop_rga(struct work_struct *work){
 			req.src.y_offset = pcdev->zoominfo.a.c.top+h*pcdev->zoominfo.a.c.height/scale_times;
 			req.dst.x_offset =  pcdev->icd->user_width*w/scale_times;
 			req.dst.y_offset = pcdev->icd->user_height*h/scale_times;
-			req.dst.yrgb_addr = vb->boff ;
+			req.dst.yrgb_addr = vb2_dma_contig_plane_paddr(vb, 0);
 		//	RKCAMERA_TR("src.act_w = %d , src.act_h  = %d! vir_w = %d , vir_h = %d,off_x = %d,off_y = %d\n",req.src.act_w,req.src.act_h ,req.src.vir_w,req.src.vir_h,req.src.x_offset,req.src.y_offset);
 		//	RKCAMERA_TR("dst.act_w = %d , dst.act_h  = %d! vir_w = %d , vir_h = %d,off_x = %d,off_y = %d\n",req.dst.act_w,req.dst.act_h ,req.dst.vir_w,req.dst.vir_h,req.dst.x_offset,req.dst.y_offset);
 		//	RKCAMERA_TR("req.src.yrgb_addr = 0x%x,req.dst.yrgb_addr = 0x%x\n",req.src.yrgb_addr,req.dst.yrgb_addr);
@@ -902,13 +1053,7 @@ static int rk_camera_scale_crop_rga(struct work_struct *work){
 			}
 		
 			if (rga_times <= 0) {
-				spin_lock_irqsave(&pcdev->lock, flags);
-				vb->state = VIDEOBUF_NEEDS_INIT;
-				spin_unlock_irqrestore(&pcdev->lock, flags);
-				mutex_lock(&rga_service.lock);
-				list_del(&session.list_session);
-				rga_service_session_clear(&session);
-				mutex_unlock(&rga_service.lock);
+				ret = -EIO;
 				goto session_done;
 			}
 			}
@@ -931,10 +1076,10 @@ static int rk_camera_scale_crop_rga(struct work_struct *work){
 static int rk_camera_scale_crop_ipp(struct work_struct *work)
 {
 	struct rk_camera_work *camera_work = container_of(work, struct rk_camera_work, work);
-	struct videobuf_buffer *vb = camera_work->vb;
+	struct vb2_buffer *vb = camera_work->vb;
 	struct rk_camera_dev *pcdev = camera_work->pcdev;
 	int vipdata_base;
-	unsigned long int flags;
+	unsigned long dst_base = vb2_dma_contig_plane_paddr(vb, 0);
 
 	struct rk29_ipp_req ipp_req;
 	int src_y_offset,src_uv_offset,dst_y_offset,dst_uv_offset,src_y_size,dst_y_size;
@@ -965,7 +1110,7 @@ static int rk_camera_scale_crop_ipp(struct work_struct *work)
     ipp_req.dst0.h = pcdev->icd->user_height/scale_times;
     ipp_req.dst_vir_w = pcdev->icd->user_width;        
     rk_pixfmt2ippfmt(pcdev->pixfmt, &ipp_req.dst0.fmt);
-    vipdata_base = pcdev->vipmem_phybase + vb->i*pcdev->vipmem_bsize;
+    vipdata_base = pcdev->vipmem_phybase + vb->v4l2_buf.index*pcdev->vipmem_bsize;
     src_y_size = pcdev->zoominfo.vir_width*pcdev->zoominfo.vir_height;  //vipmem
     dst_y_size = pcdev->icd->user_width*pcdev->icd->user_height;
     for (h=0; h<scale_times; h++) {
@@ -981,8 +1126,8 @@ static int rk_camera_scale_crop_ipp(struct work_struct *work)
 
     		ipp_req.src0.YrgbMst = vipdata_base + src_y_offset;
     		ipp_req.src0.CbrMst = vipdata_base + src_y_size + src_uv_offset;
-    		ipp_req.dst0.YrgbMst = vb->boff + dst_y_offset;
-    		ipp_req.dst0.CbrMst = vb->boff + dst_y_size + dst_uv_offset;
+    		ipp_req.dst0.YrgbMst = dst_base + dst_y_offset;
+    		ipp_req.dst0.CbrMst = dst_base + dst_y_size + dst_uv_offset;
     		while(ipp_times-- > 0) {
                 if (ipp_blit_sync(&ipp_req)){
                     RKCAMERA_TR("ipp do erro,do again,ipp_times = %d!\n",ipp_times);
@@ -992,10 +1137,8 @@ static int rk_camera_scale_crop_ipp(struct work_struct *work)
             }
             
             if (ipp_times <= 0) {
-    			spin_lock_irqsave(&pcdev->lock, flags);
-    			vb->state = VIDEOBUF_NEEDS_INIT;
-    			spin_unlock_irqrestore(&pcdev->lock, flags);
-    			RKCAMERA_TR("Capture image(vb->i:0x%x) which IPP operated is error:\n",vb->i);
+    			ret = -EIO;
+    			RKCAMERA_TR("Capture image(vb index:0x%x) which IPP operated is error:\n",vb->v4l2_buf.index);
     			RKCAMERA_TR("widx:%d hidx:%d ",w,h);
     			RKCAMERA_TR("%dx%d@(%d,%d)->%dx%d\n",pcdev->zoominfo.a.c.width,pcdev->zoominfo.a.c.height,pcdev->zoominfo.a.c.left,pcdev->zoominfo.a.c.top,pcdev->icd->user_width,pcdev->icd->user_height);
     			RKCAMERA_TR("ipp_req.src0.YrgbMst:0x%x ipp_req.src0.CbrMst:0x%x \n", ipp_req.src0.YrgbMst,ipp_req.src0.CbrMst);
@@ -1016,115 +1159,165 @@ do_ipp_err:
 }
 #endif
 #if (CONFIG_CAMERA_SCALE_CROP_MACHINE == RK_CAM_SCALE_CROP_ARM)
+/*
+ * Bilinear YUV420SP scaler used when neither IPP nor RGA does the job.
+ * A frame is cut into horizontal stripes of the destination, one per
+ * online cpu: the first stripe runs in the caller, the others on
+ * system_unbound_wq, so a digital zoom frame costs about 1/ncpus of
+ * the single threaded loop.
+ */
+#define RK_CAM_SCALE_STRIPES_MAX    4
+
+struct rk_camera_scale_req {
+    const unsigned char *src_y;     /* top left of the crop window */
+    const unsigned char *src_uv;
+    int src_w, src_h;               /* line length and height of the source */
+    int crop_w, crop_h;
+    unsigned char *dst_y;
+    unsigned char *dst_uv;
+    int dst_w, dst_h;
+};
+
+struct rk_camera_scale_stripe {
+    struct work_struct work;
+    const struct rk_camera_scale_req *req;
+    int y_start, y_end;             /* luma rows of the destination, even */
+};
+
+static inline unsigned int rk_camera_scale_lerp(unsigned int a, unsigned int b, unsigned int coeff)
+{
+    return (a*(0xffff - coeff) + b*coeff) >> 16;
+}
+
+static void rk_camera_scale_rows(const struct rk_camera_scale_req *req, int y_start, int y_end)
+{
+    unsigned long inv_x = ((unsigned long)req->crop_w<<16)/req->dst_w + 1;
+    unsigned long inv_y = ((unsigned long)req->crop_h<<16)/req->dst_h + 1;
+    const unsigned char *s0,*s1;
+    unsigned char *d;
+    unsigned long fx,fy;
+    unsigned int xc,yc,r0,r1;
+    int srcW,srcH,dstW,x,y,sX,sY;
+
+    /* y */
+    srcW = req->src_w;
+    srcH = req->src_h;
+    dstW = req->dst_w;
+    for (y = y_start; y < y_end; y++) {
+        fy = y*inv_y;
+        yc = fy & 0xffff;
+        sY = fy >> 16;
+        sY = (sY >= srcH - 1) ? (srcH - 2) : sY;
+        s0 = req->src_y + sY*srcW;
+        s1 = s0 + srcW;
+        d = req->dst_y + y*dstW;
+        for (x = 0, fx = 0; x < dstW; x++, fx += inv_x) {
+            xc = fx & 0xffff;
+            sX = fx >> 16;
+            sX = (sX >= srcW - 1) ? (srcW - 2) : sX;
+            r0 = rk_camera_scale_lerp(s0[sX], s0[sX + 1], xc);
+            r1 = rk_camera_scale_lerp(s1[sX], s1[sX + 1], xc);
+            d[x] = rk_camera_scale_lerp(r0, r1, yc);
+        }
+    }
+
+    /* uv, interleaved: both components share the coefficients */
+    srcW /= 2;
+    srcH /= 2;
+    dstW /= 2;
+    for (y = y_start/2; y < y_end/2; y++) {
+        fy = y*inv_y;
+        yc = fy & 0xffff;
+        sY = fy >> 16;
+        sY = (sY >= srcH - 1) ? (srcH - 2) : sY;
+        s0 = req->src_uv + sY*srcW*2;
+        s1 = s0 + srcW*2;
+        d = req->dst_uv + y*dstW*2;
+        for (x = 0, fx = 0; x < dstW; x++, fx += inv_x) {
+            xc = fx & 0xffff;
+            sX = fx >> 16;
+            sX = ((sX >= srcW - 1) ? (srcW - 2) : sX)*2;
+            r0 = rk_camera_scale_lerp(s0[sX], s0[sX + 2], xc);
+            r1 = rk_camera_scale_lerp(s1[sX], s1[sX + 2], xc);
+            d[x*2] = rk_camera_scale_lerp(r0, r1, yc);
+            r0 = rk_camera_scale_lerp(s0[sX + 1], s0[sX + 3], xc);
+            r1 = rk_camera_scale_lerp(s1[sX + 1], s1[sX + 3], xc);
+            d[x*2 + 1] = rk_camera_scale_lerp(r0, r1, yc);
+        }
+    }
+}
+
+static void rk_camera_scale_stripe_work(struct work_struct *work)
+{
+    struct rk_camera_scale_stripe *stripe = container_of(work, struct rk_camera_scale_stripe, work);
+
+    rk_camera_scale_rows(stripe->req, stripe->y_start, stripe->y_end);
+}
+
+/* @nr_stripes: 0 for one stripe per online cpu */
+static void rk_camera_scale_yuv420sp(const struct rk_camera_scale_req *req, int nr_stripes)
+{
+    struct rk_camera_scale_stripe stripe[RK_CAM_SCALE_STRIPES_MAX];
+    int i,rows;
+
+    if (nr_stripes <= 0)
+        nr_stripes = num_online_cpus();
+    nr_stripes = MIN(nr_stripes, RK_CAM_SCALE_STRIPES_MAX);
+    rows = ALIGN(DIV_ROUND_UP(req->dst_h, nr_stripes), 2);
+
+    for (i = 0; i < nr_stripes; i++) {
+        stripe[i].req = req;
+        stripe[i].y_start = MIN(i*rows, req->dst_h);
+        stripe[i].y_end = MIN((i + 1)*rows, req->dst_h);
+        INIT_WORK_ONSTACK(&stripe[i].work, rk_camera_scale_stripe_work);
+        if (i && (stripe[i].y_start < stripe[i].y_end))
+            queue_work(system_unbound_wq, &stripe[i].work);
+    }
+
+    rk_camera_scale_rows(req, stripe[0].y_start, stripe[0].y_end);
+
+    for (i = 1; i < nr_stripes; i++) {
+        flush_work(&stripe[i].work);
+        destroy_work_on_stack(&stripe[i].work);
+    }
+    destroy_work_on_stack(&stripe[0].work);
+}
+
 static int rk_camera_scale_crop_arm(struct work_struct *work)
 {
     struct rk_camera_work *camera_work = container_of(work, struct rk_camera_work, work);	
-    struct videobuf_buffer *vb = camera_work->vb;	
+    struct vb2_buffer *vb = camera_work->vb;	
     struct rk_camera_dev *pcdev = camera_work->pcdev;	
     struct rk29_camera_vbinfo *vb_info;        
-    unsigned char *psY,*pdY,*psUV,*pdUV; 
+    struct rk_camera_scale_req req;
     unsigned char *src,*dst;
     unsigned long src_phy,dst_phy;
-    int srcW,srcH,cropW,cropH,dstW,dstH;
-    long zoomindstxIntInv,zoomindstyIntInv;
-    long x,y;
-    long yCoeff00,yCoeff01,xCoeff00,xCoeff01;
-    long sX,sY;
-    long r0,r1,a,b,c,d;
-    int ret = 0;
+    int srcW,srcH,cropW;
 
-    src_phy = pcdev->vipmem_phybase + vb->i*pcdev->vipmem_bsize;    
-    src = psY = (unsigned char*)(pcdev->vipmem_virbase + vb->i*pcdev->vipmem_bsize);
-    psUV = psY + pcdev->zoominfo.vir_width*pcdev->zoominfo.vir_height;
-	
+    src_phy = pcdev->vipmem_phybase + vb->v4l2_buf.index*pcdev->vipmem_bsize;    
+    src = (unsigned char*)(pcdev->vipmem_virbase + vb->v4l2_buf.index*pcdev->vipmem_bsize);
     srcW = pcdev->zoominfo.vir_width;
     srcH = pcdev->zoominfo.vir_height;
     cropW = pcdev->zoominfo.a.c.width;
-    cropH = pcdev->zoominfo.a.c.height;
-	
-    psY = psY + (srcW-cropW);
-    psUV = psUV + (srcW-cropW); 
-    
-    vb_info = pcdev->vbinfo+vb->i; 
-    dst_phy = vb_info->phy_addr;
-    dst = pdY = (unsigned char*)vb_info->vir_addr; 
-    pdUV = pdY + pcdev->icd->user_width*pcdev->icd->user_height;
-    dstW = pcdev->icd->user_width;
-    dstH = pcdev->icd->user_height;
-
-    zoomindstxIntInv = ((unsigned long)cropW<<16)/dstW + 1;
-    zoomindstyIntInv = ((unsigned long)cropH<<16)/dstH + 1;
-
-    //y
-    //for(y = 0; y<dstH - 1 ; y++ ) {   
-    for(y = 0; y<dstH; y++ ) {   
-        yCoeff00 = (y*zoomindstyIntInv)&0xffff;
-        yCoeff01 = 0xffff - yCoeff00; 
-        sY = (y*zoomindstyIntInv >> 16);
-        sY = (sY >= srcH - 1)? (srcH - 2) : sY;      
-        for(x = 0; x<dstW; x++ ) {
-            xCoeff00 = (x*zoomindstxIntInv)&0xffff;
-            xCoeff01 = 0xffff - xCoeff00; 	
-            sX = (x*zoomindstxIntInv >> 16);
-            sX = (sX >= srcW -1)?(srcW- 2) : sX;
-            a = psY[sY*srcW + sX];
-            b = psY[sY*srcW + sX + 1];
-            c = psY[(sY+1)*srcW + sX];
-            d = psY[(sY+1)*srcW + sX + 1];
-
-            r0 = (a * xCoeff01 + b * xCoeff00)>>16 ;
-            r1 = (c * xCoeff01 + d * xCoeff00)>>16 ;
-            r0 = (r0 * yCoeff01 + r1 * yCoeff00)>>16;
-
-            pdY[x] = r0;
-        }
-        pdY += dstW;
-    }
 
-    dstW /= 2;
-    dstH /= 2;
-    srcW /= 2;
-    srcH /= 2;
-
-    //UV
-    //for(y = 0; y<dstH - 1 ; y++ ) {
-    for(y = 0; y<dstH; y++ ) {
-        yCoeff00 = (y*zoomindstyIntInv)&0xffff;
-        yCoeff01 = 0xffff - yCoeff00; 
-        sY = (y*zoomindstyIntInv >> 16);
-        sY = (sY >= srcH -1)? (srcH - 2) : sY;      
-        for(x = 0; x<dstW; x++ ) {
-            xCoeff00 = (x*zoomindstxIntInv)&0xffff;
-            xCoeff01 = 0xffff - xCoeff00; 	
-            sX = (x*zoomindstxIntInv >> 16);
-            sX = (sX >= srcW -1)?(srcW- 2) : sX;
-            //U
-            a = psUV[(sY*srcW + sX)*2];
-            b = psUV[(sY*srcW + sX + 1)*2];
-            c = psUV[((sY+1)*srcW + sX)*2];
-            d = psUV[((sY+1)*srcW + sX + 1)*2];
-
-            r0 = (a * xCoeff01 + b * xCoeff00)>>16 ;
-            r1 = (c * xCoeff01 + d * xCoeff00)>>16 ;
-            r0 = (r0 * yCoeff01 + r1 * yCoeff00)>>16;
-
-            pdUV[x*2] = r0;
-
-            //V
-            a = psUV[(sY*srcW + sX)*2 + 1];
-            b = psUV[(sY*srcW + sX + 1)*2 + 1];
-            c = psUV[((sY+1)*srcW + sX)*2 + 1];
-            d = psUV[((sY+1)*srcW + sX + 1)*2 + 1];
-
-            r0 = (a * xCoeff01 + b * xCoeff00)>>16 ;
-            r1 = (c * xCoeff01 + d * xCoeff00)>>16 ;
-            r0 = (r0 * yCoeff01 + r1 * yCoeff00)>>16;
-
-            pdUV[x*2 + 1] = r0;
-        }
-        pdUV += dstW*2;
-    }
-rk_camera_scale_crop_arm_end:
+    vb_info = pcdev->vbinfo+vb->v4l2_buf.index; 
+    dst_phy = vb_info->phy_addr;
+    dst = (unsigned char*)vb_info->vir_addr; 
+    if (dst == NULL)
+        return -ENOMEM;
+
+    req.src_y = src + (srcW-cropW);
+    req.src_uv = src + srcW*srcH + (srcW-cropW);
+    req.src_w = srcW;
+    req.src_h = srcH;
+    req.crop_w = cropW;
+    req.crop_h = pcdev->zoominfo.a.c.height;
+    req.dst_y = dst;
+    req.dst_uv = dst + pcdev->icd->user_width*pcdev->icd->user_height;
+    req.dst_w = pcdev->icd->user_width;
+    req.dst_h = pcdev->icd->user_height;
+
+    rk_camera_scale_yuv420sp(&req, 0);
 
     dmac_flush_range((void*)src,(void*)(src+pcdev->vipmem_bsize));
     outer_flush_range((phys_addr_t)src_phy,(phys_addr_t)(src_phy+pcdev->vipmem_bsize));
@@ -1132,15 +1325,102 @@ rk_camera_scale_crop_arm_end:
     dmac_flush_range((void*)dst,(void*)(dst+vb_info->size));
     outer_flush_range((phys_addr_t)dst_phy,(phys_addr_t)(dst_phy+vb_info->size));
 
-	return ret;    
+	return 0;    
 }
+
+/*
+ * debugfs rk_camera/scale_bench: time the scaler at a 4/3 digital zoom
+ * for the usual preview sizes, on one stripe and on all online cpus.
+ */
+#define RK_CAM_SCALE_BENCH_ROUNDS   10
+
+static const struct {
+    const char *name;
+    int w, h;
+} rk_camera_scale_bench_size[] = {
+    { "vga", 640, 480 },
+    { "svga", 800, 600 },
+    { "720p", 1280, 720 },
+    { "1080p", 1920, 1080 },
+};
+
+static s64 rk_camera_scale_bench_run(const struct rk_camera_scale_req *req, int nr_stripes)
+{
+    ktime_t start;
+    int i;
+
+    start = ktime_get();
+    for (i = 0; i < RK_CAM_SCALE_BENCH_ROUNDS; i++)
+        rk_camera_scale_yuv420sp(req, nr_stripes);
+    return div_s64(ktime_us_delta(ktime_get(), start), RK_CAM_SCALE_BENCH_ROUNDS);
+}
+
+static int rk_camera_scale_bench_show(struct seq_file *s, void *unused)
+{
+    struct rk_camera_scale_req req;
+    unsigned char *src,*dst;
+    size_t size;
+    s64 one_us,all_us;
+    int i,w,h;
+
+    w = rk_camera_scale_bench_size[ARRAY_SIZE(rk_camera_scale_bench_size) - 1].w;
+    h = rk_camera_scale_bench_size[ARRAY_SIZE(rk_camera_scale_bench_size) - 1].h;
+    size = w*h*3/2;
+    src = vmalloc(size);
+    dst = vmalloc(size);
+    if (!src || !dst)
+        goto out;
+    for (i = 0; i < size; i++)
+        src[i] = i*7;
+
+    seq_printf(s, "%d online cpus, %d rounds\n", num_online_cpus(), RK_CAM_SCALE_BENCH_ROUNDS);
+    seq_printf(s, "%-6s %10s %8s %8s %8s %8s\n", "size", "crop", "1cpu us", "fps", "ncpu us", "fps");
+    for (i = 0; i < ARRAY_SIZE(rk_camera_scale_bench_size); i++) {
+        w = rk_camera_scale_bench_size[i].w;
+        h = rk_camera_scale_bench_size[i].h;
+
+        req.src_w = w;
+        req.src_h = h;
+        req.crop_w = (w*3/4) & ~CROP_ALIGN_BYTES;
+        req.crop_h = (h*3/4) & ~0x01;
+        req.src_y = src + (w - req.crop_w);
+        req.src_uv = src + w*h + (w - req.crop_w);
+        req.dst_y = dst;
+        req.dst_uv = dst + w*h;
+        req.dst_w = w;
+        req.dst_h = h;
+
+        one_us = rk_camera_scale_bench_run(&req, 1);
+        all_us = rk_camera_scale_bench_run(&req, 0);
+        seq_printf(s, "%-6s %4dx%-5d %8lld %8lld %8lld %8lld\n", rk_camera_scale_bench_size[i].name,
+                   req.crop_w, req.crop_h, one_us, one_us ? div64_s64(1000000, one_us) : 0,
+                   all_us, all_us ? div64_s64(1000000, all_us) : 0);
+    }
+out:
+    vfree(dst);
+    vfree(src);
+    return 0;
+}
+
+static int rk_camera_scale_bench_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, rk_camera_scale_bench_show, NULL);
+}
+
+static const struct file_operations rk_camera_scale_bench_fops = {
+    .open    = rk_camera_scale_bench_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = single_release,
+};
 #endif
 static void rk_camera_capture_process(struct work_struct *work)
 {
     struct rk_camera_work *camera_work = container_of(work, struct rk_camera_work, work);    
-    struct videobuf_buffer *vb = camera_work->vb;    
+    struct vb2_buffer *vb = camera_work->vb;    
+    struct rk_camera_buffer *buf = to_rk_vb(vb);
     struct rk_camera_dev *pcdev = camera_work->pcdev;    
-    //enum v4l2_mbus_pixelcode icd_code = pcdev->icd->current_fmt->code;    
+    struct videobuf_buffer sensor_vb;
     unsigned long flags = 0;    
     int err = 0;    
 
@@ -1152,31 +1432,109 @@ static void rk_camera_capture_process(struct work_struct *work)
         err = (pcdev->icd_cb.scale_crop_cb)(work);
     	}
     up(&pcdev->zoominfo.sem); 
+
+    buf->ts_ready = ktime_get();
+    trace_rk_camera_scale_done(pcdev->hostid, vb->v4l2_buf.index, vb->v4l2_buf.sequence, ktime_to_us(buf->ts_ready),
+                               rk_camera_stage(pcdev, RK_CAM_STAGE_SCALE, buf->ts_done, buf->ts_ready));
+    if (err)
+        rk_camera_drop(pcdev, RK_CAM_DROP_SCALE_ERR, vb);
     
-    if (pcdev->icd_cb.sensor_cb)        
-        (pcdev->icd_cb.sensor_cb)(vb);    
+    if (pcdev->icd_cb.sensor_cb) {
+        /* sensor drivers still take a videobuf descriptor of the frame */
+        memset(&sensor_vb, 0x00, sizeof(struct videobuf_buffer));
+        sensor_vb.i = vb->v4l2_buf.index;
+        sensor_vb.width = pcdev->icd->user_width;
+        sensor_vb.height = pcdev->icd->user_height;
+        sensor_vb.boff = vb2_dma_contig_plane_paddr(vb, 0);
+        sensor_vb.bsize = vb2_plane_size(vb, 0);
+        (pcdev->icd_cb.sensor_cb)(&sensor_vb);    
+    }
 
 rk_camera_capture_process_end:    
-    if (err) {        
-        vb->state = VIDEOBUF_ERROR;    
-    } else {
-        if ((vb->state == VIDEOBUF_QUEUED) || (vb->state == VIDEOBUF_ACTIVE)) {
-	        vb->state = VIDEOBUF_DONE;
-	        vb->field_count++;
-		}
-    }    
-    wake_up(&(camera_work->vb->done));     
+    vb2_buffer_done(vb, err ? VB2_BUF_STATE_ERROR : VB2_BUF_STATE_DONE);
     spin_lock_irqsave(&pcdev->camera_work_lock, flags);    
     list_add_tail(&camera_work->queue, &pcdev->camera_work_queue);    
     spin_unlock_irqrestore(&pcdev->camera_work_lock, flags);    
     return;
 }
+/* Frame 1 of the CIF is complete: retire the active buffer and arm the next one */
+static void rk_camera_frame_done(struct rk_camera_dev *pcdev)
+{
+    struct vb2_buffer *vb;
+	struct rk_camera_work *wk = NULL;
+    struct rk_camera_buffer *buf;
+	struct timeval tv;
+    unsigned long flags;
+
+    spin_lock_irqsave(&pcdev->lock, flags);
+    if (!pcdev->fps) {
+        do_gettimeofday(&pcdev->first_tv);            
+    }
+	pcdev->fps++;
+	if (!pcdev->active) {
+        rk_camera_drop(pcdev, RK_CAM_DROP_NO_BUFFER, NULL);
+		goto unlock;
+    }
+    if (pcdev->frame_inval>0) {
+        pcdev->frame_inval--;
+        rk_camera_drop(pcdev, RK_CAM_DROP_FRAME_INVAL, pcdev->active);
+        rk_videobuf_capture(pcdev->active,pcdev);
+        goto unlock;
+    } else if (pcdev->frame_inval) {
+    	RKCAMERA_TR("frame_inval : %0x",pcdev->frame_inval);
+        pcdev->frame_inval = 0;
+    }
+    if(pcdev->fps == RK30_CAM_FRAME_MEASURE) {
+        do_gettimeofday(&tv);            
+        pcdev->frame_interval = ((tv.tv_sec*1000000 + tv.tv_usec) - (pcdev->first_tv.tv_sec*1000000 + pcdev->first_tv.tv_usec))
+                                /(RK30_CAM_FRAME_MEASURE-1);
+    }
+    vb = pcdev->active;
+    buf = to_rk_vb(vb);
+    buf->ts_done = ktime_get();
+    list_del_init(&buf->queue);
+    pcdev->active = NULL;
+    if (!list_empty(&pcdev->capture)) {
+        pcdev->active = &list_entry(pcdev->capture.next, struct rk_camera_buffer, queue)->vb;
+		rk_videobuf_capture(pcdev->active,pcdev);
+    }
+    if (pcdev->active == NULL) {
+		RKCAMERA_DG("%s video_buf queue is empty!\n",__FUNCTION__);
+	}
+    spin_unlock_irqrestore(&pcdev->lock, flags);
+
+    do_gettimeofday(&vb->v4l2_buf.timestamp);
+    vb->v4l2_buf.sequence = pcdev->sequence++;
+    trace_rk_camera_dma_done(pcdev->hostid, vb->v4l2_buf.index, vb->v4l2_buf.sequence, ktime_to_us(buf->ts_done),
+                             rk_camera_stage(pcdev, RK_CAM_STAGE_CAPTURE, buf->ts_start, buf->ts_done));
+	if (CAM_WORKQUEUE_IS_EN()) {
+        spin_lock_irqsave(&pcdev->camera_work_lock, flags);
+        if (!list_empty(&pcdev->camera_work_queue)) {
+            wk = list_entry(pcdev->camera_work_queue.next, struct rk_camera_work, queue);
+            list_del_init(&wk->queue);
+        }
+        spin_unlock_irqrestore(&pcdev->camera_work_lock, flags);
+        if (wk) {
+            INIT_WORK(&(wk->work), rk_camera_capture_process);
+	        wk->vb = vb;
+	        wk->pcdev = pcdev;
+	        queue_work(pcdev->camera_wq, &(wk->work));
+        } else {
+            /* all vipmem slots are still being scaled, give the buffer back */
+            rk_camera_drop(pcdev, RK_CAM_DROP_NO_WORK, vb);
+            vb2_buffer_done(vb, VB2_BUF_STATE_ERROR);
+        }
+	} else {
+        buf->ts_ready = buf->ts_done;
+        vb2_buffer_done(vb, VB2_BUF_STATE_DONE);
+	}
+    return;
+unlock:
+    spin_unlock_irqrestore(&pcdev->lock, flags);
+}
 static irqreturn_t rk_camera_irq(int irq, void *data)
 {
     struct rk_camera_dev *pcdev = data;
-    struct videobuf_buffer *vb;
-	struct rk_camera_work *wk;
-	struct timeval tv;
     unsigned long tmp_intstat;
     unsigned long tmp_cifctrl; 
  
@@ -1198,114 +1556,77 @@ static irqreturn_t rk_camera_irq(int irq, void *data)
     /* ddl@rock-chps.com : Current VIP is run in One Frame Mode, Frame 1 is validate */
     if (read_cif_reg(pcdev->base,CIF_CIF_FRAME_STATUS) & 0x01) {
     	write_cif_reg(pcdev->base,CIF_CIF_INTSTAT,0x01);  /* clear vip interrupte single  */
-        if (!pcdev->fps) {
-            do_gettimeofday(&pcdev->first_tv);            
-        }
-		pcdev->fps++;
-		if (!pcdev->active)
-			goto RK_CAMERA_IRQ_END;
-        if (pcdev->frame_inval>0) {
-            pcdev->frame_inval--;
-            rk_videobuf_capture(pcdev->active,pcdev);
-            goto RK_CAMERA_IRQ_END;
-        } else if (pcdev->frame_inval) {
-        	RKCAMERA_TR("frame_inval : %0x",pcdev->frame_inval);
-            pcdev->frame_inval = 0;
-        }
-        if(pcdev->fps == RK30_CAM_FRAME_MEASURE) {
-            do_gettimeofday(&tv);            
-            pcdev->frame_interval = ((tv.tv_sec*1000000 + tv.tv_usec) - (pcdev->first_tv.tv_sec*1000000 + pcdev->first_tv.tv_usec))
-                                    /(RK30_CAM_FRAME_MEASURE-1);
-        }
-        vb = pcdev->active;
-        if(!vb){
-            printk("no acticve buffer!!!\n");
-            goto RK_CAMERA_IRQ_END;
-            }
-		/* ddl@rock-chips.com : this vb may be deleted from queue */
-		if ((vb->state == VIDEOBUF_QUEUED) || (vb->state == VIDEOBUF_ACTIVE)) {
-        	list_del_init(&vb->queue);
-		}
-        pcdev->active = NULL;
-        if (!list_empty(&pcdev->capture)) {
-            pcdev->active = list_entry(pcdev->capture.next, struct videobuf_buffer, queue);
-			if (pcdev->active) {
-                WARN_ON(pcdev->active->state != VIDEOBUF_QUEUED);                     
-				rk_videobuf_capture(pcdev->active,pcdev);
-			}
-        }
-        if (pcdev->active == NULL) {
-			RKCAMERA_DG("%s video_buf queue is empty!\n",__FUNCTION__);
-		}
-
-        do_gettimeofday(&vb->ts);
-		if (CAM_WORKQUEUE_IS_EN()) {
-            if (!list_empty(&pcdev->camera_work_queue)) {
-                wk = list_entry(pcdev->camera_work_queue.next, struct rk_camera_work, queue);
-                list_del_init(&wk->queue);
-                INIT_WORK(&(wk->work), rk_camera_capture_process);
-		        wk->vb = vb;
-		        wk->pcdev = pcdev;
-		        queue_work(pcdev->camera_wq, &(wk->work));
-            }             			
-		} else {
-		    if ((vb->state == VIDEOBUF_QUEUED) || (vb->state == VIDEOBUF_ACTIVE)) {
-    	        vb->state = VIDEOBUF_DONE;    	        
-    	        vb->field_count++;
-    		}
-			wake_up(&vb->done);
-		}
-		
+        rk_camera_frame_done(pcdev);
     }
 
-RK_CAMERA_IRQ_END:
     if((tmp_cifctrl & ENABLE_CAPTURE) == 0)
         write_cif_reg(pcdev->base,CIF_CIF_CTRL, (tmp_cifctrl | ENABLE_CAPTURE));
     return IRQ_HANDLED;
 }
+/*
+ * Synthetic frames for test_fps: fill the capture target the way the CIF
+ * would, a luma ramp moving down by four lines a frame on grey chroma.
+ */
+static void rk_camera_test_work(struct work_struct *work)
+{
+    struct rk_camera_dev *pcdev = container_of(to_delayed_work(work), struct rk_camera_dev, test_work);
+    struct vb2_buffer *vb;
+    unsigned char *y_addr = NULL;
+    unsigned int width = 0, height = 0, row;
+    unsigned long flags;
+
+    if (pcdev->stop_cif == true)
+        return;
+
+    spin_lock_irqsave(&pcdev->lock, flags);
+    vb = pcdev->active;
+    if (vb && pcdev->icd) {
+        if (CAM_WORKQUEUE_IS_EN()) {
+            y_addr = (unsigned char*)pcdev->vipmem_virbase + vb->v4l2_buf.index*pcdev->vipmem_bsize;
+            width = pcdev->zoominfo.vir_width;
+            height = pcdev->zoominfo.vir_height;
+        } else {
+            y_addr = vb2_plane_vaddr(vb, 0);
+            width = pcdev->icd->user_width;
+            height = pcdev->icd->user_height;
+        }
+    }
+    spin_unlock_irqrestore(&pcdev->lock, flags);
 
+    if (y_addr) {
+        for (row = 0; row < height; row++)
+            memset(y_addr + row*width, (row + pcdev->sequence*4) & 0xff, width);
+        memset(y_addr + width*height, 0x80, width*height/2);
+    }
+    rk_camera_frame_done(pcdev);
+
+    schedule_delayed_work(&pcdev->test_work, pcdev->test_interval);
+}
 
-static void rk_videobuf_release(struct videobuf_queue *vq,
-                                  struct videobuf_buffer *vb)
+static void rk_videobuf_release(struct vb2_buffer *vb)
 {
-    struct rk_camera_buffer *buf = container_of(vb, struct rk_camera_buffer, vb);
-    struct soc_camera_device *icd = vq->priv_data;
+    struct soc_camera_device *icd = soc_camera_from_vb2q(vb->vb2_queue);
     struct soc_camera_host *ici = to_soc_camera_host(icd->dev.parent);
     struct rk_camera_dev *pcdev = ici->priv;
+    struct rk_camera_buffer *buf = to_rk_vb(vb);
+    unsigned long flags;
 #if CAMERA_VIDEOBUF_ARM_ACCESS    
     struct rk29_camera_vbinfo *vb_info =NULL;
 #endif
 
-#ifdef DEBUG
-    dev_dbg(&icd->dev, "%s (vb=0x%p) 0x%08lx %d\n", __func__,
-            vb, vb->baddr, vb->bsize);
+    dev_dbg(&icd->dev, "%s (vb=0x%p) 0x%08lx %lu\n", __func__,
+            vb, (unsigned long)vb2_dma_contig_plane_paddr(vb, 0), vb2_plane_size(vb, 0));
 
-    switch (vb->state)
-    {
-        case VIDEOBUF_ACTIVE:
-            dev_dbg(&icd->dev, "%s (active)\n", __func__);
-            break;
-        case VIDEOBUF_QUEUED:
-            dev_dbg(&icd->dev, "%s (queued)\n", __func__);
-            break;
-        case VIDEOBUF_PREPARED:
-            dev_dbg(&icd->dev, "%s (prepared)\n", __func__);
-            break;
-        default:  
-            dev_dbg(&icd->dev, "%s (unknown)\n", __func__);
-            break;
-    }
-#endif
-	if (vb == pcdev->active) {
-		RKCAMERA_DG("%s Wait for this video buf(0x%x) write finished!\n ",__FUNCTION__,(unsigned int)vb);
-		interruptible_sleep_on_timeout(&vb->done, msecs_to_jiffies(500));
-		RKCAMERA_DG("%s This video buf(0x%x) write finished, release now!!\n",__FUNCTION__,(unsigned int)vb);
-	}
+    spin_lock_irqsave(&pcdev->lock, flags);
+	if (vb == pcdev->active)
+		pcdev->active = NULL;
+    list_del_init(&buf->queue);
+    spin_unlock_irqrestore(&pcdev->lock, flags);
 
     flush_workqueue(pcdev->camera_wq); 
 #if CAMERA_VIDEOBUF_ARM_ACCESS
-    if ((pcdev->vbinfo) && (vb->i < pcdev->vbinfo_count)) {
-        vb_info = pcdev->vbinfo + vb->i;
+    if ((pcdev->vbinfo) && (vb->v4l2_buf.index < pcdev->vbinfo_count)) {
+        vb_info = pcdev->vbinfo + vb->v4l2_buf.index;
         
         if (vb_info->vir_addr) {
             iounmap(vb_info->vir_addr);
@@ -1315,32 +1636,66 @@ static void rk_videobuf_release(struct videobuf_queue *vq,
 		
 	}
 #endif    
-    rk_videobuf_free(vq, buf);
 }
+static int rk_videobuf_finish(struct vb2_buffer *vb)
+{
+    struct soc_camera_device *icd = soc_camera_from_vb2q(vb->vb2_queue);
+    struct soc_camera_host *ici = to_soc_camera_host(icd->dev.parent);
+    struct rk_camera_dev *pcdev = ici->priv;
+    struct rk_camera_buffer *buf = to_rk_vb(vb);
+    ktime_t now;
+
+    if (vb->state != VB2_BUF_STATE_DONE)
+        return 0;
 
-static struct videobuf_queue_ops rk_videobuf_ops =
+    now = ktime_get();
+    rk_camera_stage(pcdev, RK_CAM_STAGE_TOTAL, buf->ts_start, now);
+    trace_rk_camera_dequeue(pcdev->hostid, vb->v4l2_buf.index, vb->v4l2_buf.sequence, ktime_to_us(now),
+                            rk_camera_stage(pcdev, RK_CAM_STAGE_QUEUE, buf->ts_ready, now));
+    return 0;
+}
+static int rk_videobuf_stop_streaming(struct vb2_queue *vq)
 {
-    .buf_setup      = rk_videobuf_setup,
+    struct soc_camera_device *icd = soc_camera_from_vb2q(vq);
+    struct soc_camera_host *ici = to_soc_camera_host(icd->dev.parent);
+    struct rk_camera_dev *pcdev = ici->priv;
+
+    /* vb2 drops its lists after this, nothing may be left in ours;
+       on close the device has already been stopped and removed */
+    if (pcdev->icd != icd)
+        return 0;
+    return rk_camera_s_stream(icd, 0);
+}
+
+static struct vb2_ops rk_videobuf_ops =
+{
+    .queue_setup    = rk_videobuf_setup,
+    .buf_init       = rk_videobuf_init,
     .buf_prepare    = rk_videobuf_prepare,
     .buf_queue      = rk_videobuf_queue,
-    .buf_release    = rk_videobuf_release,
+    .buf_finish     = rk_videobuf_finish,
+    .buf_cleanup    = rk_videobuf_release,
+    .stop_streaming = rk_videobuf_stop_streaming,
+    .wait_prepare   = soc_camera_unlock,
+    .wait_finish    = soc_camera_lock,
 };
 
-static void rk_camera_init_videobuf(struct videobuf_queue *q,
+/*
+ * MMAP buffers come from the dma-contig allocator, USERPTR buffers must be
+ * physically contiguous (e.g. mmapped ion carveout buffers): the CIF, IPP
+ * and RGA then write the frame straight into the buffer userspace holds.
+ */
+static int rk_camera_init_videobuf(struct vb2_queue *q,
                                       struct soc_camera_device *icd)
 {
-    struct soc_camera_host *ici = to_soc_camera_host(icd->dev.parent);
-    struct rk_camera_dev *pcdev = ici->priv;
-
-    /* We must pass NULL as dev pointer, then all pci_* dma operations
-     * transform to normal dma_* ones. */
-    videobuf_queue_dma_contig_init(q,
-                                   &rk_videobuf_ops,
-                                   ici->v4l2_dev.dev, &pcdev->lock,
-                                   V4L2_BUF_TYPE_VIDEO_CAPTURE,
-                                   V4L2_FIELD_NONE,
-                                   sizeof(struct rk_camera_buffer),
-                                   icd,&icd->video_lock);
+    q->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    q->io_modes = VB2_MMAP | VB2_USERPTR;
+    q->drv_priv = icd;
+    q->ops = &rk_videobuf_ops;
+    q->mem_ops = &vb2_dma_contig_memops;
+    q->buf_struct_size = sizeof(struct rk_camera_buffer);
+
+    return vb2_queue_init(q);
 }
 static int rk_camera_activate(struct rk_camera_dev *pcdev, struct soc_camera_device *icd)
 {
@@ -1503,6 +1858,7 @@ static void rk_camera_remove_device(struct soc_camera_device *icd)
     struct soc_camera_host *ici = to_soc_camera_host(icd->dev.parent);
     struct rk_camera_dev *pcdev = ici->priv;
 	struct v4l2_subdev *sd = soc_camera_to_subdev(icd);
+    unsigned long flags;
 #if CAMERA_VIDEOBUF_ARM_ACCESS    
     struct rk29_camera_vbinfo *vb_info;
     unsigned int i;
@@ -1536,6 +1892,7 @@ static void rk_camera_remove_device(struct soc_camera_device *icd)
          pcdev->fps_timer.istarted = false;
     }
     flush_work(&(pcdev->camera_reinit_work.work));
+    cancel_delayed_work_sync(&pcdev->test_work);
 	flush_workqueue((pcdev->camera_wq));
     
 	if (pcdev->camera_work) {
@@ -1561,14 +1918,15 @@ static void rk_camera_remove_device(struct soc_camera_device *icd)
 		pcdev->vbinfo_count = 0;
 	}
 #endif
-	pcdev->active = NULL;
     pcdev->icd = NULL;
     pcdev->icd_cb.sensor_cb = NULL;
 	pcdev->reginfo_suspend.Inval = Reg_Invalidate;
 	/* ddl@rock-chips.com: capture list must be reset, because this list may be not empty,
      * if app havn't dequeue all videobuf before close camera device;
 	*/
-    INIT_LIST_HEAD(&pcdev->capture);
+	spin_lock_irqsave(&pcdev->lock, flags);
+    rk_camera_clear_capture(pcdev);
+	spin_unlock_irqrestore(&pcdev->lock, flags);
 
 	mutex_unlock(&camera_lock);
 	RKCAMERA_DG("%s exit\n",__FUNCTION__);
@@ -2290,40 +2648,11 @@ RK_CAMERA_TRY_FMT_END:
     return ret;
 }
 
-static int rk_camera_reqbufs(struct soc_camera_device *icd,
-                               struct v4l2_requestbuffers *p)
-{
-    int i;
-
-    /* This is for locking debugging only. I removed spinlocks and now I
-     * check whether .prepare is ever called on a linked buffer, or whether
-     * a dma IRQ can occur for an in-work or unlinked buffer. Until now
-     * it hadn't triggered */
-    for (i = 0; i < p->count; i++) {
-        struct rk_camera_buffer *buf = container_of(icd->vb_vidq.bufs[i],
-                                                           struct rk_camera_buffer, vb);
-        buf->inwork = 0;
-        INIT_LIST_HEAD(&buf->vb.queue);
-    }
-
-    return 0;
-}
-
 static unsigned int rk_camera_poll(struct file *file, poll_table *pt)
 {
     struct soc_camera_device *icd = file->private_data;
-    struct rk_camera_buffer *buf;
-
-    buf = list_entry(icd->vb_vidq.stream.next, struct rk_camera_buffer,
-                    vb.stream);
-
-    poll_wait(file, &buf->vb.done, pt);
 
-    if (buf->vb.state == VIDEOBUF_DONE ||
-            buf->vb.state == VIDEOBUF_ERROR)
-        return POLLIN|POLLRDNORM;
-
-    return 0;
+    return vb2_poll(&icd->vb2_vidq, file, pt);
 }
 
 static int rk_camera_querycap(struct soc_camera_host *ici,
@@ -2456,7 +2785,7 @@ static void rk_camera_reinit_work(struct work_struct *work)
 	struct rk_camera_work *camera_work = container_of(work, struct rk_camera_work, work);
 	struct rk_camera_dev *pcdev = camera_work->pcdev;
     struct soc_camera_link *tmp_soc_cam_link;
-    int index = 0;
+    struct rk_camera_buffer *buf, *tmp;
 	unsigned long flags = 0;
     if(pcdev->icd == NULL)
         return;
@@ -2485,24 +2814,15 @@ static void rk_camera_reinit_work(struct work_struct *work)
     pcdev->stop_cif = true;
 	write_cif_reg(pcdev->base,CIF_CIF_CTRL, (read_cif_reg(pcdev->base,CIF_CIF_CTRL)&(~ENABLE_CAPTURE)));
 	RKCAMERA_DG("the reinit times = %d\n",pcdev->reinit_times);
-   if(pcdev->video_vq && pcdev->video_vq->irqlock){
-   	spin_lock_irqsave(pcdev->video_vq->irqlock, flags);
-    	for (index = 0; index < VIDEO_MAX_FRAME; index++) {
-    		if (NULL == pcdev->video_vq->bufs[index])
-    			continue;
-            
-    		if (pcdev->video_vq->bufs[index]->state == VIDEOBUF_QUEUED) 
-            {
-    			list_del_init(&pcdev->video_vq->bufs[index]->queue);
-    			pcdev->video_vq->bufs[index]->state = VIDEOBUF_NEEDS_INIT;
-    			wake_up_all(&pcdev->video_vq->bufs[index]->done);
-                printk("wake up video buffer index = %d  !!!\n",index);
-    		}
-    	}
-    	spin_unlock_irqrestore(pcdev->video_vq->irqlock, flags); 
-    }else{
-    RKCAMERA_TR("video queue has somthing wrong !!\n");
-    }
+	spin_lock_irqsave(&pcdev->lock, flags);
+	list_for_each_entry_safe(buf, tmp, &pcdev->capture, queue) {
+		list_del_init(&buf->queue);
+		rk_camera_drop(pcdev, RK_CAM_DROP_REINIT, &buf->vb);
+		vb2_buffer_done(&buf->vb, VB2_BUF_STATE_ERROR);
+		printk("wake up video buffer index = %d  !!!\n",buf->vb.v4l2_buf.index);
+	}
+	pcdev->active = NULL;
+	spin_unlock_irqrestore(&pcdev->lock, flags);
 
 	RKCAMERA_TR("the %d reinit times ,wake up video buffers!\n ",pcdev->reinit_times);
 }
@@ -2597,6 +2917,7 @@ static int rk_camera_s_stream(struct soc_camera_device *icd, int enable)
     struct rk_camera_dev *pcdev = ici->priv;
     int cif_ctrl_val;
 	int ret;
+	int fps;
 	unsigned long flags;
 
 	WARN_ON(pcdev->icd != icd);
@@ -2611,9 +2932,17 @@ static int rk_camera_s_stream(struct soc_camera_device *icd, int enable)
         pcdev->timer_get_fps = false;
         pcdev->reinit_times  = 0;
         pcdev->stop_cif = false;
+        pcdev->sequence = 0;
 //		hrtimer_start(&(pcdev->fps_timer.timer),ktime_set(3, 0),HRTIMER_MODE_REL);
-		cif_ctrl_val |= ENABLE_CAPTURE;
-        	write_cif_reg(pcdev->base,CIF_CIF_CTRL, cif_ctrl_val);
+		/* test_fps is writable at any time, read it once per stream */
+		fps = ACCESS_ONCE(test_fps);
+		if (fps > 0) {
+			pcdev->test_interval = max_t(unsigned long, msecs_to_jiffies(1000/fps), 1);
+			schedule_delayed_work(&pcdev->test_work, 0);
+		} else {
+			cif_ctrl_val |= ENABLE_CAPTURE;
+        		write_cif_reg(pcdev->base,CIF_CIF_CTRL, cif_ctrl_val);
+		}
 		hrtimer_start(&(pcdev->fps_timer.timer),ktime_set(3, 0),HRTIMER_MODE_REL);
         pcdev->fps_timer.istarted = true;
 	} else {
@@ -2627,13 +2956,15 @@ static int rk_camera_s_stream(struct soc_camera_device *icd, int enable)
     	write_cif_reg(pcdev->base,CIF_CIF_CTRL, cif_ctrl_val);
         pcdev->stop_cif = true;
     	spin_unlock_irqrestore(&pcdev->lock, flags);
+		cancel_delayed_work_sync(&pcdev->test_work);
 		flush_workqueue((pcdev->camera_wq));
 		RKCAMERA_DG("STREAM_OFF cancel timer and flush work:0x%x \n", ret);
 	}
     //must be reinit,or will be somthing wrong in irq process.
     if(enable == false){
-        pcdev->active = NULL;
-        INIT_LIST_HEAD(&pcdev->capture);
+		spin_lock_irqsave(&pcdev->lock, flags);
+        rk_camera_clear_capture(pcdev);
+		spin_unlock_irqrestore(&pcdev->lock, flags);
         }
 	RKCAMERA_DG("%s.. enable : 0x%x , CIF_CIF_CTRL = 0x%x\n", __FUNCTION__, enable,read_cif_reg(pcdev->base,CIF_CIF_CTRL));
 	return 0;
@@ -2868,8 +3199,7 @@ static struct soc_camera_host_ops rk_soc_camera_host_ops =
     .put_formats	= rk_camera_put_formats,
     .set_fmt	= rk_camera_set_fmt,
     .try_fmt	= rk_camera_try_fmt,
-    .init_videobuf	= rk_camera_init_videobuf,
-    .reqbufs	= rk_camera_reqbufs,
+    .init_videobuf2	= rk_camera_init_videobuf,
     .poll		= rk_camera_poll,
     .querycap	= rk_camera_querycap,
     .set_bus_param	= rk_camera_set_bus_param,
@@ -3089,6 +3419,8 @@ static int rk_camera_probe(struct platform_device *pdev)
 
 	pcdev->camera_reinit_work.pcdev = pcdev;
 	INIT_WORK(&(pcdev->camera_reinit_work.work), rk_camera_reinit_work);
+	INIT_DELAYED_WORK(&pcdev->test_work, rk_camera_test_work);
+    spin_lock_init(&pcdev->stats.lock);
 
     for (i=0; i<2; i++) {
         pcdev->icd_frmival[i].icd = NULL;
@@ -3101,9 +3433,22 @@ static int rk_camera_probe(struct platform_device *pdev)
     pcdev->soc_host.v4l2_dev.dev	= &pdev->dev;
     pcdev->soc_host.nr		= pdev->id;
 
+    pcdev->alloc_ctx = vb2_dma_contig_init_ctx(&pdev->dev);
+    if (IS_ERR(pcdev->alloc_ctx)) {
+        err = PTR_ERR(pcdev->alloc_ctx);
+        goto exit_free_irq;
+    }
+
     err = soc_camera_host_register(&pcdev->soc_host);
     if (err)
-        goto exit_free_irq;
+        goto exit_free_ctx;
+    if (rk_camera_debugfs_dir) {
+        pcdev->debugfs = debugfs_create_dir(IS_CIF0() ? "cif0" : "cif1", rk_camera_debugfs_dir);
+        if (IS_ERR(pcdev->debugfs))
+            pcdev->debugfs = NULL;
+        if (pcdev->debugfs)
+            debugfs_create_file("stats", S_IRUSR | S_IWUSR, pcdev->debugfs, pcdev, &rk_camera_stats_fops);
+    }
 	pcdev->fps_timer.pcdev = pcdev;
 	hrtimer_init(&(pcdev->fps_timer.timer), CLOCK_MONOTONIC, HRTIMER_MODE_REL);
 	pcdev->fps_timer.timer.function = rk_camera_fps_func;
@@ -3121,6 +3466,8 @@ static int rk_camera_probe(struct platform_device *pdev)
     RKCAMERA_DG("%s(%d) Exit  \n",__FUNCTION__,__LINE__);
     return 0;
 
+exit_free_ctx:
+    vb2_dma_contig_cleanup_ctx(pcdev->alloc_ctx);
 exit_free_irq:
     
     for (i=0; i<2; i++) {
@@ -3188,7 +3535,9 @@ static int __devexit rk_camera_remove(struct platform_device *pdev)
         }
     }
 
+    debugfs_remove_recursive(pcdev->debugfs);
     soc_camera_host_unregister(&pcdev->soc_host);
+    vb2_dma_contig_cleanup_ctx(pcdev->alloc_ctx);
 
     meminfo_ptr = IS_CIF0()? (&pcdev->pdata->meminfo):(&pcdev->pdata->meminfo_cif1);
     meminfo_ptrr = IS_CIF0()? (&pcdev->pdata->meminfo_cif1):(&pcdev->pdata->meminfo);
@@ -3235,6 +3584,13 @@ static int rk_camera_init_async(void *unused)
 static int __devinit rk_camera_init(void)
 {
     RKCAMERA_DG("%s..%s..%d  \n",__FUNCTION__,__FILE__,__LINE__);
+    rk_camera_debugfs_dir = debugfs_create_dir("rk_camera", NULL);
+    if (IS_ERR(rk_camera_debugfs_dir))
+        rk_camera_debugfs_dir = NULL;
+#if (CONFIG_CAMERA_SCALE_CROP_MACHINE == RK_CAM_SCALE_CROP_ARM)
+    if (rk_camera_debugfs_dir)
+        debugfs_create_file("scale_bench", S_IRUSR, rk_camera_debugfs_dir, NULL, &rk_camera_scale_bench_fops);
+#endif
     kthread_run(rk_camera_init_async, NULL, "rk_camera_init");
     return 0;
 }
@@ -3242,6 +3598,7 @@ static int __devinit rk_camera_init(void)
 static void __exit rk_camera_exit(void)
 {
     platform_driver_unregister(&rk_camera_driver);
+    debugfs_remove_recursive(rk_camera_debugfs_dir);
 }
 
 device_initcall_sync(rk_camera_init);
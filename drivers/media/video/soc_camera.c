@@ -819,7 +819,8 @@ static int soc_camera_streamoff(struct file *file, void *priv,
     if (ici->ops->s_stream)
 		ici->ops->s_stream(icd, 0);				/* ddl@rock-chips.com : Add stream control for host */
 
-    videobuf_mmap_free(&icd->vb_vidq);          /* ddl@rock-chips.com : free video buf */
+    if (ici->ops->init_videobuf)
+        videobuf_mmap_free(&icd->vb_vidq);          /* ddl@rock-chips.com : free video buf */
 	
 	return 0;
 }
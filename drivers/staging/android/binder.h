@@ -32,6 +32,7 @@ enum {
 	BINDER_TYPE_HANDLE	= B_PACK_CHARS('s', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_WEAK_HANDLE	= B_PACK_CHARS('w', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_FD		= B_PACK_CHARS('f', 'd', '*', B_TYPE_LARGE),
+	BINDER_TYPE_PTR		= B_PACK_CHARS('p', 't', '*', B_TYPE_LARGE),
 };
 
 enum {
@@ -61,6 +62,20 @@ struct flat_binder_object {
 	void			*cookie;
 };
 
+/*
+ * A sender buffer passed by reference in a scatter-gather transaction
+ * (BC_TRANSACTION_SG or BC_REPLY_SG). The driver copies 'length' bytes from
+ * 'buffer' straight into the target's mapping and rewrites 'buffer' to
+ * point at that copy, so large payloads need not be flattened into the
+ * parcel first. Listed in the offsets like a flat_binder_object.
+ */
+struct binder_buffer_object {
+	unsigned long		type;	/* BINDER_TYPE_PTR */
+	unsigned long		flags;	/* must be zero */
+	void			*buffer;
+	size_t			length;
+};
+
 /*
  * On 64-bit platforms where user code may run in 32-bits the driver must
  * translate the buffer (and local binder) addresses apropriately.
@@ -147,6 +162,12 @@ struct binder_transaction_data {
 	} data;
 };
 
+struct binder_transaction_data_sg {
+	struct binder_transaction_data transaction_data;
+	size_t		buffers_size;	/* sum of the buffer lengths, each */
+					/* rounded up to sizeof(void *) */
+};
+
 struct binder_ptr_cookie {
 	void *ptr;
 	void *cookie;
@@ -324,6 +345,13 @@ enum BinderDriverCommandProtocol {
 	/*
 	 * void *: cookie
 	 */
+
+	BC_TRANSACTION_SG = _IOW('c', 17, struct binder_transaction_data_sg),
+	BC_REPLY_SG = _IOW('c', 18, struct binder_transaction_data_sg),
+	/*
+	 * binder_transaction_data_sg: the sent command, with room for the
+	 * buffers of its BINDER_TYPE_PTR objects.
+	 */
 };
 
 #endif /* _LINUX_BINDER_H */
@@ -21,9 +21,11 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
+#include <linux/mutex.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/time.h>
 #include "logger.h"
 
@@ -34,15 +36,33 @@
  *
  * This structure lives from module insertion until module removal, so it does
  * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * spinlock 'lock'.
+ *
+ * Writers do not copy their payload under the lock: they reserve space for
+ * the entry and a slot in 'slots' and write its header under the lock, then
+ * copy the payload from userspace unlocked. Writers finish in any order, but
+ * 'c_off' only moves over the oldest slots that are done, so readers see
+ * entries in the order they were reserved.
  */
+#define LOGGER_SLOTS	32	/* writers copying their payload at once */
+
+struct logger_slot {
+	size_t			end;	/* offset just past the entry */
+	bool			done;	/* payload copied */
+};
+
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
+	wait_queue_head_t	commit_wq; /* writers waiting for a slot */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
+	spinlock_t		lock;	/* lock protecting the offsets */
 	size_t			w_off;	/* current write head offset */
+	size_t			c_off;	/* entries before this are complete */
+	struct logger_slot	slots[LOGGER_SLOTS]; /* entries in flight */
+	unsigned int		s_head;	/* oldest slot in flight */
+	unsigned int		s_tail;	/* next slot to reserve */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
 };
@@ -51,7 +71,9 @@ struct logger_log {
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by log->lock; 'mutex'
+ * also keeps reads on the same file from sharing 'bounce' and the offset
+ * it was taken from.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
@@ -59,8 +81,13 @@ struct logger_reader {
 	size_t			r_off;	/* current read head offset */
 	bool			r_all;	/* reader can read all entries */
 	int			r_ver;	/* reader ABI version */
+	unsigned char		*bounce; /* entry being copied to userspace */
+	struct mutex		mutex;	/* one read() at a time */
 };
 
+#define LOGGER_ENTRY_MAX_LEN \
+	(sizeof(struct logger_entry) + LOGGER_ENTRY_MAX_PAYLOAD)
+
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
@@ -112,7 +139,7 @@ static struct logger_entry *get_entry_header(struct logger_log *log,
  * get_entry_msg_len - Grabs the length of the message of the entry
  * starting from from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock.
  */
 static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
 {
@@ -156,54 +183,43 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * do_read_log - copies the 'count' bytes long entry at the reader's offset
+ * to reader->bounce and moves the reader past it.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static void do_read_log(struct logger_log *log, struct logger_reader *reader,
+			size_t count)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
 	size_t len;
-	size_t msg_start;
 
-	/*
-	 * First, copy the header to userspace, using the version of
-	 * the header requested
-	 */
-	entry = get_entry_header(log, reader->r_off, &scratch);
-	if (copy_header_to_user(reader->r_ver, entry, buf))
-		return -EFAULT;
+	len = min(count, log->size - reader->r_off);
+	memcpy(reader->bounce, log->buffer + reader->r_off, len);
 
-	count -= get_user_hdr_len(reader->r_ver);
-	buf += get_user_hdr_len(reader->r_ver);
-	msg_start = logger_offset(reader->r_off + sizeof(struct logger_entry));
+	if (count != len)
+		memcpy(reader->bounce + len, log->buffer, count - len);
 
-	/*
-	 * We read from the msg in two disjoint operations. First, we read from
-	 * the current msg head offset up to 'count' bytes or to the end of
-	 * the log, whichever comes first.
-	 */
-	len = min(count, log->size - msg_start);
-	if (copy_to_user(buf, log->buffer + msg_start, len))
-		return -EFAULT;
+	reader->r_off = logger_offset(reader->r_off + count);
+}
 
-	/*
-	 * Second, we read any remaining bytes, starting back at the head of
-	 * the log.
-	 */
-	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+/*
+ * copy_entry_to_user - copies the entry in reader->bounce to the user-space
+ * buffer 'buf', with the header version the reader asked for. Returns the
+ * number of bytes copied on success.
+ */
+static ssize_t copy_entry_to_user(struct logger_reader *reader,
+				  char __user *buf)
+{
+	struct logger_entry *entry = (struct logger_entry *) reader->bounce;
+	size_t hdr_len = get_user_hdr_len(reader->r_ver);
 
-	reader->r_off = logger_offset(reader->r_off +
-		sizeof(struct logger_entry) + count);
+	if (copy_header_to_user(reader->r_ver, entry, buf))
+		return -EFAULT;
+
+	if (copy_to_user(buf + hdr_len, entry->msg, entry->len))
+		return -EFAULT;
 
-	return count + get_user_hdr_len(reader->r_ver);
+	return hdr_len + entry->len;
 }
 
 /*
@@ -213,7 +229,7 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 static size_t get_next_entry_by_uid(struct logger_log *log,
 		size_t off, uid_t euid)
 {
-	while (off != log->w_off) {
+	while (off != log->c_off) {
 		struct logger_entry *entry;
 		struct logger_entry scratch;
 		size_t next_len;
@@ -247,6 +263,7 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	size_t len;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -254,9 +271,9 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		spin_lock(&log->lock);
+		ret = (log->c_off == reader->r_off);
+		spin_unlock(&log->lock);
 		if (!ret)
 			break;
 
@@ -277,40 +294,48 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->mutex);
+	spin_lock(&log->lock);
 
 	if (!reader->r_all)
 		reader->r_off = get_next_entry_by_uid(log,
 			reader->r_off, current_euid());
 
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	if (unlikely(log->c_off == reader->r_off)) {
+		spin_unlock(&log->lock);
+		mutex_unlock(&reader->mutex);
 		goto start;
 	}
 
 	/* get the size of the next entry */
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
-	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
+	len = get_entry_msg_len(log, reader->r_off);
+	if (count < get_user_hdr_len(reader->r_ver) + len) {
+		spin_unlock(&log->lock);
+		mutex_unlock(&reader->mutex);
+		return -EINVAL;
 	}
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	/*
+	 * Take exactly one entry from the log. It is copied aside so that
+	 * writers never wait for a reader's page faults.
+	 */
+	do_read_log(log, reader, sizeof(struct logger_entry) + len);
 
-out:
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
+
+	ret = copy_entry_to_user(reader, buf);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
 /*
  * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * bytes after 'off'. Never goes past 'c_off': entries after it may not be
+ * complete yet.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
 static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
 {
@@ -321,7 +346,7 @@ static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
 			get_entry_msg_len(log, off);
 		off = logger_offset(off + nr);
 		count += nr;
-	} while (count < len);
+	} while (count < len && off != log->c_off);
 
 	return off;
 }
@@ -349,7 +374,7 @@ static inline int clock_interval(size_t a, size_t b, size_t c)
  * We do this by "pulling forward" the readers and start head to the first
  * entry after the new write head.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void fix_up_readers(struct logger_log *log, size_t len)
 {
@@ -366,50 +391,134 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
- *
- * The caller needs to hold log->mutex.
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at offset 'off'
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void do_write_log(struct logger_log *log, size_t off,
+			 const void *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
+}
 
-	log->w_off = logger_offset(log->w_off + count);
+/*
+ * clear_log - zeroes 'count' bytes of 'log' at offset 'off'
+ */
+static void clear_log(struct logger_log *log, size_t off, size_t count)
+{
+	size_t len;
+
+	len = min(count, log->size - off);
+	memset(log->buffer + off, 0, len);
 
+	if (count != len)
+		memset(log->buffer, 0, count - len);
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
+ * do_write_log_user - writes 'count' bytes from the user-space buffer 'buf'
+ * to the log 'log' at offset 'off'
  *
  * Returns 'count' on success, negative error code on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
+static ssize_t do_write_log_from_user(struct logger_log *log, size_t off,
 				      const void __user *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	len = min(count, log->size - off);
+	if (len && copy_from_user(log->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
 		if (copy_from_user(log->buffer, buf + len, count - len))
 			return -EFAULT;
 
-	log->w_off = logger_offset(log->w_off + count);
-
 	return count;
 }
 
+/*
+ * logger_reserve - makes room for the entry described by 'header', writes
+ * the header and returns the offset of its payload. The entry's slot is
+ * returned in 'slot'. The entry stays invisible to readers until
+ * logger_commit().
+ */
+static size_t logger_reserve(struct logger_log *log,
+			     struct logger_entry *header, unsigned int *slot)
+{
+	size_t len = sizeof(struct logger_entry) + header->len;
+	unsigned int head;
+	size_t off;
+
+	spin_lock(&log->lock);
+
+	/*
+	 * Wait for the oldest writer in flight if every slot is taken, or if
+	 * the entry would lap one whose payload is still being copied. With
+	 * a log this much larger than an entry, the latter only happens when
+	 * a writer has been stuck in a page fault for a whole buffer's worth
+	 * of logging.
+	 */
+	while (log->s_tail - log->s_head == LOGGER_SLOTS ||
+	       (log->s_tail != log->s_head && clock_interval(log->w_off,
+				logger_offset(log->w_off + len), log->c_off))) {
+		head = log->s_head;
+		spin_unlock(&log->lock);
+		wait_event(log->commit_wq, ACCESS_ONCE(log->s_head) != head);
+		spin_lock(&log->lock);
+	}
+
+	/*
+	 * Fix up any readers, pulling them forward to the first readable
+	 * entry after (what will be) the new write offset.
+	 */
+	fix_up_readers(log, len);
+
+	off = log->w_off;
+	do_write_log(log, off, header, sizeof(struct logger_entry));
+	log->w_off = logger_offset(off + len);
+
+	*slot = log->s_tail++ % LOGGER_SLOTS;
+	log->slots[*slot].end = log->w_off;
+	log->slots[*slot].done = false;
+
+	spin_unlock(&log->lock);
+
+	return logger_offset(off + sizeof(struct logger_entry));
+}
+
+/*
+ * logger_commit - marks the entry in 'slot' as complete. Readers see it once
+ * every entry reserved before it is complete too.
+ */
+static void logger_commit(struct logger_log *log, unsigned int slot)
+{
+	struct logger_slot *s;
+	bool done = false;
+
+	spin_lock(&log->lock);
+	log->slots[slot].done = true;
+	while (log->s_head != log->s_tail) {
+		s = &log->slots[log->s_head % LOGGER_SLOTS];
+		if (!s->done)
+			break;
+		log->c_off = s->end;
+		log->s_head++;
+		done = true;
+	}
+	spin_unlock(&log->lock);
+
+	if (done) {
+		/* wake up any blocked readers and writers */
+		wake_up_interruptible(&log->wq);
+		wake_up(&log->commit_wq);
+	}
+}
+
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
@@ -419,10 +528,11 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
 	ssize_t ret = 0;
+	unsigned int slot;
+	size_t off;
 
 	now = current_kernel_time();
 
@@ -438,17 +548,7 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	off = logger_reserve(log, &header, &slot);
 
 	while (nr_segs-- > 0) {
 		size_t len;
@@ -458,21 +558,23 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		nr = do_write_log_from_user(log, off, iov->iov_base, len);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+			/*
+			 * The entry is already part of the log and other
+			 * entries may follow it, so blank out its payload.
+			 */
+			clear_log(log, off, header.len - ret);
+			ret = nr;
+			break;
 		}
 
+		off = logger_offset(off + nr);
 		iov++;
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
-
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	logger_commit(log, slot);
 
 	return ret;
 }
@@ -504,17 +606,24 @@ static int logger_open(struct inode *inode, struct file *file)
 		if (!reader)
 			return -ENOMEM;
 
+		reader->bounce = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		if (!reader->bounce) {
+			kfree(reader);
+			return -ENOMEM;
+		}
+
 		reader->log = log;
+		mutex_init(&reader->mutex);
 		reader->r_ver = 1;
 		reader->r_all = in_egroup_p(inode->i_gid) ||
 			capable(CAP_SYSLOG);
 
 		INIT_LIST_HEAD(&reader->list);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -532,7 +641,13 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
+		struct logger_log *log = reader->log;
+
+		spin_lock(&log->lock);
 		list_del(&reader->list);
+		spin_unlock(&log->lock);
+
+		kfree(reader->bounce);
 		kfree(reader);
 	}
 
@@ -562,14 +677,14 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 	if (!reader->r_all)
 		reader->r_off = get_next_entry_by_uid(log,
 			reader->r_off, current_euid());
 
-	if (log->w_off != reader->r_off)
+	if (log->c_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -583,7 +698,10 @@ static long logger_set_version(struct logger_reader *reader, void __user *arg)
 	if ((version < 1) || (version > 2))
 		return -EINVAL;
 
+	/* not in the middle of a read sized for the old header */
+	mutex_lock(&reader->mutex);
 	reader->r_ver = version;
+	mutex_unlock(&reader->mutex);
 	return 0;
 }
 
@@ -594,7 +712,15 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
 
-	mutex_lock(&log->mutex);
+	/* needs to copy from userspace, so it cannot run under log->lock */
+	if (cmd == LOGGER_SET_VERSION) {
+		if (!(file->f_mode & FMODE_READ))
+			return -EBADF;
+		reader = file->private_data;
+		return logger_set_version(reader, argp);
+	}
+
+	spin_lock(&log->lock);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -606,10 +732,10 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
+		if (log->c_off >= reader->r_off)
+			ret = log->c_off - reader->r_off;
 		else
-			ret = (log->size - reader->r_off) + log->w_off;
+			ret = (log->size - reader->r_off) + log->c_off;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -622,7 +748,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			reader->r_off = get_next_entry_by_uid(log,
 				reader->r_off, current_euid());
 
-		if (log->w_off != reader->r_off)
+		if (log->c_off != reader->r_off)
 			ret = get_user_hdr_len(reader->r_ver) +
 				get_entry_msg_len(log, reader->r_off);
 		else
@@ -634,8 +760,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+			reader->r_off = log->c_off;
+		log->head = log->c_off;
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -646,17 +772,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		reader = file->private_data;
 		ret = reader->r_ver;
 		break;
-	case LOGGER_SET_VERSION:
-		if (!(file->f_mode & FMODE_READ)) {
-			ret = -EBADF;
-			break;
-		}
-		reader = file->private_data;
-		ret = logger_set_version(reader, argp);
-		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -688,9 +806,13 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
+	.commit_wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .commit_wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
+	.c_off = 0, \
+	.s_head = 0, \
+	.s_tail = 0, \
 	.head = 0, \
 	.size = SIZE, \
 };
@@ -31,10 +31,27 @@
 
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/eventfd.h>
+#include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/miscdevice.h>
 #include <linux/mm.h>
 #include <linux/oom.h>
+#include <linux/poll.h>
 #include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/notifier.h>
+#include <linux/uaccess.h>
+#include <linux/vmpressure.h>
+#include <linux/wait.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/lowmemorykiller.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -55,12 +72,117 @@ static int lowmem_minfree_size = 4;
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+/*
+ * Kill candidates, bucketed by oom_adj so that the shrinker only looks
+ * at the processes of the highest populated bucket instead of walking
+ * the whole task list. Processes enter the index when they are forked,
+ * when their oom_adj is written, or when a full scan of the task list
+ * meets them, and leave it when their task_struct is freed. RSS changes
+ * on every fault, so it is read when choosing within a bucket rather
+ * than kept sorted.
+ */
+#define LOWMEM_ADJ_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+#define LOWMEM_HASH_BITS	7
+
+struct lowmem_task {
+	struct list_head bucket_node;
+	struct hlist_node hash_node;
+	struct task_struct *task;	/* thread group leader, no reference */
+	int oom_adj;
+};
+
+/* Taken from the task free notifier, which may run in softirq context */
+static DEFINE_SPINLOCK(lowmem_index_lock);
+static struct list_head lowmem_buckets[LOWMEM_ADJ_BUCKETS];
+static struct hlist_head lowmem_hash[1 << LOWMEM_HASH_BITS];
+
+/*
+ * Set while some process may be missing from the index: before the
+ * first scan, when an entry could not be allocated, and when exec from
+ * a secondary thread made another task the group leader. Cleared by
+ * the full scan, which indexes every process again.
+ */
+static bool lowmem_index_stale = true;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
 			printk(x);			\
 	} while (0)
 
+static struct hlist_head *lowmem_hash_head(struct task_struct *task)
+{
+	return &lowmem_hash[hash_ptr(task, LOWMEM_HASH_BITS)];
+}
+
+/* Caller must hold lowmem_index_lock */
+static struct lowmem_task *lowmem_index_find(struct task_struct *task)
+{
+	struct lowmem_task *lt;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(lt, node, lowmem_hash_head(task), hash_node) {
+		if (lt->task == task)
+			return lt;
+	}
+
+	return NULL;
+}
+
+static void lowmem_index_update(struct task_struct *task, int oom_adj)
+{
+	unsigned long flags;
+	struct lowmem_task *lt, *new;
+
+	if (oom_adj < OOM_DISABLE || oom_adj > OOM_ADJUST_MAX)
+		return;
+
+	new = kmalloc(sizeof(*new), GFP_ATOMIC);
+
+	spin_lock_irqsave(&lowmem_index_lock, flags);
+	lt = lowmem_index_find(task);
+	if (!lt) {
+		lt = new;
+		new = NULL;
+		if (!lt) {
+			lowmem_index_stale = true;
+			goto out;
+		}
+		lt->task = task;
+		hlist_add_head(&lt->hash_node, lowmem_hash_head(task));
+		INIT_LIST_HEAD(&lt->bucket_node);
+	}
+	lt->oom_adj = oom_adj;
+	list_move(&lt->bucket_node, &lowmem_buckets[oom_adj - OOM_DISABLE]);
+out:
+	spin_unlock_irqrestore(&lowmem_index_lock, flags);
+
+	kfree(new);
+}
+
+static void lowmem_index_remove(struct task_struct *task)
+{
+	unsigned long flags;
+	struct lowmem_task *lt;
+
+	spin_lock_irqsave(&lowmem_index_lock, flags);
+	lt = lowmem_index_find(task);
+	if (lt) {
+		hlist_del(&lt->hash_node);
+		list_del(&lt->bucket_node);
+		/*
+		 * A task indexed as leader that is not one anymore went
+		 * through de_thread(): the thread that exec'd leads the
+		 * group now and nothing indexed it.
+		 */
+		if (!thread_group_leader(task))
+			lowmem_index_stale = true;
+	}
+	spin_unlock_irqrestore(&lowmem_index_lock, flags);
+
+	kfree(lt);
+}
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -76,19 +198,162 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	if (task == lowmem_deathpending)
 		lowmem_deathpending = NULL;
 
+	/*
+	 * Not only leaders: after exec from a secondary thread the old
+	 * leader exits as a plain thread and still owns its entry.
+	 */
+	lowmem_index_remove(task);
+
 	return NOTIFY_OK;
 }
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long val,
+		    void *data);
+
+static struct notifier_block oom_adj_nb = {
+	.notifier_call	= oom_adj_notify_func,
+};
+
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long val,
+		    void *data)
+{
+	struct task_struct *task = data;
+	struct task_struct *leader;
+
+	/*
+	 * The caller holds a reference on task only, and its leader may be
+	 * going away: keep it from being freed until it is indexed, so that
+	 * the free notifier removes the entry again, and skip it if it has
+	 * already been released.
+	 */
+	rcu_read_lock();
+	leader = task->group_leader;
+	if (!pid_alive(leader)) {
+		rcu_read_unlock();
+		return NOTIFY_OK;
+	}
+	get_task_struct(leader);
+	rcu_read_unlock();
+
+	lowmem_index_update(leader, task->signal->oom_adj);
+	put_task_struct(leader);
+
+	return NOTIFY_OK;
+}
+
+/*
+ * Pick the biggest process of the highest populated oom_adj bucket at
+ * or above min_adj. Returns it with a reference held.
+ */
+static struct task_struct *lowmem_select_indexed(int min_adj,
+					int *tasksize, int *oom_adj)
+{
+	int b;
+	unsigned long flags;
+	struct lowmem_task *lt;
+	struct task_struct *selected = NULL;
+
+	spin_lock_irqsave(&lowmem_index_lock, flags);
+	for (b = LOWMEM_ADJ_BUCKETS - 1;
+	     b >= min_adj - OOM_DISABLE && !selected; b--) {
+		list_for_each_entry(lt, &lowmem_buckets[b], bucket_node) {
+			struct task_struct *p = lt->task;
+			int size;
+
+			task_lock(p);
+			if (!p->mm) {
+				task_unlock(p);
+				continue;
+			}
+			size = get_mm_rss(p->mm);
+			task_unlock(p);
+
+			if (size <= 0 || (selected && size <= *tasksize))
+				continue;
+
+			selected = p;
+			*tasksize = size;
+			*oom_adj = lt->oom_adj;
+		}
+	}
+	if (selected)
+		get_task_struct(selected);
+	spin_unlock_irqrestore(&lowmem_index_lock, flags);
+
+	return selected;
+}
+
+/*
+ * Walk the whole task list, for when the index may be missing some
+ * process. Every process met is added to the index, so later calls do
+ * not need to scan again until the index goes stale.
+ */
+static struct task_struct *lowmem_select_scan(int min_adj,
+					int *tasksize, int *oom_adj_out)
 {
 	struct task_struct *p;
 	struct task_struct *selected = NULL;
+	int selected_tasksize = 0;
+	int selected_oom_adj = min_adj;
+
+	lowmem_index_stale = false;
+	smp_mb();
+
+	read_lock(&tasklist_lock);
+	for_each_process(p) {
+		struct mm_struct *mm;
+		struct signal_struct *sig;
+		int oom_adj;
+		int size;
+
+		task_lock(p);
+		mm = p->mm;
+		sig = p->signal;
+		if (!mm || !sig) {
+			task_unlock(p);
+			continue;
+		}
+		oom_adj = sig->oom_adj;
+		size = get_mm_rss(mm);
+		task_unlock(p);
+
+		lowmem_index_update(p, oom_adj);
+
+		if (oom_adj < min_adj || size <= 0)
+			continue;
+		if (selected) {
+			if (oom_adj < selected_oom_adj)
+				continue;
+			if (oom_adj == selected_oom_adj &&
+			    size <= selected_tasksize)
+				continue;
+		}
+		selected = p;
+		selected_tasksize = size;
+		selected_oom_adj = oom_adj;
+	}
+	if (selected)
+		get_task_struct(selected);
+	read_unlock(&tasklist_lock);
+
+	*tasksize = selected_tasksize;
+	*oom_adj_out = selected_oom_adj;
+	return selected;
+}
+
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct task_struct *selected;
 	int rem = 0;
-	int tasksize;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
+	size_t minfree = 0;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
+	bool from_index;
+	ktime_t start;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
@@ -113,6 +378,7 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		if (other_free < lowmem_minfree[i] &&
 		    other_file < lowmem_minfree[i]) {
 			min_adj = lowmem_adj[i];
+			minfree = lowmem_minfree[i];
 			break;
 		}
 	}
@@ -129,58 +395,271 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     sc->nr_to_scan, sc->gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
+	/*
+	 * A stale index may lack the best candidate, so it must not pick
+	 * alone. The scan then decides: it walks every process, indexed
+	 * ones included, by the same order (oom_adj, then size).
+	 */
+	start = ktime_get();
+	from_index = !ACCESS_ONCE(lowmem_index_stale);
+	if (from_index)
+		selected = lowmem_select_indexed(min_adj, &selected_tasksize,
+						 &selected_oom_adj);
+	else
+		selected = lowmem_select_scan(min_adj, &selected_tasksize,
+					      &selected_oom_adj);
 
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
-	}
 	if (selected) {
+		trace_lowmem_kill(selected, selected_oom_adj,
+				  selected_tasksize, min_adj, minfree,
+				  other_free, other_file,
+				  ktime_to_ns(ktime_sub(ktime_get(), start)),
+				  from_index);
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize);
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
 		force_sig(SIGKILL, selected);
+		put_task_struct(selected);
 		rem -= selected_tasksize;
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
+/*
+ * /dev/mem_pressure lets userspace hear about memory pressure before
+ * anything has to be killed. Each open file is a listener:
+ *
+ *  - write "<level>" or "<level> <eventfd>" to choose the lowest level
+ *    reported (low, medium or critical; default medium) and optionally
+ *    an eventfd to signal;
+ *  - poll() for POLLIN, then read() the highest level seen since the
+ *    previous read. read() blocks unless O_NONBLOCK is set.
+ */
+struct lowmem_listener {
+	struct list_head node;
+	enum vmpressure_levels threshold;
+	int pending;			/* level + 1, 0 if none */
+	struct eventfd_ctx *eventfd;
+};
+
+static DEFINE_SPINLOCK(lowmem_listeners_lock);
+static LIST_HEAD(lowmem_listeners);
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_pressure_wait);
+
+static int
+vmpressure_notify_func(struct notifier_block *self, unsigned long level,
+		       void *data);
+
+static struct notifier_block vmpressure_nb = {
+	.notifier_call	= vmpressure_notify_func,
+};
+
+static int
+vmpressure_notify_func(struct notifier_block *self, unsigned long level,
+		       void *data)
+{
+	struct lowmem_listener *l;
+	unsigned long flags;
+	bool wake = false;
+
+	spin_lock_irqsave(&lowmem_listeners_lock, flags);
+	list_for_each_entry(l, &lowmem_listeners, node) {
+		if (level < l->threshold)
+			continue;
+		if (l->pending < level + 1)
+			l->pending = level + 1;
+		if (l->eventfd)
+			eventfd_signal(l->eventfd, 1);
+		wake = true;
+	}
+	spin_unlock_irqrestore(&lowmem_listeners_lock, flags);
+
+	if (wake)
+		wake_up_interruptible(&lowmem_pressure_wait);
+
+	return NOTIFY_OK;
+}
+
+static int lowmem_pressure_open(struct inode *inode, struct file *file)
+{
+	struct lowmem_listener *l;
+	unsigned long flags;
+
+	l = kzalloc(sizeof(*l), GFP_KERNEL);
+	if (!l)
+		return -ENOMEM;
+	l->threshold = VMPRESSURE_MEDIUM;
+
+	spin_lock_irqsave(&lowmem_listeners_lock, flags);
+	list_add_tail(&l->node, &lowmem_listeners);
+	spin_unlock_irqrestore(&lowmem_listeners_lock, flags);
+
+	file->private_data = l;
+	return nonseekable_open(inode, file);
+}
+
+static int lowmem_pressure_release(struct inode *inode, struct file *file)
+{
+	struct lowmem_listener *l = file->private_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_listeners_lock, flags);
+	list_del(&l->node);
+	spin_unlock_irqrestore(&lowmem_listeners_lock, flags);
+
+	if (l->eventfd)
+		eventfd_ctx_put(l->eventfd);
+	kfree(l);
+	return 0;
+}
+
+static int lowmem_pressure_take(struct lowmem_listener *l)
+{
+	unsigned long flags;
+	int pending;
+
+	spin_lock_irqsave(&lowmem_listeners_lock, flags);
+	pending = l->pending;
+	l->pending = 0;
+	spin_unlock_irqrestore(&lowmem_listeners_lock, flags);
+
+	return pending;
+}
+
+static ssize_t lowmem_pressure_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	struct lowmem_listener *l = file->private_data;
+	char kbuf[16];
+	int pending;
+	int len;
+
+	while (!(pending = lowmem_pressure_take(l))) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(lowmem_pressure_wait,
+					     ACCESS_ONCE(l->pending)))
+			return -ERESTARTSYS;
+	}
+
+	len = scnprintf(kbuf, sizeof(kbuf), "%s\n",
+			vmpressure_level_name(pending - 1));
+	if (count < len)
+		return -EINVAL;
+	if (copy_to_user(buf, kbuf, len))
+		return -EFAULT;
+	return len;
+}
+
+static ssize_t lowmem_pressure_write(struct file *file,
+				     const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	struct lowmem_listener *l = file->private_data;
+	struct eventfd_ctx *eventfd = NULL, *old;
+	enum vmpressure_levels level;
+	char kbuf[32], *p, *name;
+	unsigned long flags;
+	int efd;
+
+	if (count >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, buf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+
+	p = strim(kbuf);
+	name = strsep(&p, " ");
+	for (level = 0; level < VMPRESSURE_NUM_LEVELS; level++) {
+		if (!strcmp(name, vmpressure_level_name(level)))
+			break;
+	}
+	if (level == VMPRESSURE_NUM_LEVELS)
+		return -EINVAL;
+
+	if (p) {
+		if (kstrtoint(skip_spaces(p), 10, &efd))
+			return -EINVAL;
+		eventfd = eventfd_ctx_fdget(efd);
+		if (IS_ERR(eventfd))
+			return PTR_ERR(eventfd);
+	}
+
+	spin_lock_irqsave(&lowmem_listeners_lock, flags);
+	l->threshold = level;
+	old = l->eventfd;
+	l->eventfd = eventfd;
+	spin_unlock_irqrestore(&lowmem_listeners_lock, flags);
+
+	if (old)
+		eventfd_ctx_put(old);
+	return count;
+}
+
+static unsigned int lowmem_pressure_poll(struct file *file, poll_table *wait)
+{
+	struct lowmem_listener *l = file->private_data;
+
+	poll_wait(file, &lowmem_pressure_wait, wait);
+	if (ACCESS_ONCE(l->pending))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations lowmem_pressure_fops = {
+	.owner		= THIS_MODULE,
+	.open		= lowmem_pressure_open,
+	.release	= lowmem_pressure_release,
+	.read		= lowmem_pressure_read,
+	.write		= lowmem_pressure_write,
+	.poll		= lowmem_pressure_poll,
+	.llseek		= no_llseek,
+};
+
+static struct miscdevice lowmem_pressure_dev = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "mem_pressure",
+	.fops		= &lowmem_pressure_fops,
+};
+
+/* debugfs lowmemorykiller/index: the indexed processes, highest first */
+static int lowmem_index_show(struct seq_file *m, void *v)
+{
+	int b;
+	unsigned long flags;
+	struct lowmem_task *lt;
+
+	spin_lock_irqsave(&lowmem_index_lock, flags);
+	seq_printf(m, "stale %d\n", lowmem_index_stale);
+	for (b = LOWMEM_ADJ_BUCKETS - 1; b >= 0; b--) {
+		list_for_each_entry(lt, &lowmem_buckets[b], bucket_node)
+			seq_printf(m, "%d %d %s\n", lt->task->pid,
+				   lt->oom_adj, lt->task->comm);
+	}
+	spin_unlock_irqrestore(&lowmem_index_lock, flags);
+
+	return 0;
+}
+
+static int lowmem_index_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lowmem_index_show, NULL);
+}
+
+static const struct file_operations lowmem_index_fops = {
+	.open		= lowmem_index_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static struct dentry *lowmem_debugfs_dir;
+
 static struct shrinker lowmem_shrinker = {
 	.shrink = lowmem_shrink,
 	.seeks = DEFAULT_SEEKS * 16
@@ -188,14 +667,32 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	int i;
+
+	for (i = 0; i < LOWMEM_ADJ_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
+
 	task_free_register(&task_nb);
+	register_oom_adj_notifier(&oom_adj_nb);
 	register_shrinker(&lowmem_shrinker);
+	register_vmpressure_notifier(&vmpressure_nb);
+	if (misc_register(&lowmem_pressure_dev))
+		pr_err("lowmemorykiller: cannot register mem_pressure device\n");
+
+	lowmem_debugfs_dir = debugfs_create_dir("lowmemorykiller", NULL);
+	if (!IS_ERR_OR_NULL(lowmem_debugfs_dir))
+		debugfs_create_file("index", S_IRUSR, lowmem_debugfs_dir,
+				    NULL, &lowmem_index_fops);
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	debugfs_remove_recursive(lowmem_debugfs_dir);
+	misc_deregister(&lowmem_pressure_dev);
+	unregister_vmpressure_notifier(&vmpressure_nb);
 	unregister_shrinker(&lowmem_shrinker);
+	unregister_oom_adj_notifier(&oom_adj_nb);
 	task_free_unregister(&task_nb);
 }
 
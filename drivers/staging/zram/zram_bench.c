@@ -0,0 +1,586 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+/*
+ * Compression benchmark, to help choosing comp_algorithm, and swap
+ * benchmark, to see how a device scales with the number of CPUs.
+ *
+ * /sys/kernel/debug/zram_bench/
+ *	corpus		write data to compress, e.g. a dump of swapped out
+ *			pages (truncating the file empties it); a synthetic
+ *			corpus is used while it is empty
+ *	algorithms	space separated list of algorithms to compare
+ *	rounds		passes over the corpus per algorithm
+ *	results		reading it runs the benchmark
+ *
+ *	swap_device	number of the zram device the swap benchmark uses;
+ *			it must not be in use, and is overwritten
+ *	swap_threads	highest number of threads to run, 0 for one per
+ *			online CPU
+ *	swap_pages	pages each thread writes and reads back
+ *	swap_results	reading it runs the swap benchmark: for 1, 2, ...
+ *			swap_threads threads, each swaps the corpus out to
+ *			its own range of the device, page by page, then
+ *			swaps it back in and checks it
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/crypto.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/genhd.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+#define ZRAM_BENCH_MAX_CORPUS	(4 << 20)
+#define ZRAM_BENCH_SYNTH_PAGES	64
+
+static struct dentry *bench_dir;
+static DEFINE_MUTEX(bench_lock);	/* protect everything below */
+static char *corpus;
+static size_t corpus_len;
+static char algorithms[128] = "lzo deflate";
+static u32 rounds = 4;
+static u32 swap_device;
+static u32 swap_threads;
+static u32 swap_pages = 1024;
+
+/*
+ * Half text-like, half random pages: roughly what swap sees, with a
+ * wide spread of compression ratios.
+ */
+static void fill_synthetic_corpus(char *buf, size_t len)
+{
+	static const char words[] =
+		"android dalvik heap bitmap surface binder parcel zram ";
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if ((i / PAGE_SIZE) & 1)
+			buf[i] = random32();
+		else
+			buf[i] = words[(i + i / PAGE_SIZE) %
+					(sizeof(words) - 1)];
+	}
+}
+
+static void bench_one(struct seq_file *m, const char *name,
+			const char *data, size_t len)
+{
+	u32 r, ratio;
+	size_t off;
+	s64 comp_us = 0, decomp_us = 0;
+	u64 orig = 0, compressed = 0;
+	struct crypto_comp *tfm;
+	char *dst, *out;
+
+	tfm = crypto_alloc_comp(name, 0, 0);
+	if (IS_ERR(tfm)) {
+		seq_printf(m, "%-10s not available\n", name);
+		return;
+	}
+
+	dst = kmalloc(ZRAM_STREAM_BUF_SIZE, GFP_KERNEL);
+	out = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!dst || !out)
+		goto out;
+
+	for (r = 0; r < rounds; r++) {
+		for (off = 0; off + PAGE_SIZE <= len; off += PAGE_SIZE) {
+			unsigned int clen = ZRAM_STREAM_BUF_SIZE;
+			unsigned int dlen = PAGE_SIZE;
+			ktime_t start;
+			int ret;
+
+			start = ktime_get();
+			ret = crypto_comp_compress(tfm, data + off, PAGE_SIZE,
+						dst, &clen);
+			comp_us += ktime_us_delta(ktime_get(), start);
+			if (ret)
+				goto fail;
+
+			start = ktime_get();
+			ret = crypto_comp_decompress(tfm, dst, clen, out,
+						&dlen);
+			decomp_us += ktime_us_delta(ktime_get(), start);
+			if (ret || dlen != PAGE_SIZE ||
+					memcmp(out, data + off, PAGE_SIZE))
+				goto fail;
+
+			orig += PAGE_SIZE;
+			compressed += clen;
+
+			/* a 4MB corpus takes a while with the slow ones */
+			cond_resched();
+		}
+	}
+
+	if (!compressed)
+		goto out;
+
+	/* bytes per microsecond is MB/s */
+	ratio = div64_u64(orig * 100, compressed);
+	seq_printf(m, "%-10s %4u.%02u %10llu %10llu\n", name,
+		ratio / 100, ratio % 100,
+		div64_u64(orig, max_t(s64, comp_us, 1)),
+		div64_u64(orig, max_t(s64, decomp_us, 1)));
+	goto out;
+
+fail:
+	seq_printf(m, "%-10s failed at offset %zu\n", name, off);
+out:
+	kfree(out);
+	kfree(dst);
+	crypto_free_comp(tfm);
+}
+
+/*
+ * The corpus to run on, whole pages of it, or a synthetic one if it is
+ * empty; *synth is then set and must be vfree()d. Called with bench_lock.
+ */
+static int get_corpus(const char **data, size_t *len, char **synth)
+{
+	*synth = NULL;
+	*data = corpus;
+	*len = round_down(corpus_len, PAGE_SIZE);
+
+	if (!*len) {
+		*len = ZRAM_BENCH_SYNTH_PAGES * PAGE_SIZE;
+		*synth = vmalloc(*len);
+		if (!*synth)
+			return -ENOMEM;
+		fill_synthetic_corpus(*synth, *len);
+		*data = *synth;
+	}
+
+	return 0;
+}
+
+static int results_show(struct seq_file *m, void *v)
+{
+	char *list, *p, *name;
+	char *synth;
+	const char *data;
+	size_t len;
+
+	mutex_lock(&bench_lock);
+
+	if (get_corpus(&data, &len, &synth)) {
+		mutex_unlock(&bench_lock);
+		return -ENOMEM;
+	}
+
+	list = kstrdup(algorithms, GFP_KERNEL);
+	if (!list) {
+		vfree(synth);
+		mutex_unlock(&bench_lock);
+		return -ENOMEM;
+	}
+
+	seq_printf(m, "corpus: %zu pages%s, %u rounds\n", len / PAGE_SIZE,
+		synth ? " (synthetic)" : "", rounds);
+	seq_printf(m, "%-10s %7s %10s %10s\n", "algorithm", "ratio",
+		"comp MB/s", "dec MB/s");
+
+	p = list;
+	while ((name = strsep(&p, " \t\n")) != NULL) {
+		if (*name)
+			bench_one(m, name, data, len);
+	}
+
+	kfree(list);
+	vfree(synth);
+	mutex_unlock(&bench_lock);
+
+	return 0;
+}
+
+static int results_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, results_show, NULL);
+}
+
+static const struct file_operations results_fops = {
+	.open		= results_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+struct swap_run {
+	struct block_device *bdev;
+	const char *data;	/* the corpus, vmalloc()ed */
+	size_t len;
+	u32 pages;		/* per thread */
+	int rw;
+	struct completion go;	/* all threads are started */
+	struct completion done;	/* the last thread is done */
+	atomic_t running;
+	atomic_t errors;
+};
+
+struct swap_thread {
+	struct swap_run *run;
+	u32 first;		/* first page of the device it uses */
+	struct page *page;	/* swapped in to */
+};
+
+static void swap_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/* One page at a time and synchronously, as swap does it */
+static int swap_page_rw(struct block_device *bdev, struct page *page,
+			u32 index, int rw)
+{
+	int ret;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_KERNEL, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_sector = (sector_t)index << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_bdev = bdev;
+	bio->bi_end_io = swap_end_io;
+	bio->bi_private = &done;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	submit_bio(rw, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+static int swap_thread_fn(void *arg)
+{
+	struct swap_thread *st = arg;
+	struct swap_run *run = st->run;
+	u32 i;
+
+	wait_for_completion(&run->go);
+
+	for (i = 0; i < run->pages; i++) {
+		const char *src = run->data + (st->first + i) %
+			(run->len / PAGE_SIZE) * PAGE_SIZE;
+		int ret;
+
+		if (run->rw == WRITE) {
+			ret = swap_page_rw(run->bdev, vmalloc_to_page(src),
+					st->first + i, WRITE);
+		} else {
+			ret = swap_page_rw(run->bdev, st->page,
+					st->first + i, READ);
+			if (!ret && memcmp(page_address(st->page), src,
+					PAGE_SIZE))
+				ret = -EIO;
+		}
+		if (ret) {
+			atomic_inc(&run->errors);
+			break;
+		}
+	}
+
+	if (atomic_dec_and_test(&run->running))
+		complete(&run->done);
+	return 0;
+}
+
+/*
+ * Run 'nr' threads, all writing or all reading, and return how long
+ * they took together in microseconds, or a negative error.
+ */
+static s64 swap_run_threads(struct swap_run *run, struct swap_thread *st,
+			u32 nr, int rw)
+{
+	struct task_struct *task;
+	ktime_t start;
+	u32 i;
+
+	run->rw = rw;
+	init_completion(&run->go);
+	init_completion(&run->done);
+	atomic_set(&run->running, nr);
+	atomic_set(&run->errors, 0);
+
+	for (i = 0; i < nr; i++) {
+		task = kthread_run(swap_thread_fn, &st[i], "zram_bench/%u", i);
+		if (IS_ERR(task)) {
+			/* let the ones started finish, with nothing to do */
+			atomic_sub(nr - i, &run->running);
+			atomic_inc(&run->errors);
+			break;
+		}
+	}
+
+	start = ktime_get();
+	complete_all(&run->go);
+	if (i)
+		wait_for_completion(&run->done);
+
+	if (atomic_read(&run->errors))
+		return -EIO;
+	return max_t(s64, ktime_us_delta(ktime_get(), start), 1);
+}
+
+static int swap_results_show(struct seq_file *m, void *v)
+{
+	const fmode_t mode = FMODE_READ | FMODE_WRITE | FMODE_EXCL;
+	struct swap_thread *st = NULL;
+	struct swap_run run;
+	struct zram *zram;
+	char *synth;
+	u32 nr, max_threads, i;
+	s64 write_us, read_us;
+	int ret = 0;
+
+	mutex_lock(&bench_lock);
+
+	max_threads = swap_threads ? swap_threads : num_online_cpus();
+	run.pages = swap_pages;
+	if (swap_device >= num_devices || !run.pages || max_threads > 64) {
+		ret = -EINVAL;
+		goto out;
+	}
+	zram = &devices[swap_device];
+	if ((u64)max_threads * run.pages * PAGE_SIZE > zram->disksize) {
+		seq_printf(m, "zram%u: %u threads of %u pages do not fit "
+			"in %llu bytes\n", swap_device, max_threads,
+			run.pages, zram->disksize);
+		goto out;
+	}
+
+	/* Fails if swap or a filesystem has the device */
+	run.bdev = blkdev_get_by_dev(disk_devt(zram->disk), mode, bench_dir);
+	if (IS_ERR(run.bdev)) {
+		ret = PTR_ERR(run.bdev);
+		goto out;
+	}
+
+	ret = get_corpus(&run.data, &run.len, &synth);
+	if (ret)
+		goto out_put;
+
+	st = kcalloc(max_threads, sizeof(*st), GFP_KERNEL);
+	if (!st) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	for (i = 0; i < max_threads; i++) {
+		st[i].run = &run;
+		st[i].first = i * run.pages;
+		st[i].page = alloc_page(GFP_KERNEL);
+		if (!st[i].page) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+	}
+
+	seq_printf(m, "zram%u, %u pages per thread, corpus: %zu pages%s\n",
+		swap_device, run.pages, run.len / PAGE_SIZE,
+		synth ? " (synthetic)" : "");
+	seq_printf(m, "%7s %10s %10s\n", "threads", "out MB/s", "in MB/s");
+
+	for (nr = 1; nr <= max_threads; nr++) {
+		u64 bytes = (u64)nr * run.pages * PAGE_SIZE;
+
+		write_us = swap_run_threads(&run, st, nr, WRITE);
+		read_us = write_us < 0 ? write_us :
+			swap_run_threads(&run, st, nr, READ);
+		if (read_us < 0) {
+			seq_printf(m, "%7u failed\n", nr);
+			break;
+		}
+
+		/* bytes per microsecond is MB/s */
+		seq_printf(m, "%7u %10llu %10llu\n", nr,
+			div64_u64(bytes, write_us), div64_u64(bytes, read_us));
+	}
+
+	/* Give the memory back, as swapoff would */
+	for (i = 0; i < max_threads * run.pages; i++)
+		zram_slot_free_notify(run.bdev, i);
+
+out_free:
+	for (i = 0; st && i < max_threads; i++) {
+		if (st[i].page)
+			__free_page(st[i].page);
+	}
+	kfree(st);
+	vfree(synth);
+out_put:
+	blkdev_put(run.bdev, mode);
+out:
+	mutex_unlock(&bench_lock);
+	return ret;
+}
+
+static int swap_results_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, swap_results_show, NULL);
+}
+
+static const struct file_operations swap_results_fops = {
+	.open		= swap_results_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int corpus_open(struct inode *inode, struct file *file)
+{
+	if (file->f_flags & O_TRUNC) {
+		mutex_lock(&bench_lock);
+		corpus_len = 0;
+		mutex_unlock(&bench_lock);
+	}
+
+	return nonseekable_open(inode, file);
+}
+
+static ssize_t corpus_write(struct file *file, const char __user *buf,
+			size_t count, loff_t *ppos)
+{
+	ssize_t ret = count;
+
+	mutex_lock(&bench_lock);
+
+	if (!corpus) {
+		corpus = vmalloc(ZRAM_BENCH_MAX_CORPUS);
+		if (!corpus) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	if (corpus_len + count > ZRAM_BENCH_MAX_CORPUS) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	if (copy_from_user(corpus + corpus_len, buf, count)) {
+		ret = -EFAULT;
+		goto out;
+	}
+	corpus_len += count;
+
+out:
+	mutex_unlock(&bench_lock);
+	return ret;
+}
+
+static const struct file_operations corpus_fops = {
+	.open		= corpus_open,
+	.write		= corpus_write,
+	.llseek		= no_llseek,
+};
+
+static int algorithms_show(struct seq_file *m, void *v)
+{
+	mutex_lock(&bench_lock);
+	seq_printf(m, "%s\n", algorithms);
+	mutex_unlock(&bench_lock);
+
+	return 0;
+}
+
+static int algorithms_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, algorithms_show, NULL);
+}
+
+static ssize_t algorithms_write(struct file *file, const char __user *buf,
+			size_t count, loff_t *ppos)
+{
+	if (count >= sizeof(algorithms))
+		return -EINVAL;
+
+	mutex_lock(&bench_lock);
+	if (copy_from_user(algorithms, buf, count)) {
+		algorithms[0] = '\0';
+		mutex_unlock(&bench_lock);
+		return -EFAULT;
+	}
+	algorithms[count] = '\0';
+	strim(algorithms);
+	mutex_unlock(&bench_lock);
+
+	return count;
+}
+
+static const struct file_operations algorithms_fops = {
+	.open		= algorithms_open,
+	.read		= seq_read,
+	.write		= algorithms_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int __init zram_bench_init(void)
+{
+	bench_dir = debugfs_create_dir("zram_bench", NULL);
+	if (IS_ERR_OR_NULL(bench_dir)) {
+		bench_dir = NULL;
+		return -ENODEV;
+	}
+
+	debugfs_create_file("corpus", S_IWUSR, bench_dir, NULL,
+			&corpus_fops);
+	debugfs_create_file("algorithms", S_IRUGO | S_IWUSR, bench_dir,
+			NULL, &algorithms_fops);
+	debugfs_create_u32("rounds", S_IRUGO | S_IWUSR, bench_dir, &rounds);
+	debugfs_create_file("results", S_IRUGO, bench_dir, NULL,
+			&results_fops);
+	debugfs_create_u32("swap_device", S_IRUGO | S_IWUSR, bench_dir,
+			&swap_device);
+	debugfs_create_u32("swap_threads", S_IRUGO | S_IWUSR, bench_dir,
+			&swap_threads);
+	debugfs_create_u32("swap_pages", S_IRUGO | S_IWUSR, bench_dir,
+			&swap_pages);
+	debugfs_create_file("swap_results", S_IRUGO, bench_dir, NULL,
+			&swap_results_fops);
+
+	return 0;
+}
+
+void zram_bench_exit(void)
+{
+	debugfs_remove_recursive(bench_dir);
+	vfree(corpus);
+}
@@ -0,0 +1,155 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+/*
+ * Content deduplication: pages with identical contents share a single
+ * pool object. Stored objects are indexed by a checksum of the
+ * uncompressed page; a checksum match is confirmed by comparing the
+ * stored bytes. Whatever comp_algorithm selects, equal stored bytes of
+ * equal length mean equal pages, as they decompress (or, stored raw at
+ * PAGE_SIZE, are) the same, so sharing is always correct. Finding every
+ * duplicate also needs the backend to compress a page the same way each
+ * time, which the crypto API compressors do for a given algorithm; one
+ * that did not would only lose hits.
+ */
+
+#include <linux/jhash.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zram_drv.h"
+
+u32 zram_dedup_checksum(void *mem)
+{
+	return jhash2(mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+/*
+ * Look for a stored object with the given contents. On success a
+ * reference is taken on the returned entry.
+ */
+struct zram_entry *zram_dedup_find(struct zram *zram, u32 checksum,
+				const void *mem, size_t len)
+{
+	struct rb_node *node;
+	struct zram_entry *entry = NULL;
+
+	spin_lock(&zram->dedup_lock);
+
+	node = zram->dedup_root.rb_node;
+	while (node) {
+		struct zram_entry *e = rb_entry(node, struct zram_entry,
+						rb_node);
+
+		if (checksum < e->checksum) {
+			node = node->rb_left;
+		} else if (checksum > e->checksum) {
+			node = node->rb_right;
+		} else {
+			/* Leftmost of the entries sharing this checksum */
+			entry = e;
+			node = node->rb_left;
+		}
+	}
+
+	while (entry && entry->checksum == checksum) {
+		if (entry->size == len) {
+			void *cmem;
+			int match;
+
+			cmem = zs_map_object(zram->mem_pool, entry->handle,
+						ZS_MM_RO);
+			match = !memcmp(cmem, mem, len);
+			zs_unmap_object(zram->mem_pool, entry->handle);
+
+			if (match) {
+				entry->refcount++;
+				goto out;
+			}
+		}
+
+		node = rb_next(&entry->rb_node);
+		entry = node ? rb_entry(node, struct zram_entry, rb_node) :
+				NULL;
+	}
+	entry = NULL;
+
+out:
+	spin_unlock(&zram->dedup_lock);
+
+	return entry;
+}
+
+/*
+ * Register a freshly stored object. Entries with equal checksums are
+ * kept to the right of each other so zram_dedup_find() can walk them
+ * in order.
+ */
+struct zram_entry *zram_dedup_insert(struct zram *zram, u32 checksum,
+				unsigned long handle, size_t len)
+{
+	struct rb_node **p, *parent = NULL;
+	struct zram_entry *entry;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->checksum = checksum;
+	entry->handle = handle;
+	entry->size = len;
+	entry->refcount = 1;
+
+	spin_lock(&zram->dedup_lock);
+
+	p = &zram->dedup_root.rb_node;
+	while (*p) {
+		struct zram_entry *e;
+
+		parent = *p;
+		e = rb_entry(parent, struct zram_entry, rb_node);
+		if (checksum < e->checksum)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&entry->rb_node, parent, p);
+	rb_insert_color(&entry->rb_node, &zram->dedup_root);
+
+	spin_unlock(&zram->dedup_lock);
+
+	return entry;
+}
+
+/*
+ * Drop a reference. Returns 1 if this was the last one, in which case
+ * the pool object has been freed as well.
+ */
+int zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	spin_lock(&zram->dedup_lock);
+	if (--entry->refcount) {
+		spin_unlock(&zram->dedup_lock);
+		return 0;
+	}
+	rb_erase(&entry->rb_node, &zram->dedup_root);
+	spin_unlock(&zram->dedup_lock);
+
+	zs_free(zram->mem_pool, entry->handle);
+	kfree(entry);
+
+	return 1;
+}
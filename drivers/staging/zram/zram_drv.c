@@ -29,9 +29,10 @@
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/crypto.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
@@ -89,6 +90,17 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
+/* Pool handle of a stored page, looking through the dedup entry */
+static unsigned long zram_get_handle(struct zram *zram, u32 index)
+{
+	unsigned long handle = zram->table[index].handle;
+
+	if (zram_test_flag(zram, index, ZRAM_DEDUP))
+		return ((struct zram_entry *)handle)->handle;
+
+	return handle;
+}
+
 static int page_zero_filled(void *ptr)
 {
 	unsigned int pos;
@@ -133,15 +145,125 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+static unsigned long zram_alloc_block(struct zram *zram)
+{
+	unsigned long blk_idx = 1;
+
+	do {
+		blk_idx = find_next_zero_bit(zram->block_bitmap,
+					zram->nr_blocks, blk_idx);
+		if (blk_idx >= zram->nr_blocks)
+			return 0;
+	} while (test_and_set_bit(blk_idx, zram->block_bitmap));
+
+	return blk_idx;
+}
+
+static void zram_free_block(struct zram *zram, unsigned long blk_idx)
+{
+	WARN_ON(!test_and_clear_bit(blk_idx, zram->block_bitmap));
+}
+
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/* Synchronously transfer one page to or from the backing device */
+static int zram_bdev_rw(struct zram *zram, struct page *page,
+			unsigned long blk_idx, int rw)
+{
+	int ret;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_sector = blk_idx << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_bdev = zram->backing_bdev;
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &done;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	submit_bio(rw, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+struct zram_bdev_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk_idx;
+	int ret;
+};
+
+static void zram_bdev_read_work(struct work_struct *work)
+{
+	struct zram_bdev_work *zw = container_of(work,
+					struct zram_bdev_work, work);
+
+	zw->ret = zram_bdev_rw(zw->zram, zw->page, zw->blk_idx, READ);
+}
+
+/*
+ * We are called from our make_request function, where any bio we
+ * submit is only queued on current->bio_list until we return. Waiting
+ * for it here would never end, so let a worker do the I/O.
+ */
+static int zram_read_from_bdev(struct zram *zram, struct page *page,
+			unsigned long blk_idx)
+{
+	struct zram_bdev_work zw;
+
+	zw.zram = zram;
+	zw.page = page;
+	zw.blk_idx = blk_idx;
+
+	INIT_WORK_ONSTACK(&zw.work, zram_bdev_read_work);
+	queue_work(system_unbound_wq, &zw.work);
+	flush_work(&zw.work);
+	destroy_work_on_stack(&zw.work);
+
+	if (!zw.ret) {
+		flush_dcache_page(page);
+		zram_stat64_inc(zram, &zram->stats.bd_reads);
+	}
+
+	return zw.ret;
+}
+
+/*
+ * Release the memory backing a table entry. Caller must hold
+ * table_lock for write.
+ */
 static void zram_free_page(struct zram *zram, size_t index)
 {
-	u32 clen;
-	void *obj;
+	unsigned long handle = zram->table[index].handle;
+	u32 clen = zram->table[index].size;
+
+	zram_clear_flag(zram, index, ZRAM_IDLE);
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_free_block(zram, handle);
+		zram_stat_dec(&zram->stats.bd_count);
 
-	if (unlikely(!page)) {
+		zram->table[index].handle = 0;
+		zram->table[index].size = 0;
+		return;
+	}
+
+	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -154,27 +276,30 @@ static void zram_free_page(struct zram *zram, size_t index)
 	}
 
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
-		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
+	zram_stat_dec(&zram->stats.pages_stored);
+
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		if (!zram_dedup_put(zram, (struct zram_entry *)handle)) {
+			/* Object still used by other pages */
+			zram_stat64_sub(zram, &zram->stats.dedup_saved, clen);
+			goto out;
+		}
+	} else {
+		zs_free(zram->mem_pool, handle);
+	}
 
-out:
 	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+out:
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
 }
 
 static void handle_zero_page(struct page *page)
@@ -191,17 +316,72 @@ static void handle_zero_page(struct page *page)
 static void handle_uncompressed_page(struct zram *zram,
 				struct page *page, u32 index)
 {
+	unsigned long handle;
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	handle = zram_get_handle(zram, index);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
+	zs_unmap_object(zram->mem_pool, handle);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	flush_dcache_page(page);
+}
+
+static int zram_read_page(struct zram *zram, struct page *page, u32 index)
+{
+	int ret;
+	unsigned int clen;
+	unsigned long handle;
+	struct zobj_header *zheader;
+	struct zram_stream *zstrm;
+	unsigned char *user_mem, *cmem;
+
+	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+		handle_zero_page(page);
+		return 0;
+	}
+
+	/* Requested page is not present in compressed area */
+	if (unlikely(!zram->table[index].handle)) {
+		pr_debug("Read before write: index=%u\n", index);
+		handle_zero_page(page);
+		return 0;
+	}
+
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		handle_uncompressed_page(zram, page, index);
+		return 0;
+	}
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	clen = PAGE_SIZE;
+
+	handle = zram_get_handle(zram, index);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+
+	/* Preemption is off while the table lock is held */
+	zstrm = this_cpu_ptr(zram->streams);
+	ret = crypto_comp_decompress(zstrm->dtfm,
+		cmem + sizeof(*zheader),
+		zram->table[index].size - sizeof(*zheader),
+		user_mem, &clen);
+
+	zs_unmap_object(zram->mem_pool, handle);
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret || clen != PAGE_SIZE)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		return ret ? ret : -EIO;
+	}
 
 	flush_dcache_page(page);
+	return 0;
 }
 
 static void zram_read(struct zram *zram, struct bio *bio)
@@ -216,58 +396,36 @@ static void zram_read(struct zram *zram, struct bio *bio)
 
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
-
-		page = bvec->bv_page;
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
-
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
+		/*
+		 * Readers only exclude writers of the same device while
+		 * an entry is being replaced; they never wait for another
+		 * CPU's compression to finish.
+		 */
+		read_lock(&zram->table_lock);
+		if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+			unsigned long blk_idx = zram->table[index].handle;
+
+			read_unlock(&zram->table_lock);
+			ret = zram_read_from_bdev(zram, bvec->bv_page,
+						blk_idx);
+		} else {
+			ret = zram_read_page(zram, bvec->bv_page, index);
+			read_unlock(&zram->table_lock);
 		}
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
+		/* Any access makes a page active again */
+		if (unlikely(zram_test_flag(zram, index, ZRAM_IDLE))) {
+			write_lock(&zram->table_lock);
+			zram_clear_flag(zram, index, ZRAM_IDLE);
+			write_unlock(&zram->table_lock);
 		}
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
-
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
-
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
-
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
-
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
+		if (unlikely(ret)) {
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
 			goto out;
 		}
 
-		flush_dcache_page(page);
 		index++;
 	}
 
@@ -279,121 +437,186 @@ out:
 	bio_io_error(bio);
 }
 
-static void zram_write(struct zram *zram, struct bio *bio)
+/*
+ * Pick the compression stream of the CPU we are running on. We may be
+ * migrated right after, which is harmless: the stream mutex keeps us
+ * correct and the stream stays mostly local.
+ */
+static struct zram_stream *zram_stream_get(struct zram *zram)
 {
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	struct zram_stream *zstrm;
 
-	zram_stat64_inc(zram, &zram->stats.num_writes);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	zstrm = per_cpu_ptr(zram->streams, raw_smp_processor_id());
+	mutex_lock(&zstrm->lock);
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+	return zstrm;
+}
 
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+static void zram_stream_put(struct zram_stream *zstrm)
+{
+	mutex_unlock(&zstrm->lock);
+}
 
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
-
-		mutex_lock(&zram->lock);
-
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
-			continue;
-		}
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
+{
+	int ret;
+	unsigned int clen;
+	u32 checksum = 0;
+	unsigned long handle;
+	struct zobj_header *zheader;
+	struct zram_entry *entry = NULL;
+	struct zram_stream *zstrm;
+	unsigned char *user_mem, *cmem, *src;
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+	zstrm = zram_stream_get(zram);
+	src = zstrm->buffer;
 
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(user_mem)) {
 		kunmap_atomic(user_mem, KM_USER0);
+		zram_stream_put(zstrm);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
-
+		write_lock(&zram->table_lock);
 		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
+		 * System overwrites unused sectors. Free memory
+		 * associated with this sector now.
 		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
-
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
+		zram_free_page(zram, index);
+		zram_stat_inc(&zram->stats.pages_zero);
+		zram_set_flag(zram, index, ZRAM_ZERO);
+		write_unlock(&zram->table_lock);
+		return 0;
+	}
+
+	if (zram->dedup_enable)
+		checksum = zram_dedup_checksum(user_mem);
+
+	clen = ZRAM_STREAM_BUF_SIZE;
+	ret = crypto_comp_compress(zstrm->tfm, user_mem, PAGE_SIZE,
+				src, &clen);
+
+	kunmap_atomic(user_mem, KM_USER0);
+
+	if (unlikely(ret)) {
+		zram_stream_put(zstrm);
+		pr_err("Compression failed! err=%d\n", ret);
+		return ret;
+	}
+
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size)) {
+		zram_stream_put(zstrm);
+		zstrm = NULL;
+		clen = PAGE_SIZE;
+	}
+
+	if (zram->dedup_enable) {
+		if (unlikely(!zstrm))
 			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
-		}
+		entry = zram_dedup_find(zram, checksum, src, clen);
+		if (unlikely(!zstrm))
+			kunmap_atomic(src, KM_USER0);
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+		if (entry) {
+			if (zstrm)
+				zram_stream_put(zstrm);
+			zram_stat64_inc(zram, &zram->stats.dedup_hits);
+			zram_stat64_add(zram, &zram->stats.dedup_saved, clen);
+			goto publish;
 		}
+	}
 
-memstore:
-		zram->table[index].offset = offset;
+	handle = zs_malloc(zram->mem_pool, clen + sizeof(*zheader),
+				GFP_NOIO | __GFP_HIGHMEM);
+	if (unlikely(!handle)) {
+		if (zstrm)
+			zram_stream_put(zstrm);
+		pr_info("Error allocating memory for compressed "
+			"page: %u, size=%u\n", index, clen);
+		return -ENOMEM;
+	}
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	if (unlikely(!zstrm))
+		src = kmap_atomic(page, KM_USER0);
+
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
 
 #if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
+	/* Back-reference needed for memory defragmentation */
+	if (zstrm) {
+		zheader = (struct zobj_header *)cmem;
+		zheader->table_idx = index;
+		cmem += sizeof(*zheader);
+	}
 #endif
 
-		memcpy(cmem, src, clen);
+	memcpy(cmem, src, clen);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+	zs_unmap_object(zram->mem_pool, handle);
+	if (unlikely(!zstrm))
+		kunmap_atomic(src, KM_USER0);
+	else
+		zram_stream_put(zstrm);
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+	if (zram->dedup_enable) {
+		entry = zram_dedup_insert(zram, checksum, handle, clen);
+		if (unlikely(!entry)) {
+			zs_free(zram->mem_pool, handle);
+			return -ENOMEM;
+		}
+	}
+
+	/* Shared objects are accounted only by their first user */
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+
+publish:
+	if (entry)
+		handle = (unsigned long)entry;
+
+	/*
+	 * The object is fully written: only now publish it, replacing
+	 * whatever the slot held before.
+	 */
+	write_lock(&zram->table_lock);
+	zram_free_page(zram, index);
+
+	zram->table[index].handle = handle;
+	zram->table[index].size = clen;
+	if (entry)
+		zram_set_flag(zram, index, ZRAM_DEDUP);
+	if (unlikely(!zstrm)) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+	}
+
+	/* Update stats */
+	zram_stat_inc(&zram->stats.pages_stored);
+	if (clen <= PAGE_SIZE / 2)
+		zram_stat_inc(&zram->stats.good_compress);
+	write_unlock(&zram->table_lock);
+
+	return 0;
+}
+
+static void zram_write(struct zram *zram, struct bio *bio)
+{
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
+
+	zram_stat64_inc(zram, &zram->stats.num_writes);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (unlikely(zram_write_page(zram, bvec->bv_page, index))) {
+			zram_stat64_inc(zram, &zram->stats.failed_writes);
+			goto out;
+		}
 
-		mutex_unlock(&zram->lock);
 		index++;
 	}
 
@@ -405,6 +628,200 @@ out:
 	bio_io_error(bio);
 }
 
+/*
+ * Attach a block device which zram_writeback() may move pages to. Must
+ * be called before the device is initialized.
+ */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	int ret;
+	char *name;
+	unsigned long nr_blocks;
+	unsigned long *bitmap;
+	struct block_device *bdev;
+
+	name = kstrdup(path, GFP_KERNEL);
+	if (!name)
+		return -ENOMEM;
+	strim(name);
+
+	bdev = blkdev_get_by_path(name, FMODE_READ | FMODE_WRITE |
+				FMODE_EXCL, zram);
+	if (IS_ERR(bdev)) {
+		pr_info("Cannot open backing device %s\n", name);
+		ret = PTR_ERR(bdev);
+		goto free_name;
+	}
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_blocks < 2) {
+		ret = -EINVAL;
+		goto put_bdev;
+	}
+
+	ret = set_blocksize(bdev, PAGE_SIZE);
+	if (ret)
+		goto put_bdev;
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (!bitmap) {
+		ret = -ENOMEM;
+		goto put_bdev;
+	}
+	/* Block 0 is reserved, see struct zram */
+	set_bit(0, bitmap);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done || zram->backing_bdev) {
+		mutex_unlock(&zram->init_lock);
+		vfree(bitmap);
+		ret = -EBUSY;
+		goto put_bdev;
+	}
+
+	zram->backing_bdev = bdev;
+	zram->backing_path = name;
+	zram->nr_blocks = nr_blocks;
+	zram->block_bitmap = bitmap;
+	mutex_unlock(&zram->init_lock);
+
+	pr_info("Using %s as backing device (%lu pages)\n", name, nr_blocks);
+	return 0;
+
+put_bdev:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+free_name:
+	kfree(name);
+	return ret;
+}
+
+/* Caller must hold init_lock */
+static void zram_reset_backing_dev(struct zram *zram)
+{
+	if (!zram->backing_bdev)
+		return;
+
+	blkdev_put(zram->backing_bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	vfree(zram->block_bitmap);
+	kfree(zram->backing_path);
+
+	zram->backing_bdev = NULL;
+	zram->backing_path = NULL;
+	zram->block_bitmap = NULL;
+	zram->nr_blocks = 0;
+}
+
+/* Mark every stored page idle; accessing a page clears the mark */
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index;
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done)
+		goto out;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		write_lock(&zram->table_lock);
+		if (zram->table[index].handle &&
+				!zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		write_unlock(&zram->table_lock);
+	}
+
+out:
+	mutex_unlock(&zram->init_lock);
+}
+
+static int zram_wb_candidate(struct zram *zram, u32 index,
+			enum zram_wb_mode mode)
+{
+	if (!zram->table[index].handle ||
+			zram_test_flag(zram, index, ZRAM_WB) ||
+			zram_test_flag(zram, index, ZRAM_DEDUP))
+		return 0;
+
+	if (mode == ZRAM_WB_HUGE)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	return zram_test_flag(zram, index, ZRAM_IDLE);
+}
+
+/*
+ * Move idle or incompressible pages to the backing device, freeing
+ * their memory. Returns the number of pages written back or a
+ * negative error code if nothing could be written.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	int ret = 0, count = 0;
+	size_t index;
+	struct page *page;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done || !zram->backing_bdev) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		unsigned long handle, blk_idx;
+
+		read_lock(&zram->table_lock);
+		if (!zram_wb_candidate(zram, index, mode)) {
+			read_unlock(&zram->table_lock);
+			continue;
+		}
+		handle = zram->table[index].handle;
+		ret = zram_read_page(zram, page, index);
+		read_unlock(&zram->table_lock);
+		if (ret)
+			break;
+
+		blk_idx = zram_alloc_block(zram);
+		if (!blk_idx) {
+			ret = -ENOSPC;
+			break;
+		}
+
+		ret = zram_bdev_rw(zram, page, blk_idx, WRITE);
+		if (ret) {
+			zram_free_block(zram, blk_idx);
+			break;
+		}
+		zram_stat64_inc(zram, &zram->stats.bd_writes);
+
+		/*
+		 * The page may have been rewritten, freed or accessed
+		 * while we were writing it out: keep it in memory then.
+		 */
+		write_lock(&zram->table_lock);
+		if (zram->table[index].handle != handle ||
+				!zram_wb_candidate(zram, index, mode)) {
+			write_unlock(&zram->table_lock);
+			zram_free_block(zram, blk_idx);
+			continue;
+		}
+
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram->table[index].handle = blk_idx;
+		zram_stat_inc(&zram->stats.bd_count);
+		write_unlock(&zram->table_lock);
+
+		count++;
+	}
+
+out:
+	mutex_unlock(&zram->init_lock);
+	__free_page(page);
+
+	return count ? count : ret;
+}
+
 /*
  * Check if request is within bounds and page aligned.
  */
@@ -453,6 +870,67 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	return 0;
 }
 
+static void zram_free_streams(struct zram *zram)
+{
+	int cpu;
+
+	if (!zram->streams)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_stream *zstrm = per_cpu_ptr(zram->streams, cpu);
+
+		if (!IS_ERR_OR_NULL(zstrm->tfm))
+			crypto_free_comp(zstrm->tfm);
+		if (!IS_ERR_OR_NULL(zstrm->dtfm))
+			crypto_free_comp(zstrm->dtfm);
+		free_pages((unsigned long)zstrm->buffer,
+				get_order(ZRAM_STREAM_BUF_SIZE));
+	}
+
+	free_percpu(zram->streams);
+	zram->streams = NULL;
+}
+
+/*
+ * Streams are set up for every possible CPU rather than tracking
+ * hotplug: the cost is a few pages per CPU and writers never have to
+ * deal with a missing stream.
+ */
+static int zram_alloc_streams(struct zram *zram)
+{
+	int cpu;
+
+	zram->streams = alloc_percpu(struct zram_stream);
+	if (!zram->streams) {
+		pr_err("Error allocating compression streams\n");
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct zram_stream *zstrm = per_cpu_ptr(zram->streams, cpu);
+
+		mutex_init(&zstrm->lock);
+
+		zstrm->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+		zstrm->dtfm = crypto_alloc_comp(zram->compressor, 0, 0);
+		if (IS_ERR(zstrm->tfm) || IS_ERR(zstrm->dtfm)) {
+			pr_err("Error allocating %s compressor\n",
+				zram->compressor);
+			return -ENOMEM;
+		}
+
+		zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL |
+				__GFP_ZERO, get_order(ZRAM_STREAM_BUF_SIZE));
+		if (!zstrm->buffer) {
+			pr_err("Error allocating compressor buffer space\n");
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
 void zram_reset_device(struct zram *zram)
 {
 	size_t index;
@@ -461,35 +939,32 @@ void zram_reset_device(struct zram *zram)
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	zram_free_streams(zram);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+		unsigned long handle = zram->table[index].handle;
 
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
+		if (!handle)
 			continue;
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
+		if (zram_test_flag(zram, index, ZRAM_WB))
+			continue;
+		else if (zram_test_flag(zram, index, ZRAM_DEDUP))
+			zram_dedup_put(zram, (struct zram_entry *)handle);
 		else
-			xv_free(zram->mem_pool, page, offset);
+			zs_free(zram->mem_pool, handle);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
+	zram_reset_backing_dev(zram);
+
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 
@@ -511,28 +986,16 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
+	ret = zram_alloc_streams(zram);
+	if (ret)
+		goto fail_streams;
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
 	zram->table = vzalloc(num_pages * sizeof(*zram->table));
 	if (!zram->table) {
 		pr_err("Error allocating zram address table\n");
-		/* To prevent accessing table entries during cleanup */
-		zram->disksize = 0;
 		ret = -ENOMEM;
-		goto fail;
+		goto fail_streams;
 	}
 
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
@@ -540,11 +1003,11 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool();
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
-		goto fail;
+		goto fail_table;
 	}
 
 	zram->init_done = 1;
@@ -553,9 +1016,18 @@ int zram_init_device(struct zram *zram)
 	pr_debug("Initialization done!\n");
 	return 0;
 
-fail:
+	/*
+	 * Unwind here rather than through zram_reset_device(), which expects
+	 * an initialized device; disksize and the backing device stay as
+	 * they were set for the next attempt.
+	 */
+fail_table:
+	set_capacity(zram->disk, 0);
+	vfree(zram->table);
+	zram->table = NULL;
+fail_streams:
+	zram_free_streams(zram);
 	mutex_unlock(&zram->init_lock);
-	zram_reset_device(zram);
 
 	pr_err("Initialization failed: err=%d\n", ret);
 	return ret;
@@ -566,7 +1038,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->table_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->table_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1053,12 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	rwlock_init(&zram->table_lock);
+	strlcpy(zram->compressor, default_compressor,
+		sizeof(zram->compressor));
+	spin_lock_init(&zram->dedup_lock);
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -690,6 +1167,10 @@ static int __init zram_init(void)
 			goto free_devices;
 	}
 
+	/* The benchmark is a debugging aid, zram works without it */
+	if (zram_bench_init())
+		pr_warning("Error creating benchmark debugfs entries\n");
+
 	return 0;
 
 free_devices:
@@ -713,8 +1194,10 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		zram_reset_backing_dev(zram);
 	}
 
+	zram_bench_exit();
 	unregister_blkdev(zram_major, "zram");
 
 	kfree(devices);
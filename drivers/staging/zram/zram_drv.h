@@ -15,10 +15,13 @@
 #ifndef _ZRAM_DRV_H_
 #define _ZRAM_DRV_H_
 
+#include <linux/crypto.h>
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/rbtree.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -40,6 +43,9 @@ struct zobj_header {
 
 /*-- Configurable parameters */
 
+/* Default compressor, any crypto API compression algorithm can be used */
+static const char default_compressor[] = "lzo";
+
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
@@ -51,8 +57,8 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -63,6 +69,9 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 #define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
 #define ZRAM_LOGICAL_BLOCK_SIZE	4096
 
+/* Compressors may expand incompressible input */
+#define ZRAM_STREAM_BUF_SIZE	(2 * PAGE_SIZE)
+
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
 	/* Page is stored uncompressed */
@@ -71,6 +80,15 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page is shared through the dedup index; handle is a zram_entry */
+	ZRAM_DEDUP,
+
+	/* Page lives on the backing device; handle is the block index */
+	ZRAM_WB,
+
+	/* Page has not been accessed since it was last marked idle */
+	ZRAM_IDLE,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
@@ -78,12 +96,21 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
+	unsigned long handle;
+	u16 size;	/* object size (excluding header) */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
 
+/* Dedup index entry, one per distinct stored page */
+struct zram_entry {
+	struct rb_node rb_node;
+	u32 checksum;
+	u32 refcount;		/* protected by dedup_lock */
+	unsigned long handle;
+	u16 size;
+};
+
 struct zram_stats {
 	u64 compr_size;		/* compressed size of pages stored */
 	u64 num_reads;		/* failed + successful */
@@ -92,20 +119,42 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 pages_compacted;	/* pages released by compaction */
+	u64 dedup_hits;		/* writes satisfied by an existing object */
+	u64 dedup_saved;	/* bytes currently saved by sharing */
+	u64 bd_reads;		/* pages read back from backing device */
+	u64 bd_writes;		/* pages written to backing device */
+	u32 bd_count;		/* pages currently on backing device */
 	u32 pages_zero;		/* no. of zero filled pages */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
 };
 
+/*
+ * Compression workspace. One is allocated for each possible CPU so
+ * that writers running on different CPUs never contend. The mutex
+ * only matters when a writer is migrated between picking a stream
+ * and finishing with it.
+ *
+ * Decompression runs under the table lock with preemption disabled,
+ * so it uses a transform of its own which needs no locking.
+ */
+struct zram_stream {
+	struct mutex lock;	/* protect tfm and buffer */
+	struct crypto_comp *tfm;
+	struct crypto_comp *dtfm;
+	void *buffer;
+};
+
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zram_stream __percpu *streams;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	rwlock_t table_lock;	/* protect table entries and 32-bit stats;
+				 * held for read across decompression and
+				 * for write only to update an entry */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -117,6 +166,24 @@ struct zram {
 	 */
 	u64 disksize;	/* bytes */
 
+	/* Compression algorithm, selected before the device is set up */
+	char compressor[CRYPTO_MAX_ALG_NAME];
+
+	/* Content deduplication, selected before the device is set up */
+	int dedup_enable;
+	struct rb_root dedup_root;
+	spinlock_t dedup_lock;	/* protect dedup_root and refcounts */
+
+	/*
+	 * Optional backing device receiving idle or incompressible pages,
+	 * also selected before the device is set up. Block 0 is never
+	 * handed out so that a zero handle keeps meaning "no data".
+	 */
+	struct block_device *backing_bdev;
+	char *backing_path;
+	unsigned long nr_blocks;
+	unsigned long *block_bitmap;
+
 	struct zram_stats stats;
 };
 
@@ -128,5 +195,32 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern void zram_slot_free_notify(struct block_device *bdev,
+			unsigned long index);
+
+/* Which slots zram_writeback() moves to the backing device */
+enum zram_wb_mode {
+	ZRAM_WB_IDLE,
+	ZRAM_WB_HUGE,
+};
+
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_mark_idle(struct zram *zram);
+extern int zram_writeback(struct zram *zram, enum zram_wb_mode mode);
+
+#ifdef CONFIG_ZRAM_BENCH
+extern int zram_bench_init(void);
+extern void zram_bench_exit(void);
+#else
+static inline int zram_bench_init(void) { return 0; }
+static inline void zram_bench_exit(void) { }
+#endif
+
+extern u32 zram_dedup_checksum(void *mem);
+extern struct zram_entry *zram_dedup_find(struct zram *zram, u32 checksum,
+				const void *mem, size_t len);
+extern struct zram_entry *zram_dedup_insert(struct zram *zram, u32 checksum,
+				unsigned long handle, size_t len);
+extern int zram_dedup_put(struct zram *zram, struct zram_entry *entry);
 
 #endif
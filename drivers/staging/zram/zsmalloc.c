@@ -0,0 +1,657 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects of similar size are grouped in size classes. Each class
+ * allocates "zspages": groups of up to ZS_MAX_PAGES_PER_ZSPAGE 0-order
+ * pages carved into equal slots. Unlike xvmalloc, a slot may straddle
+ * the boundary between two pages of its zspage, so the tail of a page
+ * is not wasted. Such objects are mapped through a per-cpu bounce
+ * buffer.
+ *
+ * Callers get an opaque handle rather than a <page, offset> pair: the
+ * handle points to a small descriptor recording where the object
+ * currently lives, which lets zs_compact() move objects out of sparsely
+ * used zspages and give those pages back.
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/list.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+
+#include "zsmalloc.h"
+
+/* Fewer pages per zspage waste less on failure, more pack better */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/*
+ * Handle descriptor flags. Bit 0 pins the object in place while it is
+ * mapped; the class index lives above ZS_HANDLE_CLASS_SHIFT and never
+ * changes for the lifetime of the handle.
+ */
+#define ZS_HANDLE_PIN_BIT	0
+#define ZS_HANDLE_CLASS_SHIFT	8
+
+struct size_class;
+
+struct zspage {
+	struct list_head list;		/* partial or full list of class */
+	struct size_class *class;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	u16 inuse;			/* allocated objects */
+	u16 free_hint;			/* lowest possibly free slot */
+	struct zs_handle *objs[0];	/* owner of each slot, NULL if free */
+};
+
+struct zs_handle {
+	unsigned long flags;
+	struct zspage *zspage;
+	unsigned int obj_idx;
+};
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head partial;	/* zspages with free slots */
+	struct list_head full;
+	u32 size;
+	u32 pages_per_zspage;
+	u32 objs_per_zspage;
+
+	/* stats, protected by lock */
+	u32 objs_used;
+	u32 objs_total;
+	u32 pages_used;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+};
+
+/* Bounce buffer for objects straddling two pages */
+struct zs_map_area {
+	char *buf;
+	void *kaddr;		/* kmap_atomic address if not bounced */
+	enum zs_mapmode mm;
+};
+
+static DEFINE_PER_CPU(struct zs_map_area, zs_map_area);
+
+static struct kmem_cache *zs_handle_cachep;
+
+static int get_size_class_index(size_t size)
+{
+	if (size <= ZS_MIN_ALLOC_SIZE)
+		return 0;
+
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA);
+}
+
+static struct size_class *handle_class(struct zs_pool *pool,
+					struct zs_handle *handle)
+{
+	return &pool->size_class[handle->flags >> ZS_HANDLE_CLASS_SHIFT];
+}
+
+/*
+ * Pick the number of pages per zspage which leaves the least unused
+ * space at the end of the zspage for objects of the given size.
+ */
+static u32 get_pages_per_zspage(u32 size)
+{
+	u32 i, best = 1, max_usedpc = 0;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		u32 zspage_size = i * PAGE_SIZE;
+		u32 waste = zspage_size % size;
+		u32 usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+static void free_zspage(struct zspage *zspage)
+{
+	u32 i;
+
+	for (i = 0; i < zspage->class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	u32 i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage) + class->objs_per_zspage *
+			sizeof(zspage->objs[0]), flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	zspage->class = class;
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(flags);
+		if (!zspage->pages[i])
+			goto fail;
+	}
+
+	return zspage;
+
+fail:
+	while (i)
+		__free_page(zspage->pages[--i]);
+	kfree(zspage);
+	return NULL;
+}
+
+/* Caller must hold class->lock and zspage must have a free slot */
+static void obj_attach(struct size_class *class, struct zspage *zspage,
+			struct zs_handle *handle)
+{
+	u32 idx = zspage->free_hint;
+
+	while (zspage->objs[idx])
+		idx++;
+
+	zspage->objs[idx] = handle;
+	zspage->free_hint = idx + 1;
+	handle->zspage = zspage;
+	handle->obj_idx = idx;
+
+	if (++zspage->inuse == class->objs_per_zspage)
+		list_move(&zspage->list, &class->full);
+	class->objs_used++;
+}
+
+/*
+ * Caller must hold class->lock. Returns true if the zspage became
+ * empty, in which case it has been unlinked from the class and the
+ * caller must free it once the lock is dropped.
+ */
+static bool obj_detach(struct size_class *class, struct zspage *zspage,
+			u32 idx)
+{
+	zspage->objs[idx] = NULL;
+	if (idx < zspage->free_hint)
+		zspage->free_hint = idx;
+
+	if (zspage->inuse-- == class->objs_per_zspage)
+		list_move(&zspage->list, &class->partial);
+	class->objs_used--;
+
+	if (zspage->inuse)
+		return false;
+
+	list_del(&zspage->list);
+	class->objs_total -= class->objs_per_zspage;
+	class->pages_used -= class->pages_per_zspage;
+	return true;
+}
+
+/* Index within zspage->pages[] and offset within that page of a slot */
+static void obj_location(struct zspage *zspage, u32 idx,
+			u32 *page_idx, u32 *offset)
+{
+	unsigned long off = (unsigned long)idx * zspage->class->size;
+
+	*page_idx = off >> PAGE_SHIFT;
+	*offset = off & ~PAGE_MASK;
+}
+
+/*
+ * Copy an object between two slots of the same class. Either slot may
+ * straddle a page boundary, so copy in chunks that stay within a page
+ * on both sides.
+ */
+static void obj_copy(struct zspage *d_zspage, u32 d_idx,
+			struct zspage *s_zspage, u32 s_idx)
+{
+	u32 size = s_zspage->class->size;
+	unsigned long d_off = (unsigned long)d_idx * size;
+	unsigned long s_off = (unsigned long)s_idx * size;
+
+	while (size) {
+		u32 d_poff = d_off & ~PAGE_MASK;
+		u32 s_poff = s_off & ~PAGE_MASK;
+		u32 len = min3(size, (u32)PAGE_SIZE - d_poff,
+				(u32)PAGE_SIZE - s_poff);
+		unsigned char *s_addr, *d_addr;
+
+		s_addr = kmap_atomic(s_zspage->pages[s_off >> PAGE_SHIFT],
+					KM_USER0);
+		d_addr = kmap_atomic(d_zspage->pages[d_off >> PAGE_SHIFT],
+					KM_USER1);
+		memcpy(d_addr + d_poff, s_addr + s_poff, len);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		d_off += len;
+		s_off += len;
+		size -= len;
+	}
+}
+
+/**
+ * zs_create_pool - create a pool from which to allocate objects
+ *
+ * Returns NULL if the pool descriptor could not be allocated.
+ */
+struct zs_pool *zs_create_pool(void)
+{
+	int i;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock_init(&class->lock);
+		INIT_LIST_HEAD(&class->partial);
+		INIT_LIST_HEAD(&class->full);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+						PAGE_SIZE / class->size;
+	}
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+/*
+ * All objects must have been freed by the caller; any leftovers are
+ * reported and their memory reclaimed.
+ */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		struct zspage *zspage, *tmp;
+
+		if (class->objs_used)
+			pr_info("zsmalloc: freeing %u live objects of "
+				"size %u\n", class->objs_used, class->size);
+
+		list_splice_init(&class->full, &class->partial);
+		list_for_each_entry_safe(zspage, tmp, &class->partial, list) {
+			u32 idx;
+
+			for (idx = 0; idx < class->objs_per_zspage; idx++)
+				if (zspage->objs[idx])
+					kmem_cache_free(zs_handle_cachep,
+							zspage->objs[idx]);
+			list_del(&zspage->list);
+			free_zspage(zspage);
+		}
+	}
+
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - allocate block of given size from pool
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ * @flags: flags for any page allocation
+ *
+ * Returns an opaque handle to the object, or 0 on failure.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags)
+{
+	int class_idx;
+	struct zspage *zspage;
+	struct zs_handle *handle;
+	struct size_class *class;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = kmem_cache_alloc(zs_handle_cachep, flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+
+	class_idx = get_size_class_index(size);
+	class = &pool->size_class[class_idx];
+	handle->flags = (unsigned long)class_idx << ZS_HANDLE_CLASS_SHIFT;
+
+	spin_lock(&class->lock);
+	if (list_empty(&class->partial)) {
+		spin_unlock(&class->lock);
+
+		zspage = alloc_zspage(class, flags);
+		if (!zspage) {
+			kmem_cache_free(zs_handle_cachep, handle);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		list_add(&zspage->list, &class->partial);
+		class->objs_total += class->objs_per_zspage;
+		class->pages_used += class->pages_per_zspage;
+	}
+
+	zspage = list_first_entry(&class->partial, struct zspage, list);
+	obj_attach(class, zspage, handle);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+/*
+ * The object must not be mapped; callers serialize zs_free() against
+ * their own users of the handle.
+ */
+void zs_free(struct zs_pool *pool, unsigned long obj)
+{
+	bool empty;
+	struct zspage *zspage;
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct size_class *class = handle_class(pool, handle);
+
+	spin_lock(&class->lock);
+	zspage = handle->zspage;
+	empty = obj_detach(class, zspage, handle->obj_idx);
+	spin_unlock(&class->lock);
+
+	if (empty)
+		free_zspage(zspage);
+	kmem_cache_free(zs_handle_cachep, handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle
+ * @pool: pool from which the object was allocated
+ * @obj: handle returned from zs_malloc
+ * @mm: access the caller intends; lets straddling objects skip a copy
+ *
+ * The object is pinned against compaction and preemption is disabled
+ * until zs_unmap_object(). Only one object per CPU may be mapped at a
+ * time.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long obj,
+			enum zs_mapmode mm)
+{
+	u32 page_idx, off, size, first;
+	struct zspage *zspage;
+	struct zs_map_area *area;
+	unsigned char *addr;
+	struct zs_handle *handle = (struct zs_handle *)obj;
+
+	bit_spin_lock(ZS_HANDLE_PIN_BIT, &handle->flags);
+
+	zspage = handle->zspage;
+	size = zspage->class->size;
+	obj_location(zspage, handle->obj_idx, &page_idx, &off);
+
+	area = &__get_cpu_var(zs_map_area);
+	area->mm = mm;
+
+	if (off + size <= PAGE_SIZE) {
+		area->kaddr = kmap_atomic(zspage->pages[page_idx], KM_USER1);
+		return area->kaddr + off;
+	}
+
+	/* Object straddles two pages: bounce it */
+	area->kaddr = NULL;
+	if (mm == ZS_MM_WO)
+		return area->buf;
+
+	first = PAGE_SIZE - off;
+
+	addr = kmap_atomic(zspage->pages[page_idx], KM_USER1);
+	memcpy(area->buf, addr + off, first);
+	kunmap_atomic(addr, KM_USER1);
+
+	addr = kmap_atomic(zspage->pages[page_idx + 1], KM_USER1);
+	memcpy(area->buf + first, addr, size - first);
+	kunmap_atomic(addr, KM_USER1);
+
+	return area->buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long obj)
+{
+	u32 page_idx, off, size, first;
+	struct zspage *zspage;
+	struct zs_map_area *area;
+	unsigned char *addr;
+	struct zs_handle *handle = (struct zs_handle *)obj;
+
+	area = &__get_cpu_var(zs_map_area);
+
+	if (area->kaddr) {
+		kunmap_atomic(area->kaddr, KM_USER1);
+		goto out;
+	}
+
+	if (area->mm == ZS_MM_RO)
+		goto out;
+
+	zspage = handle->zspage;
+	size = zspage->class->size;
+	obj_location(zspage, handle->obj_idx, &page_idx, &off);
+	first = PAGE_SIZE - off;
+
+	addr = kmap_atomic(zspage->pages[page_idx], KM_USER1);
+	memcpy(addr + off, area->buf, first);
+	kunmap_atomic(addr, KM_USER1);
+
+	addr = kmap_atomic(zspage->pages[page_idx + 1], KM_USER1);
+	memcpy(addr, area->buf + first, size - first);
+	kunmap_atomic(addr, KM_USER1);
+
+out:
+	bit_spin_unlock(ZS_HANDLE_PIN_BIT, &handle->flags);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/*
+ * Move objects from @src into free slots of @dst until @src is empty
+ * or @dst is full. Objects that are currently mapped cannot be moved;
+ * returns -EBUSY if one was met. Caller must hold class->lock.
+ */
+static int migrate_zspage(struct size_class *class, struct zspage *src,
+			struct zspage *dst, unsigned long *nr_moved)
+{
+	u32 s_idx;
+
+	for (s_idx = 0; s_idx < class->objs_per_zspage; s_idx++) {
+		struct zs_handle *handle = src->objs[s_idx];
+
+		if (!handle)
+			continue;
+
+		if (dst->inuse == class->objs_per_zspage)
+			break;
+
+		if (!bit_spin_trylock(ZS_HANDLE_PIN_BIT, &handle->flags))
+			return -EBUSY;
+
+		/* Attach first so that dst cannot be freed by the detach */
+		obj_attach(class, dst, handle);
+		obj_copy(dst, handle->obj_idx, src, s_idx);
+		obj_detach(class, src, s_idx);
+		(*nr_moved)++;
+
+		bit_spin_unlock(ZS_HANDLE_PIN_BIT, &handle->flags);
+
+		if (!src->inuse)
+			break;
+	}
+
+	return 0;
+}
+
+/*
+ * Empty the least used partial zspage of a class into the most used
+ * ones while enough free slots are scattered around to release at
+ * least one zspage. Returns the number of pages released.
+ */
+static unsigned long compact_class(struct size_class *class,
+				unsigned long *nr_moved)
+{
+	unsigned long freed = 0;
+	LIST_HEAD(free_list);
+	struct zspage *zspage, *tmp;
+
+	spin_lock(&class->lock);
+	while (class->objs_total - class->objs_used >=
+			class->objs_per_zspage) {
+		struct zspage *src = NULL, *dst = NULL;
+
+		list_for_each_entry(zspage, &class->partial, list) {
+			if (!src || zspage->inuse < src->inuse)
+				src = zspage;
+		}
+		list_for_each_entry(zspage, &class->partial, list) {
+			if (zspage != src && (!dst ||
+					zspage->inuse > dst->inuse))
+				dst = zspage;
+		}
+
+		if (!src || !dst)
+			break;
+
+		if (migrate_zspage(class, src, dst, nr_moved))
+			break;
+
+		if (!src->inuse) {
+			/* obj_detach already unlinked it from the class */
+			list_add(&src->list, &free_list);
+			freed += class->pages_per_zspage;
+		}
+	}
+	spin_unlock(&class->lock);
+
+	list_for_each_entry_safe(zspage, tmp, &free_list, list) {
+		list_del(&zspage->list);
+		free_zspage(zspage);
+	}
+
+	return freed;
+}
+
+/**
+ * zs_compact - release sparsely used zspages by moving their objects
+ * @pool: pool to compact
+ *
+ * Mapped objects are skipped, so this may be called at any time.
+ * Returns the number of pages given back to the system.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0, nr_moved = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++)
+		freed += compact_class(&pool->size_class[i], &nr_moved);
+
+	pr_debug("zsmalloc: compaction moved %lu objects, freed %lu pages\n",
+		nr_moved, freed);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	int i;
+	u64 npages = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++)
+		npages += pool->size_class[i].pages_used;
+
+	return npages << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+/*
+ * Snapshot of per-class usage. Returns -EINVAL once class_idx is past
+ * the last class, so callers can simply iterate from 0.
+ */
+int zs_get_class_stats(struct zs_pool *pool, int class_idx,
+			struct zs_class_stats *stats)
+{
+	struct size_class *class;
+
+	if (class_idx < 0 || class_idx >= ZS_SIZE_CLASSES)
+		return -EINVAL;
+
+	class = &pool->size_class[class_idx];
+
+	spin_lock(&class->lock);
+	stats->size = class->size;
+	stats->pages_per_zspage = class->pages_per_zspage;
+	stats->objs_used = class->objs_used;
+	stats->objs_total = class->objs_total;
+	stats->pages_used = class->pages_used;
+	spin_unlock(&class->lock);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(zs_get_class_stats);
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	zs_handle_cachep = kmem_cache_create("zs_handle",
+				sizeof(struct zs_handle), 0, 0, NULL);
+	if (!zs_handle_cachep)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct zs_map_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto fail;
+	}
+
+	return 0;
+
+fail:
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu(zs_map_area, cpu).buf);
+	kmem_cache_destroy(zs_handle_cachep);
+	zs_handle_cachep = NULL;
+	return -ENOMEM;
+}
+
+module_init(zs_init);
@@ -1,9 +1,10 @@
 #include <linux/fb.h>
 #include <linux/delay.h>
-#include "../../rk29_fb.h"
+#include <linux/rk_fb.h>
 #include <mach/gpio.h>
 #include <mach/iomux.h>
-#include "screen.h"
+#include <mach/board.h>
+#include <linux/rk_screen.h>
 
 /* Base */
 #define OUT_TYPE		SCREEN_MCU
@@ -383,7 +384,38 @@ int lcd_disparea(u8 area)
 
 }
 
-void set_lcd_info(struct rk29fb_screen *screen)
+/*
+ * Point the panel memory window at a rect for the next frame: column
+ * and page address set for scan direction 0, as set up by lcd_init(),
+ * then memory write so that the lcdc data lands at its top left.
+ */
+int lcd_set_area(u16 xpos, u16 ypos, u16 xsize, u16 ysize)
+{
+    u32 x1 = xpos + xsize - 1;
+    u32 y1 = ypos + ysize - 1;
+
+    if(!xsize || !ysize || x1 >= H_VD || y1 >= V_VD)
+        return -EINVAL;
+
+    mcu_ioctl(MCU_SETBYPASS, 1);
+
+    Set_LCD_8B_REG(0x2a,0X00,(xpos>>8)&0xff);
+    Set_LCD_8B_REG(0x2a,0X01,xpos&0xff);
+    Set_LCD_8B_REG(0x2a,0X02,(x1>>8)&0xff);
+    Set_LCD_8B_REG(0x2a,0X03,x1&0xff);
+
+    Set_LCD_8B_REG(0x2b,0X00,(ypos>>8)&0xff);
+    Set_LCD_8B_REG(0x2b,0X01,ypos&0xff);
+    Set_LCD_8B_REG(0x2b,0X02,(y1>>8)&0xff);
+    Set_LCD_8B_REG(0x2b,0X03,y1&0xff);
+    Set_LCD_8B_REG(0x2c,0X00,-1);
+
+    mcu_ioctl(MCU_SETBYPASS, 0);
+
+    return 0;
+}
+
+void set_lcd_info(struct rk29fb_screen *screen, struct rk29lcd_info *lcd_info)
 {
     /* screen type & face */
     screen->type = OUT_TYPE;
@@ -428,6 +460,7 @@ void set_lcd_info(struct rk29fb_screen *screen)
     screen->scandir = lcd_scandir;
     screen->refresh = lcd_refresh;
     screen->disparea = lcd_disparea;
+    screen->set_area = lcd_set_area;
 }
 
 
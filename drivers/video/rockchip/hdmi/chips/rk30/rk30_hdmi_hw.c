@@ -19,6 +19,7 @@ int rk30_hdmi_initial(void)
 	hdmi->remove = rk30_hdmi_removed ;
 	hdmi->control_output = rk30_hdmi_control_output;
 	hdmi->config_video = rk30_hdmi_config_video;
+	hdmi->switch_video = rk30_hdmi_switch_video;
 	hdmi->config_audio = rk30_hdmi_config_audio;
 	hdmi->detect_hotplug = rk30_hdmi_detect_hotplug;
 	hdmi->read_edid = rk30_hdmi_read_edid;
@@ -359,24 +360,12 @@ static void rk30_hdmi_config_csc(struct hdmi_video_para *vpara)
 	HDMIWrReg(AV_CTRL2, v_CSC_ENABLE(1));
 }
 
-int rk30_hdmi_config_video(struct hdmi_video_para *vpara)
+// Video format and timing, everything but the phy and the power mode.
+static int rk30_hdmi_config_timing(struct hdmi_video_para *vpara)
 {
 	int value;
 	struct fb_videomode *mode;
 	
-	hdmi_dbg(hdmi->dev, "[%s]\n", __FUNCTION__);
-	if(vpara == NULL) {
-		hdmi_err(hdmi->dev, "[%s] input parameter error\n", __FUNCTION__);
-		return -1;
-	}
-	if(hdmi->pwr_mode == PWR_SAVE_MODE_E)
-		rk30_hdmi_set_pwr_mode(PWR_SAVE_MODE_D);
-	if(hdmi->pwr_mode == PWR_SAVE_MODE_D || hdmi->pwr_mode == PWR_SAVE_MODE_A)
-		rk30_hdmi_set_pwr_mode(PWR_SAVE_MODE_B);
-	
-	if(hdmi->hdcp_power_off_cb)
-		hdmi->hdcp_power_off_cb();
-		
 	// Input video mode is RGB24bit, Data enable signal from external
 	HDMIMskReg(value, AV_CTRL1, m_INPUT_VIDEO_MODE | m_DE_SIGNAL_SELECT, \
 		v_INPUT_VIDEO_MODE(vpara->input_mode) | EXTERNAL_DE)	
@@ -447,12 +436,56 @@ int rk30_hdmi_config_video(struct hdmi_video_para *vpara)
 	else {
 		hdmi_dbg(hdmi->dev, "[%s] sucess output DVI.\n", __FUNCTION__);	
 	}
+	return 0;
+}
+
+int rk30_hdmi_config_video(struct hdmi_video_para *vpara)
+{
+	int rc;
 	
+	hdmi_dbg(hdmi->dev, "[%s]\n", __FUNCTION__);
+	if(vpara == NULL) {
+		hdmi_err(hdmi->dev, "[%s] input parameter error\n", __FUNCTION__);
+		return -1;
+	}
+	if(hdmi->pwr_mode == PWR_SAVE_MODE_E)
+		rk30_hdmi_set_pwr_mode(PWR_SAVE_MODE_D);
+	if(hdmi->pwr_mode == PWR_SAVE_MODE_D || hdmi->pwr_mode == PWR_SAVE_MODE_A)
+		rk30_hdmi_set_pwr_mode(PWR_SAVE_MODE_B);
+	
+	if(hdmi->hdcp_power_off_cb)
+		hdmi->hdcp_power_off_cb();
+	
+	rc = rk30_hdmi_config_timing(vpara);
+	if(rc)
+		return rc;
 	rk30_hdmi_config_phy(vpara->vic);
 	rk30_hdmi_control_output(0);
 	return 0;
 }
 
+/*
+ * Retime a running link. The phy settings and the audio N/CTS only depend
+ * on the TMDS clock, so as long as it does not change the output stays in
+ * power mode E and the link is not retrained; otherwise the caller has to
+ * go through rk30_hdmi_config_video.
+ */
+int rk30_hdmi_switch_video(struct hdmi_video_para *vpara)
+{
+	const struct fb_videomode *mode;
+	
+	if(vpara == NULL || hdmi->pwr_mode != PWR_SAVE_MODE_E)
+		return -EINVAL;
+	mode = hdmi_vic_to_videomode(vpara->vic);
+	if(mode == NULL || mode->pixclock != hdmi->tmdsclk)
+		return -EINVAL;
+	
+	hdmi_dbg(hdmi->dev, "[%s] vic %d\n", __FUNCTION__, vpara->vic);
+	if(hdmi->hdcp_power_off_cb)
+		hdmi->hdcp_power_off_cb();
+	return rk30_hdmi_config_timing(vpara);
+}
+
 static void rk30_hdmi_config_aai(void)
 {
 	int i;
@@ -416,6 +416,7 @@ extern int rk30_hdmi_detect_hotplug(void);
 extern int rk30_hdmi_read_edid(int block, unsigned char *buff);
 extern int rk30_hdmi_removed(void);
 extern int rk30_hdmi_config_video(struct hdmi_video_para *vpara);
+extern int rk30_hdmi_switch_video(struct hdmi_video_para *vpara);
 extern int rk30_hdmi_config_audio(struct hdmi_audio *audio);
 extern void rk30_hdmi_control_output(int enable);
 
@@ -7,6 +7,8 @@
 #include <linux/mutex.h>
 #include <linux/device.h>
 #include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
 #include <linux/display-sys.h>
 #ifdef CONFIG_SWITCH
 #include <linux/switch.h>
@@ -187,8 +189,11 @@ enum hdmi_state{
 	CONFIG_VIDEO,
 	CONFIG_AUDIO,
 	PLAY_BACK,
+	SWITCH_VIDEO,
 };
 
+#define HDMI_STATE_NUM	(SWITCH_VIDEO + 1)
+
 // HDMI configuration command
 enum hdmi_change {
 	HDMI_CONFIG_NONE = 0,
@@ -293,10 +298,16 @@ struct hdmi {
 	int yscale;					// y directoon scale value
 	int tmdsclk;				// TDMS Clock frequency
 	
+	s64 stage_us[HDMI_STATE_NUM];	// time the last hotplug/mode change spent in each state
+	ktime_t config_start;		// hotplug or mode change being configured, 0 if none
+	s64 config_us;				// last hotplug/mode change to playback time
+	
 	int (*insert)(void);
 	int (*remove)(void);
 	void (*control_output)(int enable);
 	int (*config_video)(struct hdmi_video_para *vpara);
+	// optional, change the video timing of a running link without retraining it
+	int (*switch_video)(struct hdmi_video_para *vpara);
 	int (*config_audio)(struct hdmi_audio *audio);
 	int (*detect_hotplug)(void);
 	// call back for edid
@@ -325,6 +336,8 @@ extern int hdmi_set_info(struct rk29fb_screen *screen, unsigned int vic);
 extern void hdmi_init_lcdc(struct rk29fb_screen *screen, struct rk29lcd_info *lcd_info);
 extern int hdmi_sys_init(void);
 extern int hdmi_sys_parse_edid(struct hdmi* hdmi);
+extern void hdmi_edid_free(struct hdmi_edid *pedid);
+extern void hdmi_edid_debugfs_init(struct dentry *dir);
 extern const char *hdmi_get_video_mode_name(unsigned char vic);
 extern int hdmi_videomode_to_vic(struct fb_videomode *vmode);
 extern const struct fb_videomode* hdmi_vic_to_videomode(int vic);
@@ -333,5 +346,6 @@ extern struct hdmi_video_timing * hdmi_find_mode(int vic);
 extern int hdmi_find_best_mode(struct hdmi* hdmi, int vic);
 extern int hdmi_ouputmode_select(struct hdmi *hdmi, int edid_ok);
 extern int hdmi_switch_fb(struct hdmi *hdmi, int vic);
+extern int hdmi_retime_fb(struct hdmi *hdmi, int vic);
 extern void hdmi_work(struct work_struct *work);
 #endif
@@ -1,3 +1,6 @@
+#include <linux/slab.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
 #include "rk_hdmi.h"
 #include "../../edid.h"
 
@@ -352,11 +355,163 @@ static int hdmi_edid_parse_extensions(unsigned char *buf, struct hdmi_edid *pedi
 }
 
 
+/*
+	@Des	Parse the base block in base, then the extension blocks got
+		from read_block into buff. Used for the sink and for EDIDs
+		written to debugfs.
+ */
+static int hdmi_edid_parse_blocks(struct hdmi_edid *pedid, unsigned char *base, unsigned char *buff,
+				  int (*read_block)(void *data, int block, unsigned char *buff), void *data)
+{
+	int rc, extendblock = 0, i;
+	
+	rc = hdmi_edid_parse_base(base, &extendblock, pedid);
+	if(rc)
+	{
+		hdmi_edid_error("[EDID] parse edid base block error\n");
+		return rc;
+	}
+	for(i = 1; i < extendblock + 1; i++)
+	{
+		memset(buff, 0 , HDMI_EDID_BLOCK_SIZE);
+		rc = read_block(data, i, buff);
+		if(rc)
+		{
+			hdmi_edid_error("[EDID] read edid block %d error\n", i);
+			return rc;
+		}
+		rc = hdmi_edid_parse_extensions(buff, pedid);
+		if(rc)
+		{
+			hdmi_edid_error("[EDID] parse edid block %d error\n", i);
+			continue;
+		}
+	}
+	return rc;
+}
+
+void hdmi_edid_free(struct hdmi_edid *pedid)
+{
+	fb_destroy_modelist(&pedid->modelist);
+	if(pedid->audio)
+		kfree(pedid->audio);
+	if(pedid->specs)
+	{
+		if(pedid->specs->modedb)
+			kfree(pedid->specs->modedb);
+		kfree(pedid->specs);
+	}
+	memset(pedid, 0, sizeof(struct hdmi_edid));
+	INIT_LIST_HEAD(&pedid->modelist);
+}
+
+static int hdmi_edid_copy(struct hdmi_edid *dst, const struct hdmi_edid *src)
+{
+	struct fb_modelist *modelist;
+	
+	memset(dst, 0, sizeof(struct hdmi_edid));
+	INIT_LIST_HEAD(&dst->modelist);
+	dst->sink_hdmi = src->sink_hdmi;
+	dst->ycbcr444 = src->ycbcr444;
+	dst->ycbcr422 = src->ycbcr422;
+	dst->deepcolor = src->deepcolor;
+	if(src->specs)
+	{
+		dst->specs = kmemdup(src->specs, sizeof(struct fb_monspecs), GFP_KERNEL);
+		if(dst->specs == NULL)
+			goto err;
+		dst->specs->modedb = NULL;
+		if(src->specs->modedb)
+		{
+			dst->specs->modedb = kmemdup(src->specs->modedb, src->specs->modedb_len * sizeof(struct fb_videomode), GFP_KERNEL);
+			if(dst->specs->modedb == NULL)
+				goto err;
+		}
+	}
+	if(src->audio)
+	{
+		dst->audio = kmemdup(src->audio, src->audio_num * sizeof(struct hdmi_audio), GFP_KERNEL);
+		if(dst->audio == NULL)
+			goto err;
+		dst->audio_num = src->audio_num;
+	}
+	// the list is sorted, adding in order appends each mode
+	list_for_each_entry(modelist, &src->modelist, list)
+	{
+		if(hdmi_add_videomode(&modelist->mode, &dst->modelist))
+			goto err;
+	}
+	return 0;
+err:
+	hdmi_edid_free(dst);
+	return -ENOMEM;
+}
+
+/*
+ * Parse results of the last sinks seen, so that replugging a sink or
+ * resuming does not read and parse its extension blocks again. A sink is
+ * recognized by its base block, which holds its serial number; the
+ * extension blocks are assumed not to change behind the same base block.
+ * Only used from hdmi_work, which is serialized.
+ */
+#define HDMI_EDID_CACHE_SIZE	4
+
+struct hdmi_edid_cache {
+	unsigned char base[HDMI_EDID_BLOCK_SIZE];
+	struct hdmi_edid edid;				//parse result, before output mode selection
+	unsigned long stamp;				//last use, 0 if the entry is free
+};
+
+static struct hdmi_edid_cache edid_cache[HDMI_EDID_CACHE_SIZE];
+static unsigned long edid_cache_stamp, edid_cache_hits, edid_cache_misses;
+
+static struct hdmi_edid_cache *hdmi_edid_cache_find(const unsigned char *base)
+{
+	int i;
+	
+	for(i = 0; i < HDMI_EDID_CACHE_SIZE; i++)
+	{
+		// compare the checksums first
+		if(edid_cache[i].stamp && edid_cache[i].base[HDMI_EDID_BLOCK_SIZE - 1] == base[HDMI_EDID_BLOCK_SIZE - 1] &&
+		   !memcmp(edid_cache[i].base, base, HDMI_EDID_BLOCK_SIZE))
+			return &edid_cache[i];
+	}
+	return NULL;
+}
+
+static void hdmi_edid_cache_add(const unsigned char *base, const struct hdmi_edid *pedid)
+{
+	struct hdmi_edid_cache *entry = &edid_cache[0];
+	int i;
+	
+	// replace a free or the least recently used entry
+	for(i = 1; i < HDMI_EDID_CACHE_SIZE; i++)
+	{
+		if(edid_cache[i].stamp < entry->stamp)
+			entry = &edid_cache[i];
+	}
+	if(entry->stamp)
+		hdmi_edid_free(&entry->edid);
+	entry->stamp = 0;
+	if(hdmi_edid_copy(&entry->edid, pedid))
+		return;
+	memcpy(entry->base, base, HDMI_EDID_BLOCK_SIZE);
+	entry->stamp = ++edid_cache_stamp;
+}
+
+static int hdmi_edid_read_sink(void *data, int block, unsigned char *buff)
+{
+	struct hdmi *hdmi = data;
+	
+	return hdmi->read_edid(block, buff);
+}
+
 int hdmi_sys_parse_edid(struct hdmi* hdmi)
 {
 	struct hdmi_edid *pedid;
+	struct hdmi_edid_cache *cache;
 	unsigned char *buff = NULL;
-	int rc = HDMI_ERROR_SUCESS, extendblock = 0, i;
+	int rc = HDMI_ERROR_SUCESS;
 	
 	if(hdmi == NULL)
 		return HDMI_ERROR_FALSE;
@@ -365,7 +520,8 @@ int hdmi_sys_parse_edid(struct hdmi* hdmi)
 	memset(pedid, 0, sizeof(struct hdmi_edid));
 	INIT_LIST_HEAD(&pedid->modelist);
 	
-	buff = kmalloc(HDMI_EDID_BLOCK_SIZE, GFP_KERNEL);
+	// base block, followed by room for one extension block
+	buff = kmalloc(HDMI_EDID_BLOCK_SIZE * 2, GFP_KERNEL);
 	if(buff == NULL)
 	{		
 		hdmi_dbg(hdmi->dev, "[%s] can not allocate memory for edid buff.\n", __FUNCTION__);
@@ -379,31 +535,121 @@ int hdmi_sys_parse_edid(struct hdmi* hdmi)
 		dev_err(hdmi->dev, "[HDMI] read edid base block error\n");
 		goto out;
 	}
-	rc = hdmi_edid_parse_base(buff, &extendblock, pedid);
-	if(rc)
+	cache = hdmi_edid_cache_find(buff);
+	if(cache && hdmi_edid_copy(pedid, &cache->edid) == 0)
 	{
-		dev_err(hdmi->dev, "[HDMI] parse edid base block error\n");
+		hdmi_dbg(hdmi->dev, "[HDMI] edid of this sink is cached\n");
+		cache->stamp = ++edid_cache_stamp;
+		edid_cache_hits++;
 		goto out;
 	}
-	for(i = 1; i < extendblock + 1; i++)
-	{
-		memset(buff, 0 , HDMI_EDID_BLOCK_SIZE);
-		rc = hdmi->read_edid(i, buff);
-		if(rc)
-		{
-			printk("[HDMI] read edid block %d error\n", i);	
-			goto out;
-		}
-		rc = hdmi_edid_parse_extensions(buff, pedid);
-		if(rc)
-		{
-			dev_err(hdmi->dev, "[HDMI] parse edid block %d error\n", i);
-			continue;
-		}
-	}
+	edid_cache_misses++;
+	rc = hdmi_edid_parse_blocks(pedid, buff, buff + HDMI_EDID_BLOCK_SIZE, hdmi_edid_read_sink, hdmi);
+	if(rc)
+		dev_err(hdmi->dev, "[HDMI] parse edid error\n");
+	else
+		hdmi_edid_cache_add(buff, pedid);
 out:
 	if(buff)
 		kfree(buff);
 	rc = hdmi_ouputmode_select(hdmi, rc);
 	return rc;
 }
+
+/*
+ * debugfs "edid": writing a raw EDID, base block and extension blocks in
+ * a single write, runs it through the parser; reading shows the result.
+ * Lets the parser be checked against EDIDs collected from sinks.
+ */
+#define HDMI_EDID_DEBUGFS_BLOCKS	8
+
+struct hdmi_edid_blob {
+	const unsigned char *data;
+	int blocks;
+};
+
+static DEFINE_MUTEX(edid_debugfs_lock);
+static struct hdmi_edid edid_debugfs;
+static int edid_debugfs_rc = -ENODATA;
+
+static int hdmi_edid_read_blob(void *data, int block, unsigned char *buff)
+{
+	struct hdmi_edid_blob *blob = data;
+	
+	if(block >= blob->blocks)
+		return HDMI_ERROR_FALSE;
+	memcpy(buff, blob->data + block * HDMI_EDID_BLOCK_SIZE, HDMI_EDID_BLOCK_SIZE);
+	return 0;
+}
+
+static int hdmi_edid_debugfs_show(struct seq_file *s, void *v)
+{
+	struct hdmi_edid *pedid = &edid_debugfs;
+	struct fb_modelist *modelist;
+	int i;
+	
+	seq_printf(s, "cache: %lu hits %lu misses\n", edid_cache_hits, edid_cache_misses);
+	mutex_lock(&edid_debugfs_lock);
+	seq_printf(s, "result: %d\n", edid_debugfs_rc);
+	if(pedid->specs)
+		seq_printf(s, "monitor: %s %s\n", pedid->specs->manufacturer, pedid->specs->monitor);
+	seq_printf(s, "sink_hdmi %d ycbcr444 %d ycbcr422 %d deepcolor 0x%02x\n",
+		   pedid->sink_hdmi, pedid->ycbcr444, pedid->ycbcr422, pedid->deepcolor);
+	for(i = 0; i < pedid->audio_num; i++)
+		seq_printf(s, "audio: type %u channel %u rate 0x%02x word_length 0x%02x\n",
+			   pedid->audio[i].type, pedid->audio[i].channel, pedid->audio[i].rate,
+			   pedid->audio[i].type == HDMI_AUDIO_LPCM ? pedid->audio[i].word_length : 0);
+	list_for_each_entry(modelist, &pedid->modelist, list)
+		seq_printf(s, "mode: %d %s\n", hdmi_videomode_to_vic(&modelist->mode),
+			   modelist->mode.name ? modelist->mode.name : "");
+	mutex_unlock(&edid_debugfs_lock);
+	return 0;
+}
+
+static int hdmi_edid_debugfs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hdmi_edid_debugfs_show, NULL);
+}
+
+static ssize_t hdmi_edid_debugfs_write(struct file *file, const char __user *ubuf,
+				       size_t count, loff_t *ppos)
+{
+	struct hdmi_edid_blob blob;
+	unsigned char *buff;
+	
+	if(count == 0 || count % HDMI_EDID_BLOCK_SIZE || count > HDMI_EDID_DEBUGFS_BLOCKS * HDMI_EDID_BLOCK_SIZE)
+		return -EINVAL;
+	// the blob, followed by room for one extension block
+	buff = kmalloc(count + HDMI_EDID_BLOCK_SIZE, GFP_KERNEL);
+	if(buff == NULL)
+		return -ENOMEM;
+	if(copy_from_user(buff, ubuf, count))
+	{
+		kfree(buff);
+		return -EFAULT;
+	}
+	blob.data = buff;
+	blob.blocks = count / HDMI_EDID_BLOCK_SIZE;
+	
+	mutex_lock(&edid_debugfs_lock);
+	hdmi_edid_free(&edid_debugfs);
+	edid_debugfs_rc = hdmi_edid_parse_blocks(&edid_debugfs, buff, buff + count, hdmi_edid_read_blob, &blob);
+	mutex_unlock(&edid_debugfs_lock);
+	kfree(buff);
+	return count;
+}
+
+static const struct file_operations hdmi_edid_debugfs_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hdmi_edid_debugfs_open,
+	.read		= seq_read,
+	.write		= hdmi_edid_debugfs_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+void hdmi_edid_debugfs_init(struct dentry *dir)
+{
+	INIT_LIST_HEAD(&edid_debugfs.modelist);
+	debugfs_create_file("edid", 0644, dir, NULL, &hdmi_edid_debugfs_fops);
+}
@@ -517,6 +517,33 @@ int hdmi_switch_fb(struct hdmi *hdmi, int vic)
 	return rc;
 }
 
+/**
+ * hdmi_retime_fb: change the lcdc timing to the video mode of a running link
+ * @hdmi: 
+ * @vic: the new video mode
+ * 
+ * NOTES:
+ * Without blanking and only at the pixel clock the lcdc runs at, any
+ * other change goes through hdmi_switch_fb.
+ */
+int hdmi_retime_fb(struct hdmi *hdmi, int vic)
+{
+	int rc = 0;
+	rk_screen *screen;
+	
+	screen =  kzalloc(sizeof(struct rk29fb_screen), GFP_KERNEL);
+	if(screen == NULL)
+		return -1;
+	
+	rc = hdmi_set_info(screen, vic);
+	if(rc == 0)
+		rc = rk_fb_switch_timing(screen, hdmi->xscale, hdmi->yscale, hdmi->lcdc->id);
+	
+	kfree(screen);
+	
+	return rc;
+}
+
 /**
  * hdmi_get_status: get hdmi hotplug status
  * 
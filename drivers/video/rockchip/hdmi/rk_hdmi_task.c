@@ -1,5 +1,6 @@
 #include <linux/kernel.h>
 #include <linux/delay.h>
+#include <linux/seq_file.h>
 #include "rk_hdmi.h"
 
 #ifdef CONFIG_RK_HDMI_CTL_CODEC
@@ -11,41 +12,75 @@ extern void codec_set_spk(bool on);
 
 static char *envp[] = {"INTERFACE=HDMI", NULL};
 
+static const char * const hdmi_state_name[HDMI_STATE_NUM] = {
+	[HDMI_SLEEP]		= "HDMI_SLEEP",
+	[HDMI_INITIAL]		= "HDMI_INITIAL",
+	[WAIT_HOTPLUG]		= "WAIT_HOTPLUG",
+	[READ_PARSE_EDID]	= "READ_PARSE_EDID",
+	[WAIT_HDMI_ENABLE]	= "WAIT_HDMI_ENABLE",
+	[SYSTEM_CONFIG]		= "SYSTEM_CONFIG",
+	[CONFIG_VIDEO]		= "CONFIG_VIDEO",
+	[CONFIG_AUDIO]		= "CONFIG_AUDIO",
+	[PLAY_BACK]			= "PLAY_BACK",
+	[SWITCH_VIDEO]		= "SWITCH_VIDEO",
+};
+
 static void hdmi_sys_show_state(int state)
 {
-	switch(state)
+	if(state >= 0 && state < HDMI_STATE_NUM)
+		dev_printk(KERN_INFO, hdmi->dev, "%s\n", hdmi_state_name[state]);
+	else
+		dev_printk(KERN_INFO, hdmi->dev, "Unkown State %d\n", state);
+}
+
+static int hdmi_timing_show(struct seq_file *s, void *v)
+{
+	int i;
+	
+	// states the last hotplug or mode change did not go through are left out
+	for(i = 0; i < HDMI_STATE_NUM; i++)
 	{
-		case HDMI_SLEEP:
-			dev_printk(KERN_INFO, hdmi->dev, "HDMI_SLEEP\n");
-			break;
-		case HDMI_INITIAL:
-			dev_printk(KERN_INFO, hdmi->dev, "HDMI_INITIAL\n");
-			break;
-		case WAIT_HOTPLUG:
-			dev_printk(KERN_INFO, hdmi->dev, "WAIT_HOTPLUG\n");
-			break;
-		case READ_PARSE_EDID:
-			dev_printk(KERN_INFO, hdmi->dev, "READ_PARSE_EDID\n");
-			break;
-		case WAIT_HDMI_ENABLE:
-			dev_printk(KERN_INFO, hdmi->dev, "WAIT_HDMI_ENABLE\n");
-			break;
-		case SYSTEM_CONFIG:
-			dev_printk(KERN_INFO, hdmi->dev, "SYSTEM_CONFIG\n");
-			break;
-		case CONFIG_VIDEO:
-			dev_printk(KERN_INFO, hdmi->dev, "CONFIG_VIDEO\n");
-			break;
-		case CONFIG_AUDIO:
-			dev_printk(KERN_INFO, hdmi->dev, "CONFIG_AUDIO\n");
-			break;
-		case PLAY_BACK:
-			dev_printk(KERN_INFO, hdmi->dev, "PLAY_BACK\n");
-			break;
-		default:
-			dev_printk(KERN_INFO, hdmi->dev, "Unkown State %d\n", state);
-			break;
+		if(hdmi->stage_us[i])
+			seq_printf(s, "%-16s %lld us\n", hdmi_state_name[i], hdmi->stage_us[i]);
 	}
+	seq_printf(s, "%-16s %lld us\n", "total", hdmi->config_us);
+	return 0;
+}
+
+static int hdmi_timing_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hdmi_timing_show, NULL);
+}
+
+static const struct file_operations hdmi_timing_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hdmi_timing_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void hdmi_debugfs_init(void)
+{
+	static struct dentry *dir;
+	
+	if(dir)
+		return;
+	dir = debugfs_create_dir("hdmi", NULL);
+	if(IS_ERR_OR_NULL(dir))
+	{
+		dir = NULL;
+		return;
+	}
+	debugfs_create_file("timing", 0444, dir, NULL, &hdmi_timing_fops);
+	hdmi_edid_debugfs_init(dir);
+}
+
+/* Start timing a hotplug or a mode change, up to playback */
+static void hdmi_config_start(void)
+{
+	memset(hdmi->stage_us, 0, sizeof(hdmi->stage_us));
+	hdmi->config_start = ktime_get();
 }
 
 int hdmi_sys_init(void)
@@ -63,22 +98,13 @@ int hdmi_sys_init(void)
 	
 	memset(&hdmi->edid, 0, sizeof(struct hdmi_edid));
 	INIT_LIST_HEAD(&hdmi->edid.modelist);
+	hdmi_debugfs_init();
 	return 0;
 }
 
 void hdmi_sys_remove(void)
 {
-	fb_destroy_modelist(&hdmi->edid.modelist);
-	if(hdmi->edid.audio)
-		kfree(hdmi->edid.audio);
-	if(hdmi->edid.specs)
-	{
-		if(hdmi->edid.specs->modedb)
-			kfree(hdmi->edid.specs->modedb);
-		kfree(hdmi->edid.specs);
-	}
-	memset(&hdmi->edid, 0, sizeof(struct hdmi_edid));
-	INIT_LIST_HEAD(&hdmi->edid.modelist);
+	hdmi_edid_free(&hdmi->edid);
 	hdmi->display	= HDMI_DISABLE;
 	rk_fb_switch_screen(hdmi->lcdc->screen1, 0, hdmi->lcdc->id);
 	kobject_uevent_env(&hdmi->dev->kobj, KOBJ_REMOVE, envp);
@@ -145,6 +171,12 @@ static int hdmi_process_command(void)
 			case HDMI_CONFIG_VIDEO:
 			default:
 				if(state > SYSTEM_CONFIG)
+					hdmi_config_start();
+				// a running link is only retimed if the hardware can
+				if(change == HDMI_CONFIG_VIDEO && state == PLAY_BACK &&
+				   hdmi->display == HDMI_ENABLE && hdmi->switch_video)
+					state = SWITCH_VIDEO;
+				else if(state > SYSTEM_CONFIG)
 					state = SYSTEM_CONFIG;
 				else
 				{
@@ -161,6 +193,24 @@ static int hdmi_process_command(void)
 	return state;
 }
 
+static void hdmi_init_video_para(struct hdmi_video_para *video)
+{
+	video->vic = hdmi->vic;
+	video->input_mode = VIDEO_INPUT_RGB_YCBCR_444;
+	video->input_color = VIDEO_INPUT_COLOR_RGB;//VIDEO_INPUT_COLOR_YCBCR
+	video->output_mode = hdmi->edid.sink_hdmi;
+	
+	if(hdmi->edid.ycbcr444)
+		video->output_color = VIDEO_OUTPUT_YCBCR444;
+	else if(hdmi->edid.ycbcr422)
+		video->output_color = VIDEO_OUTPUT_YCBCR422;
+	else
+		video->output_color = VIDEO_OUTPUT_RGB444;
+	// For DVI, output RGB
+	if(hdmi->edid.sink_hdmi == 0)
+		video->output_color = VIDEO_OUTPUT_RGB444;
+}
+
 static DEFINE_MUTEX(work_mutex);
 
 void hdmi_work(struct work_struct *work)
@@ -168,6 +218,8 @@ void hdmi_work(struct work_struct *work)
 	int hotplug, state_last;
 	int rc = HDMI_ERROR_SUCESS, trytimes = 0;
 	struct hdmi_video_para video;
+	ktime_t start;
+	int timing;
 	
 	mutex_lock(&work_mutex);
 	/* Process hdmi command */
@@ -183,6 +235,7 @@ void hdmi_work(struct work_struct *work)
 	if(hotplug != hdmi->hotplug)
 	{
 		if(hotplug  == HDMI_HPD_ACTIVED){
+			hdmi_config_start();
 			if(hdmi->insert)
 				hdmi->insert();
 			hdmi->state = READ_PARSE_EDID;
@@ -215,6 +268,8 @@ void hdmi_work(struct work_struct *work)
 	do {
 		hdmi_sys_show_state(hdmi->state);
 		state_last = hdmi->state;
+		timing = hdmi->config_start.tv64 != 0;
+		start = ktime_get();
 		switch(hdmi->state)
 		{
 			case READ_PARSE_EDID:
@@ -242,21 +297,7 @@ void hdmi_work(struct work_struct *work)
 				break;
 			case CONFIG_VIDEO:
 				hdmi->display = HDMI_DISABLE;
-				video.vic = hdmi->vic;
-				video.input_mode = VIDEO_INPUT_RGB_YCBCR_444;
-				video.input_color = VIDEO_INPUT_COLOR_RGB;//VIDEO_INPUT_COLOR_YCBCR
-				video.output_mode = hdmi->edid.sink_hdmi;
-				
-				if(hdmi->edid.ycbcr444)
-					video.output_color = VIDEO_OUTPUT_YCBCR444;
-				else if(hdmi->edid.ycbcr422)
-					video.output_color = VIDEO_OUTPUT_YCBCR422;
-				else
-					video.output_color = VIDEO_OUTPUT_RGB444;
-				// For DVI, output RGB
-				if(hdmi->edid.sink_hdmi == 0)
-					video.output_color = VIDEO_OUTPUT_RGB444;
-				
+				hdmi_init_video_para(&video);
 				rc = hdmi->config_video(&video);
 				if(rc == HDMI_ERROR_SUCESS)
 				{
@@ -281,14 +322,40 @@ void hdmi_work(struct work_struct *work)
 					}
 				}
 				
+				if(hdmi->config_start.tv64) {
+					hdmi->config_us = ktime_us_delta(ktime_get(), hdmi->config_start);
+					hdmi->config_start.tv64 = 0;
+					hdmi_dbg(hdmi->dev, "[%s] configured in %lld us\n", __FUNCTION__, hdmi->config_us);
+				}
 				if(hdmi->wait == 1) {	
 					complete(&hdmi->complete);
 					hdmi->wait = 0;						
 				}
 				break;
+			case SWITCH_VIDEO:
+				if(hdmi->autoconfig)	
+					hdmi->vic = hdmi_find_best_mode(hdmi, 0);
+				else
+					hdmi->vic = hdmi_find_best_mode(hdmi, hdmi->vic);
+				// lcdc and link are only retimed at the same pixel/TMDS clock
+				hdmi_init_video_para(&video);
+				if(hdmi_retime_fb(hdmi, hdmi->vic) == HDMI_ERROR_SUCESS &&
+				   hdmi->switch_video(&video) == HDMI_ERROR_SUCESS) {
+					if(hdmi->hdcp_cb)
+						hdmi->hdcp_cb();
+					hdmi->state = PLAY_BACK;
+				}
+				else {
+					// reload the lcdc and retrain the link
+					hdmi->display = HDMI_DISABLE;
+					hdmi->state = SYSTEM_CONFIG;
+				}
+				break;
 			default:
 				break;
 		}
+		if(timing && state_last >= 0 && state_last < HDMI_STATE_NUM)
+			hdmi->stage_us[state_last] += ktime_us_delta(ktime_get(), start);
 		if(rc != HDMI_ERROR_SUCESS)
 		{
 			trytimes++;
@@ -127,6 +127,63 @@ static int rk30_lcdc_deinit(struct rk30_lcdc_device *lcdc_dev)
 	return 0;
 }
 
+/* lcdc the MCU panel hangs off, for the panel commands below */
+static struct rk30_lcdc_device *mcu_lcdc;
+
+/*
+ * Commands and data to a MCU panel in bypass mode, the interface the
+ * panel files share with rk29_fb.
+ */
+int mcu_ioctl(unsigned int cmd, unsigned long arg)
+{
+	struct rk30_lcdc_device *lcdc_dev = mcu_lcdc;
+
+	if(!lcdc_dev)
+		return -ENODEV;
+
+	spin_lock(&lcdc_dev->reg_lock);
+	if(likely(lcdc_dev->clk_on))
+	{
+		switch(cmd)
+		{
+			case MCU_WRCMD:
+				LcdClrBit(lcdc_dev, MCU_CTRL, m_MCU_RS_SELECT);
+				LcdWrReg(lcdc_dev, MCU_BYPASS_WPORT, arg);
+				LcdSetBit(lcdc_dev, MCU_CTRL, m_MCU_RS_SELECT);
+				break;
+			case MCU_WRDATA:
+				LcdSetBit(lcdc_dev, MCU_CTRL, m_MCU_RS_SELECT);
+				LcdWrReg(lcdc_dev, MCU_BYPASS_WPORT, arg);
+				break;
+			case MCU_SETBYPASS:
+				LcdMskReg(lcdc_dev, MCU_CTRL, m_MCU_BYPASSMODE_SELECT, v_MCU_BYPASSMODE_SELECT(arg));
+				LCDC_REG_CFG_DONE();
+				break;
+			default:
+				break;
+		}
+	}
+	spin_unlock(&lcdc_dev->reg_lock);
+
+	return 0;
+}
+
+// sync, porch and active area; right_margin is passed as a MCU panel stretches it
+static void dsp_timing_set_reg(struct rk30_lcdc_device *lcdc_dev,rk_screen *screen,u16 right_margin)
+{
+	u16 x_res = screen->x_res, y_res = screen->y_res;
+
+	LcdWrReg(lcdc_dev, DSP_HTOTAL_HS_END,v_HSYNC(screen->hsync_len) |
+             v_HORPRD(screen->hsync_len + screen->left_margin + x_res + right_margin));
+	LcdWrReg(lcdc_dev, DSP_HACT_ST_END, v_HAEP(screen->hsync_len + screen->left_margin + x_res) |
+             v_HASP(screen->hsync_len + screen->left_margin));
+
+	LcdWrReg(lcdc_dev, DSP_VTOTAL_VS_END, v_VSYNC(screen->vsync_len) |
+              v_VERPRD(screen->vsync_len + screen->upper_margin + y_res + screen->lower_margin));
+	LcdWrReg(lcdc_dev, DSP_VACT_ST_END,  v_VAEP(screen->vsync_len + screen->upper_margin+y_res)|
+              v_VASP(screen->vsync_len + screen->upper_margin));
+}
+
 static int rk30_load_screen(struct rk_lcdc_device_driver *dev_drv, bool initscreen)
 {
 	int ret = -EINVAL;
@@ -137,8 +194,7 @@ static int rk30_load_screen(struct rk_lcdc_device_driver *dev_drv, bool initscre
 	u16 face;
 	u16 mcu_total, mcu_rwstart, mcu_csstart, mcu_rwend, mcu_csend;
 	u16 right_margin = screen->right_margin;
-	u16 lower_margin = screen->lower_margin;
-	u16 x_res = screen->x_res, y_res = screen->y_res;
+	u16 x_res = screen->x_res;
 
 	// set the rgb or mcu
 	spin_lock(&lcdc_dev->reg_lock);
@@ -146,6 +202,7 @@ static int rk30_load_screen(struct rk_lcdc_device_driver *dev_drv, bool initscre
 	{
 		if(screen->type==SCREEN_MCU)
 		{
+			mcu_lcdc = lcdc_dev;
 	    		LcdMskReg(lcdc_dev, MCU_CTRL, m_MCU_OUTPUT_SELECT,v_MCU_OUTPUT_SELECT(1));
 			// set out format and mcu timing
 	   		mcu_total  = (screen->mcu_wrperiod*150*1000)/1000000;
@@ -216,15 +273,7 @@ static int rk30_load_screen(struct rk_lcdc_device_driver *dev_drv, bool initscre
 		 	v_BLACK_MODE(0));
 
 		
-		LcdWrReg(lcdc_dev, DSP_HTOTAL_HS_END,v_HSYNC(screen->hsync_len) |
-	             v_HORPRD(screen->hsync_len + screen->left_margin + x_res + right_margin));
-		LcdWrReg(lcdc_dev, DSP_HACT_ST_END, v_HAEP(screen->hsync_len + screen->left_margin + x_res) |
-	             v_HASP(screen->hsync_len + screen->left_margin));
-
-		LcdWrReg(lcdc_dev, DSP_VTOTAL_VS_END, v_VSYNC(screen->vsync_len) |
-	              v_VERPRD(screen->vsync_len + screen->upper_margin + y_res + lower_margin));
-		LcdWrReg(lcdc_dev, DSP_VACT_ST_END,  v_VAEP(screen->vsync_len + screen->upper_margin+y_res)|
-	              v_VASP(screen->vsync_len + screen->upper_margin));
+		dsp_timing_set_reg(lcdc_dev,screen,right_margin);
 		// let above to take effect
 		LCDC_REG_CFG_DONE();
 	}
@@ -257,10 +306,190 @@ static int rk30_load_screen(struct rk_lcdc_device_driver *dev_drv, bool initscre
 	return 0;
 }
 
-static int mcu_refresh(struct rk30_lcdc_device *lcdc_dev)
+/* what mcu_refresh() narrows to the band, put back once the band frame started */
+static const u16 mcu_band_regs[] = {
+	offsetof(LCDC_REG,WIN0_ACT_INFO),
+	offsetof(LCDC_REG,WIN0_DSP_ST),
+	offsetof(LCDC_REG,WIN0_DSP_INFO),
+	offsetof(LCDC_REG,WIN0_YRGB_MST0),
+	offsetof(LCDC_REG,WIN0_CBR_MST0),
+	offsetof(LCDC_REG,WIN1_ACT_INFO),
+	offsetof(LCDC_REG,WIN1_DSP_ST),
+	offsetof(LCDC_REG,WIN1_DSP_INFO),
+	offsetof(LCDC_REG,WIN1_YRGB_MST),
+	offsetof(LCDC_REG,WIN1_CBR_MST),
+	offsetof(LCDC_REG,WIN2_DSP_ST),
+	offsetof(LCDC_REG,WIN2_DSP_INFO),
+	offsetof(LCDC_REG,WIN2_MST),
+	offsetof(LCDC_REG,DSP_VTOTAL_VS_END),
+	offsetof(LCDC_REG,DSP_VACT_ST_END),
+};
+#define MCU_BAND_REGS	ARRAY_SIZE(mcu_band_regs)
+
+#define mcu_band_bak(lcdc_dev,i) \
+	((volatile u32 *)((char *)&(lcdc_dev)->regbak + mcu_band_regs[i]))
+#define mcu_band_reg(lcdc_dev,i) \
+	((volatile u32 *)((char *)(lcdc_dev)->preg + mcu_band_regs[i]))
+
+/*
+ * A MCU panel keeps the picture in its own memory and the lcdc holds
+ * after each frame, so only the rows covering rect are sent: the panel
+ * memory window and the lcdc active area shrink to that band and the
+ * windows move up with it. A window crossing the top of the band starts
+ * at its first line inside; scaled or yuv windows cannot be cut like
+ * that and turn the refresh into a full frame, as do panels without
+ * set_area. Once the band frame started, and so latched its registers,
+ * the full screen values are written back, except where someone else
+ * wrote a newer value meanwhile. Returns the number of pixels sent.
+ */
+static int mcu_refresh(struct rk30_lcdc_device *lcdc_dev,struct rk_fb_rect *rect)
 {
-   
-    return 0;
+	struct rk_lcdc_device_driver *dev_drv = &lcdc_dev->driver;
+	rk_screen *screen = dev_drv->cur_screen;
+	struct layer_par *par;
+	u16 hasp = screen->hsync_len + screen->left_margin;
+	u16 vasp = screen->vsync_len + screen->upper_margin;
+	u16 y0 = rect->ypos,h = rect->ysize;
+	u16 ypos,yact,ysize;
+	u32 y_addr,skip;
+	u32 full[MCU_BAND_REGS],band[MCU_BAND_REGS];
+	unsigned long flags;
+	int i;
+
+	if(screen->type != SCREEN_MCU)
+		return -EINVAL;
+
+	spin_lock(&lcdc_dev->reg_lock);
+	if(unlikely(!lcdc_dev->clk_on))
+	{
+		spin_unlock(&lcdc_dev->reg_lock);
+		return -EPERM;
+	}
+	if(LcdReadBit(lcdc_dev,MCU_CTRL,m_MCU_HOLDMODE_FRAME_ST))
+	{
+		spin_unlock(&lcdc_dev->reg_lock);
+		return -EBUSY;
+	}
+
+	if(!screen->set_area)
+	{
+		y0 = 0;
+		h = screen->y_res;
+	}
+	for(i = 0; i < 3; i++)
+	{
+		par = dev_drv->layer_par[i];
+		if(!(lcdc_dev->regbak.SYS_CTRL1 & (m_W0_EN << i)))
+			continue;
+		if((par->ypos < y0) && ((par->ypos + par->ysize) > y0) &&
+			((par->yact != par->ysize) || (par->format > RGB565)))
+		{
+			y0 = 0;
+			h = screen->y_res;
+		}
+	}
+
+	for(i = 0; i < MCU_BAND_REGS; i++)
+		full[i] = *mcu_band_bak(lcdc_dev,i);
+
+	for(i = 0; i < 3; i++)
+	{
+		par = dev_drv->layer_par[i];
+		if(!(lcdc_dev->regbak.SYS_CTRL1 & (m_W0_EN << i)))
+			continue;
+		y_addr = par->smem_start + par->y_offset;
+		ypos = par->ypos;
+		yact = par->yact;
+		ysize = par->ysize;
+		if((par->ypos + par->ysize) <= y0)	//above the band,move it out of the active area
+		{
+			ypos = h;
+		}
+		else if(par->ypos >= y0)
+		{
+			ypos = par->ypos - y0;
+		}
+		else
+		{
+			skip = y0 - par->ypos;
+			y_addr += skip * par->xvir * ((par->format == RGB565) ? 2 : ((par->format == RGB888) ? 3 : 4));
+			ypos = 0;
+			yact -= skip;
+			ysize -= skip;
+		}
+
+		switch(i)
+		{
+			case 0:
+				LcdWrReg(lcdc_dev, WIN0_ACT_INFO,v_ACT_WIDTH(par->xact) | v_ACT_HEIGHT(yact));
+				LcdWrReg(lcdc_dev, WIN0_DSP_ST,v_DSP_STX((par->xpos + hasp)) | v_DSP_STY((ypos + vasp)));
+				LcdWrReg(lcdc_dev, WIN0_DSP_INFO,v_DSP_WIDTH(par->xsize) | v_DSP_HEIGHT(ysize));
+				LcdWrReg(lcdc_dev, WIN0_YRGB_MST0, y_addr);
+				LcdWrReg(lcdc_dev, WIN0_CBR_MST0, par->cbr_start + par->c_offset);
+				break;
+			case 1:
+				LcdWrReg(lcdc_dev, WIN1_ACT_INFO,v_ACT_WIDTH(par->xact) | v_ACT_HEIGHT(yact));
+				LcdWrReg(lcdc_dev, WIN1_DSP_ST,v_DSP_STX((par->xpos + hasp)) | v_DSP_STY((ypos + vasp)));
+				LcdWrReg(lcdc_dev, WIN1_DSP_INFO,v_DSP_WIDTH(par->xsize) | v_DSP_HEIGHT(ysize));
+				LcdWrReg(lcdc_dev, WIN1_YRGB_MST, y_addr);
+				LcdWrReg(lcdc_dev, WIN1_CBR_MST, par->cbr_start + par->c_offset);
+				break;
+			case 2:
+				LcdWrReg(lcdc_dev, WIN2_DSP_ST,v_DSP_STX((par->xpos + hasp)) | v_DSP_STY((ypos + vasp)));
+				LcdWrReg(lcdc_dev, WIN2_DSP_INFO,v_DSP_WIDTH(par->xsize) | v_DSP_HEIGHT(ysize));
+				LcdWrReg(lcdc_dev, WIN2_MST, y_addr);
+				break;
+		}
+	}
+
+	LcdWrReg(lcdc_dev, DSP_VTOTAL_VS_END, v_VSYNC(screen->vsync_len) |
+		v_VERPRD((vasp + h + screen->lower_margin)));
+	LcdWrReg(lcdc_dev, DSP_VACT_ST_END, v_VAEP((vasp + h)) | v_VASP(vasp));
+	LCDC_REG_CFG_DONE();
+	for(i = 0; i < MCU_BAND_REGS; i++)
+		band[i] = *mcu_band_bak(lcdc_dev,i);
+	spin_unlock(&lcdc_dev->reg_lock);
+
+	if(screen->set_area)
+		screen->set_area(0,y0,screen->x_res,h);
+
+	spin_lock_irqsave(&dev_drv->cpl_lock,flags);
+	init_completion(&dev_drv->frame_done);
+	spin_unlock_irqrestore(&dev_drv->cpl_lock,flags);
+
+	spin_lock(&lcdc_dev->reg_lock);
+	if(likely(lcdc_dev->clk_on))
+	{
+		LcdMskReg(lcdc_dev, MCU_CTRL, m_MCU_HOLDMODE_FRAME_ST, v_MCU_HOLDMODE_FRAME_ST(1));
+	}
+	spin_unlock(&lcdc_dev->reg_lock);
+
+	if(!wait_for_completion_timeout(&dev_drv->frame_done,msecs_to_jiffies(screen->ft+5)))
+		printk(KERN_ERR "lcdc%d: mcu band frame did not start\n",lcdc_dev->id);
+
+	spin_lock(&lcdc_dev->reg_lock);
+	for(i = 0; i < MCU_BAND_REGS; i++)	//regbak too when off,resume writes it back
+	{
+		if(*mcu_band_bak(lcdc_dev,i) != band[i])
+			continue;
+		*mcu_band_bak(lcdc_dev,i) = full[i];
+		if(likely(lcdc_dev->clk_on))
+			*mcu_band_reg(lcdc_dev,i) = full[i];
+	}
+	if(likely(lcdc_dev->clk_on))
+	{
+		LCDC_REG_CFG_DONE();
+	}
+	spin_unlock(&lcdc_dev->reg_lock);
+
+	return screen->x_res * h;
+}
+
+static int rk30_lcdc_refresh(struct rk_lcdc_device_driver *dev_drv,struct rk_fb_rect *rect)
+{
+	struct rk30_lcdc_device *lcdc_dev = container_of(dev_drv,struct rk30_lcdc_device,driver);
+
+	return mcu_refresh(lcdc_dev,rect);
 }
 
 
@@ -432,8 +661,8 @@ static  int win2_display(struct rk30_lcdc_device *lcdc_dev,struct layer_par *par
 	return 0;
 }
 
-static  int win0_set_par(struct rk30_lcdc_device *lcdc_dev,rk_screen *screen,
-	struct layer_par *par )
+static void win0_set_reg(struct rk30_lcdc_device *lcdc_dev,rk_screen *screen,
+	struct layer_par *par)
 {
 	u32 xact, yact, xvir, yvir, xpos, ypos;
 	u32 ScaleYrgbX = 0x1000;
@@ -471,50 +700,53 @@ static  int win0_set_par(struct rk30_lcdc_device *lcdc_dev,rk_screen *screen,
 
 	DBG(1,"%s for lcdc%d>>format:%d>>>xact:%d>>yact:%d>>xsize:%d>>ysize:%d>>xvir:%d>>yvir:%d>>xpos:%d>>ypos:%d>>\n",
 		__func__,lcdc_dev->id,par->format,xact,yact,par->xsize,par->ysize,xvir,yvir,xpos,ypos);
-	
+
+	LcdWrReg(lcdc_dev, WIN0_SCL_FACTOR_YRGB, v_X_SCL_FACTOR(ScaleYrgbX) | v_Y_SCL_FACTOR(ScaleYrgbY));
+	LcdWrReg(lcdc_dev, WIN0_SCL_FACTOR_CBR,v_X_SCL_FACTOR(ScaleCbrX)| v_Y_SCL_FACTOR(ScaleCbrY));
+	LcdMskReg(lcdc_dev, SYS_CTRL1, m_W0_FORMAT, v_W0_FORMAT(par->format));		//(inf->video_mode==0)
+	LcdWrReg(lcdc_dev, WIN0_ACT_INFO,v_ACT_WIDTH(xact) | v_ACT_HEIGHT(yact));
+	LcdWrReg(lcdc_dev, WIN0_DSP_ST, v_DSP_STX(xpos) | v_DSP_STY(ypos));
+	LcdWrReg(lcdc_dev, WIN0_DSP_INFO, v_DSP_WIDTH(par->xsize)| v_DSP_HEIGHT(par->ysize));
+	LcdMskReg(lcdc_dev, WIN0_COLOR_KEY_CTRL, m_COLORKEY_EN | m_KEYCOLOR,
+		v_COLORKEY_EN(1) | v_KEYCOLOR(0));
+	switch(par->format) 
+	{
+		case ARGB888:
+			LcdWrReg(lcdc_dev, WIN0_VIR,v_ARGB888_VIRWIDTH(xvir));
+			//LcdMskReg(lcdc_dev,SYS_CTRL1,m_W0_RGB_RB_SWAP,v_W1_RGB_RB_SWAP(1));
+			break;
+		case RGB888:  //rgb888
+			LcdWrReg(lcdc_dev, WIN0_VIR,v_RGB888_VIRWIDTH(xvir));
+			//LcdMskReg(lcdc_dev,SYS_CTRL1,m_W0_RGB_RB_SWAP,v_W0_RGB_RB_SWAP(1));
+			break;
+		case RGB565:  //rgb565
+			LcdWrReg(lcdc_dev, WIN0_VIR,v_RGB565_VIRWIDTH(xvir));
+			break;
+		case YUV422:
+		case YUV420:   
+			LcdWrReg(lcdc_dev, WIN0_VIR,v_YUV_VIRWIDTH(xvir));
+			break;
+		default:
+			LcdWrReg(lcdc_dev, WIN0_VIR,v_RGB888_VIRWIDTH(xvir));
+			break;
+	}
+}
+
+static int win0_set_par(struct rk30_lcdc_device *lcdc_dev,rk_screen *screen,
+	struct layer_par *par )
+{
 	spin_lock(&lcdc_dev->reg_lock);
 	if(likely(lcdc_dev->clk_on))
 	{
-		LcdWrReg(lcdc_dev, WIN0_SCL_FACTOR_YRGB, v_X_SCL_FACTOR(ScaleYrgbX) | v_Y_SCL_FACTOR(ScaleYrgbY));
-		LcdWrReg(lcdc_dev, WIN0_SCL_FACTOR_CBR,v_X_SCL_FACTOR(ScaleCbrX)| v_Y_SCL_FACTOR(ScaleCbrY));
-		LcdMskReg(lcdc_dev, SYS_CTRL1, m_W0_FORMAT, v_W0_FORMAT(par->format));		//(inf->video_mode==0)
-		LcdWrReg(lcdc_dev, WIN0_ACT_INFO,v_ACT_WIDTH(xact) | v_ACT_HEIGHT(yact));
-		LcdWrReg(lcdc_dev, WIN0_DSP_ST, v_DSP_STX(xpos) | v_DSP_STY(ypos));
-		LcdWrReg(lcdc_dev, WIN0_DSP_INFO, v_DSP_WIDTH(par->xsize)| v_DSP_HEIGHT(par->ysize));
-		LcdMskReg(lcdc_dev, WIN0_COLOR_KEY_CTRL, m_COLORKEY_EN | m_KEYCOLOR,
-			v_COLORKEY_EN(1) | v_KEYCOLOR(0));
-		switch(par->format) 
-		{
-			case ARGB888:
-				LcdWrReg(lcdc_dev, WIN0_VIR,v_ARGB888_VIRWIDTH(xvir));
-				//LcdMskReg(lcdc_dev,SYS_CTRL1,m_W0_RGB_RB_SWAP,v_W1_RGB_RB_SWAP(1));
-				break;
-			case RGB888:  //rgb888
-				LcdWrReg(lcdc_dev, WIN0_VIR,v_RGB888_VIRWIDTH(xvir));
-				//LcdMskReg(lcdc_dev,SYS_CTRL1,m_W0_RGB_RB_SWAP,v_W0_RGB_RB_SWAP(1));
-				break;
-			case RGB565:  //rgb565
-				LcdWrReg(lcdc_dev, WIN0_VIR,v_RGB565_VIRWIDTH(xvir));
-				break;
-			case YUV422:
-			case YUV420:   
-				LcdWrReg(lcdc_dev, WIN0_VIR,v_YUV_VIRWIDTH(xvir));
-				break;
-			default:
-				LcdWrReg(lcdc_dev, WIN0_VIR,v_RGB888_VIRWIDTH(xvir));
-				break;
-		}
-
+		win0_set_reg(lcdc_dev,screen,par);
 		LCDC_REG_CFG_DONE();
 	}
 	spin_unlock(&lcdc_dev->reg_lock);
-
-    return 0;
-
+	return 0;
 }
 
-static int win1_set_par(struct rk30_lcdc_device *lcdc_dev,rk_screen *screen,
-	struct layer_par *par )
+static void win1_set_reg(struct rk30_lcdc_device *lcdc_dev,rk_screen *screen,
+	struct layer_par *par)
 {
 	u32 xact, yact, xvir, yvir, xpos, ypos;
 	u32 ScaleYrgbX = 0x1000;
@@ -534,66 +766,70 @@ static int win1_set_par(struct rk30_lcdc_device *lcdc_dev,rk_screen *screen,
 	DBG(1,"%s for lcdc%d>>format:%d>>>xact:%d>>yact:%d>>xsize:%d>>ysize:%d>>xvir:%d>>yvir:%d>>xpos:%d>>ypos:%d>>\n",
 		__func__,lcdc_dev->id,par->format,xact,yact,par->xsize,par->ysize,xvir,yvir,xpos,ypos);
 
-	
+	switch (par->format)
+	{
+		case YUV422:// yuv422
+			ScaleCbrX = CalScale((xact/2), par->xsize);
+			ScaleCbrY = CalScale(yact, par->ysize);
+			break;
+		case YUV420: // yuv420
+			ScaleCbrX = CalScale(xact/2, par->xsize);
+			ScaleCbrY = CalScale(yact/2, par->ysize);
+			break;
+		case YUV444:// yuv444
+			ScaleCbrX = CalScale(xact, par->xsize);
+			ScaleCbrY = CalScale(yact, par->ysize);
+			break;
+		default:
+			break;
+	}
+
+	LcdWrReg(lcdc_dev, WIN1_SCL_FACTOR_YRGB, v_X_SCL_FACTOR(ScaleYrgbX) | v_Y_SCL_FACTOR(ScaleYrgbY));
+	LcdWrReg(lcdc_dev, WIN1_SCL_FACTOR_CBR,  v_X_SCL_FACTOR(ScaleCbrX) | v_Y_SCL_FACTOR(ScaleCbrY));
+	LcdMskReg(lcdc_dev,SYS_CTRL1, m_W1_FORMAT, v_W1_FORMAT(par->format));
+	LcdWrReg(lcdc_dev, WIN1_ACT_INFO,v_ACT_WIDTH(xact) | v_ACT_HEIGHT(yact));
+	LcdWrReg(lcdc_dev, WIN1_DSP_ST,v_DSP_STX(xpos) | v_DSP_STY(ypos));
+	LcdWrReg(lcdc_dev, WIN1_DSP_INFO,v_DSP_WIDTH(par->xsize) | v_DSP_HEIGHT(par->ysize));
+	// enable win1 color key and set the color to black(rgb=0)
+	LcdMskReg(lcdc_dev, WIN1_COLOR_KEY_CTRL, m_COLORKEY_EN | m_KEYCOLOR,v_COLORKEY_EN(1) | v_KEYCOLOR(0));
+	switch(par->format)
+	{
+		case ARGB888:
+			LcdWrReg(lcdc_dev, WIN1_VIR,v_ARGB888_VIRWIDTH(xvir));
+			//LcdMskReg(lcdc_dev,SYS_CTRL1,m_W1_RGB_RB_SWAP,v_W1_RGB_RB_SWAP(1));
+			break;
+		case RGB888:  //rgb888
+			LcdWrReg(lcdc_dev, WIN1_VIR,v_RGB888_VIRWIDTH(xvir));
+			// LcdMskReg(lcdc_dev,SYS_CTRL1,m_W1_RGB_RB_SWAP,v_W1_RGB_RB_SWAP(1));
+			break;
+		case RGB565:  //rgb565
+			LcdWrReg(lcdc_dev, WIN1_VIR,v_RGB565_VIRWIDTH(xvir));
+			break;
+		case YUV422:
+		case YUV420:   
+			LcdWrReg(lcdc_dev, WIN1_VIR,v_YUV_VIRWIDTH(xvir));
+			break;
+		default:
+			LcdWrReg(lcdc_dev, WIN1_VIR,v_RGB888_VIRWIDTH(xvir));
+			break;
+	}
+}
+
+static int win1_set_par(struct rk30_lcdc_device *lcdc_dev,rk_screen *screen,
+	struct layer_par *par )
+{
 	spin_lock(&lcdc_dev->reg_lock);
 	if(likely(lcdc_dev->clk_on))
 	{
-		switch (par->format)
-	 	{
-			case YUV422:// yuv422
-				ScaleCbrX = CalScale((xact/2), par->xsize);
-				ScaleCbrY = CalScale(yact, par->ysize);
-				break;
-			case YUV420: // yuv420
-				ScaleCbrX = CalScale(xact/2, par->xsize);
-				ScaleCbrY = CalScale(yact/2, par->ysize);
-				break;
-			case YUV444:// yuv444
-				ScaleCbrX = CalScale(xact, par->xsize);
-				ScaleCbrY = CalScale(yact, par->ysize);
-				break;
-			default:
-				break;
-		}
-
-		LcdWrReg(lcdc_dev, WIN1_SCL_FACTOR_YRGB, v_X_SCL_FACTOR(ScaleYrgbX) | v_Y_SCL_FACTOR(ScaleYrgbY));
-		LcdWrReg(lcdc_dev, WIN1_SCL_FACTOR_CBR,  v_X_SCL_FACTOR(ScaleCbrX) | v_Y_SCL_FACTOR(ScaleCbrY));
-		LcdMskReg(lcdc_dev,SYS_CTRL1, m_W1_FORMAT, v_W1_FORMAT(par->format));
-		LcdWrReg(lcdc_dev, WIN1_ACT_INFO,v_ACT_WIDTH(xact) | v_ACT_HEIGHT(yact));
-		LcdWrReg(lcdc_dev, WIN1_DSP_ST,v_DSP_STX(xpos) | v_DSP_STY(ypos));
-		LcdWrReg(lcdc_dev, WIN1_DSP_INFO,v_DSP_WIDTH(par->xsize) | v_DSP_HEIGHT(par->ysize));
-		// enable win1 color key and set the color to black(rgb=0)
-		LcdMskReg(lcdc_dev, WIN1_COLOR_KEY_CTRL, m_COLORKEY_EN | m_KEYCOLOR,v_COLORKEY_EN(1) | v_KEYCOLOR(0));
-		switch(par->format)
-	    	{
-		        case ARGB888:
-				LcdWrReg(lcdc_dev, WIN1_VIR,v_ARGB888_VIRWIDTH(xvir));
-				//LcdMskReg(lcdc_dev,SYS_CTRL1,m_W1_RGB_RB_SWAP,v_W1_RGB_RB_SWAP(1));
-				break;
-		        case RGB888:  //rgb888
-				LcdWrReg(lcdc_dev, WIN1_VIR,v_RGB888_VIRWIDTH(xvir));
-				// LcdMskReg(lcdc_dev,SYS_CTRL1,m_W1_RGB_RB_SWAP,v_W1_RGB_RB_SWAP(1));
-				break;
-		        case RGB565:  //rgb565
-				LcdWrReg(lcdc_dev, WIN1_VIR,v_RGB565_VIRWIDTH(xvir));
-				break;
-		        case YUV422:
-		        case YUV420:   
-				LcdWrReg(lcdc_dev, WIN1_VIR,v_YUV_VIRWIDTH(xvir));
-				break;
-		        default:
-				LcdWrReg(lcdc_dev, WIN1_VIR,v_RGB888_VIRWIDTH(xvir));
-				break;
-	    	}
-		
-		LCDC_REG_CFG_DONE(); 
+		win1_set_reg(lcdc_dev,screen,par);
+		LCDC_REG_CFG_DONE();
 	}
 	spin_unlock(&lcdc_dev->reg_lock);
-    return 0;
+	return 0;
 }
 
-static int win2_set_par(struct rk30_lcdc_device *lcdc_dev,rk_screen *screen,
-	struct layer_par *par )
+static void win2_set_reg(struct rk30_lcdc_device *lcdc_dev,rk_screen *screen,
+	struct layer_par *par)
 {
 	u32 xact, yact, xvir, yvir, xpos, ypos;
 	u32 ScaleYrgbX = 0x1000;
@@ -613,42 +849,45 @@ static int win2_set_par(struct rk30_lcdc_device *lcdc_dev,rk_screen *screen,
 	DBG(1,"%s for lcdc%d>>format:%d>>>xact:%d>>yact:%d>>xsize:%d>>ysize:%d>>xvir:%d>>yvir:%d>>xpos:%d>>ypos:%d>>\n",
 		__func__,lcdc_dev->id,par->format,xact,yact,par->xsize,par->ysize,xvir,yvir,xpos,ypos);
 
-	
+	LcdMskReg(lcdc_dev,SYS_CTRL1, m_W2_FORMAT, v_W2_FORMAT(par->format));
+	LcdWrReg(lcdc_dev, WIN2_DSP_ST,v_DSP_STX(xpos) | v_DSP_STY(ypos));
+	LcdWrReg(lcdc_dev, WIN2_DSP_INFO,v_DSP_WIDTH(par->xsize) | v_DSP_HEIGHT(par->ysize));
+	// enable win1 color key and set the color to black(rgb=0)
+	LcdMskReg(lcdc_dev, WIN2_COLOR_KEY_CTRL, m_COLORKEY_EN | m_KEYCOLOR,v_COLORKEY_EN(1) | v_KEYCOLOR(0));
+	switch(par->format)
+	{
+		case ARGB888:
+			LcdWrReg(lcdc_dev, WIN2_VIR,v_ARGB888_VIRWIDTH(xvir));
+			//LcdMskReg(lcdc_dev,SYS_CTRL1,m_W1_RGB_RB_SWAP,v_W1_RGB_RB_SWAP(1));
+			break;
+		case RGB888:  //rgb888
+			LcdWrReg(lcdc_dev, WIN2_VIR,v_RGB888_VIRWIDTH(xvir));
+			// LcdMskReg(lcdc_dev,SYS_CTRL1,m_W1_RGB_RB_SWAP,v_W1_RGB_RB_SWAP(1));
+			break;
+		case RGB565:  //rgb565
+			LcdWrReg(lcdc_dev, WIN2_VIR,v_RGB565_VIRWIDTH(xvir));
+			break;
+		case YUV422:
+		case YUV420:   
+			LcdWrReg(lcdc_dev, WIN2_VIR,v_YUV_VIRWIDTH(xvir));
+			break;
+		default:
+			LcdWrReg(lcdc_dev, WIN2_VIR,v_RGB888_VIRWIDTH(xvir));
+			break;
+	}
+}
+
+static int win2_set_par(struct rk30_lcdc_device *lcdc_dev,rk_screen *screen,
+	struct layer_par *par )
+{
 	spin_lock(&lcdc_dev->reg_lock);
 	if(likely(lcdc_dev->clk_on))
 	{
-
-		LcdMskReg(lcdc_dev,SYS_CTRL1, m_W2_FORMAT, v_W2_FORMAT(par->format));
-		LcdWrReg(lcdc_dev, WIN2_DSP_ST,v_DSP_STX(xpos) | v_DSP_STY(ypos));
-		LcdWrReg(lcdc_dev, WIN2_DSP_INFO,v_DSP_WIDTH(par->xsize) | v_DSP_HEIGHT(par->ysize));
-		// enable win1 color key and set the color to black(rgb=0)
-		LcdMskReg(lcdc_dev, WIN2_COLOR_KEY_CTRL, m_COLORKEY_EN | m_KEYCOLOR,v_COLORKEY_EN(1) | v_KEYCOLOR(0));
-		switch(par->format)
-	    	{
-		        case ARGB888:
-				LcdWrReg(lcdc_dev, WIN2_VIR,v_ARGB888_VIRWIDTH(xvir));
-				//LcdMskReg(lcdc_dev,SYS_CTRL1,m_W1_RGB_RB_SWAP,v_W1_RGB_RB_SWAP(1));
-				break;
-		        case RGB888:  //rgb888
-				LcdWrReg(lcdc_dev, WIN2_VIR,v_RGB888_VIRWIDTH(xvir));
-				// LcdMskReg(lcdc_dev,SYS_CTRL1,m_W1_RGB_RB_SWAP,v_W1_RGB_RB_SWAP(1));
-				break;
-		        case RGB565:  //rgb565
-				LcdWrReg(lcdc_dev, WIN2_VIR,v_RGB565_VIRWIDTH(xvir));
-				break;
-		        case YUV422:
-		        case YUV420:   
-				LcdWrReg(lcdc_dev, WIN2_VIR,v_YUV_VIRWIDTH(xvir));
-				break;
-		        default:
-				LcdWrReg(lcdc_dev, WIN2_VIR,v_RGB888_VIRWIDTH(xvir));
-				break;
-	    	}
-		
-		LcdWrReg(lcdc_dev, REG_CFG_DONE, 0x01); 
+		win2_set_reg(lcdc_dev,screen,par);
+		LcdWrReg(lcdc_dev, REG_CFG_DONE, 0x01);
 	}
 	spin_unlock(&lcdc_dev->reg_lock);
-    return 0;
+	return 0;
 }
 
 static int rk30_lcdc_open(struct rk_lcdc_device_driver *dev_drv,int layer_id,bool open)
@@ -699,6 +938,59 @@ static int rk30_lcdc_set_par(struct rk_lcdc_device_driver *dev_drv,int layer_id)
 	return 0;
 }
 
+/*
+ * Switch a running output to the timing in cur_screen at the same dot
+ * clock: the sync and active area registers and the open windows, which
+ * are placed relative to the porches, are written before a single
+ * REG_CFG_DONE, so the output changes at one frame start and is not
+ * blanked. The caller has set the window sizes for the new screen.
+ */
+static int rk30_lcdc_set_timing(struct rk_lcdc_device_driver *dev_drv)
+{
+	struct rk30_lcdc_device *lcdc_dev = container_of(dev_drv,struct rk30_lcdc_device,driver);
+	rk_screen *screen = dev_drv->cur_screen;
+	u64 ft;
+	int fps,ret = 0;
+
+	if(!screen || screen->type == SCREEN_MCU)
+		return -EINVAL;
+
+	//the frame start interrupt sets REG_CFG_DONE too,it must not latch half of the timing
+	disable_irq(lcdc_dev->irq);
+	spin_lock(&lcdc_dev->reg_lock);
+	if(unlikely(!lcdc_dev->clk_on))
+	{
+		ret = -EPERM;
+		goto out;
+	}
+
+	LcdMskReg(lcdc_dev, DSP_CTRL0, m_HSYNC_POLARITY | m_VSYNC_POLARITY | m_DEN_POLARITY | m_DCLK_POLARITY,
+		v_HSYNC_POLARITY(screen->pin_hsync) | v_VSYNC_POLARITY(screen->pin_vsync) |
+		v_DEN_POLARITY(screen->pin_den) | v_DCLK_POLARITY(screen->pin_dclk));
+	dsp_timing_set_reg(lcdc_dev,screen,screen->right_margin);
+	if(dev_drv->layer_par[0]->state)
+		win0_set_reg(lcdc_dev,screen,dev_drv->layer_par[0]);
+	if(dev_drv->layer_par[1]->state)
+		win1_set_reg(lcdc_dev,screen,dev_drv->layer_par[1]);
+	if(dev_drv->layer_par[2]->state)
+		win2_set_reg(lcdc_dev,screen,dev_drv->layer_par[2]);
+	LCDC_REG_CFG_DONE();
+out:
+	spin_unlock(&lcdc_dev->reg_lock);
+	enable_irq(lcdc_dev->irq);
+	if(ret)
+		return ret;
+
+	ft = (u64)(screen->upper_margin + screen->lower_margin + screen->y_res +screen->vsync_len)*
+		(screen->left_margin + screen->right_margin + screen->x_res + screen->hsync_len)*
+		(dev_drv->pixclock);       // one frame time ,(pico seconds)
+	fps = div64_u64(1000000000000llu,ft);
+	if(fps)
+		screen->ft = 1000/fps;
+	DBG(1,"%s for lcdc%d>>%dx%d ft:%dms\n",__func__,lcdc_dev->id,screen->x_res,screen->y_res,screen->ft);
+	return 0;
+}
+
 int rk30_lcdc_pan_display(struct rk_lcdc_device_driver * dev_drv,int layer_id)
 {
 	struct rk30_lcdc_device *lcdc_dev = container_of(dev_drv,struct rk30_lcdc_device,driver);
@@ -751,6 +1043,194 @@ int rk30_lcdc_pan_display(struct rk_lcdc_device_driver * dev_drv,int layer_id)
 	return 0;
 }
 
+/*
+ * Write a queued flip, from the frame start interrupt. The interrupted
+ * context may hold reg_lock, so do not wait for it: the flip is retried
+ * at the next frame start.
+ */
+static int rk30_lcdc_flip(struct rk_lcdc_device_driver * dev_drv,int layer_id,u32 y_addr,u32 uv_addr)
+{
+	struct rk30_lcdc_device *lcdc_dev = container_of(dev_drv,struct rk30_lcdc_device,driver);
+
+	if(!spin_trylock(&lcdc_dev->reg_lock))
+		return -EBUSY;
+	if(likely(lcdc_dev->clk_on))
+	{
+		switch(layer_id)
+		{
+			case 0:
+				LcdWrReg(lcdc_dev, WIN0_YRGB_MST0, y_addr);
+				LcdWrReg(lcdc_dev, WIN0_CBR_MST0, uv_addr);
+				break;
+			case 1:
+				LcdWrReg(lcdc_dev, WIN1_YRGB_MST, y_addr);
+				LcdWrReg(lcdc_dev, WIN1_CBR_MST, uv_addr);
+				break;
+			case 2:
+				LcdWrReg(lcdc_dev, WIN2_MST, y_addr);
+				break;
+			default:
+				break;
+		}
+		LCDC_REG_CFG_DONE();
+	}
+	spin_unlock(&lcdc_dev->reg_lock);
+
+	return 0;
+}
+
+static int rk30_lcdc_check_overlay(rk_screen *screen,struct rk_fb_overlay_cfg *cfg)
+{
+	struct rk_fb_win_cfg *win;
+	int i;
+
+	for(i = 0; i < RK_FB_OVERLAY_WINS; i++)
+	{
+		win = &cfg->win[i];
+		if(!win->enable)
+			continue;
+		switch(win->format)
+		{
+			case ARGB888:
+			case RGB888:
+			case RGB565:
+				break;
+			case YUV420:
+			case YUV422:
+			case YUV444:
+				if(i == 2)	//win2 has no cbr plane
+					return -EINVAL;
+				break;
+			default:
+				return -EINVAL;
+		}
+		if(!win->y_addr || !win->xact || !win->yact || !win->xsize || !win->ysize)
+			return -EINVAL;
+		if(win->xvir < win->xact)
+			return -EINVAL;
+		if(((win->xpos + win->xsize) > screen->x_res) || ((win->ypos + win->ysize) > screen->y_res))
+			return -EINVAL;
+		if(i == 2)	//win2 has no scaler
+		{
+			if((win->xact != win->xsize) || (win->yact != win->ysize))
+				return -EINVAL;
+		}
+		else if((CalScale(win->xact,win->xsize) > 0xffff) || (CalScale(win->yact,win->ysize) > 0xffff))
+		{
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Set all windows from one FBIOSET_OVERLAY_CONFIG: everything is written
+ * before a single REG_CFG_DONE, so the hardware switches to the new
+ * config at one frame start.
+ */
+static int rk30_lcdc_set_overlay(struct rk_lcdc_device_driver *dev_drv,void __user *argp)
+{
+	struct rk30_lcdc_device *lcdc_dev = container_of(dev_drv,struct rk30_lcdc_device,driver);
+	rk_screen *screen = dev_drv->cur_screen;
+	struct rk_fb_overlay_cfg cfg;
+	struct rk_fb_win_cfg *win;
+	struct layer_par *par;
+	u32 enable = 0,blend = 0,alpha_mode = 0;
+	bool blend_en;
+	int i,cnt = 0,ret;
+
+	if(!screen)
+		return -ENOENT;
+	if(copy_from_user(&cfg,argp,sizeof(cfg)))
+		return -EFAULT;
+	ret = rk30_lcdc_check_overlay(screen,&cfg);
+	if(ret)
+		return ret;
+
+	//the frame start interrupt sets REG_CFG_DONE too,it must not latch half of the config
+	disable_irq(lcdc_dev->irq);
+	spin_lock(&lcdc_dev->reg_lock);
+	if(unlikely(!lcdc_dev->clk_on))
+	{
+		ret = -EPERM;
+		goto out;
+	}
+
+	for(i = 0; i < RK_FB_OVERLAY_WINS; i++)
+	{
+		win = &cfg.win[i];
+		par = dev_drv->layer_par[i];
+		par->state = win->enable;
+		if(!win->enable)
+			continue;
+
+		par->format = win->format;
+		par->xact = win->xact;
+		par->yact = win->yact;
+		par->xvir = win->xvir;
+		par->yvir = win->yact;
+		par->xpos = win->xpos;
+		par->ypos = win->ypos;
+		par->xsize = win->xsize;
+		par->ysize = win->ysize;
+		blend_en = (win->alpha != 0xff) || win->pixel_alpha;
+
+		switch(i)
+		{
+			case 0:
+				win0_set_reg(lcdc_dev,screen,par);
+				LcdWrReg(lcdc_dev, WIN0_YRGB_MST0, win->y_addr);
+				LcdWrReg(lcdc_dev, WIN0_CBR_MST0, win->uv_addr);
+				enable |= v_W0_EN(1);
+				blend |= v_W0_BLEND_EN(blend_en) | v_W0_BLEND_FACTOR(win->alpha);
+				alpha_mode |= v_W0_ALPHA_MODE(win->pixel_alpha);
+				cnt++;
+				break;
+			case 1:
+				win1_set_reg(lcdc_dev,screen,par);
+				LcdWrReg(lcdc_dev, WIN1_YRGB_MST, win->y_addr);
+				LcdWrReg(lcdc_dev, WIN1_CBR_MST, win->uv_addr);
+				enable |= v_W1_EN(1);
+				blend |= v_W1_BLEND_EN(blend_en) | v_W1_BLEND_FACTOR(win->alpha);
+				alpha_mode |= v_W1_ALPHA_MODE(win->pixel_alpha);
+				cnt++;
+				break;
+			case 2:
+				win2_set_reg(lcdc_dev,screen,par);
+				LcdWrReg(lcdc_dev, WIN2_MST, win->y_addr);
+				enable |= v_W2_EN(1);
+				blend |= v_W2_BLEND_EN(blend_en) | v_W2_BLEND_FACTOR(win->alpha);
+				alpha_mode |= v_W2_ALPHA_MODE(win->pixel_alpha);
+				break;
+		}
+	}
+
+	LcdMskReg(lcdc_dev, BLEND_CTRL, m_W0_BLEND_EN | m_W1_BLEND_EN | m_W2_BLEND_EN |
+		m_W0_BLEND_FACTOR | m_W1_BLEND_FACTOR | m_W2_BLEND_FACTOR, blend);
+	LcdMskReg(lcdc_dev, DSP_CTRL0, m_W0_ALPHA_MODE | m_W1_ALPHA_MODE | m_W2_ALPHA_MODE |
+		m_W0W1_POSITION_SWAP, alpha_mode | v_W0W1_POSITION_SWAP(cfg.win0_on_top));
+	LcdMskReg(lcdc_dev, SYS_CTRL1, m_W0_EN | m_W1_EN | m_W2_EN, enable);
+
+	//same standby rule as win0_open/win1_open
+	if(cnt && !lcdc_dev->atv_layer_cnt)
+	{
+		LcdMskReg(lcdc_dev, SYS_CTRL0,m_LCDC_STANDBY,v_LCDC_STANDBY(0));
+	}
+	else if(!cnt && lcdc_dev->atv_layer_cnt)
+	{
+		LcdMskReg(lcdc_dev, SYS_CTRL0,m_LCDC_STANDBY,v_LCDC_STANDBY(1));
+	}
+	lcdc_dev->atv_layer_cnt = cnt;
+
+	LCDC_REG_CFG_DONE();
+out:
+	spin_unlock(&lcdc_dev->reg_lock);
+	enable_irq(lcdc_dev->irq);
+
+	return ret;
+}
+
 int rk30_lcdc_ioctl(struct rk_lcdc_device_driver * dev_drv,unsigned int cmd, unsigned long arg,int layer_id)
 {
 	struct rk30_lcdc_device *lcdc_dev = container_of(dev_drv,struct rk30_lcdc_device,driver);
@@ -765,6 +1245,9 @@ int rk30_lcdc_ioctl(struct rk_lcdc_device_driver * dev_drv,unsigned int cmd, uns
             		if(copy_to_user(argp, panel_size, 8)) 
 				return -EFAULT;
 			break;
+		case FBIOSET_OVERLAY_CONFIG:
+			ret = rk30_lcdc_set_overlay(dev_drv,argp);
+			break;
 		default:
 			break;
 	}
@@ -1184,6 +1667,7 @@ int rk30_lcdc_early_resume(struct rk_lcdc_device_driver *dev_drv)
 static irqreturn_t rk30_lcdc_isr(int irq, void *dev_id)
 {
 	struct rk30_lcdc_device *lcdc_dev = (struct rk30_lcdc_device *)dev_id;
+	ktime_t timestamp = ktime_get();
 	
 	LcdMskReg(lcdc_dev, INT_STATUS, m_FRM_START_INT_CLEAR, v_FRM_START_INT_CLEAR(1));
 	LCDC_REG_CFG_DONE();
@@ -1195,6 +1679,7 @@ static irqreturn_t rk30_lcdc_isr(int irq, void *dev_id)
 		complete(&(lcdc_dev->driver.frame_done));
 		spin_unlock(&(lcdc_dev->driver.cpl_lock));
 	}
+	rk_fb_flip_isr(&lcdc_dev->driver,timestamp);
 	return IRQ_HANDLED;
 }
 
@@ -1228,7 +1713,10 @@ static struct rk_lcdc_device_driver lcdc_driver = {
 	.set_par       		= rk30_lcdc_set_par,
 	.blank         		= rk30_lcdc_blank,
 	.pan_display            = rk30_lcdc_pan_display,
+	.flip			= rk30_lcdc_flip,
+	.refresh		= rk30_lcdc_refresh,
 	.load_screen		= rk30_load_screen,
+	.set_timing		= rk30_lcdc_set_timing,
 	.get_layer_state	= rk30_lcdc_get_layer_state,
 	.ovl_mgr		= rk30_lcdc_ovl_mgr,
 	.get_disp_info		= rk30_lcdc_get_disp_info,
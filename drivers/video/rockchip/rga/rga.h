@@ -8,11 +8,16 @@
 #define RGA_FLUSH       0x5019
 #define RGA_GET_RESULT  0x501a
 #define RGA_GET_VERSION 0x501b
+#define RGA_BLIT_BATCH  0x501c
 
 
 #define RGA_REG_CTRL_LEN    0x8    /* 8  */
 #define RGA_REG_CMD_LEN     0x1c   /* 28 */
 #define RGA_CMD_BUF_SIZE    0x700  /* 16*28*4 */
+#define RGA_CMD_LIST_MAX    8      /* commands chained in one hw run */
+#define RGA_BATCH_MAX       32     /* requests in one RGA_BLIT_BATCH */
+
+#define RGA_BATCH_SYNC      0x1    /* wait for the whole batch */
 
 #define RGA_OUT_OF_RESOURCES    -10
 #define RGA_MALLOC_ERROR        -11
@@ -328,6 +333,9 @@ typedef struct TILE_INFO
 TILE_INFO;	
 
 
+struct rga_mmu_cache;
+struct rga_mmu_cache_entry;
+
 /**
  * struct for process session which connect to rga
  *
@@ -346,8 +354,20 @@ typedef struct rga_session {
 	pid_t           pid;
 	atomic_t        task_running;
     atomic_t        num_done;
+    struct rga_mmu_cache *mmu_cache;    /* MMU tables of user buffers */
 } rga_session;
 
+/**
+ * struct for RGA_BLIT_BATCH: count requests submitted with one ioctl
+ * and chained in the hardware command list, with one interrupt per
+ * RGA_CMD_LIST_MAX commands instead of one per request.
+ */
+struct rga_batch {
+    uint32_t count;
+    uint32_t flags;             /* RGA_BATCH_SYNC */
+    struct rga_req *reqs;       /* user pointer to count requests */
+};
+
 struct rga_reg {    
     rga_session 		*session;
 	struct list_head	session_link;		/* link to rga service session */
@@ -355,6 +375,9 @@ struct rga_reg {
 	uint32_t  sys_reg[RGA_REG_CTRL_LEN];
     uint32_t  cmd_reg[RGA_REG_CMD_LEN];
     uint32_t *MMU_base;
+    bool      batch;            /* may be chained with the next reg */
+    int       mmu_entries;      /* MMU cache entries held, src and dst */
+    struct rga_mmu_cache_entry *mmu_entry[2];
     //atomic_t int_enable;
         
     //struct rga_req req;
@@ -372,7 +395,7 @@ typedef struct rga_service_info {
     atomic_t		total_running;
     
     struct rga_reg        *reg;
-    uint32_t            cmd_buff[28*8];/* cmd_buff for rga */
+    uint32_t            cmd_buff[28*RGA_CMD_LIST_MAX];/* cmd_buff for rga */
     uint32_t            *pre_scale_buf;
     atomic_t            int_disable;     /* 0 int enable 1 int disable  */
     atomic_t            cmd_num;
@@ -461,6 +484,9 @@ typedef struct rga_service_info {
 
 #define RGA_BLIT_COMPLETE_EVENT 1
 
+int rga_blit_kernel(struct rga_req *req);
+int rga_blit_kernel_hw(struct rga_req *req);
+
 
 
 
@@ -47,6 +47,7 @@
 #include "rga_reg_info.h"
 #include "rga_mmu_info.h"
 #include "RGA_API.h"
+#include "rga_soft.h"
 
 #define RGA_TEST 0
 #define RGA_TEST_TIME 0
@@ -91,6 +92,7 @@ struct rga_drvdata {
 };
 
 static struct rga_drvdata *drvdata;
+static struct dentry *rga_debugfs_dir;
 rga_service_info rga_service;
 
 static int rga_blit_async(rga_session *session, struct rga_req *req);
@@ -384,7 +386,8 @@ static void rga_copy_reg(struct rga_reg *reg, uint32_t offset)
     uint32_t *cmd_buf;
     uint32_t *reg_p;
 
-    if(atomic_read(&reg->session->task_running) != 0)
+    /* only commands chained behind the first may find their session busy */
+    if((offset == 0) && (atomic_read(&reg->session->task_running) != 0))
     {
         printk(KERN_ERR "task_running is no zero\n");
     }
@@ -403,10 +406,27 @@ static void rga_copy_reg(struct rga_reg *reg, uint32_t offset)
     dsb();
 }
 
+/*
+ * Put a new reg on the waiting lists, or on the caller's private
+ * pending list when it is part of a batch that is not complete yet.
+ */
+static void rga_reg_queue(struct rga_reg *reg, struct list_head *pending)
+{
+    if(pending != NULL)
+    {
+        list_add_tail(&reg->status_link, pending);
+        return;
+    }
+
+    mutex_lock(&rga_service.lock);
+	list_add_tail(&reg->status_link, &rga_service.waiting);
+	list_add_tail(&reg->session_link, &reg->session->waiting);
+	mutex_unlock(&rga_service.lock);
+}
 
-static struct rga_reg * rga_reg_init(rga_session *session, struct rga_req *req)
+static struct rga_reg * rga_reg_init(rga_session *session, struct rga_req *req, struct list_head *pending)
 {
-    uint32_t ret;
+    int ret;
 	struct rga_reg *reg = kzalloc(sizeof(struct rga_reg), GFP_KERNEL);
 	if (NULL == reg) {
 		pr_err("kmalloc fail in rga_reg_init\n");
@@ -414,6 +434,7 @@ static struct rga_reg * rga_reg_init(rga_session *session, struct rga_req *req)
 	}
 
     reg->session = session;
+    reg->batch = (pending != NULL);
 	INIT_LIST_HEAD(&reg->session_link);
 	INIT_LIST_HEAD(&reg->status_link);
 
@@ -429,6 +450,7 @@ static struct rga_reg * rga_reg_init(rga_session *session, struct rga_req *req)
             printk("%s, [%d] set mmu info error \n", __FUNCTION__, __LINE__);
             if(reg != NULL)
             {
+                rga_mmu_release(reg);
                 kfree(reg);
             }
             return NULL;
@@ -440,22 +462,20 @@ static struct rga_reg * rga_reg_init(rga_session *session, struct rga_req *req)
         printk("gen reg info error\n");
         if(reg != NULL)
         {
+            rga_mmu_release(reg);
             kfree(reg);
         }
         return NULL;
     }
 
-    mutex_lock(&rga_service.lock);
-	list_add_tail(&reg->status_link, &rga_service.waiting);
-	list_add_tail(&reg->session_link, &session->waiting);
-	mutex_unlock(&rga_service.lock);
+    rga_reg_queue(reg, pending);
 
     return reg;
 }
 
-static struct rga_reg * rga_reg_init_2(rga_session *session, struct rga_req *req0, struct rga_req *req1)
+static struct rga_reg * rga_reg_init_2(rga_session *session, struct rga_req *req0, struct rga_req *req1, struct list_head *pending)
 {
-    uint32_t ret;
+    int ret;
 
     struct rga_reg *reg0, *reg1;
 
@@ -477,10 +497,12 @@ static struct rga_reg * rga_reg_init_2(rga_session *session, struct rga_req *req
     	}
 
         reg0->session = session;
+        reg0->batch = (pending != NULL);
     	INIT_LIST_HEAD(&reg0->session_link);
     	INIT_LIST_HEAD(&reg0->status_link);
 
         reg1->session = session;
+        reg1->batch = (pending != NULL);
         INIT_LIST_HEAD(&reg1->session_link);
     	INIT_LIST_HEAD(&reg1->status_link);
 
@@ -509,22 +531,20 @@ static struct rga_reg * rga_reg_init_2(rga_session *session, struct rga_req *req
 
         RGA_gen_reg_info(req1, (uint8_t *)reg1->cmd_reg);
 
-        mutex_lock(&rga_service.lock);
-    	list_add_tail(&reg0->status_link, &rga_service.waiting);
-        list_add_tail(&reg0->session_link, &session->waiting);
-        list_add_tail(&reg1->status_link, &rga_service.waiting);
-    	list_add_tail(&reg1->session_link, &session->waiting);
-        mutex_unlock(&rga_service.lock);
+        rga_reg_queue(reg0, pending);
+        rga_reg_queue(reg1, pending);
 
         return reg1;
     }
     while(0);
 
     if(reg0 != NULL) {
+        rga_mmu_release(reg0);
         kfree(reg0);
     }
 
     if(reg1 != NULL) {
+        rga_mmu_release(reg1);
         kfree(reg1);
     }
 
@@ -536,6 +556,7 @@ static void rga_reg_deinit(struct rga_reg *reg)
 {
 	list_del_init(&reg->session_link);
 	list_del_init(&reg->status_link);
+	rga_mmu_release(reg);
 	kfree(reg);
 }
 
@@ -565,26 +586,56 @@ static void rga_service_session_clear(rga_session *session)
 	}
 }
 
+/*
+ * Pick the commands for the next hardware run: the first waiting reg,
+ * followed by the batch regs of the same session queued right behind
+ * it. Only walks the list, so it does not depend on the hardware.
+ * Caller must hold rga_service.lock.
+ */
+static int rga_collect_cmd_list(struct list_head *waiting, struct rga_reg **regs, int max)
+{
+    struct rga_reg *reg;
+    int num = 0;
+
+    list_for_each_entry(reg, waiting, status_link)
+    {
+        if((num > 0) && (!regs[0]->batch || !reg->batch || (reg->session != regs[0]->session)))
+            break;
+
+        regs[num++] = reg;
+        if(num == max)
+            break;
+    }
+
+    return num;
+}
+
 /* Caller must hold rga_service.lock */
 static void rga_try_set_reg(void)
 {
-    struct rga_reg *reg ;
+    struct rga_reg *regs[RGA_CMD_LIST_MAX];
+    struct rga_reg *reg;
+    int num, i;
 
     if (list_empty(&rga_service.running))
     {
         if (!list_empty(&rga_service.waiting))
         {
             /* RGA is idle */
-            reg = list_entry(rga_service.waiting.next, struct rga_reg, status_link);
+            num = rga_collect_cmd_list(&rga_service.waiting, regs, RGA_CMD_LIST_MAX);
+            reg = regs[0];
 
             rga_power_on();
             udelay(3);
 
-            rga_copy_reg(reg, 0);
-            rga_reg_from_wait_to_run(reg);
+            for(i=0; i<num; i++)
+            {
+                rga_copy_reg(regs[i], i);
+                rga_reg_from_wait_to_run(regs[i]);
+            }
 
-            dmac_flush_range(&rga_service.cmd_buff[0], &rga_service.cmd_buff[28]);
-            outer_flush_range(virt_to_phys(&rga_service.cmd_buff[0]),virt_to_phys(&rga_service.cmd_buff[28]));
+            dmac_flush_range(&rga_service.cmd_buff[0], &rga_service.cmd_buff[28*num]);
+            outer_flush_range(virt_to_phys(&rga_service.cmd_buff[0]),virt_to_phys(&rga_service.cmd_buff[28*num]));
 
             rga_soft_reset();
             rga_write(0, RGA_MMU_CTRL);
@@ -610,9 +661,13 @@ static void rga_try_set_reg(void)
             /* All CMD finish int */
             rga_write(rga_read(RGA_INT)|(0x1<<10)|(0x1<<8), RGA_INT);
 
-            /* Start proc */
+            /* Start proc, chained commands are fetched one after another */
             atomic_set(&reg->session->done, 0);
-            rga_write(0x1, RGA_CMD_CTRL);
+            if(num == 1)
+                rga_write(0x1, RGA_CMD_CTRL);
+            else
+                rga_write(s_RGA_CMD_CTRL_CMD_INCR_NUM(num) | s_RGA_CMD_CTRL_CMD_INCR_VALID(1)
+                          | s_RGA_CMD_CTRL_CMD_LINE_FET_ST(1), RGA_CMD_CTRL);
 
 #if RGA_TEST
             {
@@ -760,7 +815,12 @@ static void rga_mem_addr_sel(struct rga_req *req)
 }
 
 
-static int rga_blit(rga_session *session, struct rga_req *req)
+/*
+ * Turn a request into one or two regs on the waiting lists, or on
+ * pending for a batch, without starting the hardware. Returns the
+ * number of regs queued.
+ */
+static int rga_blit_queue(rga_session *session, struct rga_req *req, struct list_head *pending)
 {
     int ret = -1;
     int num = 0;
@@ -809,7 +869,7 @@ static int rga_blit(rga_session *session, struct rga_req *req)
                 break;
         	}
 
-            reg = rga_reg_init_2(session, req, req2);
+            reg = rga_reg_init_2(session, req, req2, pending);
             if(reg == NULL) {
                 break;
             }
@@ -834,19 +894,14 @@ static int rga_blit(rga_session *session, struct rga_req *req)
                 rga_mem_addr_sel(req);
             }
 
-            reg = rga_reg_init(session, req);
+            reg = rga_reg_init(session, req, pending);
             if(reg == NULL) {
                 break;
             }
             num = 1;
         }
 
-        mutex_lock(&rga_service.lock);
-        atomic_add(num, &rga_service.total_running);
-        rga_try_set_reg();
-        mutex_unlock(&rga_service.lock);
-
-        return 0;
+        return num;
     }
     while(0);
 
@@ -858,6 +913,142 @@ static int rga_blit(rga_session *session, struct rga_req *req)
     return -EFAULT;
 }
 
+static int rga_blit(rga_session *session, struct rga_req *req)
+{
+    int num;
+
+    num = rga_blit_queue(session, req, NULL);
+    if(num < 0)
+    {
+        return num;
+    }
+
+    mutex_lock(&rga_service.lock);
+    atomic_add(num, &rga_service.total_running);
+    rga_try_set_reg();
+    mutex_unlock(&rga_service.lock);
+
+    return 0;
+}
+
+static int rga_blit_wait(rga_session *session)
+{
+    int ret = 0;
+    int ret_timeout = 0;
+
+    ret_timeout = wait_event_interruptible_timeout(session->wait, atomic_read(&session->done), RGA_TIMEOUT_DELAY);
+
+    if (unlikely(ret_timeout< 0))
+    {
+		pr_err("sync pid %d wait task ret %d\n", session->pid, ret_timeout);
+        mutex_lock(&rga_service.lock);
+        rga_del_running_list();
+        mutex_unlock(&rga_service.lock);
+        ret = -ETIMEDOUT;
+	}
+    else if (0 == ret_timeout)
+    {
+		pr_err("sync pid %d wait %d task done timeout\n", session->pid, atomic_read(&session->task_running));
+        mutex_lock(&rga_service.lock);
+        rga_del_running_list_timeout();
+        rga_try_set_reg();
+        mutex_unlock(&rga_service.lock);
+		ret = -ETIMEDOUT;
+	}
+
+    return ret;
+}
+
+/*
+ * Queue all requests of a batch before kicking the hardware, so they
+ * go out as chained command lists instead of one run per request.
+ * The whole batch is mapped on a private list first and only reaches
+ * the waiting lists once every request succeeded, so a failing batch
+ * runs nothing.
+ */
+static int rga_blit_batch(rga_session *session, struct rga_batch *batch)
+{
+    struct rga_req *reqs;
+    struct rga_reg *reg, *n;
+    LIST_HEAD(pending);
+    uint32_t i;
+    int num, total = 0;
+    int ret = 0;
+
+    if((batch->count == 0) || (batch->count > RGA_BATCH_MAX))
+    {
+        ERR("invalid batch count %d\n", batch->count);
+        return -EINVAL;
+    }
+
+    reqs = kmalloc(batch->count * sizeof(struct rga_req), GFP_KERNEL);
+    if(reqs == NULL)
+    {
+        printk("%s [%d] get rga_req mem failed\n",__FUNCTION__,__LINE__);
+        return -ENOMEM;
+    }
+
+    if (unlikely(copy_from_user(reqs, batch->reqs, batch->count * sizeof(struct rga_req))))
+    {
+        ERR("copy_from_user failed\n");
+        ret = -EFAULT;
+        goto out;
+    }
+
+    /* reject a bad batch before any of it reaches the hardware */
+    for(i=0; i<batch->count; i++)
+    {
+        if(rga_check_param(&reqs[i]) == -EINVAL)
+        {
+            printk("batch req %d argument is inval\n", i);
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
+    for(i=0; i<batch->count; i++)
+    {
+        num = rga_blit_queue(session, &reqs[i], &pending);
+        if(num < 0)
+        {
+            printk("batch req %d queue failed\n", i);
+            ret = num;
+            break;
+        }
+        total += num;
+    }
+
+    if(ret < 0)
+    {
+        list_for_each_entry_safe(reg, n, &pending, status_link)
+        {
+            list_del_init(&reg->status_link);
+            rga_mmu_release(reg);
+            kfree(reg);
+        }
+        goto out;
+    }
+
+    mutex_lock(&rga_service.lock);
+    list_for_each_entry_safe(reg, n, &pending, status_link)
+    {
+        list_move_tail(&reg->status_link, &rga_service.waiting);
+        list_add_tail(&reg->session_link, &session->waiting);
+    }
+    atomic_add(total, &rga_service.total_running);
+    rga_try_set_reg();
+    mutex_unlock(&rga_service.lock);
+
+    if((ret == 0) && ((batch->flags & RGA_BATCH_SYNC) || (atomic_read(&rga_service.total_running) > 16)))
+    {
+        ret = rga_blit_wait(session);
+    }
+
+out:
+    kfree(reqs);
+    return ret;
+}
+
 static int rga_blit_async(rga_session *session, struct rga_req *req)
 {
 	int ret = -1;
@@ -875,7 +1066,6 @@ static int rga_blit_async(rga_session *session, struct rga_req *req)
 static int rga_blit_sync(rga_session *session, struct rga_req *req)
 {
     int ret = -1;
-    int ret_timeout = 0;
 
     #if RGA_TEST
     printk("*** rga_blit_sync proc ***\n");
@@ -892,25 +1082,7 @@ static int rga_blit_sync(rga_session *session, struct rga_req *req)
         return ret;
     }
 
-    ret_timeout = wait_event_interruptible_timeout(session->wait, atomic_read(&session->done), RGA_TIMEOUT_DELAY);
-
-    if (unlikely(ret_timeout< 0))
-    {
-		pr_err("sync pid %d wait task ret %d\n", session->pid, ret_timeout);
-        mutex_lock(&rga_service.lock);
-        rga_del_running_list();
-        mutex_unlock(&rga_service.lock);
-        ret = -ETIMEDOUT;
-	}
-    else if (0 == ret_timeout)
-    {
-		pr_err("sync pid %d wait %d task done timeout\n", session->pid, atomic_read(&session->task_running));
-        mutex_lock(&rga_service.lock);
-        rga_del_running_list_timeout();
-        rga_try_set_reg();
-        mutex_unlock(&rga_service.lock);
-		ret = -ETIMEDOUT;
-	}
+    ret = rga_blit_wait(session);
 
     #if RGA_TEST_TIME
     rga_end = ktime_get();
@@ -921,6 +1093,60 @@ static int rga_blit_sync(rga_session *session, struct rga_req *req)
     return ret;
 }
 
+/*
+ * Run a request on kernel buffers on the RGA and wait for it, from a
+ * temporary session. The self test uses it to compare both engines.
+ */
+int rga_blit_kernel_hw(struct rga_req *req)
+{
+    rga_session session;
+    int ret;
+
+    if (drvdata == NULL)
+        return -ENODEV;
+
+    memset(&session, 0, sizeof(rga_session));
+    session.pid = current->pid;
+	INIT_LIST_HEAD(&session.waiting);
+	INIT_LIST_HEAD(&session.running);
+	INIT_LIST_HEAD(&session.list_session);
+	init_waitqueue_head(&session.wait);
+	atomic_set(&session.task_running, 0);
+    atomic_set(&session.num_done, 0);
+
+	mutex_lock(&rga_service.lock);
+	list_add_tail(&session.list_session, &rga_service.session);
+	mutex_unlock(&rga_service.lock);
+
+	mutex_lock(&rga_service.mutex);
+    ret = rga_blit_sync(&session, req);
+	mutex_unlock(&rga_service.mutex);
+
+	mutex_lock(&rga_service.lock);
+	list_del(&session.list_session);
+	rga_service_session_clear(&session);
+	mutex_unlock(&rga_service.lock);
+
+    return ret;
+}
+
+/*
+ * Run a request on kernel buffers and wait for it. When the RGA is
+ * missing, or has more jobs queued than an async ioctl may add to, the
+ * CPU takes the requests it supports. Only MMU requests qualify: their
+ * addresses are kernel virtual ones, the others are physical.
+ */
+int rga_blit_kernel(struct rga_req *req)
+{
+    if (req->mmu_info.mmu_en &&
+        ((drvdata == NULL) || (atomic_read(&rga_service.total_running) > 16)))
+    {
+        if (rga_soft_blit(req) == 0)
+            return 0;
+    }
+
+    return rga_blit_kernel_hw(req);
+}
 
 static long rga_ioctl(struct file *file, uint32_t cmd, unsigned long arg)
 {
@@ -971,6 +1197,19 @@ static long rga_ioctl(struct file *file, uint32_t cmd, unsigned long arg)
                 ret = rga_blit_async(session, req);
             }
 			break;
+		case RGA_BLIT_BATCH:
+		{
+			struct rga_batch batch;
+
+			if (unlikely(copy_from_user(&batch, (struct rga_batch*)arg, sizeof(struct rga_batch))))
+			{
+				ERR("copy_from_user failed\n");
+				ret = -EFAULT;
+				break;
+			}
+			ret = rga_blit_batch(session, &batch);
+			break;
+		}
 		case RGA_FLUSH:
 			ret = rga_flush(session, arg);
 			break;
@@ -1039,6 +1278,7 @@ static int rga_release(struct inode *inode, struct file *file)
 	}
 
 	wake_up_interruptible_sync(&session->wait);
+	rga_mmu_cache_destroy(session);
 	mutex_lock(&rga_service.lock);
 	list_del(&session->list_session);
 	rga_service_session_clear(session);
@@ -1236,6 +1476,12 @@ static int __init rga_init(void)
 			return ret;
 	}
 
+    rga_debugfs_dir = debugfs_create_dir("rga", NULL);
+    if (IS_ERR(rga_debugfs_dir))
+        rga_debugfs_dir = NULL;
+    rga_mmu_cache_debugfs_init(rga_debugfs_dir);
+    rga_soft_debugfs_init(rga_debugfs_dir);
+
     //rga_test_0();
 
 	INFO("Module initialized.\n");
@@ -1247,6 +1493,8 @@ static void __exit rga_exit(void)
 {
     uint32_t i;
 
+    debugfs_remove_recursive(rga_debugfs_dir);
+
     rga_power_off();
 
     for(i=0; i<2048; i++)
@@ -14,6 +14,9 @@
 #include <linux/slab.h>
 #include <linux/memory.h>
 #include <linux/dma-mapping.h>
+#include <linux/debugfs.h>
+#include <linux/mmu_notifier.h>
+#include <linux/spinlock.h>
 #include <asm/memory.h>
 #include <asm/atomic.h>
 #include <asm/cacheflush.h>
@@ -216,7 +219,8 @@ static int rga_buf_size_cal(uint32_t yrgb_addr, uint32_t uv_addr, uint32_t v_add
 static int rga_MapUserMemory(struct page **pages, 
                                             uint32_t *pageTable, 
                                             uint32_t Memory, 
-                                            uint32_t pageCount)
+                                            uint32_t pageCount,
+                                            bool *pinned)
 {
     int32_t result;
     uint32_t i;
@@ -302,7 +306,8 @@ static int rga_MapUserMemory(struct page **pages,
                 }     
             }
 
-            return 0;
+            *pinned = false;
+            return status;
         }
 
         for (i = 0; i < pageCount; i++)
@@ -326,6 +331,7 @@ static int rga_MapUserMemory(struct page **pages,
             pageTable[i] = page_to_phys(pages[i]);
         }
 
+        *pinned = true;
         return 0;
     }
     while(0);
@@ -356,6 +362,309 @@ static int rga_MapUserMemory(struct page **pages,
     return status;
 }
 
+/*
+ * MMU table cache: the tables of user buffers are kept per session, so
+ * a surface blitted every frame has its pages looked up only once. An
+ * entry owns the page references taken by get_user_pages(), and the
+ * session's mmu_notifier drops entries whose range gets unmapped or
+ * remapped. Every reg using an entry holds a reference on it as well, so
+ * the pages stay pinned until the jobs DMAing through them are done.
+ */
+#define RGA_MMU_CACHE_MAX   16
+
+struct rga_mmu_cache_entry {
+    struct list_head    link;
+    atomic_t            users;          /* the cache, if linked, and each reg */
+    uint32_t            start;          /* first page number */
+    uint32_t            count;          /* number of pages */
+    bool                pinned;         /* holds a reference on each page */
+    uint32_t            table[0];
+};
+
+struct rga_mmu_cache {
+    struct mmu_notifier mn;
+    struct mm_struct    *mm;
+    spinlock_t          lock;           /* protects everything below */
+    struct list_head    entries;        /* most recently used first */
+    int                 num;
+    unsigned long       seq;            /* bumped by every invalidation */
+    int                 invalidating;   /* invalidate_range_start/end pairs open */
+};
+
+static atomic_t rga_mmu_cache_hits = ATOMIC_INIT(0);
+static atomic_t rga_mmu_cache_misses = ATOMIC_INIT(0);
+static atomic_t rga_mmu_cache_dropped = ATOMIC_INIT(0);
+
+static void rga_flush_user_pages(uint32_t *pageTable, uint32_t pageCount)
+{
+    uint32_t i;
+
+    for (i = 0; i < pageCount; i++)
+    {
+#ifdef ANDROID
+        dma_sync_single_for_device(
+                    NULL,
+                    pageTable[i],
+                    PAGE_SIZE,
+                    DMA_TO_DEVICE);
+#else
+        flush_dcache_page(pfn_to_page(pageTable[i] >> PAGE_SHIFT));
+#endif
+    }
+}
+
+static void rga_mmu_entry_put(struct rga_mmu_cache_entry *entry)
+{
+    uint32_t i;
+
+    if (!atomic_dec_and_test(&entry->users))
+        return;
+
+    if (entry->pinned)
+    {
+        for (i = 0; i < entry->count; i++)
+            page_cache_release(pfn_to_page(entry->table[i] >> PAGE_SHIFT));
+    }
+
+    kfree(entry);
+}
+
+/* Caller must hold cache->lock */
+static void rga_mmu_cache_drop(struct rga_mmu_cache *cache, struct rga_mmu_cache_entry *entry)
+{
+    list_del(&entry->link);
+    cache->num--;
+    rga_mmu_entry_put(entry);
+}
+
+/* Drops the references of reg on the entries its MMU table came from */
+void rga_mmu_release(struct rga_reg *reg)
+{
+    int i;
+
+    for (i = 0; i < reg->mmu_entries; i++)
+        rga_mmu_entry_put(reg->mmu_entry[i]);
+    reg->mmu_entries = 0;
+}
+
+static void rga_mmu_cache_invalidate(struct rga_mmu_cache *cache, unsigned long start, unsigned long end)
+{
+    struct rga_mmu_cache_entry *entry, *n;
+
+    spin_lock(&cache->lock);
+    cache->seq++;
+    list_for_each_entry_safe(entry, n, &cache->entries, link)
+    {
+        if (((unsigned long)entry->start << PAGE_SHIFT) < end &&
+            ((unsigned long)(entry->start + entry->count) << PAGE_SHIFT) > start)
+        {
+            rga_mmu_cache_drop(cache, entry);
+            atomic_inc(&rga_mmu_cache_dropped);
+        }
+    }
+    spin_unlock(&cache->lock);
+}
+
+static void rga_mmu_cache_invalidate_page(struct mmu_notifier *mn, struct mm_struct *mm,
+                                          unsigned long address)
+{
+    struct rga_mmu_cache *cache = container_of(mn, struct rga_mmu_cache, mn);
+
+    rga_mmu_cache_invalidate(cache, address, address + PAGE_SIZE);
+}
+
+static void rga_mmu_cache_invalidate_range_start(struct mmu_notifier *mn, struct mm_struct *mm,
+                                                 unsigned long start, unsigned long end)
+{
+    struct rga_mmu_cache *cache = container_of(mn, struct rga_mmu_cache, mn);
+
+    spin_lock(&cache->lock);
+    cache->invalidating++;
+    spin_unlock(&cache->lock);
+
+    rga_mmu_cache_invalidate(cache, start, end);
+}
+
+static void rga_mmu_cache_invalidate_range_end(struct mmu_notifier *mn, struct mm_struct *mm,
+                                               unsigned long start, unsigned long end)
+{
+    struct rga_mmu_cache *cache = container_of(mn, struct rga_mmu_cache, mn);
+
+    spin_lock(&cache->lock);
+    cache->invalidating--;
+    spin_unlock(&cache->lock);
+}
+
+static void rga_mmu_cache_release(struct mmu_notifier *mn, struct mm_struct *mm)
+{
+    struct rga_mmu_cache *cache = container_of(mn, struct rga_mmu_cache, mn);
+
+    rga_mmu_cache_invalidate(cache, 0, ULONG_MAX);
+}
+
+static const struct mmu_notifier_ops rga_mmu_cache_ops = {
+    .release                = rga_mmu_cache_release,
+    .invalidate_page        = rga_mmu_cache_invalidate_page,
+    .invalidate_range_start = rga_mmu_cache_invalidate_range_start,
+    .invalidate_range_end   = rga_mmu_cache_invalidate_range_end,
+};
+
+/* Returns the cache of the session for current->mm, NULL if there is none */
+static struct rga_mmu_cache *rga_mmu_cache_get(rga_session *session)
+{
+    struct rga_mmu_cache *cache = session->mmu_cache;
+
+    if (cache != NULL)
+        return (cache->mm == current->mm) ? cache : NULL;
+
+    if (current->mm == NULL)
+        return NULL;
+
+    cache = kzalloc(sizeof(struct rga_mmu_cache), GFP_KERNEL);
+    if (cache == NULL)
+        return NULL;
+
+    spin_lock_init(&cache->lock);
+    INIT_LIST_HEAD(&cache->entries);
+    cache->mn.ops = &rga_mmu_cache_ops;
+    cache->mm = current->mm;
+
+    /* keep the mm_struct around until the session is closed */
+    atomic_inc(&cache->mm->mm_count);
+    if (mmu_notifier_register(&cache->mn, cache->mm))
+    {
+        mmdrop(cache->mm);
+        kfree(cache);
+        return NULL;
+    }
+
+    session->mmu_cache = cache;
+    return cache;
+}
+
+void rga_mmu_cache_destroy(rga_session *session)
+{
+    struct rga_mmu_cache *cache = session->mmu_cache;
+
+    if (cache == NULL)
+        return;
+
+    /* calls ->release, unless exit_mmap already did */
+    mmu_notifier_unregister(&cache->mn, cache->mm);
+    rga_mmu_cache_invalidate(cache, 0, ULONG_MAX);
+    mmdrop(cache->mm);
+    kfree(cache);
+    session->mmu_cache = NULL;
+}
+
+static int rga_MapUserMemoryCached(struct rga_reg *reg,
+                                   struct page **pages,
+                                   uint32_t *pageTable,
+                                   uint32_t Memory,
+                                   uint32_t pageCount)
+{
+    struct rga_mmu_cache *cache;
+    struct rga_mmu_cache_entry *entry, *hit;
+    unsigned long seq = 0;
+    bool pinned;
+    int ret;
+
+    if (reg->mmu_entries == ARRAY_SIZE(reg->mmu_entry))
+        return RGA_OUT_OF_RESOURCES;
+
+    /* allocated up front, so the pages are never pinned without an owner */
+    entry = kmalloc(sizeof(struct rga_mmu_cache_entry) + pageCount * sizeof(uint32_t), GFP_KERNEL);
+    if (entry == NULL)
+        return RGA_MALLOC_ERROR;
+
+    cache = rga_mmu_cache_get(reg->session);
+    if (cache != NULL)
+    {
+        spin_lock(&cache->lock);
+        list_for_each_entry(hit, &cache->entries, link)
+        {
+            if ((Memory >= hit->start) && (Memory + pageCount <= hit->start + hit->count))
+            {
+                list_move(&hit->link, &cache->entries);
+                memcpy(pageTable, &hit->table[Memory - hit->start], pageCount * sizeof(uint32_t));
+                if (hit->pinned)
+                    rga_flush_user_pages(pageTable, pageCount);
+                atomic_inc(&hit->users);
+                reg->mmu_entry[reg->mmu_entries++] = hit;
+                spin_unlock(&cache->lock);
+                atomic_inc(&rga_mmu_cache_hits);
+                kfree(entry);
+                return 0;
+            }
+        }
+        seq = cache->seq;
+        spin_unlock(&cache->lock);
+
+        atomic_inc(&rga_mmu_cache_misses);
+    }
+
+    ret = rga_MapUserMemory(pages, pageTable, Memory, pageCount, &pinned);
+    if (ret < 0)
+    {
+        kfree(entry);
+        return ret;
+    }
+
+    entry->start = Memory;
+    entry->count = pageCount;
+    entry->pinned = pinned;
+    memcpy(entry->table, pageTable, pageCount * sizeof(uint32_t));
+
+    /* the reg's reference, the pages are released when its job is done */
+    atomic_set(&entry->users, 1);
+    reg->mmu_entry[reg->mmu_entries++] = entry;
+
+    if (cache == NULL)
+        return 0;
+
+    spin_lock(&cache->lock);
+    /* the range may have changed while its pages were looked up */
+    if ((cache->seq == seq) && !cache->invalidating)
+    {
+        atomic_inc(&entry->users);
+        list_add(&entry->link, &cache->entries);
+        if (++cache->num > RGA_MMU_CACHE_MAX)
+            rga_mmu_cache_drop(cache, list_entry(cache->entries.prev, struct rga_mmu_cache_entry, link));
+    }
+    spin_unlock(&cache->lock);
+
+    return 0;
+}
+
+static int rga_mmu_cache_show(struct seq_file *s, void *unused)
+{
+    unsigned long hits = atomic_read(&rga_mmu_cache_hits);
+    unsigned long misses = atomic_read(&rga_mmu_cache_misses);
+
+    seq_printf(s, "hits %lu misses %lu hit rate %lu%% dropped %d\n",
+               hits, misses, (hits + misses) ? hits * 100 / (hits + misses) : 0,
+               atomic_read(&rga_mmu_cache_dropped));
+    return 0;
+}
+
+static int rga_mmu_cache_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, rga_mmu_cache_show, NULL);
+}
+
+static const struct file_operations rga_mmu_cache_fops = {
+    .open    = rga_mmu_cache_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = single_release,
+};
+
+void rga_mmu_cache_debugfs_init(struct dentry *dir)
+{
+    if (dir != NULL)
+        debugfs_create_file("mmu_cache", S_IRUGO, dir, NULL, &rga_mmu_cache_fops);
+}
+
 static int rga_mmu_info_BitBlt_mode(struct rga_reg *reg, struct rga_req *req)
 {    
     int SrcMemSize, DstMemSize;
@@ -408,7 +717,7 @@ static int rga_mmu_info_BitBlt_mode(struct rga_reg *reg, struct rga_req *req)
 
         if(req->src.yrgb_addr < KERNEL_SPACE_VALID)
         {            
-            ret = rga_MapUserMemory(&pages[0], &MMU_Base[0], SrcStart, SrcMemSize);
+            ret = rga_MapUserMemoryCached(reg, &pages[0], &MMU_Base[0], SrcStart, SrcMemSize);
             if (ret < 0) {
                 pr_err("rga map src memory failed\n");
                 status = ret;
@@ -444,7 +753,7 @@ static int rga_mmu_info_BitBlt_mode(struct rga_reg *reg, struct rga_req *req)
             ktime_t start, end;
             start = ktime_get();
             #endif
-            ret = rga_MapUserMemory(&pages[SrcMemSize], &MMU_Base[SrcMemSize], DstStart, DstMemSize);
+            ret = rga_MapUserMemoryCached(reg, &pages[SrcMemSize], &MMU_Base[SrcMemSize], DstStart, DstMemSize);
             if (ret < 0) {
                 pr_err("rga map dst memory failed\n");
                 status = ret;
@@ -579,7 +888,7 @@ static int rga_mmu_info_color_palette_mode(struct rga_reg *reg, struct rga_req *
         /* map src addr */
         if (req->src.yrgb_addr < KERNEL_SPACE_VALID) 
         {            
-            ret = rga_MapUserMemory(&pages[CMDMemSize], &MMU_Base[CMDMemSize], SrcStart, SrcMemSize);
+            ret = rga_MapUserMemoryCached(reg, &pages[CMDMemSize], &MMU_Base[CMDMemSize], SrcStart, SrcMemSize);
             if (ret < 0) 
             {
                 pr_err("rga map src memory failed\n");
@@ -600,7 +909,7 @@ static int rga_mmu_info_color_palette_mode(struct rga_reg *reg, struct rga_req *
         /* map dst addr */
         if (req->src.yrgb_addr < KERNEL_SPACE_VALID) 
         {
-            ret = rga_MapUserMemory(&pages[CMDMemSize + SrcMemSize], &MMU_Base[CMDMemSize + SrcMemSize], DstStart, DstMemSize);
+            ret = rga_MapUserMemoryCached(reg, &pages[CMDMemSize + SrcMemSize], &MMU_Base[CMDMemSize + SrcMemSize], DstStart, DstMemSize);
             if (ret < 0) 
             {
                 pr_err("rga map dst memory failed\n");
@@ -698,7 +1007,7 @@ static int rga_mmu_info_color_fill_mode(struct rga_reg *reg, struct rga_req *req
 
         if (req->dst.yrgb_addr < KERNEL_SPACE_VALID) 
         {
-            ret = rga_MapUserMemory(&pages[0], &MMU_Base[0], DstStart, DstMemSize);
+            ret = rga_MapUserMemoryCached(reg, &pages[0], &MMU_Base[0], DstStart, DstMemSize);
             if (ret < 0) {
                 pr_err("rga map dst memory failed\n");
                 status = ret;
@@ -789,7 +1098,7 @@ static int rga_mmu_info_line_point_drawing_mode(struct rga_reg *reg, struct rga_
 
         if (req->dst.yrgb_addr < KERNEL_SPACE_VALID)
         {
-            ret = rga_MapUserMemory(&pages[0], &MMU_Base[0], DstStart, DstMemSize);
+            ret = rga_MapUserMemoryCached(reg, &pages[0], &MMU_Base[0], DstStart, DstMemSize);
             if (ret < 0) {
                 pr_err("rga map dst memory failed\n");
                 status = ret;
@@ -889,7 +1198,7 @@ static int rga_mmu_info_blur_sharp_filter_mode(struct rga_reg *reg, struct rga_r
 
         if (req->src.yrgb_addr < KERNEL_SPACE_VALID)
         {
-            ret = rga_MapUserMemory(&pages[0], &MMU_Base[0], SrcStart, SrcMemSize);
+            ret = rga_MapUserMemoryCached(reg, &pages[0], &MMU_Base[0], SrcStart, SrcMemSize);
             if (ret < 0) 
             {
                 pr_err("rga map src memory failed\n");
@@ -910,7 +1219,7 @@ static int rga_mmu_info_blur_sharp_filter_mode(struct rga_reg *reg, struct rga_r
         
         if (req->dst.yrgb_addr < KERNEL_SPACE_VALID)
         {
-            ret = rga_MapUserMemory(&pages[SrcMemSize], &MMU_Base[SrcMemSize], DstStart, DstMemSize);
+            ret = rga_MapUserMemoryCached(reg, &pages[SrcMemSize], &MMU_Base[SrcMemSize], DstStart, DstMemSize);
             if (ret < 0) 
             {
                 pr_err("rga map dst memory failed\n");
@@ -1034,7 +1343,7 @@ static int rga_mmu_info_pre_scale_mode(struct rga_reg *reg, struct rga_req *req)
         /* map src pages */
         if (req->src.yrgb_addr < KERNEL_SPACE_VALID)
         {
-            ret = rga_MapUserMemory(&pages[0], &MMU_Base[0], SrcStart, SrcMemSize);
+            ret = rga_MapUserMemoryCached(reg, &pages[0], &MMU_Base[0], SrcStart, SrcMemSize);
             if (ret < 0) {
                 pr_err("rga map src memory failed\n");
                 status = ret;
@@ -1075,7 +1384,7 @@ static int rga_mmu_info_pre_scale_mode(struct rga_reg *reg, struct rga_req *req)
         else 
         {
             /* user space */
-            ret = rga_MapUserMemory(&pages[SrcMemSize], &MMU_Base[SrcMemSize], DstStart, DstMemSize);
+            ret = rga_MapUserMemoryCached(reg, &pages[SrcMemSize], &MMU_Base[SrcMemSize], DstStart, DstMemSize);
             if (ret < 0) 
             {
                 pr_err("rga map dst memory failed\n");
@@ -1182,7 +1491,7 @@ static int rga_mmu_info_update_palette_table_mode(struct rga_reg *reg, struct rg
 
         if (req->src.yrgb_addr < KERNEL_SPACE_VALID)
         {
-            ret = rga_MapUserMemory(&pages[CMDMemSize], &MMU_Base[CMDMemSize], SrcStart, SrcMemSize);
+            ret = rga_MapUserMemoryCached(reg, &pages[CMDMemSize], &MMU_Base[CMDMemSize], SrcStart, SrcMemSize);
             if (ret < 0) {
                 pr_err("rga map src memory failed\n");
                 return -EINVAL;
@@ -1280,7 +1589,7 @@ static int rga_mmu_info_update_patten_buff_mode(struct rga_reg *reg, struct rga_
 
         if (req->src.yrgb_addr < KERNEL_SPACE_VALID)
         {
-            ret = rga_MapUserMemory(&pages[CMDMemSize], &MMU_Base[CMDMemSize], SrcStart, SrcMemSize);
+            ret = rga_MapUserMemoryCached(reg, &pages[CMDMemSize], &MMU_Base[CMDMemSize], SrcStart, SrcMemSize);
             if (ret < 0) {
                 pr_err("rga map src memory failed\n");
                 status = ret;
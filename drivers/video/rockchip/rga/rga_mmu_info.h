@@ -1,6 +1,7 @@
 #ifndef __RGA_MMU_INFO_H__
 #define __RGA_MMU_INFO_H__
 
+#include <linux/debugfs.h>
 #include "rga.h"
 
 #ifndef MIN
@@ -13,6 +14,9 @@
 
 
 int rga_set_mmu_info(struct rga_reg *reg, struct rga_req *req);
+void rga_mmu_release(struct rga_reg *reg);
+void rga_mmu_cache_destroy(rga_session *session);
+void rga_mmu_cache_debugfs_init(struct dentry *dir);
 
 
 #endif
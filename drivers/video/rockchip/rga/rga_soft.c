@@ -0,0 +1,728 @@
+/*
+ * Copyright (C) 2012 ROCKCHIP, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * CPU engine for the RGA, covering what the compositor uses: solid
+ * color fill, and bitblt from RGB or YUV to RGB with nearest scaling,
+ * mirroring and 90/180/270 rotation. YUV destinations, alpha/rop,
+ * palettes and other angles are not supported. Buffers are given by
+ * kernel virtual addresses, as for kernel requests run through the MMU.
+ * rga_blit_kernel() runs requests here when the RGA is missing or busy.
+ *
+ * Geometry follows the convention of the user library: dst act_w/act_h
+ * are the size before rotation, and x_offset/y_offset name the dst
+ * pixel the src top left corner lands on (the right column for 90 and
+ * 180, the bottom row for 180 and 270).
+ *
+ * No access leaves the vir_w x vir_h image of a buffer, laid out as
+ * rga_buf_size_cal() maps it: a src rectangle outside of it is refused,
+ * dst pixels outside of it are clipped.
+ *
+ * /sys/kernel/debug/rga/selftest runs a fixed set of requests on both
+ * engines. For each of them it checks the CRC of the register program
+ * and of the CPU output against the golden values below, and prints the
+ * time taken by each engine and the number of pixels the two results
+ * disagree on. tools/testing/rga runs the same checks on a host.
+ */
+
+#define pr_fmt(fmt) "rga: " fmt
+
+#include <linux/kernel.h>
+#include <linux/crc32.h>
+#include <linux/dma-mapping.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include "rga.h"
+#include "rga_reg_info.h"
+#include "rga_soft.h"
+
+#define RGA_SOFT_MAX_VIR    8191
+
+static int rga_soft_bpp(uint32_t format)
+{
+    switch (format)
+    {
+        case RK_FORMAT_RGBA_8888 :
+        case RK_FORMAT_RGBX_8888 :
+        case RK_FORMAT_BGRA_8888 :
+            return 4;
+        case RK_FORMAT_RGB_888 :
+        case RK_FORMAT_BGR_888 :
+            return 3;
+        case RK_FORMAT_RGB_565 :
+        case RK_FORMAT_RGBA_5551 :
+        case RK_FORMAT_RGBA_4444 :
+            return 2;
+        default :
+            return 0;
+    }
+}
+
+static int rga_soft_is_yuv(uint32_t format)
+{
+    return (format >= RK_FORMAT_YCbCr_422_SP) && (format <= RK_FORMAT_YCrCb_420_P);
+}
+
+/* line stride in bytes, lines are word aligned as in rga_buf_size_cal() */
+static uint32_t rga_soft_stride(const rga_img_info_t *img)
+{
+    if (rga_soft_is_yuv(img->format))
+        return (img->vir_w + 3) & (~3);
+
+    return (img->vir_w * rga_soft_bpp(img->format) + 3) & (~3);
+}
+
+static int rga_soft_in_buf(const rga_img_info_t *img, int x, int y)
+{
+    return (x >= 0) && (y >= 0) && (x < img->vir_w) && (y < img->vir_h);
+}
+
+static uint8_t *rga_soft_pixel(const rga_img_info_t *img, int x, int y)
+{
+    return (uint8_t *)img->yrgb_addr + y * rga_soft_stride(img) + x * rga_soft_bpp(img->format);
+}
+
+/* Returns the pixel as 0xAARRGGBB */
+static uint32_t rga_soft_load(uint32_t format, const uint8_t *p)
+{
+    uint32_t a = 0xff, r, g, b;
+    uint16_t v;
+
+    switch (format)
+    {
+        case RK_FORMAT_RGBA_8888 :
+            a = p[3];
+            /* fall through */
+        case RK_FORMAT_RGBX_8888 :
+        case RK_FORMAT_RGB_888 :
+            r = p[0]; g = p[1]; b = p[2];
+            break;
+        case RK_FORMAT_BGRA_8888 :
+            a = p[3];
+            /* fall through */
+        case RK_FORMAT_BGR_888 :
+            b = p[0]; g = p[1]; r = p[2];
+            break;
+        case RK_FORMAT_RGB_565 :
+            v = p[0] | (p[1] << 8);
+            r = (v >> 11) & 0x1f; g = (v >> 5) & 0x3f; b = v & 0x1f;
+            r = (r << 3) | (r >> 2); g = (g << 2) | (g >> 4); b = (b << 3) | (b >> 2);
+            break;
+        case RK_FORMAT_RGBA_5551 :
+            v = p[0] | (p[1] << 8);
+            r = (v >> 11) & 0x1f; g = (v >> 6) & 0x1f; b = (v >> 1) & 0x1f;
+            r = (r << 3) | (r >> 2); g = (g << 3) | (g >> 2); b = (b << 3) | (b >> 2);
+            a = (v & 0x1) ? 0xff : 0;
+            break;
+        case RK_FORMAT_RGBA_4444 :
+            v = p[0] | (p[1] << 8);
+            r = ((v >> 12) & 0xf) * 17; g = ((v >> 8) & 0xf) * 17; b = ((v >> 4) & 0xf) * 17;
+            a = (v & 0xf) * 17;
+            break;
+        default :
+            return 0;
+    }
+
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+static void rga_soft_store(uint32_t format, uint8_t *p, uint32_t argb)
+{
+    uint32_t a = argb >> 24, r = (argb >> 16) & 0xff, g = (argb >> 8) & 0xff, b = argb & 0xff;
+    uint16_t v;
+
+    switch (format)
+    {
+        case RK_FORMAT_RGBA_8888 :
+        case RK_FORMAT_RGBX_8888 :
+            p[0] = r; p[1] = g; p[2] = b; p[3] = a;
+            return;
+        case RK_FORMAT_BGRA_8888 :
+            p[0] = b; p[1] = g; p[2] = r; p[3] = a;
+            return;
+        case RK_FORMAT_RGB_888 :
+            p[0] = r; p[1] = g; p[2] = b;
+            return;
+        case RK_FORMAT_BGR_888 :
+            p[0] = b; p[1] = g; p[2] = r;
+            return;
+        case RK_FORMAT_RGB_565 :
+            v = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+            break;
+        case RK_FORMAT_RGBA_5551 :
+            v = ((r >> 3) << 11) | ((g >> 3) << 6) | ((b >> 3) << 1) | (a >> 7);
+            break;
+        case RK_FORMAT_RGBA_4444 :
+            v = ((r >> 4) << 12) | ((g >> 4) << 8) | ((b >> 4) << 4) | (a >> 4);
+            break;
+        default :
+            return;
+    }
+
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+/* YUV to RGB in 10 bit fixed point, rows of yuv2rgb_mode0/1/2 */
+static const int rga_soft_yuv2rgb[3][6] = {
+    /* y offset, y scale, v to r, u to g, v to g, u to b */
+    { 16, 1192, 1634, -401, -833, 2066 },   /* BT.601 MPEG */
+    {  0, 1024, 1436, -352, -731, 1815 },   /* BT.601 JPEG */
+    { 16, 1192, 1836, -218, -546, 2163 },   /* BT.709 */
+};
+
+static uint8_t rga_soft_clamp(int v)
+{
+    v = (v + 512) >> 10;
+    return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+/*
+ * Y plane of stride bytes per line, then the chroma at uv_addr: Cb and
+ * Cr interleaved on lines of stride bytes for the semi planar formats,
+ * or Cb at uv_addr and Cr at v_addr on lines of stride / 2 bytes for
+ * the planar ones, with half the lines for 4:2:0. The YCrCb formats
+ * swap Cb and Cr.
+ */
+static uint32_t rga_soft_load_yuv(const struct rga_req *req, const rga_img_info_t *img, int x, int y)
+{
+    const int *k = rga_soft_yuv2rgb[(req->yuv2rgb_mode < 3) ? req->yuv2rgb_mode : 0];
+    uint32_t stride = rga_soft_stride(img);
+    int cy, u, v, yy;
+    uint8_t *c;
+
+    yy = ((uint8_t *)img->yrgb_addr)[y * stride + x];
+
+    switch (img->format)
+    {
+        case RK_FORMAT_YCbCr_420_SP :
+        case RK_FORMAT_YCbCr_420_P :
+        case RK_FORMAT_YCrCb_420_SP :
+        case RK_FORMAT_YCrCb_420_P :
+            cy = y >> 1;
+            break;
+        default :
+            cy = y;
+            break;
+    }
+
+    switch (img->format)
+    {
+        case RK_FORMAT_YCbCr_422_SP :
+        case RK_FORMAT_YCbCr_420_SP :
+        case RK_FORMAT_YCrCb_422_SP :
+        case RK_FORMAT_YCrCb_420_SP :
+            c = (uint8_t *)img->uv_addr + cy * stride + (x & ~1);
+            u = c[0]; v = c[1];
+            break;
+        default :
+            u = ((uint8_t *)img->uv_addr)[cy * (stride >> 1) + (x >> 1)];
+            v = ((uint8_t *)img->v_addr)[cy * (stride >> 1) + (x >> 1)];
+            break;
+    }
+
+    if (img->format >= RK_FORMAT_YCrCb_422_SP)
+    {
+        int t = u; u = v; v = t;
+    }
+
+    yy = (yy - k[0]) * k[1];
+    u -= 128;
+    v -= 128;
+
+    return 0xff000000 | (rga_soft_clamp(yy + k[2] * v) << 16) |
+           (rga_soft_clamp(yy + k[3] * u + k[4] * v) << 8) | rga_soft_clamp(yy + k[5] * u);
+}
+
+static uint32_t rga_soft_load_pixel(const struct rga_req *req, const rga_img_info_t *img, int x, int y)
+{
+    if (rga_soft_is_yuv(img->format))
+        return rga_soft_load_yuv(req, img, x, y);
+
+    return rga_soft_load(img->format, rga_soft_pixel(img, x, y));
+}
+
+static int rga_soft_check_img(const rga_img_info_t *img)
+{
+    if ((img->vir_w == 0) || (img->vir_h == 0) ||
+        (img->vir_w > RGA_SOFT_MAX_VIR) || (img->vir_h > RGA_SOFT_MAX_VIR))
+        return -EINVAL;
+
+    /* chroma is shared by pixel pairs, and 4:2:0 by line pairs */
+    if (rga_soft_is_yuv(img->format) && ((img->vir_w & 1) || (img->vir_h & 1)))
+        return -EINVAL;
+
+    return 0;
+}
+
+static int rga_soft_in_clip(const struct rga_req *req, int x, int y)
+{
+    return (x >= req->clip.xmin) && (x <= req->clip.xmax) &&
+           (y >= req->clip.ymin) && (y <= req->clip.ymax);
+}
+
+static int rga_soft_color_fill(const struct rga_req *req)
+{
+    const rga_img_info_t *dst = &req->dst;
+    uint32_t c = req->fg_color;
+    uint32_t argb;
+    int x, y;
+
+    if ((req->color_fill_mode != 0) || (rga_soft_bpp(dst->format) == 0) || rga_soft_check_img(dst))
+        return -EINVAL;
+
+    /* fg_color is given as an RGBA_8888 pixel */
+    argb = (c & 0xff000000) | ((c & 0xff) << 16) | (c & 0xff00) | ((c >> 16) & 0xff);
+
+    for (y = dst->y_offset; y < dst->y_offset + dst->act_h; y++)
+    {
+        for (x = dst->x_offset; x < dst->x_offset + dst->act_w; x++)
+        {
+            if (rga_soft_in_buf(dst, x, y) && rga_soft_in_clip(req, x, y))
+                rga_soft_store(dst->format, rga_soft_pixel(dst, x, y), argb);
+        }
+    }
+
+    return 0;
+}
+
+static int rga_soft_bitblt(const struct rga_req *req)
+{
+    const rga_img_info_t *src = &req->src;
+    const rga_img_info_t *dst = &req->dst;
+    uint32_t xf, yf;
+    int u, v, x, y;
+    int angle = 0;
+
+    if (((rga_soft_bpp(src->format) == 0) && !rga_soft_is_yuv(src->format)) ||
+        (rga_soft_bpp(dst->format) == 0))
+        return -EINVAL;
+    if (rga_soft_check_img(src) || rga_soft_check_img(dst))
+        return -EINVAL;
+    if ((src->act_w == 0) || (src->act_h == 0) || (dst->act_w == 0) || (dst->act_h == 0))
+        return -EINVAL;
+    if ((src->x_offset + src->act_w > src->vir_w) || (src->y_offset + src->act_h > src->vir_h))
+        return -EINVAL;
+
+    if (req->rotate_mode == rotate_mode1)
+    {
+        if ((req->sina == 0) && (req->cosa == 65536))
+            angle = 0;
+        else if ((req->sina == 65536) && (req->cosa == 0))
+            angle = 90;
+        else if ((req->sina == 0) && (req->cosa == -65536))
+            angle = 180;
+        else if ((req->sina == -65536) && (req->cosa == 0))
+            angle = 270;
+        else
+            return -EINVAL;
+    }
+
+    /* nearest neighbour, 16.16 steps */
+    xf = ((uint32_t)src->act_w << 16) / dst->act_w;
+    yf = ((uint32_t)src->act_h << 16) / dst->act_h;
+
+    for (v = 0; v < dst->act_h; v++)
+    {
+        for (u = 0; u < dst->act_w; u++)
+        {
+            int sx = src->x_offset + ((u * xf) >> 16);
+            int sy = src->y_offset + ((v * yf) >> 16);
+
+            if (req->rotate_mode == rotate_mode2)
+            {
+                x = dst->x_offset + dst->act_w - 1 - u; y = dst->y_offset + v;
+            }
+            else if (req->rotate_mode == rotate_mode3)
+            {
+                x = dst->x_offset + u; y = dst->y_offset + dst->act_h - 1 - v;
+            }
+            else
+            {
+                switch (angle)
+                {
+                    case 90 :
+                        x = dst->x_offset - v; y = dst->y_offset + u;
+                        break;
+                    case 180 :
+                        x = dst->x_offset - u; y = dst->y_offset - v;
+                        break;
+                    case 270 :
+                        x = dst->x_offset + v; y = dst->y_offset - u;
+                        break;
+                    default :
+                        x = dst->x_offset + u; y = dst->y_offset + v;
+                        break;
+                }
+            }
+
+            if (!rga_soft_in_buf(dst, x, y) || !rga_soft_in_clip(req, x, y))
+                continue;
+
+            rga_soft_store(dst->format, rga_soft_pixel(dst, x, y),
+                           rga_soft_load_pixel(req, src, sx, sy));
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * rga_soft_blit - run a request on the CPU
+ *
+ * Returns -EINVAL for requests outside the supported subset: other
+ * render modes, YUV destinations, palette formats, alpha/rop, arbitrary
+ * angles, and src rectangles outside the src image.
+ */
+int rga_soft_blit(const struct rga_req *req)
+{
+    if (req->alpha_rop_flag & 0x1)
+        return -EINVAL;
+
+    switch (req->render_mode)
+    {
+        case bitblt_mode :
+            return rga_soft_bitblt(req);
+        case color_fill_mode :
+            return rga_soft_color_fill(req);
+        default :
+            return -EINVAL;
+    }
+}
+
+
+#define RGA_SOFT_SRC_W      96
+#define RGA_SOFT_SRC_H      64
+#define RGA_SOFT_DST_W      128
+#define RGA_SOFT_DST_H      96
+#define RGA_SOFT_SRC_SIZE   (RGA_SOFT_SRC_W * RGA_SOFT_SRC_H * 4)
+#define RGA_SOFT_DST_SIZE   (RGA_SOFT_DST_W * RGA_SOFT_DST_H * 4)
+#define RGA_SOFT_ROUNDS     8
+
+enum
+{
+    RGA_SOFT_FILL,
+    RGA_SOFT_COPY,
+    RGA_SOFT_TO_565,
+    RGA_SOFT_SCALE,
+    RGA_SOFT_MIRROR,
+    RGA_SOFT_ROT90,
+    RGA_SOFT_ROT180,
+    RGA_SOFT_ROT270,
+    RGA_SOFT_NV12,
+    RGA_SOFT_YUV422P,
+    RGA_SOFT_CASES,
+};
+
+struct rga_soft_golden
+{
+    const char *name;
+    uint32_t prog_crc;
+    uint32_t out_crc;
+};
+
+/*
+ * CRCs of the register program and of the CPU output of each case. A
+ * change to RGA_gen_reg_info() or to this engine that moves one of them
+ * has to update the table, after checking the new output on hardware.
+ */
+static const struct rga_soft_golden rga_soft_golden[RGA_SOFT_CASES] = {
+    [RGA_SOFT_FILL]     = { "fill",     0x0739a7f4, 0xc30fad1a },
+    [RGA_SOFT_COPY]     = { "copy",     0xea08d564, 0xed9a768d },
+    [RGA_SOFT_TO_565]   = { "to565",    0x17182137, 0x9f16d88b },
+    [RGA_SOFT_SCALE]    = { "scale",    0xf295ac93, 0x3fd9f631 },
+    [RGA_SOFT_MIRROR]   = { "mirror",   0x274ae3c6, 0xb90fd9ab },
+    [RGA_SOFT_ROT90]    = { "rot90",    0xba76e07c, 0x3fa7d9a3 },
+    [RGA_SOFT_ROT180]   = { "rot180",   0xe652245e, 0x9e552404 },
+    [RGA_SOFT_ROT270]   = { "rot270",   0x99e10b5f, 0x903b967c },
+    [RGA_SOFT_NV12]     = { "nv12",     0xb41841e9, 0x3f557f02 },
+    [RGA_SOFT_YUV422P]  = { "yuv422p",  0xf95c1ab6, 0x16fcf399 },
+};
+
+static DEFINE_MUTEX(rga_soft_lock);
+
+/* src holds RGA_SOFT_SRC_SIZE bytes, dst RGA_SOFT_DST_SIZE */
+static void rga_soft_build_req(struct rga_req *req, int id, uint8_t *src, uint8_t *dst)
+{
+    memset(req, 0, sizeof(struct rga_req));
+
+    req->render_mode = bitblt_mode;
+    req->src.yrgb_addr = (uint32_t)src;
+    req->src.format = RK_FORMAT_RGBA_8888;
+    req->src.vir_w = RGA_SOFT_SRC_W;
+    req->src.vir_h = RGA_SOFT_SRC_H;
+    req->src.act_w = RGA_SOFT_SRC_W;
+    req->src.act_h = RGA_SOFT_SRC_H;
+
+    req->dst.yrgb_addr = (uint32_t)dst;
+    req->dst.format = RK_FORMAT_RGBA_8888;
+    req->dst.vir_w = RGA_SOFT_DST_W;
+    req->dst.vir_h = RGA_SOFT_DST_H;
+    req->dst.act_w = RGA_SOFT_SRC_W;
+    req->dst.act_h = RGA_SOFT_SRC_H;
+
+    req->clip.xmax = RGA_SOFT_DST_W - 1;
+    req->clip.ymax = RGA_SOFT_DST_H - 1;
+    req->cosa = 65536;
+
+    /* kernel buffers through the MMU, as rga_test_0 */
+    req->mmu_info.mmu_en = 1;
+    req->mmu_info.mmu_flag = 0x21;
+
+    switch (id)
+    {
+        case RGA_SOFT_FILL :
+            req->render_mode = color_fill_mode;
+            req->fg_color = 0x80402010;
+            req->dst.x_offset = 8;
+            req->dst.y_offset = 4;
+            break;
+        case RGA_SOFT_TO_565 :
+            req->dst.format = RK_FORMAT_RGB_565;
+            break;
+        case RGA_SOFT_SCALE :
+            req->src.act_w = RGA_SOFT_SRC_W / 2;
+            req->src.act_h = RGA_SOFT_SRC_H / 2;
+            req->dst.act_w = RGA_SOFT_DST_W;
+            req->dst.act_h = RGA_SOFT_DST_H;
+            break;
+        case RGA_SOFT_MIRROR :
+            req->rotate_mode = rotate_mode2;
+            break;
+        case RGA_SOFT_ROT90 :
+            req->rotate_mode = rotate_mode1;
+            req->sina = 65536;
+            req->cosa = 0;
+            req->dst.x_offset = RGA_SOFT_SRC_H - 1;
+            break;
+        case RGA_SOFT_ROT180 :
+            req->rotate_mode = rotate_mode1;
+            req->cosa = -65536;
+            req->dst.x_offset = RGA_SOFT_SRC_W - 1;
+            req->dst.y_offset = RGA_SOFT_SRC_H - 1;
+            break;
+        case RGA_SOFT_ROT270 :
+            req->rotate_mode = rotate_mode1;
+            req->sina = -65536;
+            req->cosa = 0;
+            req->dst.y_offset = RGA_SOFT_SRC_W - 1;
+            break;
+        case RGA_SOFT_NV12 :
+            req->src.format = RK_FORMAT_YCbCr_420_SP;
+            req->src.uv_addr = (uint32_t)(src + RGA_SOFT_SRC_W * RGA_SOFT_SRC_H);
+            break;
+        case RGA_SOFT_YUV422P :
+            req->src.format = RK_FORMAT_YCbCr_422_P;
+            req->src.uv_addr = (uint32_t)(src + RGA_SOFT_SRC_W * RGA_SOFT_SRC_H);
+            req->src.v_addr = req->src.uv_addr + RGA_SOFT_SRC_W * RGA_SOFT_SRC_H / 2;
+            req->yuv2rgb_mode = yuv2rgb_mode1;
+            break;
+        default :
+            break;
+    }
+}
+
+/*
+ * Checksum of the register program, with the buffer addresses replaced
+ * by fixed ones so it can be compared between boots and builds.
+ */
+static uint32_t rga_soft_program_crc(const struct rga_req *req)
+{
+    uint32_t prog[RGA_REG_CMD_LEN];
+    struct rga_req tmp = *req;
+
+    tmp.src.yrgb_addr = 0x10000000;
+    tmp.src.uv_addr = tmp.src.uv_addr ? 0x10100000 : 0;
+    tmp.src.v_addr = tmp.src.v_addr ? 0x10200000 : 0;
+    tmp.dst.yrgb_addr = 0x20000000;
+    tmp.mmu_info.mmu_en = 0;
+    tmp.mmu_info.mmu_flag = 0;
+
+    memset(prog, 0, sizeof(prog));
+    if (RGA_gen_reg_info(&tmp, (unsigned char *)prog) == -1)
+        return 0;
+
+    return crc32_le(~0, (unsigned char *)prog, sizeof(prog));
+}
+
+static void rga_soft_fill_src(uint8_t *src)
+{
+    int x, y;
+
+    for (y = 0; y < RGA_SOFT_SRC_H; y++)
+    {
+        for (x = 0; x < RGA_SOFT_SRC_W; x++)
+        {
+            uint8_t *p = src + (y * RGA_SOFT_SRC_W + x) * 4;
+
+            p[0] = x * 255 / RGA_SOFT_SRC_W;
+            p[1] = y * 255 / RGA_SOFT_SRC_H;
+            p[2] = (x ^ y) << 2;
+            p[3] = 0xff;
+        }
+    }
+}
+
+/**
+ * rga_soft_run_case - run a self test case on the CPU
+ *
+ * src must hold the pattern of rga_soft_fill_src(). Returns 0, or the
+ * error of rga_soft_blit(), with the CRCs of the register program and
+ * of the dst buffer.
+ */
+static int rga_soft_run_case(int id, uint8_t *src, uint8_t *dst, uint32_t *prog_crc, uint32_t *out_crc)
+{
+    struct rga_req req;
+    int ret;
+
+    rga_soft_build_req(&req, id, src, dst);
+    memset(dst, 0x5a, RGA_SOFT_DST_SIZE);
+    ret = rga_soft_blit(&req);
+
+    *prog_crc = rga_soft_program_crc(&req);
+    *out_crc = crc32_le(~0, dst, RGA_SOFT_DST_SIZE);
+    return ret;
+}
+
+static int rga_soft_mismatches(const struct rga_req *req, uint8_t *hw, uint8_t *sw)
+{
+    rga_img_info_t a = req->dst, b = req->dst;
+    int x, y, n = 0;
+
+    a.yrgb_addr = (uint32_t)hw;
+    b.yrgb_addr = (uint32_t)sw;
+
+    for (y = 0; y < RGA_SOFT_DST_H; y++)
+    {
+        for (x = 0; x < RGA_SOFT_DST_W; x++)
+        {
+            uint32_t p = rga_soft_load(a.format, rga_soft_pixel(&a, x, y));
+            uint32_t q = rga_soft_load(b.format, rga_soft_pixel(&b, x, y));
+            int i;
+
+            /* allow rounding differences of one step per channel */
+            for (i = 0; i < 32; i += 8)
+            {
+                if (ABS((int)((p >> i) & 0xff) - (int)((q >> i) & 0xff)) > 1)
+                {
+                    n++;
+                    break;
+                }
+            }
+        }
+    }
+
+    return n;
+}
+
+static int rga_soft_selftest_show(struct seq_file *s, void *unused)
+{
+    uint8_t *src, *hw, *sw;
+    struct rga_req req, hw_req;
+    int id, i, bad = 0, ret = 0;
+
+    src = kmalloc(RGA_SOFT_SRC_SIZE, GFP_KERNEL);
+    hw = kmalloc(RGA_SOFT_DST_SIZE, GFP_KERNEL);
+    sw = kmalloc(RGA_SOFT_DST_SIZE, GFP_KERNEL);
+    if ((src == NULL) || (hw == NULL) || (sw == NULL))
+    {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    rga_soft_fill_src(src);
+
+    mutex_lock(&rga_soft_lock);
+    seq_printf(s, "%-8s %11s %11s %8s %8s %10s\n", "case", "prog crc", "out crc", "hw us", "sw us", "mismatches");
+
+    for (id = 0; id < RGA_SOFT_CASES; id++)
+    {
+        const struct rga_soft_golden *g = &rga_soft_golden[id];
+        uint32_t prog_crc, out_crc;
+        s64 hw_us = 0, sw_us = 0;
+        int hw_ret = 0, sw_ret;
+        ktime_t start;
+
+        sw_ret = rga_soft_run_case(id, src, sw, &prog_crc, &out_crc);
+
+        rga_soft_build_req(&req, id, src, sw);
+        start = ktime_get();
+        for (i = 0; (i < RGA_SOFT_ROUNDS) && !sw_ret; i++)
+            sw_ret = rga_soft_blit(&req);
+        sw_us = div_s64(ktime_us_delta(ktime_get(), start), RGA_SOFT_ROUNDS);
+
+        memset(hw, 0x5a, RGA_SOFT_DST_SIZE);
+        dma_sync_single_for_device(NULL, virt_to_phys(src), RGA_SOFT_SRC_SIZE, DMA_TO_DEVICE);
+        dma_sync_single_for_device(NULL, virt_to_phys(hw), RGA_SOFT_DST_SIZE, DMA_TO_DEVICE);
+        start = ktime_get();
+        for (i = 0; (i < RGA_SOFT_ROUNDS) && !hw_ret; i++)
+        {
+            /* the driver rewrites the addresses of the request it runs */
+            rga_soft_build_req(&hw_req, id, src, hw);
+            hw_ret = rga_blit_kernel_hw(&hw_req);
+        }
+        hw_us = div_s64(ktime_us_delta(ktime_get(), start), RGA_SOFT_ROUNDS);
+        dma_sync_single_for_cpu(NULL, virt_to_phys(hw), RGA_SOFT_DST_SIZE, DMA_FROM_DEVICE);
+
+        if ((prog_crc != g->prog_crc) || sw_ret || (out_crc != g->out_crc))
+            bad++;
+
+        seq_printf(s, "%-8s %08x %-2s %08x %-2s ", g->name,
+                   prog_crc, (prog_crc == g->prog_crc) ? "ok" : "!!",
+                   out_crc, (!sw_ret && (out_crc == g->out_crc)) ? "ok" : "!!");
+        if (hw_ret)
+            seq_printf(s, "%8s ", "-");
+        else
+            seq_printf(s, "%8lld ", hw_us);
+        if (sw_ret)
+            seq_printf(s, "%8s ", "-");
+        else
+            seq_printf(s, "%8lld ", sw_us);
+        if (hw_ret || sw_ret)
+            seq_printf(s, "%10s\n", "-");
+        else
+            seq_printf(s, "%10d\n", rga_soft_mismatches(&req, hw, sw));
+    }
+
+    seq_printf(s, "%d of %d cases differ from the golden CRCs\n", bad, RGA_SOFT_CASES);
+    mutex_unlock(&rga_soft_lock);
+
+out:
+    kfree(sw);
+    kfree(hw);
+    kfree(src);
+    return ret;
+}
+
+static int rga_soft_selftest_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, rga_soft_selftest_show, NULL);
+}
+
+static const struct file_operations rga_soft_selftest_fops = {
+    .open    = rga_soft_selftest_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = single_release,
+};
+
+void rga_soft_debugfs_init(struct dentry *dir)
+{
+    if (dir != NULL)
+        debugfs_create_file("selftest", S_IRUSR, dir, NULL, &rga_soft_selftest_fops);
+}
@@ -0,0 +1,12 @@
+#ifndef __RGA_SOFT_H__
+#define __RGA_SOFT_H__
+
+#include <linux/debugfs.h>
+#include "rga.h"
+
+
+int rga_soft_blit(const struct rga_req *req);
+void rga_soft_debugfs_init(struct dentry *dir);
+
+
+#endif
@@ -187,6 +187,39 @@ static void hdmi_post_work(struct work_struct *work)
 }
 #endif
 
+/* offsets of the buffer at (xoffset,yoffset) in a layer's memory */
+static int rk_fb_calc_offset(struct layer_par *par,u32 xoffset,u32 yoffset,u32 xvir,
+	u32 *y_offset,u32 *c_offset)
+{
+	switch (par->format)
+    	{
+		case ARGB888:
+			*y_offset = (yoffset*xvir + xoffset)*4;
+			break;
+		case  RGB888:
+			*y_offset = (yoffset*xvir + xoffset)*3;
+			break;
+		case RGB565:
+			*y_offset = (yoffset*xvir + xoffset)*2;
+	            	break;
+		case  YUV422:
+			*y_offset = yoffset*xvir + xoffset;
+			*c_offset = *y_offset;
+	            	break;
+		case  YUV420:
+			*y_offset = yoffset*xvir + xoffset;
+			*c_offset = (yoffset>>1)*xvir + xoffset;
+	            	break;
+		case  YUV444 : // yuv444
+			*y_offset = yoffset*xvir + xoffset;
+			*c_offset = yoffset*2*xvir +(xoffset<<1);
+			break;
+		default:
+            		return -EINVAL;
+    	}
+	return 0;
+}
+
 static int rk_pan_display(struct fb_var_screeninfo *var, struct fb_info *info)
 {
 	struct rk_fb_inf *inf = dev_get_drvdata(info->device);
@@ -211,33 +244,11 @@ static int rk_pan_display(struct fb_var_screeninfo *var, struct fb_info *info)
 	{
 		 par = dev_drv->layer_par[layer_id];
 	}
-	switch (par->format)
-    	{
-		case ARGB888:
-			par->y_offset = (yoffset*xvir + xoffset)*4;
-			break;
-		case  RGB888:
-			par->y_offset = (yoffset*xvir + xoffset)*3;
-			break;
-		case RGB565:
-			par->y_offset = (yoffset*xvir + xoffset)*2;
-	            	break;
-		case  YUV422:
-			par->y_offset = yoffset*xvir + xoffset;
-			par->c_offset = par->y_offset;
-	            	break;
-		case  YUV420:
-			par->y_offset = yoffset*xvir + xoffset;
-			par->c_offset = (yoffset>>1)*xvir + xoffset;
-	            	break;
-		case  YUV444 : // yuv444
-			par->y_offset = yoffset*xvir + xoffset;
-			par->c_offset = yoffset*2*xvir +(xoffset<<1);
-			break;
-		default:
-			printk("un supported format:0x%x\n",data_format);
-            		return -EINVAL;
-    	}
+	if(rk_fb_calc_offset(par,xoffset,yoffset,xvir,&par->y_offset,&par->c_offset))
+	{
+		printk("un supported format:0x%x\n",data_format);
+		return -EINVAL;
+	}
 
 	#if defined(CONFIG_RK_HDMI)
 		#if defined(CONFIG_DUAL_LCDC_DUAL_DISP_IN_KERNEL)
@@ -267,6 +278,219 @@ static int rk_pan_display(struct fb_var_screeninfo *var, struct fb_info *info)
  	#endif
 	return 0;
 }
+/*
+ * Queue a flip for the frame start interrupt instead of writing the
+ * window and waiting for the next frame like pan_display does.
+ */
+static int rk_fb_queue_flip(struct fb_info *info,struct rk_lcdc_device_driver *dev_drv,
+	int layer_id,void __user *argp)
+{
+	struct rk_fb_flip_queue *q = &dev_drv->flip_queue;
+	struct fb_var_screeninfo *var = &info->var;
+	struct rk_fb_flip_req *req;
+	struct layer_par *par;
+	struct rk_fb_flip flip;
+	u32 y_offset = 0,c_offset = 0;
+	unsigned long flags;
+
+	if(!dev_drv->flip || (layer_id < 0) || (layer_id >= RK30_MAX_LAYER_SUPPORT))
+		return -ENODEV;
+	if(copy_from_user(&flip,argp,sizeof(flip)))
+		return -EFAULT;
+	if(dev_drv->first_frame)  //the frame start interrupt is enabled by the first pan_display
+		return -EAGAIN;
+	if(!flip.smem_start && (((flip.xoffset + var->xres) > var->xres_virtual) ||
+		((flip.yoffset + var->yres) > var->yres_virtual)))
+		return -EINVAL;
+
+	par = dev_drv->layer_par[layer_id];
+	if(rk_fb_calc_offset(par,flip.xoffset,flip.yoffset,var->xres_virtual,&y_offset,&c_offset))
+		return -EINVAL;
+
+	spin_lock_irqsave(&q->lock,flags);
+	if(q->count == RK_FB_FLIP_QUEUE_SIZE)
+	{
+		spin_unlock_irqrestore(&q->lock,flags);
+		return -EBUSY;
+	}
+	req = &q->req[(q->head + q->count) % RK_FB_FLIP_QUEUE_SIZE];
+	req->layer_id = layer_id;
+	req->y_addr = (flip.smem_start ? flip.smem_start : par->smem_start) + y_offset;
+	req->uv_addr = (flip.cbr_start ? flip.cbr_start : par->cbr_start) + c_offset;
+	req->cookie = flip.cookie;
+	q->count++;
+	spin_unlock_irqrestore(&q->lock,flags);
+
+	return 0;
+}
+
+/*
+ * Called by the lcdc driver from its frame start interrupt. The flips
+ * written at the previous frame start are on screen from now on; then
+ * the oldest queued flip of each layer is written, to be latched at the
+ * next frame start.
+ */
+void rk_fb_flip_isr(struct rk_lcdc_device_driver *dev_drv,ktime_t timestamp)
+{
+	struct rk_fb_flip_queue *q = &dev_drv->flip_queue;
+	struct rk_fb_flip_req *req;
+	int i;
+
+	spin_lock(&q->lock);
+	for(i = 0; i < RK30_MAX_LAYER_SUPPORT; i++)
+	{
+		if(q->applied_mask & (1 << i))
+		{
+			q->done_cookie[i] = q->applied[i].cookie;
+			q->done_time[i] = timestamp;
+			q->done_mask |= 1 << i;
+		}
+	}
+	q->applied_mask = 0;
+
+	/* in queue order, at most one flip per layer and frame */
+	while(q->count)
+	{
+		req = &q->req[q->head];
+		if(q->applied_mask & (1 << req->layer_id))
+			break;
+		if(dev_drv->flip(dev_drv,req->layer_id,req->y_addr,req->uv_addr))
+			break;	//registers busy,retry at the next frame start
+		q->applied[req->layer_id] = *req;
+		q->applied_mask |= 1 << req->layer_id;
+		q->head = (q->head + 1) % RK_FB_FLIP_QUEUE_SIZE;
+		q->count--;
+	}
+
+	if(q->done_mask)
+		schedule_work(&q->notify_work);
+	spin_unlock(&q->lock);
+}
+
+static void rk_fb_flip_notify(struct work_struct *work)
+{
+	struct rk_fb_flip_queue *q = container_of(work,struct rk_fb_flip_queue,notify_work);
+	struct rk_lcdc_device_driver *dev_drv =
+		container_of(q,struct rk_lcdc_device_driver,flip_queue);
+	struct rk_fb_inf *inf = platform_get_drvdata(g_fb_pdev);
+	unsigned long flags;
+	int i,layer_id;
+	u32 mask;
+
+	spin_lock_irqsave(&q->lock,flags);
+	mask = q->done_mask;
+	q->done_mask = 0;
+	spin_unlock_irqrestore(&q->lock,flags);
+
+	for(i = 0; i < inf->num_fb; i++)
+	{
+		if(inf->fb[i]->par != dev_drv)
+			continue;
+		layer_id = dev_drv->fb_get_layer(dev_drv,inf->fb[i]->fix.id);
+		if((layer_id >= 0) && (mask & (1 << layer_id)))
+			sysfs_notify(&inf->fb[i]->dev->kobj,NULL,"flip_done");
+	}
+}
+
+/* damage->lock must be held */
+static void rk_fb_damage_add(struct rk_fb_damage *damage,struct rk_fb_rect *rect)
+{
+	u16 x1,y1,x2,y2;
+
+	if(!damage->dirty)
+	{
+		damage->rect = *rect;
+		damage->dirty = true;
+		return;
+	}
+	x1 = min(damage->rect.xpos,rect->xpos);
+	y1 = min(damage->rect.ypos,rect->ypos);
+	x2 = max(damage->rect.xpos + damage->rect.xsize,rect->xpos + rect->xsize);
+	y2 = max(damage->rect.ypos + damage->rect.ysize,rect->ypos + rect->ysize);
+	damage->rect.xpos = x1;
+	damage->rect.ypos = y1;
+	damage->rect.xsize = x2 - x1;
+	damage->rect.ysize = y2 - y1;
+}
+
+/* pixels per second sent to the panel,over the last second or more */
+u32 rk_fb_damage_pixel_rate(struct rk_fb_damage *damage)
+{
+	unsigned long elapsed;
+	u32 rate;
+
+	spin_lock(&damage->lock);
+	elapsed = jiffies - damage->window_start;
+	if(elapsed >= HZ)
+	{
+		damage->pixel_rate = div_u64((u64)damage->window_pixels * HZ,elapsed);
+		damage->window_pixels = 0;
+		damage->window_start = jiffies;
+	}
+	rate = damage->pixel_rate;
+	spin_unlock(&damage->lock);
+
+	return rate;
+}
+
+static void rk_fb_damage_work(struct work_struct *work)
+{
+	struct rk_fb_damage *damage = container_of(to_delayed_work(work),struct rk_fb_damage,work);
+	struct rk_lcdc_device_driver *dev_drv =
+		container_of(damage,struct rk_lcdc_device_driver,damage);
+	struct rk_fb_rect rect;
+	int pixels;
+
+	spin_lock(&damage->lock);
+	if(!damage->dirty)
+	{
+		spin_unlock(&damage->lock);
+		return;
+	}
+	rect = damage->rect;
+	damage->dirty = false;
+	spin_unlock(&damage->lock);
+
+	pixels = dev_drv->refresh(dev_drv,&rect);
+
+	spin_lock(&damage->lock);
+	if(pixels == -EBUSY)	//the previous frame is still being sent
+	{
+		rk_fb_damage_add(damage,&rect);
+		schedule_delayed_work(&damage->work,1);
+	}
+	else if(pixels > 0)
+	{
+		damage->pixels += pixels;
+		damage->window_pixels += pixels;
+	}
+	spin_unlock(&damage->lock);
+}
+
+static int rk_fb_set_damage(struct rk_lcdc_device_driver *dev_drv,void __user *argp)
+{
+	struct rk_fb_damage *damage = &dev_drv->damage;
+	rk_screen *screen = dev_drv->cur_screen;
+	struct rk_fb_rect rect;
+
+	if(!dev_drv->refresh || !screen || (screen->type != SCREEN_MCU))
+		return -ENODEV;
+	if(copy_from_user(&rect,argp,sizeof(rect)))
+		return -EFAULT;
+	if(!rect.xsize || !rect.ysize || (rect.xpos >= screen->x_res) || (rect.ypos >= screen->y_res))
+		return -EINVAL;
+	rect.xsize = min_t(u32,rect.xsize,screen->x_res - rect.xpos);
+	rect.ysize = min_t(u32,rect.ysize,screen->y_res - rect.ypos);
+
+	spin_lock(&damage->lock);
+	if(!damage->dirty)	//first damage of this frame,send it all one frame time later
+		schedule_delayed_work(&damage->work,msecs_to_jiffies(screen->ft));
+	rk_fb_damage_add(damage,&rect);
+	spin_unlock(&damage->lock);
+
+	return 0;
+}
+
 static int rk_fb_ioctl(struct fb_info *info, unsigned int cmd,unsigned long arg)
 {
 	struct fb_fix_screeninfo *fix = &info->fix;
@@ -296,6 +520,12 @@ static int rk_fb_ioctl(struct fb_info *info, unsigned int cmd,unsigned long arg)
 				return -EFAULT;
 			dev_drv->open(dev_drv,layer_id,enable);
 			break;
+		case FBIO_QUEUE_FLIP:
+			return rk_fb_queue_flip(info,dev_drv,layer_id,argp);
+		case FBIOSET_OVERLAY_CONFIG:
+			return dev_drv->ioctl(dev_drv,cmd,arg,layer_id);
+		case FBIOSET_DAMAGE:
+			return rk_fb_set_damage(dev_drv,argp);
 		case FBIOGET_ENABLE:
 			enable = dev_drv->get_layer_state(dev_drv,layer_id);
 			if(copy_to_user(argp,&enable,sizeof(enable)))
@@ -878,6 +1108,85 @@ int rk_fb_disp_scale(u8 scale_x, u8 scale_y,u8 lcdc_id)
 	
 }
 
+/*
+ * Change the timing of a running screen to screen, the fb on it scaled to
+ * scale_x/scale_y percent, without rk_fb_switch_screen's reload of the lcdc:
+ * the output is not blanked. Only for lcdcs that can do it and only at the
+ * dot clock the screen already runs at; -EINVAL and nothing changed
+ * otherwise. On other errors the caller has to go through
+ * rk_fb_switch_screen.
+ */
+int rk_fb_switch_timing(rk_screen *screen,u8 scale_x,u8 scale_y,int lcdc_id)
+{
+	struct rk_fb_inf *inf =  platform_get_drvdata(g_fb_pdev);
+	struct fb_info *info = NULL;
+	struct fb_var_screeninfo *var = NULL;
+	struct rk_lcdc_device_driver * dev_drv = NULL;
+	struct layer_par *par = NULL;
+	u16 xpos,ypos;
+	u16 xsize,ysize;
+	char name[6];
+	int i;
+	int layer_id;
+
+	sprintf(name, "lcdc%d",lcdc_id);
+	for(i = 0; i < inf->num_lcdc; i++)
+	{
+		if(!strcmp(inf->lcdc_dev_drv[i]->name,name))
+		{
+			dev_drv = inf->lcdc_dev_drv[i];
+			break;
+		}
+	}
+
+	if(i == inf->num_lcdc)
+	{
+		printk(KERN_ERR "%s driver not found!",name);
+		return -ENODEV;
+	}
+
+	//one lcdc with two outputs switches the output interface,that needs a reload
+	if(!dev_drv->set_timing || dev_drv->screen1 || !dev_drv->cur_screen)
+		return -EINVAL;
+	if(screen->pixclock != dev_drv->cur_screen->pixclock)
+		return -EINVAL;
+
+	if((lcdc_id == 0) || (inf->num_lcdc == 1))
+	{
+		info = inf->fb[0];
+	}
+	else if( (inf->num_lcdc == 2)&&(lcdc_id == 1))
+	{
+		info = inf->fb[dev_drv->num_layer];
+	}
+	if(!info)
+		return -ENODEV;
+	layer_id = dev_drv->fb_get_layer(dev_drv,info->fix.id);
+	if(layer_id < 0)
+		return -ENODEV;
+
+	memcpy(dev_drv->cur_screen,screen,sizeof(rk_screen));
+
+	//same placement as rk_fb_disp_scale,fb_set_par would write it with its own REG_CFG_DONE
+	var = &info->var;
+	xpos = (screen->x_res-screen->x_res*scale_x/100)>>1;
+	ypos = (screen->y_res-screen->y_res*scale_y/100)>>1;
+	xsize = screen->x_res*scale_x/100;
+	ysize = screen->y_res*scale_y/100;
+	var->nonstd &= 0xff;
+	var->nonstd |= (xpos<<8) + (ypos<<20);
+	var->grayscale &= 0xff;
+	var->grayscale |= (xsize<<8) + (ysize<<20);
+
+	par = dev_drv->layer_par[layer_id];
+	par->xpos = xpos;
+	par->ypos = ypos;
+	par->xsize = xsize;
+	par->ysize = ysize;
+
+	return dev_drv->set_timing(dev_drv);
+}
+
 static int rk_request_fb_buffer(struct fb_info *fbi,int fb_id)
 {
 	struct resource *res;
@@ -988,9 +1297,12 @@ static int init_lcdc_device_driver(struct rk_lcdc_device_driver *dev_drv,
 	dev_drv->blank 		= def_drv->blank;
 	dev_drv->set_par 	= def_drv->set_par;
 	dev_drv->pan_display 	= def_drv->pan_display;
+	dev_drv->flip		= def_drv->flip;
+	dev_drv->refresh	= def_drv->refresh;
 	dev_drv->suspend 	= def_drv->suspend;
 	dev_drv->resume 	= def_drv->resume;
 	dev_drv->load_screen 	= def_drv->load_screen;
+	dev_drv->set_timing	= def_drv->set_timing;
 	dev_drv->def_layer_par 	= def_drv->def_layer_par;
 	dev_drv->num_layer	= def_drv->num_layer;
 	dev_drv->get_layer_state= def_drv->get_layer_state;
@@ -1006,6 +1318,11 @@ static int init_lcdc_device_driver(struct rk_lcdc_device_driver *dev_drv,
 	init_layer_par(dev_drv);
 	init_completion(&dev_drv->frame_done);
 	spin_lock_init(&dev_drv->cpl_lock);
+	spin_lock_init(&dev_drv->flip_queue.lock);
+	INIT_WORK(&dev_drv->flip_queue.notify_work,rk_fb_flip_notify);
+	spin_lock_init(&dev_drv->damage.lock);
+	INIT_DELAYED_WORK(&dev_drv->damage.work,rk_fb_damage_work);
+	dev_drv->damage.window_start = jiffies;
 	mutex_init(&dev_drv->fb_win_id_mutex);
 	dev_drv->fb_layer_remap(dev_drv,FB_DEFAULT_ORDER); //102
 	dev_drv->first_frame = 1;
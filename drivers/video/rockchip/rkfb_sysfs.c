@@ -306,6 +306,46 @@ static ssize_t set_fb_win_map(struct device *dev,struct device_attribute *attr,
 	
 }
 
+static ssize_t show_flip_done(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fbi = dev_get_drvdata(dev);
+	struct rk_lcdc_device_driver * dev_drv = 
+		(struct rk_lcdc_device_driver * )fbi->par;
+	struct rk_fb_flip_queue *q = &dev_drv->flip_queue;
+	int layer_id = dev_drv->fb_get_layer(dev_drv,fbi->fix.id);
+	unsigned long flags;
+	ktime_t timestamp;
+	u32 cookie;
+
+	if((layer_id < 0) || (layer_id >= RK30_MAX_LAYER_SUPPORT))
+		return -ENODEV;
+
+	spin_lock_irqsave(&q->lock,flags);
+	cookie = q->done_cookie[layer_id];
+	timestamp = q->done_time[layer_id];
+	spin_unlock_irqrestore(&q->lock,flags);
+
+	return snprintf(buf, PAGE_SIZE, "%u %lld\n",cookie,ktime_to_ns(timestamp));
+}
+
+static ssize_t show_refresh_pixels(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fbi = dev_get_drvdata(dev);
+	struct rk_lcdc_device_driver * dev_drv = 
+		(struct rk_lcdc_device_driver * )fbi->par;
+	struct rk_fb_damage *damage = &dev_drv->damage;
+	u32 rate = rk_fb_damage_pixel_rate(damage);
+	u64 pixels;
+
+	spin_lock(&damage->lock);
+	pixels = damage->pixels;
+	spin_unlock(&damage->lock);
+
+	return snprintf(buf, PAGE_SIZE, "total:%llu per second:%u\n",pixels,rate);
+}
+
 static struct device_attribute rkfb_attrs[] = {
 	__ATTR(phys_addr, S_IRUGO, show_phys, NULL),
 	__ATTR(virt_addr, S_IRUGO, show_virt, NULL),
@@ -317,6 +357,8 @@ static struct device_attribute rkfb_attrs[] = {
 	__ATTR(fps, S_IRUGO | S_IWUSR, show_fps, set_fps),
 	__ATTR(dsp_lut, S_IRUGO | S_IWUSR, show_dsp_lut, set_dsp_lut),
 	__ATTR(map, S_IRUGO | S_IWUSR, show_fb_win_map, set_fb_win_map),
+	__ATTR(flip_done, S_IRUGO, show_flip_done, NULL),
+	__ATTR(refresh_pixels, S_IRUGO, show_refresh_pixels, NULL),
 };
 
 int rkfb_create_sysfs(struct fb_info *fbi)
@@ -173,6 +173,22 @@ void *ion_map_kernel(struct ion_client *client, struct ion_handle *handle);
  */
 void ion_unmap_kernel(struct ion_client *client, struct ion_handle *handle);
 
+/**
+ * ion_cache_op() - cache maintenance on part of a buffer
+ * @client:	the client
+ * @handle:	handle of the buffer
+ * @virt:	start of a mapping of the buffer, user or kernel
+ * @offset:	offset of the range in the buffer
+ * @len:	length of the range
+ * @type:	ION_CACHE_FLUSH, ION_CACHE_CLEAN or ION_CACHE_INV
+ *
+ * Lets clients that only touched part of a buffer skip maintenance on
+ * the rest of it.
+ */
+int ion_cache_op(struct ion_client *client, struct ion_handle *handle,
+		 void *virt, unsigned long offset, unsigned long len,
+		 unsigned int type);
+
 /**
  * ion_map_dma - create a dma mapping for a given handle
  * @client:	the client
@@ -307,6 +323,13 @@ struct ion_cacheop_data {
 	struct ion_handle *handle;
 	void *virt;
 };
+struct ion_cacheop_range_data {
+	unsigned int type;
+	struct ion_handle *handle;
+	void *virt;
+	unsigned long offset;
+	unsigned long len;
+};
 struct ion_buffer_info {
 	unsigned long phys;
 	unsigned long size;
@@ -391,6 +414,16 @@ struct ion_heap_info {
 
 #define ION_CUSTOM_GET_HEAP_INFO	_IOWR(ION_IOC_MAGIC, 10, \
 				      		struct ion_heap_info) 
+
+/**
+ * DOC: ION_CUSTOM_CACHE_OP_RANGE - cache maintenance on part of a buffer
+ *
+ * Like ION_CUSTOM_CACHE_OP, but only for the len bytes at offset in the
+ * mapping starting at virt.
+ */
+#define ION_CUSTOM_CACHE_OP_RANGE	_IOWR(ION_IOC_MAGIC, 11, \
+						struct ion_cacheop_range_data)
+
 /* Compatible with pmem */
 struct ion_pmem_region {
 	unsigned long offset;
@@ -20,6 +20,8 @@
 #include<linux/completion.h>
 #include<linux/spinlock.h>
 #include<asm/atomic.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 #include <mach/board.h>
 
 
@@ -50,6 +52,12 @@
 #define FBIOSET_OVERLAY_STATE     	0x5018
 #define FBIOSET_ENABLE			0x5019	
 #define FBIOGET_ENABLE			0x5020
+#define FBIO_QUEUE_FLIP			0x5021
+#define FBIOSET_OVERLAY_CONFIG		0x5022
+#define FBIOSET_DAMAGE			0x5023
+
+#define RK_FB_FLIP_QUEUE_SIZE		8
+#define RK_FB_OVERLAY_WINS		3	//win0,win1,win2
 
 /********************************************************************
 **              display output interface supported by rk lcdc                       *
@@ -193,6 +201,90 @@ struct layer_par {
     
 };
 
+/*
+ * FBIO_QUEUE_FLIP argument: show the buffer at xoffset/yoffset of the fb
+ * memory (or of smem_start/cbr_start if they are not zero) on the layer
+ * of this fb. The flip is written at the next frame start and is on
+ * screen from the one after; the fb's flip_done sysfs file then reads
+ * "cookie timestamp_ns" and can be polled for the change.
+ */
+struct rk_fb_flip {
+	__u32 xoffset;
+	__u32 yoffset;
+	__u32 smem_start;
+	__u32 cbr_start;
+	__u32 cookie;		/* returned in flip_done, chosen by the caller */
+};
+
+struct rk_fb_win_cfg {
+	__u32 enable;
+	__u32 format;		/* enum data_format */
+	__u32 y_addr;		/* physical address of the first pixel shown */
+	__u32 uv_addr;
+	__u16 xact;		/* source size */
+	__u16 yact;
+	__u16 xvir;		/* source line length in pixels */
+	__u16 xpos;		/* destination on the panel */
+	__u16 ypos;
+	__u16 xsize;
+	__u16 ysize;
+	__u8 alpha;		/* plane alpha, 0xff is opaque */
+	__u8 pixel_alpha;	/* blend with the alpha of ARGB888 pixels */
+};
+
+/*
+ * FBIOSET_OVERLAY_CONFIG argument: the state of all windows of the lcdc
+ * behind the fb. It is checked as a whole and written in one register
+ * update, so all windows change at the same frame start. win2 is always
+ * on top, win0_on_top orders win0 and win1.
+ */
+struct rk_fb_overlay_cfg {
+	struct rk_fb_win_cfg win[RK_FB_OVERLAY_WINS];
+	__u32 win0_on_top;
+};
+
+/*
+ * FBIOSET_DAMAGE argument: a changed area of the screen. Rects passed
+ * within one frame time are merged and sent to a MCU panel together.
+ */
+struct rk_fb_rect {
+	__u16 xpos;
+	__u16 ypos;
+	__u16 xsize;
+	__u16 ysize;
+};
+
+struct rk_fb_damage {
+	spinlock_t lock;
+	struct rk_fb_rect rect;			/* union of the damage not sent yet */
+	bool dirty;
+	struct delayed_work work;
+	u64 pixels;				/* sent to the panel in total */
+	u32 window_pixels;			/* sent since window_start */
+	unsigned long window_start;
+	u32 pixel_rate;				/* pixels per second over the last window */
+};
+
+struct rk_fb_flip_req {
+	int layer_id;
+	u32 y_addr;
+	u32 uv_addr;
+	u32 cookie;
+};
+
+struct rk_fb_flip_queue {
+	spinlock_t lock;			/* taken from the lcdc interrupt */
+	struct rk_fb_flip_req req[RK_FB_FLIP_QUEUE_SIZE];
+	int head;
+	int count;
+	struct rk_fb_flip_req applied[RK30_MAX_LAYER_SUPPORT];	/* written, latched at the next frame start */
+	u32 applied_mask;
+	u32 done_cookie[RK30_MAX_LAYER_SUPPORT];
+	ktime_t done_time[RK30_MAX_LAYER_SUPPORT];
+	u32 done_mask;				/* layers to notify */
+	struct work_struct notify_work;
+};
+
 struct rk_lcdc_device_driver{
 	char name[6];
 	int id;
@@ -217,6 +309,8 @@ struct rk_lcdc_device_driver{
 	struct completion  frame_done;		  //sync for pan_display,whe we set a new frame address to lcdc register,we must make sure the frame begain to display
 	spinlock_t  cpl_lock; 			 //lock for completion  frame done
 	int first_frame ;
+	struct rk_fb_flip_queue flip_queue;
+	struct rk_fb_damage damage;
 
 	struct rk29fb_info *screen_ctr_info;
 	int (*open)(struct rk_lcdc_device_driver *dev_drv,int layer_id,bool open);
@@ -227,8 +321,11 @@ struct rk_lcdc_device_driver{
 	int (*blank)(struct rk_lcdc_device_driver *dev_drv,int layer_id,int blank_mode);
 	int (*set_par)(struct rk_lcdc_device_driver *dev_drv,int layer_id);
 	int (*pan_display)(struct rk_lcdc_device_driver *dev_drv,int layer_id);
+	int (*flip)(struct rk_lcdc_device_driver *dev_drv,int layer_id,u32 y_addr,u32 uv_addr); //called from the frame start interrupt,must not wait
+	int (*refresh)(struct rk_lcdc_device_driver *dev_drv,struct rk_fb_rect *rect);	//mcu panel: send rect,returns the pixels sent
 	ssize_t (*get_disp_info)(struct rk_lcdc_device_driver *dev_drv,char *buf,int layer_id);
 	int (*load_screen)(struct rk_lcdc_device_driver *dev_drv, bool initscreen);
+	int (*set_timing)(struct rk_lcdc_device_driver *dev_drv);	//optional,retime to cur_screen at the same dot clock without blanking
 	int (*get_layer_state)(struct rk_lcdc_device_driver *dev_drv,int layer_id);
 	int (*ovl_mgr)(struct rk_lcdc_device_driver *dev_drv,int swap,bool set);  //overlay manager
 	int (*fps_mgr)(struct rk_lcdc_device_driver *dev_drv,int fps,bool set);
@@ -257,6 +354,9 @@ extern int rk_fb_unregister(struct rk_lcdc_device_driver *dev_drv);
 extern int get_fb_layer_id(struct fb_fix_screeninfo *fix);
 extern struct rk_lcdc_device_driver * rk_get_lcdc_drv(char *name);
 extern int rk_fb_switch_screen(rk_screen *screen ,int enable ,int lcdc_id);
+extern int rk_fb_switch_timing(rk_screen *screen,u8 scale_x,u8 scale_y,int lcdc_id);
 extern int rk_fb_disp_scale(u8 scale_x, u8 scale_y,u8 lcdc_id);
 extern int rkfb_create_sysfs(struct fb_info *fbi);
+extern void rk_fb_flip_isr(struct rk_lcdc_device_driver *dev_drv,ktime_t timestamp);
+extern u32 rk_fb_damage_pixel_rate(struct rk_fb_damage *damage);
 #endif
@@ -123,6 +123,7 @@ typedef struct rk29fb_screen {
 	int (*refresh)(u8 arg);
 	int (*scandir)(u16 dir);
 	int (*disparea)(u8 area);
+	int (*set_area)(u16 xpos,u16 ypos,u16 xsize,u16 ysize);	//mcu:panel memory window the next frame is written to
 	int (*sscreen_get)(struct rk29fb_screen *screen, u8 resolution);
 	int (*sscreen_set)(struct rk29fb_screen *screen, bool type);// 1: use scaler 0:bypass
 } rk_screen;
@@ -130,5 +131,6 @@ typedef struct rk29fb_screen {
 extern void set_lcd_info(struct rk29fb_screen *screen, struct rk29lcd_info *lcd_info);
 extern void set_tv_info(struct rk29fb_screen *screen);
 extern void set_hdmi_info(struct rk29fb_screen *screen);
+extern int mcu_ioctl(unsigned int cmd, unsigned long arg);
 
 #endif
@@ -0,0 +1,30 @@
+#ifndef __LINUX_VMPRESSURE_H
+#define __LINUX_VMPRESSURE_H
+
+#include <linux/gfp.h>
+#include <linux/notifier.h>
+
+/*
+ * Memory pressure levels, derived from how many of the pages scanned
+ * by reclaim it actually managed to free.
+ */
+enum vmpressure_levels {
+	VMPRESSURE_LOW = 0,	/* reclaiming efficiently */
+	VMPRESSURE_MEDIUM,	/* reclaim is struggling, trim caches */
+	VMPRESSURE_CRITICAL,	/* about to OOM or kill */
+	VMPRESSURE_NUM_LEVELS,
+};
+
+extern void vmpressure(gfp_t gfp, unsigned long scanned,
+		       unsigned long reclaimed);
+extern enum vmpressure_levels vmpressure_level(void);
+extern const char *vmpressure_level_name(enum vmpressure_levels level);
+
+/*
+ * Notifiers are called from the reclaim path, with the level as the
+ * action, once per scan window. They must not sleep.
+ */
+extern int register_vmpressure_notifier(struct notifier_block *nb);
+extern int unregister_vmpressure_notifier(struct notifier_block *nb);
+
+#endif /* __LINUX_VMPRESSURE_H */
@@ -0,0 +1,57 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+
+#if !defined(_TRACE_LOWMEMORYKILLER_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_LOWMEMORYKILLER_H
+
+#include <linux/sched.h>
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(lowmem_kill,
+
+	TP_PROTO(struct task_struct *p, int oom_adj, int tasksize,
+		int min_adj, size_t minfree, int other_free, int other_file,
+		s64 select_ns, bool from_index),
+
+	TP_ARGS(p, oom_adj, tasksize, min_adj, minfree, other_free,
+		other_file, select_ns, from_index),
+
+	TP_STRUCT__entry(
+		__array(char, comm, TASK_COMM_LEN)
+		__field(pid_t, pid)
+		__field(int, oom_adj)
+		__field(int, tasksize)
+		__field(int, min_adj)
+		__field(size_t, minfree)
+		__field(int, other_free)
+		__field(int, other_file)
+		__field(s64, select_ns)
+		__field(bool, from_index)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->comm, p->comm, TASK_COMM_LEN);
+		__entry->pid = p->pid;
+		__entry->oom_adj = oom_adj;
+		__entry->tasksize = tasksize;
+		__entry->min_adj = min_adj;
+		__entry->minfree = minfree;
+		__entry->other_free = other_free;
+		__entry->other_file = other_file;
+		__entry->select_ns = select_ns;
+		__entry->from_index = from_index;
+	),
+
+	TP_printk("comm=%s pid=%d adj=%d size=%d reason: min_adj=%d "
+		"minfree=%zu free=%d file=%d select_ns=%lld via=%s",
+		__entry->comm, __entry->pid, __entry->oom_adj,
+		__entry->tasksize, __entry->min_adj, __entry->minfree,
+		__entry->other_free, __entry->other_file,
+		__entry->select_ns, __entry->from_index ? "index" : "scan")
+);
+
+#endif /* _TRACE_LOWMEMORYKILLER_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -0,0 +1,96 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM rk_camera
+
+#if !defined(_TRACE_RK_CAMERA_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_RK_CAMERA_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+
+/*
+ * Life of a capture buffer: armed in the CIF (the frame starts at the
+ * next sensor vsync), written by the CIF dma, scaled by the capture
+ * work, dequeued by the application. stage_us is the time spent since
+ * the previous stage, ts_us the monotonic time of this one.
+ */
+DECLARE_EVENT_CLASS(rk_camera_frame,
+
+	TP_PROTO(int cif, int index, unsigned int sequence, s64 ts_us,
+		s64 stage_us),
+
+	TP_ARGS(cif, index, sequence, ts_us, stage_us),
+
+	TP_STRUCT__entry(
+		__field(int, cif)
+		__field(int, index)
+		__field(unsigned int, sequence)
+		__field(s64, ts_us)
+		__field(s64, stage_us)
+	),
+
+	TP_fast_assign(
+		__entry->cif = cif;
+		__entry->index = index;
+		__entry->sequence = sequence;
+		__entry->ts_us = ts_us;
+		__entry->stage_us = stage_us;
+	),
+
+	TP_printk("cif=%d index=%d seq=%u ts_us=%lld stage_us=%lld",
+		__entry->cif, __entry->index, __entry->sequence,
+		__entry->ts_us, __entry->stage_us)
+);
+
+DEFINE_EVENT(rk_camera_frame, rk_camera_frame_start,
+	TP_PROTO(int cif, int index, unsigned int sequence, s64 ts_us,
+		s64 stage_us),
+	TP_ARGS(cif, index, sequence, ts_us, stage_us)
+);
+
+DEFINE_EVENT(rk_camera_frame, rk_camera_dma_done,
+	TP_PROTO(int cif, int index, unsigned int sequence, s64 ts_us,
+		s64 stage_us),
+	TP_ARGS(cif, index, sequence, ts_us, stage_us)
+);
+
+DEFINE_EVENT(rk_camera_frame, rk_camera_scale_done,
+	TP_PROTO(int cif, int index, unsigned int sequence, s64 ts_us,
+		s64 stage_us),
+	TP_ARGS(cif, index, sequence, ts_us, stage_us)
+);
+
+DEFINE_EVENT(rk_camera_frame, rk_camera_dequeue,
+	TP_PROTO(int cif, int index, unsigned int sequence, s64 ts_us,
+		s64 stage_us),
+	TP_ARGS(cif, index, sequence, ts_us, stage_us)
+);
+
+TRACE_EVENT(rk_camera_frame_drop,
+
+	TP_PROTO(int cif, int index, unsigned int sequence, const char *reason),
+
+	TP_ARGS(cif, index, sequence, reason),
+
+	TP_STRUCT__entry(
+		__field(int, cif)
+		__field(int, index)
+		__field(unsigned int, sequence)
+		__string(reason, reason)
+	),
+
+	TP_fast_assign(
+		__entry->cif = cif;
+		__entry->index = index;
+		__entry->sequence = sequence;
+		__assign_str(reason, reason);
+	),
+
+	TP_printk("cif=%d index=%d seq=%u reason=%s",
+		__entry->cif, __entry->index, __entry->sequence,
+		__get_str(reason))
+);
+
+#endif /* _TRACE_RK_CAMERA_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -1382,6 +1382,9 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	if (clone_flags & CLONE_THREAD)
 		threadgroup_fork_read_unlock(current);
 	perf_event_fork(p);
+	/* A new process inherits oom_adj, let the listeners index it */
+	if (!(clone_flags & CLONE_THREAD))
+		oom_adj_changed(p);
 	return p;
 
 bad_fork_free_pid:
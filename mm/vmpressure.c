@@ -0,0 +1,127 @@
+/*
+ * linux/mm/vmpressure.c
+ *
+ * Memory pressure levels for userspace, computed from the efficiency of
+ * page reclaim: when reclaim has to scan many pages for each one it
+ * frees, the working set no longer fits and the system is about to
+ * thrash, kill or OOM.
+ *
+ * Released under the GPL v2.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/vmpressure.h>
+
+/*
+ * Number of scanned pages the ratio is computed over. Smaller windows
+ * react faster but report more noise.
+ */
+static const unsigned long vmpressure_win = SWAP_CLUSTER_MAX * 16;
+
+/* Percentage of scanned pages that were not reclaimed */
+static const unsigned int vmpressure_level_med = 60;
+static const unsigned int vmpressure_level_critical = 95;
+
+static DEFINE_SPINLOCK(vmpressure_lock);
+static unsigned long vmpressure_scanned;
+static unsigned long vmpressure_reclaimed;
+static enum vmpressure_levels vmpressure_cur = VMPRESSURE_LOW;
+
+static ATOMIC_NOTIFIER_HEAD(vmpressure_notify_list);
+
+static const char * const vmpressure_str_levels[] = {
+	[VMPRESSURE_LOW] = "low",
+	[VMPRESSURE_MEDIUM] = "medium",
+	[VMPRESSURE_CRITICAL] = "critical",
+};
+
+const char *vmpressure_level_name(enum vmpressure_levels level)
+{
+	if (level >= VMPRESSURE_NUM_LEVELS)
+		return "unknown";
+	return vmpressure_str_levels[level];
+}
+EXPORT_SYMBOL_GPL(vmpressure_level_name);
+
+static enum vmpressure_levels vmpressure_calc_level(unsigned long scanned,
+						    unsigned long reclaimed)
+{
+	unsigned long pressure;
+
+	/* Reclaim can free more than it scanned, e.g. via slab */
+	if (reclaimed >= scanned)
+		return VMPRESSURE_LOW;
+
+	pressure = (scanned - reclaimed) * 100 / scanned;
+
+	if (pressure >= vmpressure_level_critical)
+		return VMPRESSURE_CRITICAL;
+	else if (pressure >= vmpressure_level_med)
+		return VMPRESSURE_MEDIUM;
+	return VMPRESSURE_LOW;
+}
+
+/**
+ * vmpressure() - account the outcome of a reclaim pass
+ * @gfp:	reclaimer's gfp mask
+ * @scanned:	number of inactive pages scanned
+ * @reclaimed:	number of pages freed
+ *
+ * Called from shrink_zone() for global reclaim. Every vmpressure_win
+ * scanned pages the level is recomputed and the notifiers are called.
+ */
+void vmpressure(gfp_t gfp, unsigned long scanned, unsigned long reclaimed)
+{
+	enum vmpressure_levels level;
+
+	/*
+	 * Only count pressure userspace can relieve: allocations that may
+	 * take highmem or movable pages, or that may do I/O or enter the
+	 * filesystem. The rest (e.g. GFP_NOIO lowmem or DMA buffers) says
+	 * little about how much room userspace has, since freeing its
+	 * pages would mostly not help them.
+	 */
+	if (!(gfp & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS)))
+		return;
+
+	if (!scanned)
+		return;
+
+	spin_lock(&vmpressure_lock);
+	vmpressure_scanned += scanned;
+	vmpressure_reclaimed += reclaimed;
+	if (vmpressure_scanned < vmpressure_win) {
+		spin_unlock(&vmpressure_lock);
+		return;
+	}
+	level = vmpressure_calc_level(vmpressure_scanned,
+				      vmpressure_reclaimed);
+	vmpressure_scanned = 0;
+	vmpressure_reclaimed = 0;
+	vmpressure_cur = level;
+	spin_unlock(&vmpressure_lock);
+
+	atomic_notifier_call_chain(&vmpressure_notify_list, level, NULL);
+}
+
+/* Level of the last completed scan window */
+enum vmpressure_levels vmpressure_level(void)
+{
+	return ACCESS_ONCE(vmpressure_cur);
+}
+EXPORT_SYMBOL_GPL(vmpressure_level);
+
+int register_vmpressure_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&vmpressure_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(register_vmpressure_notifier);
+
+int unregister_vmpressure_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&vmpressure_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(unregister_vmpressure_notifier);
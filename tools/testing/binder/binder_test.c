@@ -0,0 +1,732 @@
+/*
+ * Host tests and stress benchmark for the binder driver.
+ *
+ * drivers/staging/android/binder.c is built against the stub headers of
+ * this directory. Every process is an open binder file with a mapping of
+ * host memory, every binder thread a pthread, and the user side of the
+ * protocol is a small libbinder below: calls, replies, the looper, and
+ * the BR_INCREFS/BR_ACQUIRE handshake.
+ *
+ * The tests run a transaction through the window in which
+ * binder_transaction() copies with no lock held, and make its caller
+ * thread exit, or its target process go away, in the middle of the copy.
+ * Build with CFLAGS=-fsanitize=address to have a use after free reported.
+ *
+ * The benchmark then starts a context manager and P client/server pairs.
+ * Servers register with the manager and clients look them up, so every
+ * handle goes through the usual object translation. Each client makes N
+ * calls with payloads of varied sizes, which its server checks and
+ * answers. It reports transactions/s and the p50/p99 call latency, over
+ * all calls and over the smallest ones, which are the calls that queue
+ * behind the large copies of the other pairs.
+ *
+ * make && ./binder_test [-v] [-p pairs] [-n calls] [-s max payload]
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#include "../../../lib/rbtree.c"
+#include "../../../drivers/staging/android/binder.c"
+
+#include <unistd.h>
+
+#define TEST_MAP_SIZE	(1024 * 1024)
+#define MAX_PAIRS	32
+#define MAX_SIZES	8
+
+enum {
+	CODE_ADD = 1,	/* register the server object in the data */
+	CODE_GET,	/* look up the server of the index in the data */
+	CODE_ECHO,	/* check the payload, reply with its sequence */
+	CODE_QUIT,	/* leave the looper */
+};
+
+int mock_verbose;
+__thread struct task_struct *current;
+struct work_struct *mock_pending_work;
+const void *mock_copy_hook_ptr;
+void (*mock_copy_hook)(void);
+
+static void *mock_vm_area_addr;
+static pid_t test_next_pid = 100;
+
+struct vm_struct *mock_get_vm_area(unsigned long size)
+{
+	static __thread struct vm_struct area;
+
+	area.addr = mock_vm_area_addr;
+	area.size = size;
+	return &area;
+}
+
+static void mock_run_work(void)
+{
+	struct work_struct *work;
+
+	while ((work = mock_pending_work)) {
+		mock_pending_work = NULL;
+		work->func(work);
+	}
+}
+
+struct test_proc {
+	struct task_struct leader;
+	struct cred cred;
+	struct signal_struct signal;
+	struct nsproxy nsproxy;
+	struct file file;
+	struct vm_area_struct vma;
+	void *map;
+};
+
+struct test_thread {
+	struct test_proc *proc;
+	struct task_struct task;
+	uint8_t wbuf[512] __attribute__((aligned(8)));
+	size_t wlen;
+	uint8_t rbuf[1024] __attribute__((aligned(8)));
+	size_t rpos, rlen;
+	struct binder_transaction_data reply;	/* until it is written */
+};
+
+static void test_task_init(struct task_struct *task, struct test_proc *p)
+{
+	task->pid = __sync_fetch_and_add(&test_next_pid, 1);
+	task->group_leader = &p->leader;
+	task->cred = &p->cred;
+	task->signal = &p->signal;
+	task->nsproxy = &p->nsproxy;
+}
+
+static void test_proc_open(struct test_proc *p, unsigned int flags)
+{
+	memset(p, 0, sizeof(*p));
+	test_task_init(&p->leader, p);
+	current = &p->leader;
+	p->file.f_flags = flags;
+	assert(binder_open(NULL, &p->file) == 0);
+
+	p->map = aligned_alloc(PAGE_SIZE, TEST_MAP_SIZE);
+	assert(p->map);
+	p->vma.vm_start = (unsigned long)p->map;
+	p->vma.vm_end = p->vma.vm_start + TEST_MAP_SIZE;
+	mock_vm_area_addr = p->map;
+	assert(binder_mmap(&p->file, &p->vma) == 0);
+}
+
+/* What munmap() and close() do, then the deferred work they queue */
+static void test_proc_close(struct test_proc *p)
+{
+	current = &p->leader;
+	p->vma.vm_ops->close(&p->vma);
+	binder_flush(&p->file, NULL);
+	binder_release(NULL, &p->file);
+	mock_run_work();
+	free(p->map);
+}
+
+static struct binder_proc *test_binder_proc(struct test_proc *p)
+{
+	return p->file.private_data;
+}
+
+static void test_thread_init(struct test_thread *t, struct test_proc *p)
+{
+	memset(t, 0, sizeof(*t));
+	t->proc = p;
+	test_task_init(&t->task, p);
+	current = &t->task;
+}
+
+static void test_cmd(struct test_thread *t, uint32_t cmd,
+		     const void *arg, size_t len)
+{
+	assert(t->wlen + sizeof(cmd) + len <= sizeof(t->wbuf));
+	memcpy(t->wbuf + t->wlen, &cmd, sizeof(cmd));
+	if (len)
+		memcpy(t->wbuf + t->wlen + sizeof(cmd), arg, len);
+	t->wlen += sizeof(cmd) + len;
+}
+
+static long test_ioctl(struct test_thread *t, unsigned int cmd, void *arg)
+{
+	current = &t->task;
+	return binder_ioctl(&t->proc->file, cmd, (unsigned long)arg);
+}
+
+/* Writes the commands queued and, if 'read', reads what is returned */
+static long test_write_read(struct test_thread *t, bool read)
+{
+	struct binder_write_read bwr = {
+		.write_size = t->wlen,
+		.write_buffer = (unsigned long)t->wbuf,
+		.read_size = read ? sizeof(t->rbuf) : 0,
+		.read_buffer = (unsigned long)t->rbuf,
+	};
+	long ret;
+
+	ret = test_ioctl(t, BINDER_WRITE_READ, &bwr);
+	t->wlen = 0;
+	t->rpos = 0;
+	t->rlen = bwr.read_consumed;
+	return ret;
+}
+
+/*
+ * test_next - returns the next return command that is not bookkeeping,
+ * reading more as needed, and copies out its transaction data if it has
+ * any. Node references are acknowledged on the next write. Returns 0 if a
+ * non-blocking read finds nothing.
+ */
+static uint32_t test_next(struct test_thread *t,
+			  struct binder_transaction_data *tr)
+{
+	struct binder_ptr_cookie *pc;
+	uint32_t cmd;
+
+	for (;;) {
+		if (t->rpos >= t->rlen) {
+			if (test_write_read(t, true) < 0)
+				return 0;
+			continue;
+		}
+		memcpy(&cmd, t->rbuf + t->rpos, sizeof(cmd));
+		t->rpos += sizeof(cmd);
+
+		switch (cmd) {
+		case BR_NOOP:
+		case BR_TRANSACTION_COMPLETE:
+		case BR_SPAWN_LOOPER:
+			break;
+		case BR_INCREFS:
+		case BR_ACQUIRE:
+			pc = (void *)(t->rbuf + t->rpos);
+			t->rpos += sizeof(*pc);
+			test_cmd(t, cmd == BR_INCREFS ? BC_INCREFS_DONE :
+				 BC_ACQUIRE_DONE, pc, sizeof(*pc));
+			break;
+		case BR_RELEASE:
+		case BR_DECREFS:
+			t->rpos += sizeof(*pc);
+			break;
+		case BR_TRANSACTION:
+		case BR_REPLY:
+			memcpy(tr, t->rbuf + t->rpos, sizeof(*tr));
+			t->rpos += sizeof(*tr);
+			return cmd;
+		default:
+			return cmd;
+		}
+	}
+}
+
+static void test_free_buffer(struct test_thread *t,
+			     struct binder_transaction_data *tr)
+{
+	test_cmd(t, BC_FREE_BUFFER, &tr->data.ptr.buffer, sizeof(void *));
+}
+
+/* test_call - a synchronous call; the reply's buffer is the caller's to free */
+static uint32_t test_call(struct test_thread *t, uint32_t handle,
+			  uint32_t code, const void *data, size_t size,
+			  const size_t *offsets, size_t offsets_size,
+			  struct binder_transaction_data *reply)
+{
+	struct binder_transaction_data tr = {
+		.target.handle = handle,
+		.code = code,
+		.data_size = size,
+		.offsets_size = offsets_size,
+		.data.ptr.buffer = data,
+		.data.ptr.offsets = offsets,
+	};
+
+	test_cmd(t, BC_TRANSACTION, &tr, sizeof(tr));
+	return test_next(t, reply);
+}
+
+/* test_reply - frees the buffer of 'tr' and answers it, on the next write */
+static void test_reply(struct test_thread *t,
+		       struct binder_transaction_data *tr,
+		       const void *data, size_t size,
+		       const size_t *offsets, size_t offsets_size)
+{
+	test_free_buffer(t, tr);
+	memset(&t->reply, 0, sizeof(t->reply));
+	t->reply.data_size = size;
+	t->reply.offsets_size = offsets_size;
+	t->reply.data.ptr.buffer = data;
+	t->reply.data.ptr.offsets = offsets;
+	test_cmd(t, BC_REPLY, &t->reply, sizeof(t->reply));
+}
+
+static void test_thread_exit(struct test_thread *t)
+{
+	if (t->wlen)
+		test_write_read(t, false);
+	test_ioctl(t, BINDER_THREAD_EXIT, NULL);
+}
+
+static int test_leaks(const char *name)
+{
+	int i, failed = 0;
+
+	for (i = 0; i < BINDER_STAT_COUNT; i++) {
+		int created = atomic_read(&binder_stats.obj_created[i]);
+		int deleted = atomic_read(&binder_stats.obj_deleted[i]);
+
+		if (created == deleted)
+			continue;
+		printf("FAIL %s: %d %s objects left\n", name,
+		       created - deleted, binder_objstat_strings[i]);
+		failed = 1;
+	}
+
+	return failed;
+}
+
+static struct test_thread *hook_thread;
+
+static void hook_thread_exit(void)
+{
+	struct task_struct *task = current;
+
+	test_ioctl(hook_thread, BINDER_THREAD_EXIT, NULL);
+	current = task;
+}
+
+/* The caller exits while its reply is copied: the reply is dropped */
+static int test_reply_to_exited(void)
+{
+	struct test_proc A, B;
+	struct test_thread a, b;
+	struct binder_transaction_data tr;
+	static const char ping[] = "ping", pong[] = "pong";
+	uint32_t cmd;
+	int failed = 0;
+
+	test_proc_open(&A, O_NONBLOCK);
+	test_proc_open(&B, O_NONBLOCK);
+	test_thread_init(&a, &A);
+	test_thread_init(&b, &B);
+
+	test_ioctl(&b, BINDER_SET_CONTEXT_MGR, NULL);
+	test_cmd(&b, BC_ENTER_LOOPER, NULL, 0);
+	test_write_read(&b, false);
+
+	/* a calls B, but does not wait for the reply yet */
+	test_cmd(&a, BC_TRANSACTION, &(struct binder_transaction_data) {
+			.data_size = sizeof(ping),
+			.data.ptr.buffer = ping,
+		 }, sizeof(struct binder_transaction_data));
+	test_write_read(&a, false);
+
+	cmd = test_next(&b, &tr);
+	if (cmd != BR_TRANSACTION || strcmp(tr.data.ptr.buffer, ping)) {
+		printf("FAIL reply to exited: server got %#x\n", cmd);
+		failed = 1;
+		goto out;
+	}
+
+	hook_thread = &a;
+	mock_copy_hook = hook_thread_exit;
+	mock_copy_hook_ptr = pong;
+	test_reply(&b, &tr, pong, sizeof(pong), NULL, 0);
+	test_write_read(&b, true);
+
+	if (mock_copy_hook_ptr) {
+		printf("FAIL reply to exited: reply not copied\n");
+		failed = 1;
+	} else if (b.rlen != 2 * sizeof(uint32_t) ||
+		   ((uint32_t *)b.rbuf)[0] != BR_NOOP ||
+		   ((uint32_t *)b.rbuf)[1] != BR_TRANSACTION_COMPLETE) {
+		printf("FAIL reply to exited: server did not just complete\n");
+		failed = 1;
+	}
+	if (test_binder_proc(&A)->allocated_buffers.rb_node) {
+		printf("FAIL reply to exited: reply buffer not freed\n");
+		failed = 1;
+	}
+
+out:
+	test_proc_close(&A);
+	test_proc_close(&B);
+	return failed | test_leaks("reply to exited");
+}
+
+static struct test_proc *hook_proc;
+static pthread_t hook_close_thread;
+
+static void *close_proc(void *arg)
+{
+	test_proc_close(arg);
+	return NULL;
+}
+
+static void hook_close_proc(void)
+{
+	struct binder_proc *proc = test_binder_proc(hook_proc);
+
+	pthread_create(&hook_close_thread, NULL, close_proc, hook_proc);
+	while (!ACCESS_ONCE(proc->is_dead))
+		sched_yield();
+}
+
+/* The target closes while the call is copied: its release waits, the call dies */
+static int test_dead_target(void)
+{
+	struct test_proc A, B;
+	struct test_thread a, b;
+	struct binder_transaction_data tr;
+	static const char ping[] = "ping";
+	uint32_t cmd;
+	int failed = 0;
+
+	test_proc_open(&A, 0);
+	test_proc_open(&B, 0);
+	test_thread_init(&a, &A);
+	test_thread_init(&b, &B);
+
+	test_ioctl(&b, BINDER_SET_CONTEXT_MGR, NULL);
+	test_cmd(&b, BC_ENTER_LOOPER, NULL, 0);
+	test_write_read(&b, false);
+
+	hook_proc = &B;
+	mock_copy_hook = hook_close_proc;
+	mock_copy_hook_ptr = ping;
+	cmd = test_call(&a, 0, 0, ping, sizeof(ping), NULL, 0, &tr);
+	if (cmd != BR_DEAD_REPLY) {
+		printf("FAIL dead target: caller got %#x\n", cmd);
+		failed = 1;
+	}
+
+	pthread_join(hook_close_thread, NULL);
+	test_thread_exit(&a);
+	test_proc_close(&A);
+	return failed | test_leaks("dead target");
+}
+
+/* The benchmark: a registry, and pairs of processes calling each other */
+static int bench_pairs = 4;
+static int bench_calls = 20000;
+static size_t bench_max_size = 64 * 1024;
+static size_t bench_sizes[MAX_SIZES];
+static int bench_nsizes;
+
+struct bench_pair {
+	int index;
+	struct test_proc server, client;
+	struct test_thread st, ct;
+	pthread_t sthread, cthread;
+	s64 *ns;		/* per call */
+	u8 *size;		/* per call, index into bench_sizes */
+	int failed;
+};
+
+static struct test_thread bench_registry;
+static uint32_t bench_handles[MAX_PAIRS];
+static const size_t bench_offsets[1];	/* one object, at the start */
+
+struct bench_add {
+	struct flat_binder_object obj;
+	uint32_t index;
+};
+
+static void *bench_registry_loop(void *arg)
+{
+	struct test_thread *t = arg;
+	struct binder_transaction_data tr;
+	struct flat_binder_object obj;
+	const struct bench_add *add;
+	bool quit = false;
+
+	test_cmd(t, BC_ENTER_LOOPER, NULL, 0);
+	while (!quit) {
+		if (test_next(t, &tr) != BR_TRANSACTION) {
+			printf("FAIL bench: registry got no transaction\n");
+			break;
+		}
+
+		switch (tr.code) {
+		case CODE_ADD:
+			add = tr.data.ptr.buffer;
+			bench_handles[add->index] = add->obj.handle;
+			/* the transaction's reference goes with its buffer */
+			test_cmd(t, BC_ACQUIRE, &bench_handles[add->index],
+				 sizeof(uint32_t));
+			test_reply(t, &tr, NULL, 0, NULL, 0);
+			break;
+		case CODE_GET:
+			memset(&obj, 0, sizeof(obj));
+			obj.type = BINDER_TYPE_HANDLE;
+			obj.handle = bench_handles[*(uint32_t *)tr.data.ptr.buffer];
+			test_reply(t, &tr, &obj, sizeof(obj), bench_offsets,
+				   sizeof(bench_offsets));
+			break;
+		default:
+			test_reply(t, &tr, NULL, 0, NULL, 0);
+			quit = true;
+			break;
+		}
+	}
+
+	test_thread_exit(t);
+	return NULL;
+}
+
+/* The payload: its call's sequence number, then a pattern from it */
+static void bench_fill(u8 *buf, size_t size, uint32_t seq)
+{
+	size_t i;
+
+	memcpy(buf, &seq, sizeof(seq));
+	for (i = sizeof(seq); i < size; i++)
+		buf[i] = seq + i;
+}
+
+static bool bench_check(const u8 *buf, size_t size, uint32_t *seq)
+{
+	size_t i;
+
+	if (size < sizeof(*seq))
+		return false;
+	memcpy(seq, buf, sizeof(*seq));
+	for (i = sizeof(*seq); i < size; i++)
+		if (buf[i] != (u8)(*seq + i))
+			return false;
+	return true;
+}
+
+static void *bench_server(void *arg)
+{
+	struct bench_pair *p = arg;
+	struct test_thread *t = &p->st;
+	struct binder_transaction_data tr;
+	uint32_t answer[2];	/* the sequence, and whether the payload was good */
+
+	test_cmd(t, BC_ENTER_LOOPER, NULL, 0);
+	for (;;) {
+		if (test_next(t, &tr) != BR_TRANSACTION) {
+			p->failed = 1;
+			break;
+		}
+		if (tr.code == CODE_QUIT) {
+			test_reply(t, &tr, NULL, 0, NULL, 0);
+			break;
+		}
+		answer[1] = bench_check(tr.data.ptr.buffer, tr.data_size,
+					&answer[0]);
+		test_reply(t, &tr, answer, sizeof(answer), NULL, 0);
+	}
+
+	test_thread_exit(t);
+	return NULL;
+}
+
+static void *bench_client(void *arg)
+{
+	struct bench_pair *p = arg;
+	struct test_thread *t = &p->ct;
+	struct binder_transaction_data tr;
+	const struct flat_binder_object *obj;
+	const uint32_t *answer;
+	uint32_t index = p->index, handle, seed = index + 1, seq;
+	ktime_t start;
+	u8 *buf;
+
+	if (test_call(t, 0, CODE_GET, &index, sizeof(index), NULL, 0,
+		      &tr) != BR_REPLY) {
+		p->failed = 1;
+		goto out;
+	}
+	obj = tr.data.ptr.buffer;
+	handle = obj->handle;
+	test_cmd(t, BC_ACQUIRE, &handle, sizeof(handle));
+	test_free_buffer(t, &tr);
+
+	buf = malloc(bench_max_size);
+	for (seq = 0; seq < bench_calls; seq++) {
+		seed = seed * 1103515245 + 12345;
+		p->size[seq] = (seed >> 16) % bench_nsizes;
+		bench_fill(buf, bench_sizes[p->size[seq]], seq);
+
+		start = ktime_get();
+		if (test_call(t, handle, CODE_ECHO, buf,
+			      bench_sizes[p->size[seq]], NULL, 0,
+			      &tr) != BR_REPLY) {
+			p->failed = 1;
+			break;
+		}
+		p->ns[seq] = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		answer = tr.data.ptr.buffer;
+		if (tr.data_size != 2 * sizeof(*answer) ||
+		    answer[0] != seq || !answer[1])
+			p->failed = 1;
+		test_free_buffer(t, &tr);
+	}
+	free(buf);
+
+	if (test_call(t, handle, CODE_QUIT, NULL, 0, NULL, 0, &tr) == BR_REPLY)
+		test_free_buffer(t, &tr);
+out:
+	test_thread_exit(t);
+	return NULL;
+}
+
+static int cmp_s64(const void *a, const void *b)
+{
+	s64 x = *(const s64 *)a, y = *(const s64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Sorts 'ns' and prints its p50 and p99 */
+static void bench_print_latency(const char *what, s64 *ns, size_t n)
+{
+	if (!n)
+		return;
+	qsort(ns, n, sizeof(*ns), cmp_s64);
+	printf("%s: %zu calls, p50 %lld ns, p99 %lld ns\n", what, n,
+	       (long long)ns[n / 2], (long long)ns[n * 99 / 100]);
+}
+
+static int bench(void)
+{
+	static struct bench_pair pairs[MAX_PAIRS];
+	struct test_proc registry;
+	struct test_thread quit;
+	struct binder_transaction_data tr;
+	pthread_t registry_thread;
+	s64 *all, *small, secs;
+	size_t size, n = 0, n_small = 0;
+	int i, seq, failed = 0;
+
+	bench_nsizes = 0;
+	for (size = 16; size <= bench_max_size && bench_nsizes < MAX_SIZES;
+	     size *= 4)
+		bench_sizes[bench_nsizes++] = size;
+
+	test_proc_open(&registry, 0);
+	test_thread_init(&bench_registry, &registry);
+	test_ioctl(&bench_registry, BINDER_SET_CONTEXT_MGR, NULL);
+	pthread_create(&registry_thread, NULL, bench_registry_loop,
+		       &bench_registry);
+
+	for (i = 0; i < bench_pairs; i++) {
+		struct bench_pair *p = &pairs[i];
+		struct bench_add add;
+
+		memset(p, 0, sizeof(*p));
+		p->index = i;
+		p->ns = calloc(bench_calls, sizeof(*p->ns));
+		p->size = calloc(bench_calls, sizeof(*p->size));
+		test_proc_open(&p->server, 0);
+		test_proc_open(&p->client, 0);
+		test_thread_init(&p->st, &p->server);
+		test_thread_init(&p->ct, &p->client);
+
+		memset(&add, 0, sizeof(add));
+		add.obj.type = BINDER_TYPE_BINDER;
+		add.obj.binder = p;
+		add.obj.cookie = p;
+		add.index = i;
+		if (test_call(&p->st, 0, CODE_ADD, &add, sizeof(add),
+			      bench_offsets, sizeof(bench_offsets),
+			      &tr) != BR_REPLY) {
+			printf("FAIL bench: server %d did not register\n", i);
+			return 1;
+		}
+		test_free_buffer(&p->st, &tr);
+		pthread_create(&p->sthread, NULL, bench_server, p);
+	}
+
+	secs = ktime_to_ns(ktime_get());
+	for (i = 0; i < bench_pairs; i++)
+		pthread_create(&pairs[i].cthread, NULL, bench_client, &pairs[i]);
+	for (i = 0; i < bench_pairs; i++)
+		pthread_join(pairs[i].cthread, NULL);
+	secs = ktime_to_ns(ktime_get()) - secs;
+	for (i = 0; i < bench_pairs; i++)
+		pthread_join(pairs[i].sthread, NULL);
+
+	test_thread_init(&quit, &registry);
+	if (test_call(&quit, 0, CODE_QUIT, NULL, 0, NULL, 0, &tr) == BR_REPLY)
+		test_free_buffer(&quit, &tr);
+	test_thread_exit(&quit);
+	pthread_join(registry_thread, NULL);
+
+	all = calloc(bench_pairs * bench_calls, sizeof(*all));
+	small = calloc(bench_pairs * bench_calls, sizeof(*small));
+	for (i = 0; i < bench_pairs; i++) {
+		struct bench_pair *p = &pairs[i];
+
+		for (seq = 0; seq < bench_calls; seq++) {
+			all[n++] = p->ns[seq];
+			if (p->size[seq] == 0)
+				small[n_small++] = p->ns[seq];
+		}
+		if (p->failed) {
+			printf("FAIL bench: pair %d got a bad reply\n", i);
+			failed = 1;
+		}
+		test_proc_close(&p->client);
+		test_proc_close(&p->server);
+		free(p->ns);
+		free(p->size);
+	}
+	test_proc_close(&registry);
+
+	printf("%d pairs, %zu-%zu byte calls: %zu calls in %.3fs, %.0f calls/s\n",
+	       bench_pairs, bench_sizes[0], bench_sizes[bench_nsizes - 1], n,
+	       secs / 1e9, n / (secs / 1e9));
+	bench_print_latency("all", all, n);
+	bench_print_latency("smallest", small, n_small);
+	free(all);
+	free(small);
+
+	return failed | test_leaks("bench");
+}
+
+int main(int argc, char **argv)
+{
+	int opt, failed = 0;
+
+	while ((opt = getopt(argc, argv, "vp:n:s:")) != -1) {
+		switch (opt) {
+		case 'v':
+			mock_verbose++;
+			break;
+		case 'p':
+			bench_pairs = atoi(optarg);
+			break;
+		case 'n':
+			bench_calls = atoi(optarg);
+			break;
+		case 's':
+			bench_max_size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (bench_pairs < 1 || bench_pairs > MAX_PAIRS || bench_calls < 1 ||
+	    bench_max_size < 16 || bench_max_size > TEST_MAP_SIZE / 4)
+		goto usage;
+
+	binder_init();
+
+	failed += test_reply_to_exited();
+	failed += test_dead_target();
+	failed += bench();
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return failed ? 1 : 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-v] [-p pairs] [-n calls] "
+		"[-s max payload]\n", argv[0]);
+	return 2;
+}
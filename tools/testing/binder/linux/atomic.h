@@ -0,0 +1,4 @@
+#ifndef LINUX_ATOMIC_H
+#define LINUX_ATOMIC_H
+#include <linux/kernel.h>
+#endif
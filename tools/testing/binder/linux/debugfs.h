@@ -0,0 +1,4 @@
+#ifndef LINUX_DEBUGFS_H
+#define LINUX_DEBUGFS_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef LINUX_FDTABLE_H
+#define LINUX_FDTABLE_H
+#include <linux/kernel.h>
+#endif
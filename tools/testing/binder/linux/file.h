@@ -0,0 +1,4 @@
+#ifndef LINUX_FILE_H
+#define LINUX_FILE_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef LINUX_IOCTL_H
+#define LINUX_IOCTL_H
+#include "../../../../include/asm-generic/ioctl.h"
+#endif
@@ -0,0 +1,496 @@
+#ifndef LINUX_KERNEL_H
+#define LINUX_KERNEL_H
+
+/*
+ * Just enough of the kernel to build drivers/staging/android/binder.c on a
+ * host. Tasks are pthreads, mutexes are pthread mutexes and a wait queue is
+ * a condition variable, so callers really sleep. A process's binder mapping
+ * is plain memory, mapped at the same address for the kernel and the user,
+ * see binder_test.c.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+typedef uint16_t __u16;
+typedef uint32_t __u32;
+typedef int32_t __s32;
+typedef void *fl_owner_t;
+
+#define __user
+#define __init
+#define __force
+#define THIS_MODULE		NULL
+#define EXPORT_SYMBOL(sym)
+#define MODULE_LICENSE(s)
+#define device_initcall(fn)
+#define likely(x)		(x)
+#define unlikely(x)		(x)
+#define barrier()		__asm__ __volatile__("" : : : "memory")
+#define ACCESS_ONCE(x)		(*(volatile typeof(x) *)&(x))
+#define BUG()			assert(0)
+#define BUG_ON(cond)		assert(!(cond))
+#define BUILD_BUG_ON(cond)	((void)sizeof(char[1 - 2 * !!(cond)]))
+#define dump_stack()		do {} while (0)
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define ALIGN(x, a)		(((x) + (a) - 1) & ~((typeof(x))(a) - 1))
+#define IS_ALIGNED(x, a)	(((x) & ((typeof(x))(a) - 1)) == 0)
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define min_t(type, a, b)	min((type)(a), (type)(b))
+
+static inline int fls64(u64 x)
+{
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+#define KERN_ERR		""
+#define KERN_WARNING		""
+#define KERN_INFO		""
+extern int mock_verbose;
+#define printk(fmt...)	do { if (mock_verbose) printf(fmt); } while (0)
+
+#define S_IRUGO			0444
+struct kernel_param;
+#define module_param_named(name, value, type, perm)
+#define module_param_call(name, set, get, arg, perm)
+static inline int param_set_int(const char *val, struct kernel_param *kp)
+{
+	return 0;
+}
+
+#define GFP_KERNEL		0
+#define __GFP_ZERO		0
+#define kmalloc(size, gfp)	malloc(size)
+#define kzalloc(size, gfp)	calloc(1, size)
+#define kfree(p)		free(p)
+
+/*
+ * User memory is host memory; a NULL user pointer stands for one that
+ * faults. Copying from mock_copy_hook_ptr first runs mock_copy_hook(), so a
+ * test can act while a copy is in progress.
+ */
+extern const void *mock_copy_hook_ptr;
+extern void (*mock_copy_hook)(void);
+
+static inline unsigned long copy_from_user(void *to, const void *from,
+					   unsigned long n)
+{
+	if (from == NULL)
+		return n;
+	if (from == mock_copy_hook_ptr) {
+		mock_copy_hook_ptr = NULL;
+		mock_copy_hook();
+	}
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline unsigned long copy_to_user(void *to, const void *from,
+					 unsigned long n)
+{
+	if (to == NULL)
+		return n;
+	memcpy(to, from, n);
+	return 0;
+}
+
+#define get_user(x, p)		((x) = *(p), 0)
+#define put_user(x, p)		(*(p) = (x), 0)
+
+/* Tasks: a binder_test.c thread sets 'current' to its task */
+struct cred { uid_t euid; };
+struct rlimit { unsigned long rlim_cur; };
+#define RLIMIT_NICE		13
+#define RLIMIT_NOFILE		7
+struct signal_struct { struct rlimit rlim[16]; };
+struct pid_namespace;
+struct nsproxy { struct pid_namespace *pid_ns; };
+struct task_struct {
+	pid_t pid;
+	struct task_struct *group_leader;
+	const struct cred *cred;
+	struct signal_struct *signal;
+	struct nsproxy *nsproxy;
+};
+extern __thread struct task_struct *current;
+#define get_task_struct(t)		do { (void)(t); } while (0)
+#define put_task_struct(t)		do { (void)(t); } while (0)
+#define task_nice(t)			0
+#define can_nice(t, nice)		1
+#define set_user_nice(t, nice)		do {} while (0)
+#define task_tgid_nr_ns(t, ns)		((t)->group_leader->pid)
+#define lock_task_sighand(t, flags)	((t)->signal)
+#define unlock_task_sighand(t, flags)	do {} while (0)
+
+typedef pthread_mutex_t spinlock_t;
+#define DEFINE_SPINLOCK(name)		spinlock_t name = PTHREAD_MUTEX_INITIALIZER
+#define spin_lock_init(l)		pthread_mutex_init(l, NULL)
+#define spin_lock(l)			pthread_mutex_lock(l)
+#define spin_unlock(l)			pthread_mutex_unlock(l)
+
+struct mutex { pthread_mutex_t m; };
+#define DEFINE_MUTEX(name)	struct mutex name = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_init(l)		pthread_mutex_init(&(l)->m, NULL)
+#define mutex_lock(l)		pthread_mutex_lock(&(l)->m)
+#define mutex_unlock(l)		pthread_mutex_unlock(&(l)->m)
+
+typedef struct { int counter; } atomic_t;
+#define ATOMIC_INIT(i)		{ (i) }
+#define atomic_read(v)		__atomic_load_n(&(v)->counter, __ATOMIC_SEQ_CST)
+#define atomic_set(v, i)	__atomic_store_n(&(v)->counter, i, __ATOMIC_SEQ_CST)
+#define atomic_inc(v)		((void)__sync_add_and_fetch(&(v)->counter, 1))
+#define atomic_dec(v)		((void)__sync_sub_and_fetch(&(v)->counter, 1))
+#define atomic_inc_return(v)	__sync_add_and_fetch(&(v)->counter, 1)
+#define atomic_dec_and_test(v)	(__sync_sub_and_fetch(&(v)->counter, 1) == 0)
+
+/*
+ * The condition is checked under the queue's own lock and every wake up
+ * takes it, so no wake up is lost between the check and the sleep.
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} wait_queue_head_t;
+#define DECLARE_WAIT_QUEUE_HEAD(name) \
+	wait_queue_head_t name = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER }
+#define init_waitqueue_head(q)					\
+	do {							\
+		pthread_mutex_init(&(q)->lock, NULL);		\
+		pthread_cond_init(&(q)->cond, NULL);		\
+	} while (0)
+#define wait_event(wq, condition)				\
+	do {							\
+		pthread_mutex_lock(&(wq).lock);			\
+		while (!(condition))				\
+			pthread_cond_wait(&(wq).cond, &(wq).lock); \
+		pthread_mutex_unlock(&(wq).lock);		\
+	} while (0)
+#define wait_event_interruptible(wq, condition) \
+	({ wait_event(wq, condition); 0; })
+#define wait_event_interruptible_exclusive(wq, condition) \
+	wait_event_interruptible(wq, condition)
+static inline void mock_wake_up(wait_queue_head_t *q)
+{
+	pthread_mutex_lock(&q->lock);
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+#define wake_up(q)			mock_wake_up(q)
+#define wake_up_interruptible(q)	mock_wake_up(q)
+#define wake_up_interruptible_all(q)	mock_wake_up(q)
+
+struct poll_table_struct;
+#define poll_wait(filp, q, wait)	do {} while (0)
+
+typedef struct { s64 tv64; } ktime_t;
+static inline ktime_t ktime_get(void)
+{
+	struct timespec ts;
+	ktime_t t;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t.tv64 = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	return t;
+}
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b)
+{
+	a.tv64 -= b.tv64;
+	return a;
+}
+#define ktime_to_ns(t)		((t).tv64)
+
+/* Deferred work runs when binder_test.c calls mock_run_work() */
+struct work_struct { void (*func)(struct work_struct *); };
+struct workqueue_struct { int dummy; };
+#define DECLARE_WORK(name, fn)	struct work_struct name = { fn }
+extern struct work_struct *mock_pending_work;
+static inline struct workqueue_struct *create_singlethread_workqueue(const char *n)
+{
+	static struct workqueue_struct wq;
+
+	return &wq;
+}
+static inline int queue_work(struct workqueue_struct *wq, struct work_struct *w)
+{
+	mock_pending_work = w;
+	return 1;
+}
+
+/* Memory: pages are never looked at, the mapping is the buffer itself */
+#define PAGE_SIZE		4096UL
+#define PAGE_MASK		(~(PAGE_SIZE - 1))
+#define PAGE_ALIGN(x)		ALIGN(x, PAGE_SIZE)
+#define PAGE_KERNEL		0
+#define VM_WRITE		0x2
+#define VM_MAYWRITE		0x20
+#define VM_DONTCOPY		0x20000
+#define VM_IOREMAP		0x1
+typedef unsigned long pgprot_t;
+#define pgprot_val(p)		(p)
+struct page { int dummy; };
+struct vm_struct { void *addr; unsigned long size; };
+struct rw_semaphore { int dummy; };
+struct mm_struct { struct rw_semaphore mmap_sem; };
+struct vm_area_struct;
+struct vm_operations_struct {
+	void (*open)(struct vm_area_struct *);
+	void (*close)(struct vm_area_struct *);
+};
+struct vm_area_struct {
+	unsigned long vm_start;
+	unsigned long vm_end;
+	unsigned long vm_flags;
+	pgprot_t vm_page_prot;
+	const struct vm_operations_struct *vm_ops;
+	void *vm_private_data;
+};
+#define alloc_page(gfp)			((struct page *)malloc(sizeof(struct page)))
+#define __free_page(p)			free(p)
+#define map_vm_area(area, prot, pages)	0
+#define vm_insert_page(vma, addr, page)	0
+#define zap_page_range(vma, a, s, d)	do {} while (0)
+#define unmap_kernel_range(a, s)	do {} while (0)
+#define mmput(mm)			do {} while (0)
+#define down_write(s)			do {} while (0)
+#define up_write(s)			do {} while (0)
+static inline struct mm_struct *get_task_mm(struct task_struct *t)
+{
+	static struct mm_struct mm;
+
+	return &mm;
+}
+extern struct vm_struct *mock_get_vm_area(unsigned long size);
+#define get_vm_area(size, flags)	mock_get_vm_area(size)
+#define vfree(p)			do {} while (0)
+
+/* Files: only what the fd translation touches, it is never exercised */
+struct fd_set_bits { unsigned long fds_bits[1]; };
+struct fdtable {
+	unsigned int max_fds;
+	struct file **fd;
+	struct fd_set_bits *close_on_exec;
+	struct fd_set_bits *open_fds;
+};
+struct files_struct {
+	spinlock_t file_lock;
+	int next_fd;
+	struct fdtable fdtab;
+};
+#define files_fdtable(files)		(&(files)->fdtab)
+#define find_next_zero_bit(p, s, o)	(s)
+#define expand_files(files, fd)		(-EMFILE)
+#undef FD_SET
+#undef FD_CLR
+#undef __FD_CLR
+#define FD_SET(fd, set)			do {} while (0)
+#define FD_CLR(fd, set)			do {} while (0)
+#define __FD_CLR(fd, set)		do {} while (0)
+#define rcu_assign_pointer(p, v)	((p) = (v))
+#define get_files_struct(t)		NULL
+#define put_files_struct(f)		do {} while (0)
+#define ERESTARTSYS			512
+#define ERESTARTNOINTR			513
+#define ERESTARTNOHAND			514
+#define ERESTART_RESTARTBLOCK		516
+
+struct inode { void *i_private; };
+struct file {
+	unsigned int f_flags;
+	void *private_data;
+	const struct file_operations *f_op;
+};
+struct file_operations {
+	void *owner;
+	void *open;
+	void *read;
+	void *llseek;
+	void *release;
+	void *poll;
+	void *unlocked_ioctl;
+	void *mmap;
+	void *flush;
+};
+#define fget(fd)			((struct file *)NULL)
+#define fput(f)				do {} while (0)
+#define filp_close(f, files)		0
+
+struct miscdevice {
+	int minor;
+	const char *name;
+	const struct file_operations *fops;
+};
+#define MISC_DYNAMIC_MINOR	255
+#define misc_register(m)	((void)(m), 0)
+
+struct dentry;
+#define debugfs_create_dir(n, p)		NULL
+#define debugfs_create_file(n, m, p, d, f)	NULL
+#define debugfs_remove(d)			do {} while (0)
+
+/* seq_file output goes to stdout, for binder_test -v */
+struct seq_file { size_t count; void *private; };
+#define seq_printf(m, fmt...)	do { if (mock_verbose) printf(fmt); } while (0)
+#define seq_puts(m, s)		seq_printf(m, "%s", s)
+#define single_open(f, show, d)	0
+#define seq_read		NULL
+#define seq_lseek		NULL
+#define single_release		NULL
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+			      struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+	entry->next = NULL;
+	entry->prev = NULL;
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+	INIT_LIST_HEAD(entry);
+}
+
+static inline void list_move(struct list_head *list, struct list_head *head)
+{
+	list_del(list);
+	list_add(list, head);
+}
+
+static inline void list_move_tail(struct list_head *list, struct list_head *head)
+{
+	list_del(list);
+	list_add_tail(list, head);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+static inline int list_is_last(const struct list_head *list,
+			       const struct list_head *head)
+{
+	return list->next == head;
+}
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_entry((head)->next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+struct hlist_head { struct hlist_node *first; };
+struct hlist_node { struct hlist_node *next, **pprev; };
+
+#define HLIST_HEAD(name)	struct hlist_head name = { NULL }
+#define INIT_HLIST_NODE(n)	((n)->next = NULL, (n)->pprev = NULL)
+
+static inline int hlist_unhashed(const struct hlist_node *h)
+{
+	return !h->pprev;
+}
+
+static inline int hlist_empty(const struct hlist_head *h)
+{
+	return !h->first;
+}
+
+static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+{
+	struct hlist_node *first = h->first;
+
+	n->next = first;
+	if (first)
+		first->pprev = &n->next;
+	h->first = n;
+	n->pprev = &h->first;
+}
+
+static inline void __hlist_del(struct hlist_node *n)
+{
+	struct hlist_node *next = n->next;
+	struct hlist_node **pprev = n->pprev;
+
+	*pprev = next;
+	if (next)
+		next->pprev = pprev;
+}
+
+static inline void hlist_del(struct hlist_node *n)
+{
+	__hlist_del(n);
+	n->next = NULL;
+	n->pprev = NULL;
+}
+
+static inline void hlist_del_init(struct hlist_node *n)
+{
+	if (!hlist_unhashed(n)) {
+		__hlist_del(n);
+		INIT_HLIST_NODE(n);
+	}
+}
+
+#define hlist_entry(ptr, type, member)	container_of(ptr, type, member)
+
+#define hlist_for_each_entry(tpos, pos, head, member)			\
+	for (pos = (head)->first;					\
+	     pos && ({ tpos = hlist_entry(pos, typeof(*tpos), member); 1; }); \
+	     pos = pos->next)
+
+#endif
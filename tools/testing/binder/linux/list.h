@@ -0,0 +1,4 @@
+#ifndef LINUX_LIST_H
+#define LINUX_LIST_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef LINUX_MM_H
+#define LINUX_MM_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef LINUX_NSPROXY_H
+#define LINUX_NSPROXY_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef LINUX_POLL_H
+#define LINUX_POLL_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef LINUX_RBTREE_STUB_H
+#define LINUX_RBTREE_STUB_H
+#include "../../../../include/linux/rbtree.h"
+#endif
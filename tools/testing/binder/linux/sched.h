@@ -0,0 +1,4 @@
+#ifndef LINUX_SCHED_H
+#define LINUX_SCHED_H
+#include <linux/kernel.h>
+#endif
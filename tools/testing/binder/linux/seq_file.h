@@ -0,0 +1,4 @@
+#ifndef LINUX_SEQ_FILE_H
+#define LINUX_SEQ_FILE_H
+#include <linux/kernel.h>
+#endif
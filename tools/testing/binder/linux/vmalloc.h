@@ -0,0 +1,4 @@
+#ifndef LINUX_VMALLOC_H
+#define LINUX_VMALLOC_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,3 @@
+#ifndef ASM_IOCTLS_H
+#define ASM_IOCTLS_H
+#endif
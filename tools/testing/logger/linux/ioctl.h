@@ -0,0 +1,4 @@
+#ifndef LINUX_IOCTL_H
+#define LINUX_IOCTL_H
+#define _IO(type, nr)		(((type) << 8) | (nr))
+#endif
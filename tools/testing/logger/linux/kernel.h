@@ -0,0 +1,198 @@
+#ifndef LINUX_KERNEL_H
+#define LINUX_KERNEL_H
+
+/*
+ * Just enough of the kernel to build drivers/staging/android/logger.c on a
+ * host, with pthreads standing in for tasks. Sleeping is yielding: nothing
+ * here ever blocks, so wake_up() has nothing to do.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+typedef uint16_t __u16;
+typedef uint32_t __u32;
+typedef int32_t __s32;
+
+#define __user
+#define __init
+#define THIS_MODULE		NULL
+#define likely(x)		(x)
+#define unlikely(x)		(x)
+#define ACCESS_ONCE(x)		(*(volatile typeof(x) *)&(x))
+
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define min_t(type, a, b)	min((type)(a), (type)(b))
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define KERN_ERR		""
+#define KERN_INFO		""
+extern int mock_verbose;
+#define printk(fmt...)	do { if (mock_verbose) printf(fmt); } while (0)
+
+#define GFP_KERNEL		0
+#define kmalloc(size, gfp)	malloc(size)
+#define kfree(p)		free(p)
+
+/* A NULL user pointer stands for one that faults */
+static inline unsigned long copy_from_user(void *to, const void *from,
+					   unsigned long n)
+{
+	if (from == NULL)
+		return n;
+	memcpy(to, from, n);
+	return 0;
+}
+
+/* Copies out yield when it is set, so that racing readers interleave */
+extern int mock_copy_yield;
+
+static inline unsigned long copy_to_user(void *to, const void *from,
+					 unsigned long n)
+{
+	if (to == NULL)
+		return n;
+	if (mock_copy_yield)
+		sched_yield();
+	memcpy(to, from, n);
+	return 0;
+}
+
+struct task_struct { pid_t pid; pid_t tgid; };
+extern __thread struct task_struct mock_task;
+#define current			(&mock_task)
+#define current_euid()		((uid_t)0)
+#define in_egroup_p(gid)	1
+#define capable(cap)		1
+#define CAP_SYSLOG		34
+
+static inline struct timespec current_kernel_time(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now;
+}
+
+typedef pthread_mutex_t spinlock_t;
+#define __SPIN_LOCK_UNLOCKED(name)	PTHREAD_MUTEX_INITIALIZER
+#define spin_lock(l)			pthread_mutex_lock(l)
+#define spin_unlock(l)			pthread_mutex_unlock(l)
+
+struct mutex { pthread_mutex_t m; };
+#define mutex_init(l)			pthread_mutex_init(&(l)->m, NULL)
+#define mutex_lock(l)			pthread_mutex_lock(&(l)->m)
+#define mutex_unlock(l)			pthread_mutex_unlock(&(l)->m)
+
+typedef struct { int dummy; } wait_queue_head_t;
+#define __WAIT_QUEUE_HEAD_INITIALIZER(name)	{ 0 }
+#define TASK_INTERRUPTIBLE			1
+#define DEFINE_WAIT(w)				int w = 0
+#define prepare_to_wait(q, w, state)		do { (void)(w); } while (0)
+#define finish_wait(q, w)			do { (void)(w); } while (0)
+#define schedule()				sched_yield()
+#define signal_pending(p)			0
+#define wake_up(q)				do {} while (0)
+#define wake_up_interruptible(q)		do {} while (0)
+#define wait_event(q, cond)					\
+	do {							\
+		while (!(cond))					\
+			sched_yield();				\
+	} while (0)
+
+#define FMODE_READ		1
+#define FMODE_WRITE		2
+#define MINOR(dev)		(dev)
+
+struct inode { dev_t i_rdev; gid_t i_gid; };
+struct file {
+	unsigned int f_mode;
+	unsigned int f_flags;
+	void *private_data;
+};
+struct kiocb { struct file *ki_filp; size_t ki_left; };
+
+typedef struct { int dummy; } poll_table;
+#define poll_wait(file, q, wait)	do {} while (0)
+
+#define nonseekable_open(inode, file)	0
+
+struct file_operations {
+	void *owner;
+	ssize_t (*read)(struct file *, char *, size_t, loff_t *);
+	ssize_t (*aio_write)(struct kiocb *, const struct iovec *,
+			     unsigned long, loff_t);
+	unsigned int (*poll)(struct file *, poll_table *);
+	long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+	long (*compat_ioctl)(struct file *, unsigned int, unsigned long);
+	int (*open)(struct inode *, struct file *);
+	int (*release)(struct inode *, struct file *);
+};
+
+struct device;
+#define MISC_DYNAMIC_MINOR	255
+struct miscdevice {
+	int minor;
+	const char *name;
+	const struct file_operations *fops;
+	struct device *parent;
+};
+
+static inline int misc_register(struct miscdevice *misc)
+{
+	static int next_minor;
+
+	misc->minor = next_minor++;
+	return 0;
+}
+#define device_initcall(fn)
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	new->next = head;
+	new->prev = head->prev;
+	head->prev->next = new;
+	head->prev = new;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_entry((head)->next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef LINUX_MODULE_H
+#define LINUX_MODULE_H
+#include <linux/kernel.h>
+#endif
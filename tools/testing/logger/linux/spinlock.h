@@ -0,0 +1,4 @@
+#ifndef LINUX_SPINLOCK_H
+#define LINUX_SPINLOCK_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,541 @@
+/*
+ * Host tests and contention benchmark for the Android logger.
+ *
+ * drivers/staging/android/logger.c is built against the stub headers of
+ * this directory, with pthreads standing in for tasks and a NULL user
+ * pointer standing in for one that faults. The tests check that entries
+ * become readable in the order they were reserved, as soon as every
+ * entry before them is complete, that a faulting write leaves a blank
+ * entry behind, that a lapped reader still reads intact entries in
+ * order, and that threads reading the same file get each entry once.
+ *
+ * The benchmark then runs N writer threads against M non-blocking reader
+ * threads on one log and reports entries/s. Every entry read is checked:
+ * its payload must be intact, and each writer's entries must arrive in
+ * order. Entries the writers lap before a reader gets to them are
+ * counted as lost, not as errors.
+ *
+ * make && ./logger_test [-v] [-w writers] [-r readers] [-n entries]
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#include "../../../drivers/staging/android/logger.c"
+
+#include <unistd.h>
+
+#define MAX_WRITERS	64
+#define MAX_READERS	64
+
+int mock_verbose;
+int mock_copy_yield;
+__thread struct task_struct mock_task = { .pid = 1, .tgid = 1 };
+
+static void open_log(struct logger_log *log, struct file *file,
+		     unsigned int mode, unsigned int flags)
+{
+	struct inode inode = { .i_rdev = log->misc.minor };
+
+	memset(file, 0, sizeof(*file));
+	file->f_mode = mode;
+	file->f_flags = flags;
+	if (logger_open(&inode, file)) {
+		fprintf(stderr, "cannot open %s\n", log->misc.name);
+		exit(2);
+	}
+}
+
+static void close_log(struct file *file)
+{
+	logger_release(NULL, file);
+}
+
+static ssize_t write_log(struct file *file, const struct iovec *iov,
+			 unsigned long nr_segs)
+{
+	struct kiocb iocb = { .ki_filp = file };
+	unsigned long i;
+
+	for (i = 0; i < nr_segs; i++)
+		iocb.ki_left += iov[i].iov_len;
+
+	return logger_aio_write(&iocb, iov, nr_segs, 0);
+}
+
+static ssize_t write_buf(struct file *file, const void *buf, size_t len)
+{
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+
+	return write_log(file, &iov, 1);
+}
+
+static ssize_t read_log(struct file *file, void *buf, size_t len)
+{
+	return logger_read(file, buf, len, NULL);
+}
+
+static void set_version(struct file *file, int version)
+{
+	logger_ioctl(file, LOGGER_SET_VERSION, (unsigned long)&version);
+}
+
+/* Entries reserved a, b: each commit must make what is complete readable */
+static int test_commit_order(void)
+{
+	struct logger_log *log = &log_radio;
+	struct logger_entry header = { .len = 8 };
+	unsigned int a, b, c;
+	size_t start, a_end, b_end;
+	int failed = 0;
+
+	start = log->c_off;
+	logger_reserve(log, &header, &a);
+	a_end = log->w_off;
+	logger_reserve(log, &header, &b);
+	logger_commit(log, b);
+	if (log->c_off != start) {
+		printf("FAIL commit order: an entry after one in flight is readable\n");
+		failed = 1;
+	}
+	logger_commit(log, a);
+	if (log->c_off != log->w_off) {
+		printf("FAIL commit order: c_off %zu, expected %zu\n",
+		       log->c_off, log->w_off);
+		failed = 1;
+	}
+
+	/* one writer is always in flight, readers must still make progress */
+	start = log->w_off;
+	logger_reserve(log, &header, &a);
+	a_end = log->w_off;
+	logger_reserve(log, &header, &b);
+	b_end = log->w_off;
+	logger_commit(log, a);
+	if (log->c_off != a_end) {
+		printf("FAIL commit order: c_off %zu after the first commit, expected %zu\n",
+		       log->c_off, a_end);
+		failed = 1;
+	}
+	logger_reserve(log, &header, &c);
+	logger_commit(log, b);
+	if (log->c_off != b_end) {
+		printf("FAIL commit order: c_off %zu after the second commit, expected %zu\n",
+		       log->c_off, b_end);
+		failed = 1;
+	}
+	logger_commit(log, c);
+	if (log->c_off != log->w_off || log->s_head != log->s_tail) {
+		printf("FAIL commit order: writers left in flight\n");
+		failed = 1;
+	}
+
+	return failed;
+}
+
+static int test_round_trip(void)
+{
+	struct file w, r;
+	struct iovec iov[2] = {
+		{ .iov_base = "hello, ", .iov_len = 7 },
+		{ .iov_base = "world", .iov_len = 6 },
+	};
+	char buf[LOGGER_ENTRY_MAX_LEN];
+	struct logger_entry *entry = (struct logger_entry *)buf;
+	struct user_logger_entry_compat *v1 = (void *)buf;
+	int failed = 0;
+	ssize_t ret;
+
+	open_log(&log_main, &r, FMODE_READ, O_NONBLOCK);
+	open_log(&log_main, &w, FMODE_WRITE, 0);
+	mock_task.pid = 12;
+	mock_task.tgid = 10;
+
+	write_log(&w, iov, 2);
+	iov[0].iov_base = NULL;
+	if (write_log(&w, iov, 2) != -EFAULT) {
+		printf("FAIL round trip: a faulting write did not fail\n");
+		failed = 1;
+	}
+	iov[0].iov_base = "HELLO, ";
+	write_log(&w, iov, 2);
+
+	ret = read_log(&r, buf, sizeof(buf));
+	if (ret != sizeof(*v1) + 13 || v1->len != 13 || v1->pid != 10 ||
+	    v1->tid != 12 || strcmp(v1->msg, "hello, world")) {
+		printf("FAIL round trip: v1 entry of %zd bytes, pid %d tid %d\n",
+		       ret, v1->pid, v1->tid);
+		failed = 1;
+	}
+
+	set_version(&r, 2);
+	ret = read_log(&r, buf, sizeof(buf));
+	if (ret != sizeof(*entry) + 13 || entry->len != 13 ||
+	    entry->hdr_size != sizeof(*entry) ||
+	    memcmp(entry->msg, "\0\0\0\0\0\0\0\0\0\0\0\0", 13)) {
+		printf("FAIL round trip: faulted entry of %zd bytes not blank\n",
+		       ret);
+		failed = 1;
+	}
+
+	if (read_log(&r, buf, sizeof(*entry) + 12) != -EINVAL) {
+		printf("FAIL round trip: short read did not fail\n");
+		failed = 1;
+	}
+	ret = read_log(&r, buf, sizeof(buf));
+	if (ret != sizeof(*entry) + 13 || strcmp(entry->msg, "HELLO, world")) {
+		printf("FAIL round trip: third entry of %zd bytes\n", ret);
+		failed = 1;
+	}
+
+	if (read_log(&r, buf, sizeof(buf)) != -EAGAIN) {
+		printf("FAIL round trip: more entries than written\n");
+		failed = 1;
+	}
+
+	close_log(&w);
+	close_log(&r);
+	return failed;
+}
+
+/* The benchmark's entry: who wrote it, then a pattern the reader checks */
+struct bench_msg {
+	__u32 writer;
+	__u32 seq;
+	unsigned char fill[0];
+};
+
+static size_t bench_len(__u32 seq)
+{
+	return sizeof(struct bench_msg) + (seq * 37) % 200;
+}
+
+static void bench_fill(struct bench_msg *msg, __u32 writer, __u32 seq)
+{
+	size_t i;
+
+	msg->writer = writer;
+	msg->seq = seq;
+	for (i = 0; i < bench_len(seq) - sizeof(*msg); i++)
+		msg->fill[i] = writer + seq + i;
+}
+
+/*
+ * bench_check - checks one entry read back. 'last' holds the sequence of the
+ * last entry read from each writer, plus one. Returns the number of entries
+ * lost before this one, or -1 if it is corrupt or out of order.
+ */
+static long bench_check(struct logger_entry *entry, __u32 *last, int writers)
+{
+	struct bench_msg *msg = (struct bench_msg *)entry->msg;
+	long lost;
+	size_t i;
+
+	if (entry->len < sizeof(*msg) || msg->writer >= writers ||
+	    entry->len != bench_len(msg->seq) || msg->seq < last[msg->writer])
+		return -1;
+
+	for (i = 0; i < entry->len - sizeof(*msg); i++)
+		if (msg->fill[i] != (unsigned char)(msg->writer + msg->seq + i))
+			return -1;
+
+	lost = msg->seq - last[msg->writer];
+	last[msg->writer] = msg->seq + 1;
+	return lost;
+}
+
+/* Lap a reader several times over, it must still read intact entries */
+static int test_lapped_reader(void)
+{
+	struct file w, r;
+	char buf[LOGGER_ENTRY_MAX_LEN];
+	__u32 seq, last = 0, entries = 0;
+	long lost, total_lost = 0;
+	int failed = 0;
+
+	open_log(&log_events, &r, FMODE_READ, O_NONBLOCK);
+	open_log(&log_events, &w, FMODE_WRITE, 0);
+	set_version(&r, 2);
+
+	for (seq = 0; seq < 3 * log_events.size / bench_len(0); seq++) {
+		bench_fill((struct bench_msg *)buf, 0, seq);
+		write_buf(&w, buf, bench_len(seq));
+	}
+
+	while (read_log(&r, buf, sizeof(buf)) > 0) {
+		lost = bench_check((struct logger_entry *)buf, &last, 1);
+		if (lost < 0) {
+			printf("FAIL lapped reader: bad entry after %u\n", last);
+			failed = 1;
+			break;
+		}
+		total_lost += lost;
+		entries++;
+	}
+
+	if (!failed && (last != seq || !total_lost ||
+			entries + total_lost != seq)) {
+		printf("FAIL lapped reader: read %u, lost %ld, up to %u of %u\n",
+		       entries, total_lost, last, seq);
+		failed = 1;
+	}
+
+	close_log(&w);
+	close_log(&r);
+	return failed;
+}
+
+struct shared_reader {
+	pthread_t thread;
+	struct file *file;
+	unsigned char *seen;	/* times each entry was read */
+	int failed;
+};
+
+static void *shared_reader(void *arg)
+{
+	struct shared_reader *sr = arg;
+	char buf[LOGGER_ENTRY_MAX_LEN];
+	__u32 last = 0;
+
+	while (read_log(sr->file, buf, sizeof(buf)) > 0) {
+		struct bench_msg *msg = (struct bench_msg *)
+			((struct logger_entry *)buf)->msg;
+
+		/* each thread must still see the entries in order */
+		if (bench_check((struct logger_entry *)buf, &last, 1) < 0) {
+			sr->failed = 1;
+			break;
+		}
+		__sync_fetch_and_add(&sr->seen[msg->seq], 1);
+	}
+
+	return NULL;
+}
+
+/* Two threads reading one file: no entry is lost, torn or read twice */
+static int test_shared_reader(void)
+{
+	struct shared_reader sr[2];
+	unsigned char seen[1000] = { 0 };
+	char buf[LOGGER_ENTRY_MAX_LEN];
+	struct file w, r;
+	__u32 seq;
+	int i, failed = 0;
+
+	open_log(&log_main, &r, FMODE_READ, O_NONBLOCK);
+	open_log(&log_main, &w, FMODE_WRITE, 0);
+	set_version(&r, 2);
+	while (read_log(&r, buf, sizeof(buf)) > 0)
+		;	/* what the earlier tests left */
+
+	/* well within the log, so that nothing is lapped */
+	for (seq = 0; seq < ARRAY_SIZE(seen); seq++) {
+		bench_fill((struct bench_msg *)buf, 0, seq);
+		write_buf(&w, buf, bench_len(seq));
+	}
+
+	mock_copy_yield = 1;
+	for (i = 0; i < 2; i++) {
+		sr[i].file = &r;
+		sr[i].seen = seen;
+		sr[i].failed = 0;
+		pthread_create(&sr[i].thread, NULL, shared_reader, &sr[i]);
+	}
+	for (i = 0; i < 2; i++) {
+		pthread_join(sr[i].thread, NULL);
+		if (sr[i].failed) {
+			printf("FAIL shared reader: thread %d read a bad entry\n",
+			       i);
+			failed = 1;
+		}
+	}
+	mock_copy_yield = 0;
+
+	for (seq = 0; seq < ARRAY_SIZE(seen) && !failed; seq++) {
+		if (seen[seq] != 1) {
+			printf("FAIL shared reader: entry %u read %d times\n",
+			       seq, seen[seq]);
+			failed = 1;
+		}
+	}
+
+	close_log(&w);
+	close_log(&r);
+	return failed;
+}
+
+static struct logger_log *bench_log = &log_system;
+static int bench_writers = 4;
+static int bench_readers = 2;
+static unsigned long bench_entries = 100000;
+static volatile int bench_writing;
+static pthread_barrier_t bench_start;
+
+struct bench_reader {
+	pthread_t thread;
+	unsigned long entries;
+	unsigned long lost;
+	int failed;
+	double secs;
+};
+
+static double now_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *bench_writer(void *arg)
+{
+	__u32 writer = (uintptr_t)arg, seq;
+	char buf[LOGGER_ENTRY_MAX_PAYLOAD];
+	struct file w;
+
+	mock_task.pid = 100 + writer;
+	mock_task.tgid = 100;
+	open_log(bench_log, &w, FMODE_WRITE, 0);
+	pthread_barrier_wait(&bench_start);
+
+	for (seq = 0; seq < bench_entries; seq++) {
+		bench_fill((struct bench_msg *)buf, writer, seq);
+		write_buf(&w, buf, bench_len(seq));
+	}
+
+	close_log(&w);
+	return NULL;
+}
+
+static void *bench_reader(void *arg)
+{
+	struct bench_reader *br = arg;
+	char buf[LOGGER_ENTRY_MAX_LEN];
+	__u32 last[MAX_WRITERS] = { 0 };
+	struct file r;
+	double start;
+	long lost;
+
+	open_log(bench_log, &r, FMODE_READ, O_NONBLOCK);
+	set_version(&r, 2);
+	pthread_barrier_wait(&bench_start);
+	start = now_secs();
+
+	for (;;) {
+		int writing = bench_writing;
+
+		if (read_log(&r, buf, sizeof(buf)) < 0) {
+			if (!writing)
+				break;
+			sched_yield();
+			continue;
+		}
+
+		lost = bench_check((struct logger_entry *)buf, last,
+				   bench_writers);
+		if (lost < 0) {
+			br->failed = 1;
+			break;
+		}
+		br->entries++;
+	}
+
+	br->secs = now_secs() - start;
+	/* the tail of a writer that finished early may have been lapped too */
+	br->lost = bench_writers * bench_entries - br->entries;
+
+	close_log(&r);
+	return NULL;
+}
+
+static int bench(void)
+{
+	pthread_t writers[MAX_WRITERS];
+	struct bench_reader readers[MAX_READERS];
+	unsigned long total = bench_writers * bench_entries;
+	double start, secs;
+	int i, failed = 0;
+
+	memset(readers, 0, sizeof(readers));
+	pthread_barrier_init(&bench_start, NULL,
+			     bench_writers + bench_readers + 1);
+	bench_writing = 1;
+
+	for (i = 0; i < bench_readers; i++)
+		pthread_create(&readers[i].thread, NULL, bench_reader,
+			       &readers[i]);
+	for (i = 0; i < bench_writers; i++)
+		pthread_create(&writers[i], NULL, bench_writer,
+			       (void *)(uintptr_t)i);
+
+	pthread_barrier_wait(&bench_start);
+	start = now_secs();
+	for (i = 0; i < bench_writers; i++)
+		pthread_join(writers[i], NULL);
+	secs = now_secs() - start;
+	bench_writing = 0;
+
+	printf("%d writers: %lu entries in %.3fs, %.0f entries/s\n",
+	       bench_writers, total, secs, total / secs);
+
+	for (i = 0; i < bench_readers; i++) {
+		struct bench_reader *br = &readers[i];
+
+		pthread_join(br->thread, NULL);
+		printf("reader %d: %lu entries in %.3fs, %.0f entries/s, "
+		       "%lu lost\n", i, br->entries, br->secs,
+		       br->entries / br->secs, br->lost);
+		if (br->failed) {
+			printf("FAIL bench: reader %d read a bad entry\n", i);
+			failed = 1;
+		}
+	}
+
+	pthread_barrier_destroy(&bench_start);
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	int opt, failed = 0;
+
+	while ((opt = getopt(argc, argv, "vw:r:n:")) != -1) {
+		switch (opt) {
+		case 'v':
+			mock_verbose++;
+			break;
+		case 'w':
+			bench_writers = atoi(optarg);
+			break;
+		case 'r':
+			bench_readers = atoi(optarg);
+			break;
+		case 'n':
+			bench_entries = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (bench_writers < 1 || bench_writers > MAX_WRITERS ||
+	    bench_readers < 0 || bench_readers > MAX_READERS)
+		goto usage;
+
+	logger_init();
+
+	failed += test_commit_order();
+	failed += test_round_trip();
+	failed += test_lapped_reader();
+	failed += test_shared_reader();
+	failed += bench();
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return failed ? 1 : 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-v] [-w writers] [-r readers] "
+		"[-n entries]\n", argv[0]);
+	return 2;
+}
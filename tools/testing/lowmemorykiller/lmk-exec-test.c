@@ -0,0 +1,175 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -g -o lmk-exec-test lmk-exec-test.c -lpthread */
+
+/*
+ * Copyright (C) 2012 ROCKCHIP, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Checks that the lowmemorykiller candidate index survives exec from a
+ * secondary thread. The process writes its oom_adj, so that the index
+ * holds its group leader, then execs itself from another thread. In
+ * de_thread() that thread takes over the pid and the group, and the old
+ * leader exits as a plain thread. The new image then reads
+ * <debugfs>/lowmemorykiller/index and expects:
+ *
+ *  - no entry for the tid of the thread that exec'd, which is now the
+ *    pid of the dead old leader;
+ *  - every listed pid to be a live thread group leader;
+ *  - its own pid to be listed after writing oom_adj again.
+ *
+ * Needs root and debugfs; set LMK_INDEX if it is not mounted on
+ * /sys/kernel/debug.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define TEST_ADJ	12
+#define TEST_ADJ2	10
+
+static const char *index_path = "/sys/kernel/debug/lowmemorykiller/index";
+static char *self;
+
+static int write_oom_adj(int adj)
+{
+	FILE *f = fopen("/proc/self/oom_adj", "w");
+
+	if (!f) {
+		perror("/proc/self/oom_adj");
+		return -1;
+	}
+	fprintf(f, "%d\n", adj);
+	return fclose(f);
+}
+
+static int is_group_leader(int pid)
+{
+	char path[64], line[128];
+	int tgid = -1;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "Tgid: %d", &tgid) == 1)
+			break;
+	fclose(f);
+	return tgid == pid;
+}
+
+/*
+ * Returns 0 if the index is sane, 1 if it should be read again, -1 on
+ * error. *own_adj gets the oom_adj listed for our pid, or -100.
+ */
+static int check_index(int dead_tid, int *own_adj)
+{
+	char line[128], comm[32];
+	int pid, adj, ret = 0;
+	FILE *f;
+
+	*own_adj = -100;
+	f = fopen(index_path, "r");
+	if (!f) {
+		perror(index_path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%d %d %31s", &pid, &adj, comm) != 3)
+			continue;
+		if (pid == getpid())
+			*own_adj = adj;
+		if (pid == dead_tid || !is_group_leader(pid)) {
+			fprintf(stderr, "stale entry: %s", line);
+			ret = 1;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+static int after_exec(int dead_tid)
+{
+	int own_adj, ret, i;
+
+	/* The old leader is freed after an RCU grace period */
+	for (i = 0; i < 20; i++) {
+		ret = check_index(dead_tid, &own_adj);
+		if (ret <= 0)
+			break;
+		usleep(100 * 1000);
+	}
+	if (ret) {
+		printf("FAIL: index still holds an exited task\n");
+		return 1;
+	}
+
+	if (write_oom_adj(TEST_ADJ2))
+		return 1;
+	if (check_index(dead_tid, &own_adj) || own_adj != TEST_ADJ2) {
+		printf("FAIL: pid %d listed with oom_adj %d, expected %d\n",
+		       getpid(), own_adj, TEST_ADJ2);
+		return 1;
+	}
+
+	printf("PASS\n");
+	return 0;
+}
+
+static void *exec_thread(void *arg)
+{
+	char tid[16];
+	char *argv[] = { self, "--after-exec", tid, NULL };
+
+	(void)arg;
+	snprintf(tid, sizeof(tid), "%ld", (long)syscall(SYS_gettid));
+	execv("/proc/self/exe", argv);
+	perror("execv");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t thread;
+	int own_adj;
+
+	self = argv[0];
+	if (getenv("LMK_INDEX"))
+		index_path = getenv("LMK_INDEX");
+	if (argc == 3 && !strcmp(argv[1], "--after-exec"))
+		return after_exec(atoi(argv[2]));
+
+	if (write_oom_adj(TEST_ADJ))
+		return 1;
+	if (check_index(-1, &own_adj) < 0)
+		return 1;
+	if (own_adj != TEST_ADJ) {
+		printf("FAIL: pid %d not indexed with oom_adj %d\n",
+		       getpid(), TEST_ADJ);
+		return 1;
+	}
+
+	errno = pthread_create(&thread, NULL, exec_thread, NULL);
+	if (errno) {
+		perror("pthread_create");
+		return 1;
+	}
+	for (;;)
+		pause();
+}
@@ -0,0 +1,8 @@
+#ifndef ASM_UNALIGNED_H
+#define ASM_UNALIGNED_H
+#include <linux/kernel.h>
+
+#define put_unaligned(val, ptr) \
+	do { typeof(*(ptr)) __v = (val); memcpy((ptr), &__v, sizeof(__v)); } while (0)
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef LINUX_INTERRUPT_H
+#define LINUX_INTERRUPT_H
+#include <linux/kernel.h>
+#endif
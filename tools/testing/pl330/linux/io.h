@@ -0,0 +1,4 @@
+#ifndef LINUX_IO_H
+#define LINUX_IO_H
+#include <linux/kernel.h>
+#endif
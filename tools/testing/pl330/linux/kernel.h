@@ -0,0 +1,142 @@
+#ifndef LINUX_KERNEL_H
+#define LINUX_KERNEL_H
+
+/* Just enough of the kernel to build arch/arm/common/pl330.c on a host */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef u32 dma_addr_t;
+
+#define __iomem
+#define __init
+#define __sramdata
+#define EXPORT_SYMBOL(sym)
+#define likely(x)	(x)
+#define unlikely(x)	(x)
+#define BUG_ON(cond)	assert(!(cond))
+#define cpu_relax()	do {} while (0)
+#define udelay(us)	do {} while (0)
+#define mb()		do {} while (0)
+#define HZ		100
+#define loops_per_jiffy	1000UL
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define printk(fmt...)			printf(fmt)
+#define dev_info(dev, fmt...)		printf(fmt)
+#define dev_err(dev, fmt...)		fprintf(stderr, fmt)
+
+struct device;
+
+/* No device behind the registers: reads see an idle DMAC */
+static inline u32 readl(const volatile void *addr) { return 0; }
+static inline u8 readb(const volatile void *addr) { return 0; }
+#define writel(val, addr)	do { (void)(val); (void)(addr); } while (0)
+
+#define GFP_KERNEL	0
+#define kmalloc(size, gfp)	malloc(size)
+#define kzalloc(size, gfp)	calloc(1, size)
+#define kfree(p)		free(p)
+
+static inline void *dma_alloc_coherent(struct device *dev, size_t size,
+				       dma_addr_t *handle, int gfp)
+{
+	void *p = malloc(size);
+
+	*handle = (dma_addr_t)(uintptr_t)p;
+	return p;
+}
+
+static inline void dma_free_coherent(struct device *dev, size_t size,
+				     void *cpu, dma_addr_t handle)
+{
+	free(cpu);
+}
+
+typedef struct { int dummy; } spinlock_t;
+#define spin_lock_init(l)		do { (void)(l); } while (0)
+#define spin_lock(l)			do { (void)(l); } while (0)
+#define spin_unlock(l)			do { (void)(l); } while (0)
+#define spin_lock_irqsave(l, f)		do { (void)(l); (f) = 0; } while (0)
+#define spin_unlock_irqrestore(l, f)	do { (void)(l); (void)(f); } while (0)
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	new->next = head;
+	new->prev = head->prev;
+	head->prev->next = new;
+	head->prev = new;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+	list_del(entry);
+	INIT_LIST_HEAD(entry);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_entry((head)->next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+#define list_for_each_entry_safe(pos, n, head, member)			\
+	for (pos = list_entry((head)->next, typeof(*pos), member),	\
+		n = list_entry(pos->member.next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = n, n = list_entry(n->member.next, typeof(*n), member))
+
+struct tasklet_struct {
+	void (*func)(unsigned long);
+	unsigned long data;
+};
+
+static inline void tasklet_init(struct tasklet_struct *t,
+				void (*func)(unsigned long), unsigned long data)
+{
+	t->func = func;
+	t->data = data;
+}
+
+#define tasklet_schedule(t)	do {} while (0)
+#define tasklet_kill(t)		do {} while (0)
+
+#endif
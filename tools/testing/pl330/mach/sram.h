@@ -0,0 +1,3 @@
+#ifndef MACH_SRAM_H
+#define MACH_SRAM_H
+#endif
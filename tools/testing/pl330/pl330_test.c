@@ -0,0 +1,458 @@
+/*
+ * Host tests for the PL330 microcode generator.
+ *
+ * arch/arm/common/pl330.c is built against the stub headers of this
+ * directory, and _setup_req() is run for the request shapes the rk
+ * dmaengine provider submits: scatter-gather lists to and from a
+ * peripheral, one period of a cyclic transfer per req slot, and memcpy.
+ * The MC is then executed by a small PL330 model, which checks that
+ * every burst of every xfer is moved once, in order, between the right
+ * addresses, through the right peripheral, and that the req ends with
+ * the event of the thread. pl330_req_mcode_len() must agree with the
+ * length of the generated MC.
+ *
+ * make && ./pl330_test [-v]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "../../../arch/arm/common/pl330.c"
+
+#include <unistd.h>
+
+#define TEST_MCBUFSZ	1024
+#define TEST_EV		3
+#define MAX_STEPS	(64 << 20)
+
+static int verbose;
+
+static struct pl330_info test_pi = {
+	.mcbufsz = TEST_MCBUFSZ,
+	.pcfg = {
+		.num_chan = 8,
+		.num_peri = 32,
+		.num_events = 16,
+	},
+};
+
+static struct pl330_dmac test_dmac = {
+	.pinfo = &test_pi,
+};
+
+static u8 test_mc[2][TEST_MCBUFSZ / 2];
+
+static struct pl330_thread test_thrd = {
+	.id = 0,
+	.ev = TEST_EV,
+	.free = false,
+	.dmac = &test_dmac,
+	.req = {
+		{ .mc_cpu = test_mc[0] },
+		{ .mc_cpu = test_mc[1] },
+	},
+};
+
+struct model {
+	const struct pl330_req *r;
+	const struct pl330_xfer *x;	/* xfer expected next */
+	u32 done;			/* bytes of it moved so far */
+	u32 sar, dar, ccr;
+	unsigned lc[2];
+	bool loaded;
+	u32 load_addr;
+	bool waited;			/* DMAWFP seen for the next access */
+	int sev;
+	unsigned long bursts;
+};
+
+static int fail(const char *name, unsigned pc, const char *why)
+{
+	printf("FAIL %s: %s at MC offset %u\n", name, why, pc);
+	return -1;
+}
+
+static u32 mc_u32(const u8 *p)
+{
+	u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static int model_store(const char *name, struct model *m, unsigned pc)
+{
+	u32 burst = BRST_SIZE(m->ccr) * BRST_LEN(m->ccr);
+	u32 src, dst;
+
+	if (!m->loaded)
+		return fail(name, pc, "store without load");
+	if (!m->x)
+		return fail(name, pc, "burst past the last xfer");
+
+	src = m->x->src_addr + ((m->ccr & CC_SRCINC) ? m->done : 0);
+	dst = m->x->dst_addr + ((m->ccr & CC_DSTINC) ? m->done : 0);
+	if (m->load_addr != src)
+		return fail(name, pc, "load from the wrong address");
+	if (m->dar != dst)
+		return fail(name, pc, "store to the wrong address");
+
+	if (m->ccr & CC_DSTINC)
+		m->dar += burst;
+	m->loaded = false;
+	m->bursts++;
+	m->done += burst;
+	if (m->done == m->x->bytes) {
+		m->x = m->x->next;
+		m->done = 0;
+	}
+	return 0;
+}
+
+static int model_load(const char *name, struct model *m, unsigned pc)
+{
+	if (m->loaded)
+		return fail(name, pc, "load overwrites a pending load");
+	m->loaded = true;
+	m->load_addr = m->sar;
+	if (m->ccr & CC_SRCINC)
+		m->sar += BRST_SIZE(m->ccr) * BRST_LEN(m->ccr);
+	return 0;
+}
+
+static int check_peri(const char *name, struct model *m, unsigned pc,
+		      u8 arg, bool wait)
+{
+	if (m->r->rqtype == MEMTOMEM)
+		return fail(name, pc, "peripheral access in memcpy");
+	if ((arg >> 3) != m->r->peri)
+		return fail(name, pc, "wrong peripheral");
+	if (wait) {
+		m->waited = true;
+		return 0;
+	}
+	if (!m->waited)
+		return fail(name, pc, "peripheral access without DMAWFP");
+	m->waited = false;
+	return 0;
+}
+
+/* Runs the MC of one req, returns 0 if it moved exactly r's xfers */
+static int model_run(const char *name, const u8 *mc, int len,
+		     const struct pl330_req *r, u32 ccr)
+{
+	struct model m = { .r = r, .x = r->x, .sev = -1 };
+	unsigned long steps = 0;
+	unsigned pc = 0;
+	u8 op;
+
+	while (pc < (unsigned)len) {
+		if (++steps > MAX_STEPS)
+			return fail(name, pc, "does not terminate");
+		op = mc[pc];
+		if (verbose > 1)
+			printf("  %3u: %02x\n", pc, op);
+		switch (op) {
+		case CMD_DMAMOV:
+			if (mc[pc + 1] == SAR)
+				m.sar = mc_u32(&mc[pc + 2]);
+			else if (mc[pc + 1] == DAR)
+				m.dar = mc_u32(&mc[pc + 2]);
+			else if (mc[pc + 1] == CCR)
+				m.ccr = mc_u32(&mc[pc + 2]);
+			else
+				return fail(name, pc, "DMAMOV to unknown register");
+			pc += SZ_DMAMOV;
+			break;
+		case CMD_DMALP:
+		case CMD_DMALP | (1 << 1):
+			m.lc[(op >> 1) & 1] = mc[pc + 1];
+			pc += SZ_DMALP;
+			break;
+		case CMD_DMALPEND | (1 << 4):
+		case CMD_DMALPEND | (1 << 4) | (1 << 2):
+			if (m.lc[(op >> 2) & 1]) {
+				m.lc[(op >> 2) & 1]--;
+				if (mc[pc + 1] > pc)
+					return fail(name, pc, "jump before the MC");
+				pc -= mc[pc + 1];
+			} else {
+				pc += SZ_DMALPEND;
+			}
+			break;
+		case CMD_DMALD:
+			if (m.r->rqtype == DEVTOMEM)
+				return fail(name, pc, "DMALD from a peripheral");
+			if (model_load(name, &m, pc))
+				return -1;
+			pc += SZ_DMALD;
+			break;
+		case CMD_DMAST:
+			if (m.r->rqtype == MEMTODEV)
+				return fail(name, pc, "DMAST to a peripheral");
+			if (model_store(name, &m, pc))
+				return -1;
+			pc += SZ_DMAST;
+			break;
+		case CMD_DMALDP | (1 << 1):
+			if (m.r->rqtype != DEVTOMEM)
+				return fail(name, pc, "DMALDP outside dev to mem");
+			if (check_peri(name, &m, pc, mc[pc + 1], false) ||
+			    model_load(name, &m, pc))
+				return -1;
+			pc += SZ_DMALDP;
+			break;
+		case CMD_DMASTP | (1 << 1):
+			if (m.r->rqtype != MEMTODEV)
+				return fail(name, pc, "DMASTP outside mem to dev");
+			if (check_peri(name, &m, pc, mc[pc + 1], false) ||
+			    model_store(name, &m, pc))
+				return -1;
+			pc += SZ_DMASTP;
+			break;
+		case CMD_DMAWFP | (1 << 1):
+			if (check_peri(name, &m, pc, mc[pc + 1], true))
+				return -1;
+			pc += SZ_DMAWFP;
+			break;
+		case CMD_DMARMB:
+		case CMD_DMAWMB:
+		case CMD_DMANOP:
+			pc += 1;
+			break;
+		case CMD_DMASEV:
+			if (m.sev >= 0)
+				return fail(name, pc, "second DMASEV");
+			m.sev = mc[pc + 1] >> 3;
+			pc += SZ_DMASEV;
+			break;
+		case CMD_DMAEND:
+			if (pc + SZ_DMAEND != (unsigned)len)
+				return fail(name, pc, "DMAEND before the end");
+			if (m.ccr != ccr)
+				return fail(name, pc, "wrong CCR");
+			if (m.x || m.loaded)
+				return fail(name, pc, "xfers left unfinished");
+			if (m.sev != TEST_EV)
+				return fail(name, pc, "no DMASEV of the thread event");
+			if (verbose)
+				printf("  %d bytes of MC, %lu bursts, %lu steps\n",
+				       len, m.bursts, steps);
+			return 0;
+		default:
+			return fail(name, pc, "unexpected instruction");
+		}
+	}
+
+	return fail(name, pc, "runs off the end");
+}
+
+/*
+ * Generates the MC of one req into req slot idx and runs it. Returns
+ * the MC length, or the error of _setup_req().
+ */
+static int run_req(const char *name, unsigned idx, struct pl330_req *r)
+{
+	struct _xfer_spec xs;
+	int dry, len, est;
+
+	xs.ccr = _prepare_ccr(r->cfg);
+	xs.r = r;
+
+	dry = _setup_req(1, &test_thrd, idx, &xs);
+	est = pl330_req_mcode_len(&test_thrd, r);
+	if (dry != est) {
+		printf("FAIL %s: pl330_req_mcode_len %d, dry run %d\n",
+		       name, est, dry);
+		return -1;
+	}
+	if (dry < 0)
+		return dry;
+	if (dry > TEST_MCBUFSZ / 2) {
+		printf("FAIL %s: %d bytes of MC do not fit a req slot\n",
+		       name, dry);
+		return -1;
+	}
+
+	memset(test_mc[idx], 0xff, sizeof(test_mc[idx]));
+	len = _setup_req(0, &test_thrd, idx, &xs);
+	if (len != dry) {
+		printf("FAIL %s: MC of %d bytes, dry run said %d\n",
+		       name, len, dry);
+		return -1;
+	}
+	if (model_run(name, test_mc[idx], len, r, xs.ccr))
+		return -1;
+
+	return len;
+}
+
+static void chain(struct pl330_xfer *x, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		x[i].next = (i + 1 < n) ? &x[i + 1] : NULL;
+}
+
+static int report(const char *name, int ret)
+{
+	if (ret >= 0)
+		printf("ok   %s\n", name);
+	return ret < 0;
+}
+
+/* A scatterlist to a peripheral FIFO: word bursts, dst fixed */
+static int test_slave_sg_to_dev(void)
+{
+	struct pl330_reqcfg cfg = {
+		.src_inc = 1, .dst_inc = 0, .brst_size = 2, .brst_len = 1,
+		.dcctl = DCCTRL0, .scctl = SCCTRL0,
+	};
+	struct pl330_xfer x[] = {
+		{ .src_addr = 0x60001000, .dst_addr = 0x20070400, .bytes = 4096 },
+		{ .src_addr = 0x60100024, .dst_addr = 0x20070400, .bytes = 36 },
+		{ .src_addr = 0x60200000, .dst_addr = 0x20070400,
+		  .bytes = 300000 * 4 },
+	};
+	struct pl330_req r = {
+		.rqtype = MEMTODEV, .peri = 5, .cfg = &cfg, .x = x,
+	};
+
+	chain(x, ARRAY_SIZE(x));
+	return report("slave_sg mem to dev",
+		      run_req("slave_sg mem to dev", 0, &r));
+}
+
+/* A scatterlist from a peripheral FIFO: 4 word bursts, src fixed */
+static int test_slave_sg_from_dev(void)
+{
+	struct pl330_reqcfg cfg = {
+		.src_inc = 0, .dst_inc = 1, .brst_size = 2, .brst_len = 4,
+		.dcctl = DCCTRL0, .scctl = SCCTRL0,
+	};
+	struct pl330_xfer x[] = {
+		{ .src_addr = 0x10204000, .dst_addr = 0x61000000, .bytes = 512 },
+		{ .src_addr = 0x10204000, .dst_addr = 0x61800010, .bytes = 16 },
+		{ .src_addr = 0x10204000, .dst_addr = 0x62000000, .bytes = 65536 },
+	};
+	struct pl330_req r = {
+		.rqtype = DEVTOMEM, .peri = 17, .cfg = &cfg, .x = x,
+	};
+
+	chain(x, ARRAY_SIZE(x));
+	return report("slave_sg dev to mem",
+		      run_req("slave_sg dev to mem", 1, &r));
+}
+
+/*
+ * Cyclic: one period per req slot, both slots in flight. Generating
+ * the second must leave the MC of the first alone.
+ */
+static int test_cyclic(void)
+{
+	const u32 period = 8192, buf = 0x63000000;
+	struct pl330_reqcfg cfg = {
+		.src_inc = 0, .dst_inc = 1, .brst_size = 1, .brst_len = 8,
+		.dcctl = DCCTRL0, .scctl = SCCTRL0,
+	};
+	struct pl330_xfer x[2] = {
+		{ .src_addr = 0x10300010, .dst_addr = buf, .bytes = period },
+		{ .src_addr = 0x10300010, .dst_addr = buf + period,
+		  .bytes = period },
+	};
+	struct pl330_req r[2] = {
+		{ .rqtype = DEVTOMEM, .peri = 9, .cfg = &cfg, .x = &x[0] },
+		{ .rqtype = DEVTOMEM, .peri = 9, .cfg = &cfg, .x = &x[1] },
+	};
+	u8 first[TEST_MCBUFSZ / 2];
+	int len0, len1;
+
+	len0 = run_req("cyclic period 0", 0, &r[0]);
+	if (len0 < 0)
+		return 1;
+	memcpy(first, test_mc[0], len0);
+
+	len1 = run_req("cyclic period 1", 1, &r[1]);
+	if (len1 < 0)
+		return 1;
+
+	if (memcmp(first, test_mc[0], len0)) {
+		printf("FAIL cyclic: period 1 clobbered the MC of period 0\n");
+		return 1;
+	}
+	if (model_run("cyclic period 0 again", test_mc[0], len0, &r[0],
+		      _prepare_ccr(&cfg)))
+		return 1;
+
+	return report("cyclic", 0);
+}
+
+/* memcpy: 16 x 8 byte bursts, enough bytes for the outer loop */
+static int test_memcpy(void)
+{
+	struct pl330_reqcfg cfg = {
+		.src_inc = 1, .dst_inc = 1, .brst_size = 3, .brst_len = 16,
+		.dcctl = DCCTRL0, .scctl = SCCTRL0,
+	};
+	struct pl330_xfer x[] = {
+		{ .src_addr = 0x64000000, .dst_addr = 0x68000000,
+		  .bytes = (16 << 20) + 3 * 128 },
+		{ .src_addr = 0x65000080, .dst_addr = 0x69000000, .bytes = 128 },
+	};
+	struct pl330_req r = {
+		.rqtype = MEMTOMEM, .cfg = &cfg, .x = x,
+	};
+
+	chain(x, ARRAY_SIZE(x));
+	return report("memcpy", run_req("memcpy", 0, &r));
+}
+
+/* A length that is not a whole number of bursts is refused */
+static int test_memcpy_unaligned(void)
+{
+	struct pl330_reqcfg cfg = {
+		.src_inc = 1, .dst_inc = 1, .brst_size = 3, .brst_len = 16,
+		.dcctl = DCCTRL0, .scctl = SCCTRL0,
+	};
+	struct pl330_xfer x = {
+		.src_addr = 0x64000000, .dst_addr = 0x68000000, .bytes = 100,
+	};
+	struct pl330_req r = {
+		.rqtype = MEMTOMEM, .cfg = &cfg, .x = &x,
+	};
+	int ret;
+
+	ret = run_req("memcpy unaligned", 0, &r);
+	if (ret != -EINVAL) {
+		printf("FAIL memcpy unaligned: got %d, expected -EINVAL\n",
+		       ret);
+		return 1;
+	}
+	return report("memcpy unaligned", 0);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, failed = 0;
+
+	while ((opt = getopt(argc, argv, "v")) != -1) {
+		if (opt == 'v') {
+			verbose++;
+		} else {
+			fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	failed += test_slave_sg_to_dev();
+	failed += test_slave_sg_from_dev();
+	failed += test_cyclic();
+	failed += test_memcpy();
+	failed += test_memcpy_unaligned();
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return failed ? 1 : 0;
+}
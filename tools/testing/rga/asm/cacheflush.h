@@ -0,0 +1,4 @@
+#ifndef ASM_CACHEFLUSH_H
+#define ASM_CACHEFLUSH_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef ASM_DELAY_H
+#define ASM_DELAY_H
+#include <linux/kernel.h>
+#endif
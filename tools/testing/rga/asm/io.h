@@ -0,0 +1,4 @@
+#ifndef ASM_IO_H
+#define ASM_IO_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef ASM_UACCESS_H
+#define ASM_UACCESS_H
+#include <linux/kernel.h>
+#endif
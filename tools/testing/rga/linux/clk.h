@@ -0,0 +1,4 @@
+#ifndef LINUX_CLK_H
+#define LINUX_CLK_H
+#include <linux/kernel.h>
+#endif
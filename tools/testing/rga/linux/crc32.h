@@ -0,0 +1,17 @@
+#ifndef LINUX_CRC32_H
+#define LINUX_CRC32_H
+#include <linux/kernel.h>
+
+/* lib/crc32.c crc32_le, one bit at a time */
+static inline u32 crc32_le(u32 crc, const unsigned char *p, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+	}
+	return crc;
+}
+#endif
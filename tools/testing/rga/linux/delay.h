@@ -0,0 +1,4 @@
+#ifndef LINUX_DELAY_H
+#define LINUX_DELAY_H
+#include <linux/kernel.h>
+#endif
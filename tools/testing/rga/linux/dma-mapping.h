@@ -0,0 +1,4 @@
+#ifndef LINUX_DMA_MAPPING_H
+#define LINUX_DMA_MAPPING_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef LINUX_ERR_H
+#define LINUX_ERR_H
+#include <linux/kernel.h>
+#endif
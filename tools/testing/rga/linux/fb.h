@@ -0,0 +1,4 @@
+#ifndef LINUX_FB_H
+#define LINUX_FB_H
+#include <linux/kernel.h>
+#endif
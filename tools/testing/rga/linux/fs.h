@@ -0,0 +1,4 @@
+#ifndef LINUX_FS_H
+#define LINUX_FS_H
+#include <linux/kernel.h>
+#endif
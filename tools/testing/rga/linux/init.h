@@ -0,0 +1,4 @@
+#ifndef LINUX_INIT_H
+#define LINUX_INIT_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef LINUX_IRQ_H
+#define LINUX_IRQ_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,296 @@
+#ifndef LINUX_KERNEL_H
+#define LINUX_KERNEL_H
+
+/*
+ * Just enough of the kernel to build drivers/video/rockchip/rga/rga_drv.c
+ * and rga_soft.c on a host. The registers are backed by rga_test.c, see
+ * mock_writel().
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef long long s64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+
+#define __iomem
+#define __user
+#define __init
+#define __exit
+#define __devinit
+#define __devexit_p(x)		(x)
+#define EXPORT_SYMBOL(sym)
+#define MODULE_AUTHOR(s)
+#define MODULE_DESCRIPTION(s)
+#define MODULE_LICENSE(s)
+#define module_init(fn)
+#define module_exit(fn)
+#define THIS_MODULE		NULL
+#define likely(x)		(x)
+#define unlikely(x)		(x)
+#define BUG_ON(cond)		assert(!(cond))
+#define dsb()			do {} while (0)
+#define udelay(us)		do {} while (0)
+#define mdelay(ms)		do {} while (0)
+#define msleep(ms)		do {} while (0)
+#define HZ			100
+#define NSEC_PER_SEC		1000000000LL
+#define SZ_8K			0x2000
+#define IS_ERR(p)		((unsigned long)(p) >= (unsigned long)-4095)
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define max_t(type, a, b)	((type)(a) > (type)(b) ? (type)(a) : (type)(b))
+
+#define KERN_ERR		""
+#define KERN_DEBUG		""
+#define KERN_INFO		""
+#define printk(fmt...)		mock_printk(fmt)
+#define pr_err(fmt...)		mock_printk(fmt)
+#define pr_info(fmt...)		mock_printk(fmt)
+
+extern int mock_verbose;
+#define mock_printk(fmt...)	do { if (mock_verbose) printf(fmt); } while (0)
+
+struct device { int dummy; };
+struct inode;
+struct dentry;
+struct task_struct { pid_t pid; };
+extern struct task_struct *current;
+
+/* Registers: writes and reads go through the mock in rga_test.c */
+extern void mock_writel(u32 val, void *addr);
+extern u32 mock_readl(void *addr);
+#define __raw_writel(v, a)	mock_writel(v, (void *)(a))
+#define __raw_readl(a)		mock_readl((void *)(a))
+
+extern void *mock_ioremap(unsigned long phys, size_t size);
+#define ioremap_nocache(p, s)		mock_ioremap(p, s)
+#define iounmap(p)			do { (void)(p); } while (0)
+#define request_mem_region(p, s, n)	1
+#define virt_to_phys(p)			((unsigned long)(uintptr_t)(p))
+#define dmac_flush_range(s, e)		do {} while (0)
+#define outer_flush_range(s, e)		do {} while (0)
+#define DMA_TO_DEVICE			1
+#define DMA_FROM_DEVICE			2
+#define dma_sync_single_for_device(d, a, s, dir)	do {} while (0)
+#define dma_sync_single_for_cpu(d, a, s, dir)		do {} while (0)
+#define __get_free_page(gfp)		((unsigned long)calloc(1, 4096))
+#define __free_page(p)			free(p)
+
+#define GFP_KERNEL	0
+#define __GFP_ZERO	0
+/* Counted, so a test can check nothing leaks; mock_kmalloc_fail = n fails the n-th */
+extern int mock_kmalloc_fail;
+extern int mock_live;
+static inline void *mock_kmalloc(size_t size, int zero)
+{
+	if (mock_kmalloc_fail && --mock_kmalloc_fail == 0)
+		return NULL;
+	mock_live++;
+	return zero ? calloc(1, size) : malloc(size);
+}
+
+static inline void mock_kfree(const void *p)
+{
+	if (p == NULL)
+		return;
+	mock_live--;
+	free((void *)p);
+}
+#define kmalloc(size, gfp)	mock_kmalloc(size, 0)
+#define kzalloc(size, gfp)	mock_kmalloc(size, 1)
+#define kfree(p)		mock_kfree(p)
+
+static inline unsigned long copy_from_user(void *to, const void *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline unsigned long copy_to_user(void *to, const void *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+/* One thread: a mutex only has to catch recursion and unbalanced unlocks */
+struct mutex { int locked; };
+#define DEFINE_MUTEX(m)		struct mutex m = { 0 }
+#define mutex_init(m)		((m)->locked = 0)
+#define mutex_lock(m)		do { assert(!(m)->locked); (m)->locked = 1; } while (0)
+#define mutex_unlock(m)		do { assert((m)->locked); (m)->locked = 0; } while (0)
+static inline int mutex_trylock(struct mutex *m)
+{
+	if (m->locked)
+		return 0;
+	m->locked = 1;
+	return 1;
+}
+
+typedef struct { int counter; } atomic_t;
+#define atomic_read(v)		((v)->counter)
+#define atomic_set(v, i)	((v)->counter = (i))
+#define atomic_add(i, v)	((v)->counter += (i))
+#define atomic_sub(i, v)	((v)->counter -= (i))
+#define atomic_inc(v)		((v)->counter++)
+
+typedef struct { int dummy; } wait_queue_head_t;
+#define init_waitqueue_head(q)			do { (void)(q); } while (0)
+#define wake_up_interruptible_sync(q)		do { (void)(q); } while (0)
+/* Waiting lets the mock hardware finish its runs, see mock_hw_done() */
+extern bool mock_hw_done(void);
+#define wait_event_interruptible_timeout(q, cond, t)		\
+({								\
+	while (!(cond) && mock_hw_done())			\
+		;						\
+	(cond) ? (t) : 0;					\
+})
+
+typedef struct { s64 tv64; } ktime_t;
+static inline ktime_t ktime_get(void) { ktime_t t = { 0 }; return t; }
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b) { a.tv64 -= b.tv64; return a; }
+#define ktime_to_ns(t)		((t).tv64)
+#define ktime_to_us(t)		((t).tv64 / 1000)
+#define ktime_us_delta(a, b)	(ktime_to_us(ktime_sub(a, b)))
+#define div_s64(a, b)		((s64)(a) / (b))
+
+struct timer_list { int dummy; };
+struct work_struct { int dummy; };
+struct delayed_work { struct work_struct work; };
+struct workqueue_struct;
+#define system_nrt_wq				NULL
+#define INIT_DELAYED_WORK(w, fn)		do { (void)(fn); } while (0)
+#define queue_delayed_work(wq, w, d)		do { (void)(w); } while (0)
+#define cancel_delayed_work_sync(w)		do { (void)(w); } while (0)
+
+struct wake_lock { int dummy; };
+#define WAKE_LOCK_SUSPEND		0
+#define wake_lock_init(l, t, n)		do { (void)(l); } while (0)
+#define wake_lock_destroy(l)		do { (void)(l); } while (0)
+#define wake_lock(l)			do { (void)(l); } while (0)
+#define wake_unlock(l)			do { (void)(l); } while (0)
+
+struct clk { int dummy; };
+#define clk_get(dev, id)	NULL
+#define clk_put(c)		do { (void)(c); } while (0)
+#define clk_enable(c)		do { (void)(c); } while (0)
+#define clk_disable(c)		do { (void)(c); } while (0)
+
+typedef int irqreturn_t;
+#define IRQ_HANDLED		1
+#define IRQ_WAKE_THREAD		2
+#define request_threaded_irq(irq, h, t, f, n, d)	0
+#define free_irq(irq, d)				do {} while (0)
+
+struct resource;
+struct platform_device { struct device dev; void *drvdata; };
+struct device_driver { void *owner; const char *name; };
+struct platform_driver {
+	int (*probe)(struct platform_device *);
+	int (*remove)(struct platform_device *);
+	struct device_driver driver;
+};
+#define platform_get_irq(pdev, n)		1
+#define platform_set_drvdata(pdev, d)		((pdev)->drvdata = (d))
+#define platform_get_drvdata(pdev)		((pdev)->drvdata)
+#define platform_driver_register(drv)		((void)(drv), 0)
+#define platform_driver_unregister(drv)		do {} while (0)
+
+struct file { void *private_data; };
+struct file_operations {
+	void *owner;
+	int (*open)(struct inode *, struct file *);
+	int (*release)(struct inode *, struct file *);
+	void *read;
+	void *llseek;
+	long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+};
+#define nonseekable_open(inode, file)	0
+
+struct miscdevice {
+	int minor;
+	const char *name;
+	const struct file_operations *fops;
+};
+#define misc_register(m)	((void)(m), 0)
+#define misc_deregister(m)	do {} while (0)
+
+#define S_IRUSR				0400
+#define debugfs_create_dir(n, p)	NULL
+#define debugfs_create_file(n, m, p, d, f)	NULL
+#define debugfs_remove_recursive(d)	do {} while (0)
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	new->next = head;
+	new->prev = head->prev;
+	head->prev->next = new;
+	head->prev = new;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+	list_del(entry);
+	INIT_LIST_HEAD(entry);
+}
+
+static inline void list_move_tail(struct list_head *list, struct list_head *head)
+{
+	list_del(list);
+	list_add_tail(list, head);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_entry((head)->next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+#define list_for_each_entry_safe(pos, n, head, member)			\
+	for (pos = list_entry((head)->next, typeof(*pos), member),	\
+		n = list_entry(pos->member.next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = n, n = list_entry(n->member.next, typeof(*n), member))
+
+#endif
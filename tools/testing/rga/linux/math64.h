@@ -0,0 +1,4 @@
+#ifndef LINUX_MATH64_H
+#define LINUX_MATH64_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef LINUX_MEMORY_H
+#define LINUX_MEMORY_H
+#include <linux/kernel.h>
+#endif
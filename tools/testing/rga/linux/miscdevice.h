@@ -0,0 +1,4 @@
+#ifndef LINUX_MISCDEVICE_H
+#define LINUX_MISCDEVICE_H
+#include <linux/kernel.h>
+#endif
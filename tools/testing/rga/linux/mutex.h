@@ -0,0 +1,4 @@
+#ifndef LINUX_MUTEX_H
+#define LINUX_MUTEX_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,4 @@
+#ifndef LINUX_PLATFORM_DEVICE_H
+#define LINUX_PLATFORM_DEVICE_H
+#include <linux/kernel.h>
+#endif
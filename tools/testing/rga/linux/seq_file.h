@@ -0,0 +1,12 @@
+#ifndef LINUX_SEQ_FILE_H
+#define LINUX_SEQ_FILE_H
+#include <linux/kernel.h>
+
+/* debugfs files are read straight to stdout */
+struct seq_file { int dummy; };
+#define seq_printf(s, fmt...)	printf(fmt)
+#define single_open(file, show, data)	0
+#define seq_read		NULL
+#define seq_lseek		NULL
+#define single_release		NULL
+#endif
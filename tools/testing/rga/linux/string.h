@@ -0,0 +1,4 @@
+#ifndef LINUX_STRING_H
+#define LINUX_STRING_H
+#include <linux/kernel.h>
+#endif
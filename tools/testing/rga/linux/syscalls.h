@@ -0,0 +1,4 @@
+#ifndef LINUX_SYSCALLS_H
+#define LINUX_SYSCALLS_H
+#include <linux/kernel.h>
+#endif
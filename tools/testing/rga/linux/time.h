@@ -0,0 +1,4 @@
+#ifndef LINUX_TIME_H
+#define LINUX_TIME_H
+#include <linux/kernel.h>
+#endif
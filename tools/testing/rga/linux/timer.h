@@ -0,0 +1,4 @@
+#ifndef LINUX_TIMER_H
+#define LINUX_TIMER_H
+#include <linux/kernel.h>
+#endif
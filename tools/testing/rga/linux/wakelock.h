@@ -0,0 +1,4 @@
+#ifndef LINUX_WAKELOCK_H
+#define LINUX_WAKELOCK_H
+#include <linux/kernel.h>
+#endif
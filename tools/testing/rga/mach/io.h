@@ -0,0 +1,4 @@
+#ifndef MACH_IO_H
+#define MACH_IO_H
+#include <linux/kernel.h>
+#endif
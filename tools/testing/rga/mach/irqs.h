@@ -0,0 +1,4 @@
+#ifndef MACH_IRQS_H
+#define MACH_IRQS_H
+#include <linux/kernel.h>
+#endif
@@ -0,0 +1,384 @@
+/*
+ * Host tests for the RGA CPU engine.
+ *
+ * drivers/video/rockchip/rga/rga_soft.c, rga_reg_info.c and RGA_API.c
+ * are built against the stub headers of this directory. The self test
+ * cases of rga_soft.c are run, and the CRCs of their register programs
+ * and outputs checked against the golden table, as
+ * /sys/kernel/debug/rga/selftest does on the device. Buffers sit right
+ * before an inaccessible page, so any access past the vir_w x vir_h
+ * image faults, and YUV is converted for known colors.
+ *
+ * Buffer addresses are 32 bit in struct rga_req, so this only runs where
+ * mmap() takes MAP_32BIT.
+ *
+ * make && ./rga_soft_test [-v]
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#include "../../../drivers/video/rockchip/rga/rga_soft.c"
+#include "../../../drivers/video/rockchip/rga/rga_reg_info.c"
+#include "../../../drivers/video/rockchip/rga/RGA_API.c"
+
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define PAGE	4096
+
+int mock_verbose;
+int mock_kmalloc_fail;
+int mock_live;
+
+rga_service_info rga_service;
+
+int rga_blit_kernel_hw(struct rga_req *req)
+{
+	return -ENODEV;
+}
+
+static sigjmp_buf fault_jmp;
+
+static void fault(int sig)
+{
+	siglongjmp(fault_jmp, 1);
+}
+
+/* size bytes ending right at a PROT_NONE page, below 4G */
+static uint8_t *guarded(size_t size)
+{
+	size_t len = (size + PAGE - 1) & ~(PAGE - 1);
+	uint8_t *p;
+
+	p = mmap(NULL, len + 2 * PAGE, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	assert(p != MAP_FAILED);
+	assert((uintptr_t)p + len + 2 * PAGE <= 0x100000000ULL);
+	assert(mprotect(p, PAGE, PROT_NONE) == 0);
+	assert(mprotect(p + PAGE + len, PAGE, PROT_NONE) == 0);
+	return p + PAGE + len - size;
+}
+
+static void unguard(uint8_t *buf, size_t size)
+{
+	size_t len = (size + PAGE - 1) & ~(PAGE - 1);
+
+	munmap(buf + size - len - PAGE, len + 2 * PAGE);
+}
+
+/* Returns the result of rga_soft_blit(), or 1 if it faulted */
+static int run(const struct rga_req *req)
+{
+	volatile int ret = 1;
+
+	if (sigsetjmp(fault_jmp, 1) == 0)
+		ret = rga_soft_blit(req);
+	return ret;
+}
+
+static void set_img(rga_img_info_t *img, uint32_t format, uint8_t *buf, int w, int h)
+{
+	memset(img, 0, sizeof(*img));
+	img->format = format;
+	img->yrgb_addr = (uint32_t)(uintptr_t)buf;
+	img->vir_w = img->act_w = w;
+	img->vir_h = img->act_h = h;
+}
+
+static void set_req(struct rga_req *req, int mode)
+{
+	memset(req, 0, sizeof(*req));
+	req->render_mode = mode;
+	req->clip.xmax = 0x7fff;
+	req->clip.ymax = 0x7fff;
+	req->cosa = 65536;
+}
+
+static int test_golden(void)
+{
+	uint8_t *src = guarded(RGA_SOFT_SRC_SIZE);
+	uint8_t *dst = guarded(RGA_SOFT_DST_SIZE);
+	int id, ret, failed = 0;
+
+	rga_soft_fill_src(src);
+
+	for (id = 0; id < RGA_SOFT_CASES; id++) {
+		const struct rga_soft_golden *g = &rga_soft_golden[id];
+		uint32_t prog_crc = 0, out_crc = 0;
+
+		if (sigsetjmp(fault_jmp, 1) == 0)
+			ret = rga_soft_run_case(id, src, dst, &prog_crc, &out_crc);
+		else
+			ret = 1;
+
+		if (mock_verbose)
+			printf("%-8s prog %08x out %08x\n", g->name, prog_crc, out_crc);
+		if (ret) {
+			printf("FAIL golden %s: returned %d\n", g->name, ret);
+			failed = 1;
+		} else if ((prog_crc != g->prog_crc) || (out_crc != g->out_crc)) {
+			printf("FAIL golden %s: prog %08x out %08x, golden %08x %08x\n",
+			       g->name, prog_crc, out_crc, g->prog_crc, g->out_crc);
+			failed = 1;
+		}
+	}
+
+	unguard(src, RGA_SOFT_SRC_SIZE);
+	unguard(dst, RGA_SOFT_DST_SIZE);
+	return failed;
+}
+
+/* dst rectangles reaching out of the dst image are clipped to it */
+static int test_dst_bounds(void)
+{
+	static const struct {
+		const char *name;
+		int mode, rotate, sina, cosa, x, y;
+	} cases[] = {
+		{ "fill",	color_fill_mode, 0, 0, 65536, 2, 2 },
+		{ "copy",	bitblt_mode, 0, 0, 65536, 2, 2 },
+		{ "mirror",	bitblt_mode, rotate_mode2, 0, 65536, 2, 2 },
+		{ "flip",	bitblt_mode, rotate_mode3, 0, 65536, 2, 2 },
+		{ "rot90",	bitblt_mode, rotate_mode1, 65536, 0, 3, 2 },
+		{ "rot180",	bitblt_mode, rotate_mode1, 0, -65536, 3, 3 },
+		{ "rot270",	bitblt_mode, rotate_mode1, -65536, 0, 2, 3 },
+	};
+	/* RGB_888 on 5 pixels: lines of 16 bytes, the last one cut short */
+	size_t src_size = 16 * 16 * 4, dst_size = 16 * 4 + 15;
+	uint8_t *src = guarded(src_size);
+	uint8_t *dst = guarded(dst_size);
+	struct rga_req req;
+	unsigned i;
+	int failed = 0;
+
+	memset(src, 0x33, src_size);
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		set_req(&req, cases[i].mode);
+		set_img(&req.src, RK_FORMAT_RGBA_8888, src, 16, 16);
+		set_img(&req.dst, RK_FORMAT_RGB_888, dst, 5, 5);
+		req.dst.act_w = 16;
+		req.dst.act_h = 16;
+		req.dst.x_offset = cases[i].x;
+		req.dst.y_offset = cases[i].y;
+		req.rotate_mode = cases[i].rotate;
+		req.sina = cases[i].sina;
+		req.cosa = cases[i].cosa;
+		req.fg_color = 0xff333333;
+
+		memset(dst, 0, dst_size);
+		if (run(&req) != 0) {
+			printf("FAIL dst bounds %s: access out of the dst image\n", cases[i].name);
+			failed = 1;
+		} else if (dst[3 * 16 + 3 * 3] != 0x33) {
+			printf("FAIL dst bounds %s: nothing drawn\n", cases[i].name);
+			failed = 1;
+		}
+	}
+
+	unguard(src, src_size);
+	unguard(dst, dst_size);
+	return failed;
+}
+
+/* src rectangles out of the src image are refused before any access */
+static int test_src_bounds(void)
+{
+	size_t size = 16 * 16 * 4;
+	uint8_t *src = guarded(size);
+	uint8_t *dst = guarded(size);
+	struct rga_req req;
+	int ret, failed = 0;
+
+	set_req(&req, bitblt_mode);
+	set_img(&req.src, RK_FORMAT_RGBA_8888, src, 16, 16);
+	set_img(&req.dst, RK_FORMAT_RGBA_8888, dst, 16, 16);
+	req.src.x_offset = 8;
+	ret = run(&req);
+	if (ret != -EINVAL) {
+		printf("FAIL src bounds x: returned %d\n", ret);
+		failed = 1;
+	}
+
+	req.src.x_offset = 0;
+	req.src.y_offset = 1;
+	ret = run(&req);
+	if (ret != -EINVAL) {
+		printf("FAIL src bounds y: returned %d\n", ret);
+		failed = 1;
+	}
+
+	req.src.y_offset = 0;
+	req.src.format = RK_FORMAT_YCbCr_420_SP;
+	req.src.uv_addr = req.src.yrgb_addr;
+	req.src.vir_h = req.src.act_h = 15;
+	ret = run(&req);
+	if (ret != -EINVAL) {
+		printf("FAIL src bounds odd yuv: returned %d\n", ret);
+		failed = 1;
+	}
+
+	unguard(src, size);
+	unguard(dst, size);
+	return failed;
+}
+
+/* Each plane is only read within the size rga_buf_size_cal() maps */
+static int test_yuv_bounds(void)
+{
+	static const struct {
+		uint32_t format;
+		int uv_lines, uv_stride, planar;
+	} cases[] = {
+		{ RK_FORMAT_YCbCr_420_SP, 6, 12, 0 },
+		{ RK_FORMAT_YCrCb_422_SP, 12, 12, 0 },
+		{ RK_FORMAT_YCbCr_420_P, 6, 6, 1 },
+		{ RK_FORMAT_YCrCb_422_P, 12, 6, 1 },
+	};
+	size_t dst_size = 10 * 12 * 4;
+	uint8_t *dst = guarded(dst_size);
+	struct rga_req req;
+	unsigned i;
+	int failed = 0;
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		/* vir_w of 10: lines of 12 bytes */
+		size_t uv_size = cases[i].uv_lines * cases[i].uv_stride;
+		uint8_t *y = guarded(12 * 12);
+		uint8_t *u = guarded(uv_size);
+		uint8_t *v = guarded(uv_size);
+
+		set_req(&req, bitblt_mode);
+		set_img(&req.src, cases[i].format, y, 10, 12);
+		set_img(&req.dst, RK_FORMAT_RGBA_8888, dst, 10, 12);
+		req.src.uv_addr = (uint32_t)(uintptr_t)u;
+		req.src.v_addr = cases[i].planar ? (uint32_t)(uintptr_t)v : 0;
+		if (run(&req) != 0) {
+			printf("FAIL yuv bounds %#x: access out of a plane\n", cases[i].format);
+			failed = 1;
+		}
+
+		unguard(y, 12 * 12);
+		unguard(u, uv_size);
+		unguard(v, uv_size);
+	}
+
+	unguard(dst, dst_size);
+	return failed;
+}
+
+static uint32_t yuv_pixel(uint32_t format, int mode, uint8_t y, uint8_t cb, uint8_t cr)
+{
+	static uint8_t *luma, *chroma, *dst;
+	uint8_t *c;
+	struct rga_req req;
+
+	/* 2x2 images: lines of 4 bytes of luma, one line of chroma */
+	if (luma == NULL) {
+		luma = guarded(8);
+		chroma = guarded(4);
+		dst = guarded(16);
+	}
+	c = chroma;
+	memset(luma, y, 8);
+	set_req(&req, bitblt_mode);
+	set_img(&req.src, format, luma, 2, 2);
+	set_img(&req.dst, RK_FORMAT_BGRA_8888, dst, 2, 2);
+	req.yuv2rgb_mode = mode;
+	req.src.uv_addr = (uint32_t)(uintptr_t)chroma;
+
+	switch (format) {
+	case RK_FORMAT_YCbCr_420_SP:
+		c[0] = cb; c[1] = cr;
+		break;
+	case RK_FORMAT_YCrCb_420_SP:
+		c[0] = cr; c[1] = cb;
+		break;
+	default:
+		c[0] = cb; c[2] = cr;
+		req.src.v_addr = (uint32_t)(uintptr_t)(c + 2);
+		break;
+	}
+
+	if (rga_soft_blit(&req) != 0)
+		return 0;
+	return *(uint32_t *)&dst[3 * 4];
+}
+
+static int near(uint32_t p, uint32_t q)
+{
+	int i;
+
+	for (i = 0; i < 32; i += 8)
+		if (ABS((int)((p >> i) & 0xff) - (int)((q >> i) & 0xff)) > 2)
+			return 0;
+	return 1;
+}
+
+static int test_yuv_colors(void)
+{
+	static const struct {
+		const char *name;
+		uint32_t format;
+		int mode;
+		uint8_t y, cb, cr;
+		uint32_t argb;
+	} cases[] = {
+		{ "601 white",	RK_FORMAT_YCbCr_420_SP, yuv2rgb_mode0, 235, 128, 128, 0xffffffff },
+		{ "601 black",	RK_FORMAT_YCbCr_420_SP, yuv2rgb_mode0, 16, 128, 128, 0xff000000 },
+		{ "601 red",	RK_FORMAT_YCbCr_420_SP, yuv2rgb_mode0, 81, 90, 240, 0xffff0000 },
+		{ "601 green",	RK_FORMAT_YCbCr_420_SP, yuv2rgb_mode0, 145, 54, 34, 0xff00ff00 },
+		{ "601 blue",	RK_FORMAT_YCbCr_420_SP, yuv2rgb_mode0, 41, 240, 110, 0xff0000ff },
+		{ "crcb red",	RK_FORMAT_YCrCb_420_SP, yuv2rgb_mode0, 81, 90, 240, 0xffff0000 },
+		{ "planar red",	RK_FORMAT_YCbCr_420_P, yuv2rgb_mode0, 81, 90, 240, 0xffff0000 },
+		{ "jpeg white",	RK_FORMAT_YCbCr_420_SP, yuv2rgb_mode1, 255, 128, 128, 0xffffffff },
+		{ "jpeg red",	RK_FORMAT_YCbCr_420_SP, yuv2rgb_mode1, 76, 85, 255, 0xffff0000 },
+		{ "709 red",	RK_FORMAT_YCbCr_420_SP, yuv2rgb_mode2, 63, 102, 240, 0xffff0000 },
+	};
+	unsigned i;
+	int failed = 0;
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		uint32_t p = yuv_pixel(cases[i].format, cases[i].mode,
+				       cases[i].y, cases[i].cb, cases[i].cr);
+
+		if (!near(p, cases[i].argb)) {
+			printf("FAIL yuv %s: %08x, expected %08x\n",
+			       cases[i].name, p, cases[i].argb);
+			failed = 1;
+		}
+	}
+
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	struct sigaction sa;
+	int opt, failed = 0;
+
+	while ((opt = getopt(argc, argv, "v")) != -1) {
+		if (opt == 'v') {
+			mock_verbose++;
+		} else {
+			fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = fault;
+	sigaction(SIGSEGV, &sa, NULL);
+
+	failed += test_golden();
+	failed += test_dst_bounds();
+	failed += test_src_bounds();
+	failed += test_yuv_bounds();
+	failed += test_yuv_colors();
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,477 @@
+/*
+ * Host tests for the RGA job queue and command lists.
+ *
+ * drivers/video/rockchip/rga/rga_drv.c is built against the stub headers
+ * of this directory with its registers backed by a mock: a write of
+ * RGA_CMD_CTRL starts a run, which records how many commands the driver
+ * chained and which request each one came from, and mock_hw_done()
+ * raises the interrupt that ends it. Requests go through the ioctl, so
+ * the tests see what user space sees. RGA_gen_reg_info() and the MMU
+ * are stubbed: a command is tagged with the src address of its request
+ * and the MMU only counts the references the driver holds.
+ *
+ * make && ./rga_test [-v]
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#include "../../../drivers/video/rockchip/rga/rga_drv.c"
+
+#include <unistd.h>
+
+#define TAG_SECOND	0x8000		/* second pass of a pre scaled request */
+#define TAG_MMU_FAIL	0x10000		/* rga_set_mmu_info() fails */
+#define TAG_GEN_FAIL	0x20000		/* RGA_gen_reg_info() fails */
+#define TAG_SOFT_FAIL	0x40000		/* rga_soft_blit() fails */
+
+#define MAX_RUNS	32
+
+int mock_verbose;
+int mock_kmalloc_fail;
+int mock_live;
+
+static struct task_struct test_task = { .pid = 1 };
+struct task_struct *current = &test_task;
+
+static u32 mock_regs[SZ_8K / 4];
+static bool hw_busy;
+static int mmu_refs;
+static int soft_blits;
+
+static struct {
+	int num;
+	u32 tags[RGA_CMD_LIST_MAX];
+} runs[MAX_RUNS];
+static int nruns;
+
+void *mock_ioremap(unsigned long phys, size_t size)
+{
+	return mock_regs;
+}
+
+u32 mock_readl(void *addr)
+{
+	return mock_regs[((char *)addr - (char *)mock_regs) / 4];
+}
+
+void mock_writel(u32 val, void *addr)
+{
+	unsigned off = (char *)addr - (char *)mock_regs;
+	int i, num;
+
+	assert(off < sizeof(mock_regs));
+
+	/* soft reset completes at once */
+	if (off == RGA_SYS_CTRL)
+		val &= ~1;
+	mock_regs[off / 4] = val;
+
+	if (off != RGA_CMD_CTRL)
+		return;
+
+	if (val == 1)
+		num = 1;
+	else
+		num = (val >> 3) & 0x3ff;
+
+	assert(!hw_busy);
+	assert(nruns < MAX_RUNS);
+	assert(num >= 1 && num <= RGA_CMD_LIST_MAX);
+	assert(mock_regs[RGA_CMD_ADDR / 4] == (u32)virt_to_phys(rga_service.cmd_buff));
+	if (num > 1)
+		assert(val == (s_RGA_CMD_CTRL_CMD_INCR_NUM(num) | s_RGA_CMD_CTRL_CMD_INCR_VALID(1)
+			       | s_RGA_CMD_CTRL_CMD_LINE_FET_ST(1)));
+
+	runs[nruns].num = num;
+	for (i = 0; i < num; i++)
+		runs[nruns].tags[i] = rga_service.cmd_buff[28 * i];
+	nruns++;
+	hw_busy = true;
+}
+
+/* End the current run: interrupt, then the threaded handler */
+bool mock_hw_done(void)
+{
+	if (!hw_busy)
+		return false;
+	hw_busy = false;
+	assert(rga_irq(0, NULL) == IRQ_WAKE_THREAD);
+	rga_irq_thread(0, NULL);
+	return true;
+}
+
+int rga_set_mmu_info(struct rga_reg *reg, struct rga_req *req)
+{
+	if (req->src.yrgb_addr & TAG_MMU_FAIL)
+		return -EFAULT;
+
+	reg->mmu_entry[reg->mmu_entries++] = (struct rga_mmu_cache_entry *)&mmu_refs;
+	mmu_refs++;
+	return 0;
+}
+
+void rga_mmu_release(struct rga_reg *reg)
+{
+	mmu_refs -= reg->mmu_entries;
+	reg->mmu_entries = 0;
+}
+
+void rga_mmu_cache_destroy(rga_session *session)
+{
+}
+
+void rga_mmu_cache_debugfs_init(struct dentry *dir)
+{
+}
+
+int rga_soft_blit(const struct rga_req *req)
+{
+	soft_blits++;
+	return (req->src.yrgb_addr & TAG_SOFT_FAIL) ? -EINVAL : 0;
+}
+
+void rga_soft_debugfs_init(struct dentry *dir)
+{
+}
+
+int RGA_gen_reg_info(const struct rga_req *msg, unsigned char *base)
+{
+	if (msg->src.yrgb_addr & TAG_GEN_FAIL)
+		return -1;
+
+	memset(base, 0, RGA_REG_CMD_LEN * 4);
+	((u32 *)base)[0] = msg->src.yrgb_addr;
+	return 0;
+}
+
+int32_t RGA_gen_two_pro(struct rga_req *msg, struct rga_req *msg1)
+{
+	*msg1 = *msg;
+	msg->dst.act_w = msg->dst.vir_w = msg->src.act_w / 2;
+	msg->dst.act_h = msg->dst.vir_h = msg->src.act_h / 2;
+	msg1->src = msg->dst;
+	msg1->src.yrgb_addr = msg->src.yrgb_addr | TAG_SECOND;
+	return 0;
+}
+
+static void make_req(struct rga_req *req, u32 tag, int src_w)
+{
+	memset(req, 0, sizeof(*req));
+	req->render_mode = bitblt_mode;
+	req->src.yrgb_addr = tag;
+	req->src.act_w = req->src.vir_w = src_w;
+	req->src.act_h = req->src.vir_h = src_w;
+	req->dst.yrgb_addr = 0x100000;
+	req->dst.act_w = req->dst.vir_w = 64;
+	req->dst.act_h = req->dst.vir_h = 64;
+	req->mmu_info.mmu_en = 1;
+}
+
+static struct file *session_open(void)
+{
+	struct file *file = calloc(1, sizeof(*file));
+
+	assert(rga_open(NULL, file) == 0);
+	return file;
+}
+
+static void session_close(struct file *file)
+{
+	assert(rga_release(NULL, file) == 0);
+	free(file);
+}
+
+static long blit_async(struct file *file, u32 tag)
+{
+	struct rga_req req;
+
+	make_req(&req, tag, 64);
+	return rga_ioctl(file, RGA_BLIT_ASYNC, (unsigned long)&req);
+}
+
+/* tags of 0 leave the request invalid, a negative one is pre scaled */
+static long blit_batch(struct file *file, const int *tags, int count, u32 flags)
+{
+	struct rga_req reqs[RGA_BATCH_MAX];
+	struct rga_batch batch = {
+		.count = count,
+		.flags = flags,
+		.reqs = reqs,
+	};
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (tags[i] < 0)
+			make_req(&reqs[i], -tags[i], 256);
+		else
+			make_req(&reqs[i], tags[i], 64);
+		if (tags[i] == 0)
+			reqs[i].src.act_w = 0;
+	}
+	return rga_ioctl(file, RGA_BLIT_BATCH, (unsigned long)&batch);
+}
+
+static void reset(void)
+{
+	nruns = 0;
+	memset(runs, 0, sizeof(runs));
+}
+
+static void finish(void)
+{
+	while (mock_hw_done())
+		;
+}
+
+static int check(const char *name, long ret, long expected,
+		 const int *nums, const u32 *tags, int expected_runs)
+{
+	int i, j, t = 0;
+
+	if (ret != expected) {
+		printf("FAIL %s: returned %ld, expected %ld\n", name, ret, expected);
+		return 1;
+	}
+	if (nruns != expected_runs) {
+		printf("FAIL %s: %d runs, expected %d\n", name, nruns, expected_runs);
+		return 1;
+	}
+	for (i = 0; i < nruns; i++) {
+		if (runs[i].num != nums[i]) {
+			printf("FAIL %s: run %d chains %d commands, expected %d\n",
+			       name, i, runs[i].num, nums[i]);
+			return 1;
+		}
+		for (j = 0; j < runs[i].num; j++, t++) {
+			if (runs[i].tags[j] != tags[t]) {
+				printf("FAIL %s: run %d command %d is %#x, expected %#x\n",
+				       name, i, j, runs[i].tags[j], tags[t]);
+				return 1;
+			}
+		}
+	}
+	if (!list_empty(&rga_service.waiting) || !list_empty(&rga_service.running)) {
+		printf("FAIL %s: regs left on the service lists\n", name);
+		return 1;
+	}
+	if (atomic_read(&rga_service.total_running) != 0) {
+		printf("FAIL %s: total_running %d\n", name,
+		       atomic_read(&rga_service.total_running));
+		return 1;
+	}
+	if (mmu_refs != 0) {
+		printf("FAIL %s: %d MMU references leaked\n", name, mmu_refs);
+		return 1;
+	}
+	if (mock_live != 0) {
+		printf("FAIL %s: %d allocations leaked\n", name, mock_live);
+		return 1;
+	}
+	if (mock_verbose)
+		printf("%s: ok\n", name);
+	return 0;
+}
+
+static int test_single(void)
+{
+	static const int nums[] = { 1, 1 };
+	static const u32 tags[] = { 1, 2 };
+	struct file *a = session_open();
+	long ret;
+
+	reset();
+	ret = blit_async(a, 1);
+	ret |= blit_async(a, 2);
+	finish();
+	session_close(a);
+	return check("single", ret, 0, nums, tags, 2);
+}
+
+static int test_batch_chained(void)
+{
+	static const int reqs[] = { 1, 2, 3 };
+	static const int nums[] = { 3 };
+	static const u32 tags[] = { 1, 2, 3 };
+	struct file *a = session_open();
+	long ret;
+
+	reset();
+	ret = blit_batch(a, reqs, 3, 0);
+	finish();
+	session_close(a);
+	return check("batch chained", ret, 0, nums, tags, 1);
+}
+
+static int test_batch_split(void)
+{
+	static const int reqs[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+	static const int nums[] = { 8, 2 };
+	static const u32 tags[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+	struct file *a = session_open();
+	long ret;
+
+	reset();
+	ret = blit_batch(a, reqs, 10, 0);
+	finish();
+	session_close(a);
+	return check("batch split", ret, 0, nums, tags, 2);
+}
+
+static int test_batch_prescale(void)
+{
+	static const int reqs[] = { -1, 2 };
+	static const int nums[] = { 3 };
+	static const u32 tags[] = { 1, 1 | TAG_SECOND, 2 };
+	struct file *a = session_open();
+	long ret;
+
+	reset();
+	ret = blit_batch(a, reqs, 2, 0);
+	finish();
+	session_close(a);
+	return check("batch prescale", ret, 0, nums, tags, 1);
+}
+
+static int test_batch_sync(void)
+{
+	static const int reqs[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+	static const int nums[] = { 8, 1 };
+	static const u32 tags[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+	struct file *a = session_open();
+	long ret;
+
+	reset();
+	ret = blit_batch(a, reqs, 9, RGA_BATCH_SYNC);
+	if (hw_busy) {
+		printf("FAIL batch sync: returned before the batch was done\n");
+		finish();
+		session_close(a);
+		return 1;
+	}
+	session_close(a);
+	return check("batch sync", ret, 0, nums, tags, 2);
+}
+
+/* A batch queued behind a running job is not chained with other sessions */
+static int test_batch_behind_busy(void)
+{
+	static const int reqs[] = { 11, 12 };
+	static const int nums[] = { 1, 2, 1 };
+	static const u32 tags[] = { 1, 11, 12, 2 };
+	struct file *a = session_open();
+	struct file *b = session_open();
+	long ret;
+
+	reset();
+	ret = blit_async(a, 1);
+	ret |= blit_batch(b, reqs, 2, 0);
+	ret |= blit_async(a, 2);
+	finish();
+	session_close(a);
+	session_close(b);
+	return check("batch behind busy", ret, 0, nums, tags, 3);
+}
+
+/*
+ * A batch failing part way runs none of its requests, even when the
+ * hardware picks up the next job before the ioctl returns.
+ */
+static int test_batch_fail(const char *name, int fail_tag, int kmalloc_fail, long expected)
+{
+	int reqs[] = { 11, 12, fail_tag, 14 };
+	static const int nums[] = { 1, 1 };
+	static const u32 tags[] = { 1, 2 };
+	struct file *a = session_open();
+	struct file *b = session_open();
+	long ret;
+
+	reset();
+	ret = blit_async(a, 1);
+	mock_kmalloc_fail = kmalloc_fail;
+	ret |= blit_batch(b, reqs, 4, 0);
+	mock_kmalloc_fail = 0;
+	mock_hw_done();
+	ret |= blit_async(a, 2);
+	finish();
+	session_close(a);
+	session_close(b);
+	return check(name, ret, expected, nums, tags, 2);
+}
+
+/* Kernel requests go to the CPU while the RGA has a full queue */
+static int test_kernel_fallback(void)
+{
+	static const int nums[] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+	static const u32 tags[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17,
+				    101 | TAG_SOFT_FAIL, 102 };
+	struct file *a = session_open();
+	struct rga_req req;
+	long ret = 0;
+	int i, soft;
+
+	reset();
+	soft_blits = 0;
+	for (i = 1; i <= 17; i++)
+		ret |= blit_async(a, i);
+
+	make_req(&req, 100, 64);
+	ret |= rga_blit_kernel(&req);
+	soft = soft_blits;
+
+	/* not supported by the CPU: waits for the RGA */
+	make_req(&req, 101 | TAG_SOFT_FAIL, 64);
+	ret |= rga_blit_kernel(&req);
+	if (hw_busy || (soft_blits != 2))
+		soft = -1;
+
+	make_req(&req, 102, 64);
+	ret |= rga_blit_kernel(&req);
+	if (soft_blits != 2)
+		soft = -1;
+
+	finish();
+	session_close(a);
+	if (soft != 1) {
+		printf("FAIL kernel fallback: %d blits on the CPU, expected 1 then 2\n", soft_blits);
+		return 1;
+	}
+	return check("kernel fallback", ret, 0, nums, tags, 19);
+}
+
+int main(int argc, char **argv)
+{
+	struct platform_device pdev;
+	int opt, failed = 0;
+
+	while ((opt = getopt(argc, argv, "v")) != -1) {
+		if (opt == 'v') {
+			mock_verbose++;
+		} else {
+			fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	memset(&pdev, 0, sizeof(pdev));
+	assert(rga_drv_probe(&pdev) == 0);
+	/* the driver data stays allocated, like on the device */
+	mock_live = 0;
+
+	failed += test_single();
+	failed += test_batch_chained();
+	failed += test_batch_split();
+	failed += test_batch_prescale();
+	failed += test_batch_sync();
+	failed += test_batch_behind_busy();
+	failed += test_kernel_fallback();
+	failed += test_batch_fail("batch invalid", 0, 0, -EINVAL);
+	failed += test_batch_fail("batch mmu fail", 13 | TAG_MMU_FAIL, 0, -EFAULT);
+	failed += test_batch_fail("batch gen fail", 13 | TAG_GEN_FAIL, 0, -EFAULT);
+	/* ioctl req, batch reqs, regs of 11 and 12, then the reg of 13 */
+	failed += test_batch_fail("batch kmalloc fail", 13, 5, -EFAULT);
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return failed ? 1 : 0;
+}